@@ -0,0 +1,65 @@
+#pragma once
+
+#include <algorithm>
+#include <audiorw.hpp>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+
+// Benchmarks are plain executables which print their results. They aren't
+// registered with CTest.
+
+// Runs fn the given number of times and prints the best and mean
+// throughput, taking bytes to be the amount processed by each run.
+auto report_throughput(const char* name, size_t bytes, int runs, auto fn) -> void {
+	auto best  = 0.0;
+	auto total = 0.0;
+	for (int i = 0; i < runs; i++) {
+		const auto start   = std::chrono::steady_clock::now();
+		fn();
+		const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		const auto mb_s    = double(bytes) / seconds / 1e6;
+		best   = std::max(best, mb_s);
+		total += mb_s;
+	}
+	std::printf("%-40s best %9.1f MB/s, mean %9.1f MB/s\n", name, best, total / runs);
+}
+
+// A tone with a little noise on it, so that lossless encoders have
+// something realistic to compress.
+struct test_signal {
+	test_signal(uint64_t channel_count)
+		: channel_count_{channel_count}
+	{
+	}
+	auto read_frames(std::span<float> buffer) -> ads::frame_count {
+		for (size_t i = 0; i < buffer.size(); i++) {
+			const auto channel = (pos_ + i) % channel_count_;
+			const auto frame   = (pos_ + i) / channel_count_;
+			noise_ = (noise_ * 1664525u) + 1013904223u;
+			buffer[i] = (0.5f * float(std::sin(double(frame) * 0.01 * double(channel + 1)))) + (float(noise_ >> 8) / float(1 << 24) - 0.5f) * 0.01f;
+		}
+		pos_ += buffer.size();
+		return {buffer.size() / channel_count_};
+	}
+private:
+	uint64_t channel_count_;
+	uint64_t pos_   = 0;
+	uint32_t noise_ = 1;
+};
+
+[[nodiscard]] inline
+auto make_test_file(audiorw::format format, uint64_t channel_count, uint64_t frame_count, int bit_depth, audiorw::storage_type type = audiorw::storage_type::int_) -> std::vector<std::byte> {
+	auto header = audiorw::header{};
+	header.format        = format;
+	header.channel_count = {channel_count};
+	header.frame_count   = {frame_count};
+	header.bit_depth     = bit_depth;
+	auto bytes = std::vector<std::byte>{};
+	auto in    = test_signal{channel_count};
+	auto out   = audiorw::stream::bytes::to(&bytes);
+	if (audiorw::write(header, &in, &out, type) != audiorw::operation_result::success) {
+		throw std::runtime_error{"Failed to make test file"};
+	}
+	return bytes;
+}
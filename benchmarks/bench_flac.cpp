@@ -0,0 +1,57 @@
+#include "bench.hpp"
+#include <string>
+#include <tuple>
+
+// Encodes the test signal as 16-bit stereo FLAC at a few compression
+// levels, on the default executor and on one thread, to show how well the
+// frames encode in parallel. Throughput is of the 16-bit PCM going in, as
+// the reference encoder reports it.
+//
+//   bench_flac [seconds of audio] [runs]
+
+static constexpr auto CHANNELS  = uint64_t{2};
+static constexpr auto BIT_DEPTH = 16;
+static constexpr auto SR        = 44100;
+
+[[nodiscard]] static
+auto encode(uint64_t frame_count, const audiorw::flac_options& options) -> size_t {
+	auto header = audiorw::header{};
+	header.format        = audiorw::format::flac;
+	header.SR            = SR;
+	header.channel_count = {CHANNELS};
+	header.frame_count   = {frame_count};
+	header.bit_depth     = BIT_DEPTH;
+	auto bytes = std::vector<std::byte>{};
+	auto in    = test_signal{CHANNELS};
+	auto out   = audiorw::stream::bytes::to(&bytes);
+	if (audiorw::write_flac(header, &in, &out, options) != audiorw::operation_result::success) {
+		throw std::runtime_error{"Failed to encode"};
+	}
+	return bytes.size();
+}
+
+auto main(int argc, char** argv) -> int {
+	const auto seconds     = argc > 1 ? std::stoull(argv[1]) : 120;
+	const auto runs        = argc > 2 ? std::stoi(argv[2]) : 3;
+	const auto frame_count = seconds * SR;
+	const auto pcm_bytes   = frame_count * CHANNELS * (BIT_DEPTH / 8);
+	auto single_thread = audiorw::inline_executor{};
+	std::printf("Encoding %llu seconds of 16-bit stereo to FLAC, %d runs each\n", static_cast<unsigned long long>(seconds), runs);
+	for (const auto level : {0, 5, 8}) {
+		auto options = audiorw::flac_options{};
+		options.compression_level = level;
+		options.executor          = audiorw::get_default_executor();
+		const auto size = encode(frame_count, options);
+		std::printf("level %d compresses to %.1f%%\n", level, 100.0 * double(size) / double(pcm_bytes));
+		const auto parallel_name = "level " + std::to_string(level) + ", default executor";
+		const auto single_name   = "level " + std::to_string(level) + ", one thread";
+		report_throughput(parallel_name.c_str(), pcm_bytes, runs, [&] {
+			std::ignore = encode(frame_count, options);
+		});
+		options.executor = &single_thread;
+		report_throughput(single_name.c_str(), pcm_bytes, runs, [&] {
+			std::ignore = encode(frame_count, options);
+		});
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,51 @@
+#include "bench.hpp"
+#include <audiorw_flat.hpp>
+#include <audiorw_memory.hpp>
+#include <string>
+
+// Decodes a WAV file into a fresh flat_item each run, with the storage
+// coming from each kind of resource, so that the page faults taken while
+// writing to new memory are part of what is measured.
+//
+//   bench_flat [output megabytes] [runs]
+
+static constexpr auto CHANNELS = uint64_t{2};
+
+[[nodiscard]] static
+auto make_options(audiorw::huge_pages mode, bool prefault) -> audiorw::huge_page_options {
+	auto options = audiorw::huge_page_options{};
+	options.mode     = mode;
+	options.prefault = prefault;
+	options.executor = audiorw::get_default_executor();
+	return options;
+}
+
+static
+auto bench_decode(const char* name, std::span<const std::byte> file, size_t output_bytes, int runs, std::pmr::memory_resource* resource) -> void {
+	report_throughput(name, output_bytes, runs, [file, resource] {
+		auto in   = audiorw::byte_input_stream{file};
+		auto item = audiorw::read(&in, audiorw::format_hint::try_wav_only, audiorw::frame_layout::planar, resource);
+		if (!item) {
+			throw std::runtime_error{"Failed to decode"};
+		}
+	});
+}
+
+auto main(int argc, char** argv) -> int {
+	const auto output_mb    = argc > 1 ? std::stoull(argv[1]) : 512;
+	const auto runs         = argc > 2 ? std::stoi(argv[2]) : 3;
+	const auto frame_count  = (output_mb << 20) / (CHANNELS * sizeof(float));
+	const auto output_bytes = frame_count * CHANNELS * sizeof(float);
+	const auto file         = make_test_file(audiorw::format::wav, CHANNELS, frame_count, 16);
+	auto transparent          = audiorw::huge_page_memory_resource{make_options(audiorw::huge_pages::transparent, false)};
+	auto transparent_prefault = audiorw::huge_page_memory_resource{make_options(audiorw::huge_pages::transparent, true)};
+	auto explicit_            = audiorw::huge_page_memory_resource{make_options(audiorw::huge_pages::explicit_, false)};
+	auto explicit_prefault    = audiorw::huge_page_memory_resource{make_options(audiorw::huge_pages::explicit_, true)};
+	std::printf("Decoding %llu MB of 16-bit stereo WAV to float, %d runs each\n", static_cast<unsigned long long>(output_mb), runs);
+	bench_decode("default resource", file, output_bytes, runs, std::pmr::get_default_resource());
+	bench_decode("transparent huge pages", file, output_bytes, runs, &transparent);
+	bench_decode("transparent huge pages, prefaulted", file, output_bytes, runs, &transparent_prefault);
+	bench_decode("explicit huge pages", file, output_bytes, runs, &explicit_);
+	bench_decode("explicit huge pages, prefaulted", file, output_bytes, runs, &explicit_prefault);
+	return EXIT_SUCCESS;
+}
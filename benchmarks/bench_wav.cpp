@@ -0,0 +1,64 @@
+#include "bench.hpp"
+#include <cstring>
+#include <string>
+
+// Decodes in-memory stereo WAV files of each sample format into float, both
+// interleaved and planar, with read_into() so that nothing is allocated
+// while it's timed. A memcpy of the same amount of output is the memory
+// bandwidth ceiling to compare against.
+//
+//   bench_wav [output megabytes] [runs]
+
+static constexpr auto CHANNELS = uint64_t{2};
+
+struct sample_format {
+	const char* name;
+	int bit_depth;
+	audiorw::storage_type type;
+};
+
+static constexpr sample_format SAMPLE_FORMATS[] = {
+	{"u8",  8,  audiorw::storage_type::int_},
+	{"s16", 16, audiorw::storage_type::int_},
+	{"s24", 24, audiorw::storage_type::int_},
+	{"s32", 32, audiorw::storage_type::int_},
+	{"f32", 32, audiorw::storage_type::float_},
+};
+
+auto main(int argc, char** argv) -> int {
+	const auto output_mb    = argc > 1 ? std::stoull(argv[1]) : 256;
+	const auto runs         = argc > 2 ? std::stoi(argv[2]) : 5;
+	const auto frame_count  = (output_mb << 20) / (CHANNELS * sizeof(float));
+	const auto output_bytes = frame_count * CHANNELS * sizeof(float);
+	auto interleaved = std::vector<float>(frame_count * CHANNELS);
+	auto left        = std::vector<float>(frame_count);
+	auto right       = std::vector<float>(frame_count);
+	const std::span<float> channels[] = {left, right};
+	// Touched once up front so that page faults aren't measured.
+	std::ranges::fill(interleaved, 0.0f);
+	std::ranges::fill(left, 0.0f);
+	std::ranges::fill(right, 0.0f);
+	std::printf("Decoding %llu MB of stereo float output, %d runs each\n", static_cast<unsigned long long>(output_mb), runs);
+	auto source = std::vector<float>(interleaved.size());
+	report_throughput("memcpy", output_bytes, runs, [&] {
+		std::memcpy(interleaved.data(), source.data(), output_bytes);
+	});
+	for (const auto& format : SAMPLE_FORMATS) {
+		const auto file = make_test_file(audiorw::format::wav, CHANNELS, frame_count, format.bit_depth, format.type);
+		const auto interleaved_name = std::string{format.name} + " interleaved";
+		const auto planar_name      = std::string{format.name} + " planar";
+		report_throughput(interleaved_name.c_str(), output_bytes, runs, [&] {
+			auto in = audiorw::byte_input_stream{file};
+			if (audiorw::read_into(&in, audiorw::format_hint::try_wav_only, std::span{interleaved}).frames_written != frame_count) {
+				throw std::runtime_error{"Failed to decode"};
+			}
+		});
+		report_throughput(planar_name.c_str(), output_bytes, runs, [&] {
+			auto in = audiorw::byte_input_stream{file};
+			if (audiorw::read_into(&in, audiorw::format_hint::try_wav_only, std::span<const std::span<float>>{channels}).frames_written != frame_count) {
+				throw std::runtime_error{"Failed to decode"};
+			}
+		});
+	}
+	return EXIT_SUCCESS;
+}
@@ -2,36 +2,96 @@
 
 #include <ads.hpp>
 #include <algorithm>
+#include <array>
 #include <boost/container/small_vector.hpp>
+#include <chrono>
 #include <filesystem>
 #include <fstream>
 #include <miniaudio.h>
 #include <stdexcept>
+#include <string>
 #include <variant>
+
+#include "audiorw_api.hpp"
+#if AUDIORW_WITH_WAVPACK
 #include <wavpack.h>
+#endif
+#include "audiorw_executor.hpp"
+#include "audiorw_file.hpp"
+#include "audiorw_md5.hpp"
 
-namespace audiorw {
+namespace audiorw::detail {
 
-enum class format {
-	flac,
-	mp3,
-	wav,
-	wavpack
-};
+enum class try_read_result { abort, fail, success };
 
-struct header {
-	audiorw::format format;
-	ads::channel_count channel_count;
-	ads::frame_count frame_count;
-	int SR        = 44100;
-	int bit_depth = 32;
+struct memory_tracker {
+	auto on_alloc(memory_category category, size_t bytes) -> void;
+	auto on_free(memory_category category, size_t bytes) -> void;
+	auto get_report() const -> const memory_report& { return report_; }
+private:
+	std::array<size_t, MEMORY_CATEGORY_COUNT> current_bytes_ = {};
+	size_t current_total_bytes_ = 0;
+	memory_report report_;
 };
 
-} // audiorw
+// Installs a memory tracker for the current thread until the end of the
+// scope, then copies the results to the report. Does nothing if the report
+// is null.
+struct scope_memory_tracker {
+	scope_memory_tracker(memory_report* report);
+	~scope_memory_tracker();
+	scope_memory_tracker(const scope_memory_tracker&) = delete;
+	scope_memory_tracker& operator=(const scope_memory_tracker&) = delete;
+private:
+	memory_report* report_;
+	memory_tracker tracker_;
+	memory_tracker* prev_tracker_ = nullptr;
+};
 
-namespace audiorw::detail {
+[[nodiscard]] auto get_memory_tracker() -> memory_tracker*;
+[[nodiscard]] auto make_allocation_callbacks(memory_tracker* tracker) -> ma_allocation_callbacks;
 
-enum class try_read_result { abort, fail, success };
+// A growable buffer which reports its allocations to the memory tracker
+// that was installed when it was created. It never shrinks, so once a
+// chunk loop has processed its first chunk it doesn't allocate again.
+template <typename T>
+struct tracked_buffer {
+	tracked_buffer(memory_category category = memory_category::scratch)
+		: category_{category}
+		, tracker_{get_memory_tracker()}
+	{
+	}
+	tracked_buffer(tracked_buffer&& rhs) noexcept = default;
+	tracked_buffer& operator=(tracked_buffer&& rhs) noexcept = default;
+	~tracked_buffer() {
+		if (auto tracker = get_tracker()) {
+			tracker->on_free(category_, vector_.capacity() * sizeof(T));
+		}
+	}
+	auto begin() { return vector_.data(); }
+	auto end()   { return vector_.data() + vector_.size(); }
+	auto data()  { return vector_.data(); }
+	auto size() const { return vector_.size(); }
+	auto operator[](size_t index) -> T& { return vector_[index]; }
+	auto resize(size_t size) -> void {
+		const auto old_capacity = vector_.capacity();
+		vector_.resize(size);
+		if (vector_.capacity() == old_capacity) {
+			return;
+		}
+		if (auto tracker = get_tracker()) {
+			tracker->on_free(category_, old_capacity * sizeof(T));
+			tracker->on_alloc(category_, vector_.capacity() * sizeof(T));
+		}
+	}
+private:
+	// The tracker is only used while it is still installed, so the buffer
+	// can safely outlive it.
+	auto get_tracker() const -> memory_tracker* { return tracker_ && tracker_ == get_memory_tracker() ? tracker_ : nullptr; }
+	memory_category category_;
+	memory_tracker* tracker_;
+	std::vector<T> vector_;
+};
 
 struct atomic_file_writer {
 	atomic_file_writer() = default;
@@ -40,17 +100,22 @@ struct atomic_file_writer {
 	~atomic_file_writer();
 	auto commit() -> void;
 	auto stream() -> std::ofstream&;
+	// Where the file is written until it is committed.
+	auto get_tmp_path() const -> const std::filesystem::path& { return tmp_path_; }
 private:
 	std::filesystem::path path_;
 	std::filesystem::path tmp_path_;
+	tracked_buffer<char> io_buffer_{memory_category::io};
 	std::ofstream file_;
 	bool commit_flag_ = false;
 };
 
 struct scope_ma_decoder {
-	scope_ma_decoder(ma_decoder_read_proc on_read, ma_decoder_seek_proc on_seek, void* user_data, audiorw::format format);
+	scope_ma_decoder(ma_decoder_read_proc on_read, ma_decoder_seek_proc on_seek, void* user_data, audiorw::format format, const ma_allocation_callbacks* allocation_callbacks = nullptr);
 	auto get_header() const -> header;
 	auto get_header(audiorw::format format) const -> header;
+	auto get_channel_count() const -> uint64_t;
+	auto get_format() const -> audiorw::format;
 	auto read_pcm_frames(void* frames, ma_uint64 frame_count) -> ma_uint64;
 	auto seek_to_pcm_frame(ma_uint64 frame) -> ma_result;
 private:
@@ -58,6 +123,7 @@ private:
 	decoder_uptr decoder_;
 };
 
+#if AUDIORW_WITH_WAVPACK
 struct scope_wavpack_reader {
 	scope_wavpack_reader(WavpackStreamReader64 stream, void* user_data);
 	~scope_wavpack_reader();
@@ -72,32 +138,100 @@ private:
 	header header_;
 	int mode_ = 0;
 };
+#endif
+
+// How the native readers get at their input. Function pointers, like
+// WavpackStreamReader64, so that the reader isn't a template.
+struct byte_stream_reader {
+	std::optional<size_t> (*get_length)(void* user_data);
+	size_t (*read_bytes)(void* user_data, std::span<std::byte> buffer);
+	bool (*seek)(void* user_data, uint64_t pos);
+};
 
-using decoder = std::variant<scope_ma_decoder, scope_wavpack_reader>;
-
-} // audiorw::detail
+// Reads PCM and IEEE float WAV files, including RF64 and BW64, without
+// going through miniaudio. The chunks are parsed once, then the samples
+// are read from the data chunk in large blocks and converted with SIMD.
+// 32 bit float data is read straight into the caller's buffer. Throws if
+// the file isn't one it can read, e.g. because it is compressed.
+struct scope_wav_reader {
+	scope_wav_reader(byte_stream_reader stream, void* user_data);
+	scope_wav_reader(scope_wav_reader&& rhs) noexcept;
+	scope_wav_reader& operator=(scope_wav_reader&& rhs) noexcept;
+	~scope_wav_reader();
+	auto get_header() const -> const header& { return header_; }
+	auto read_frames(std::span<float> buffer) -> ads::frame_count;
+	// Converts and deinterleaves in a single pass, writing up to frame_count
+	// frames to [offset, offset + frame_count) of each channel's span.
+	auto read_frames(std::span<const std::span<float>> channels, size_t offset, size_t frame_count) -> ads::frame_count;
+	auto seek(ads::frame_idx pos) -> bool;
+private:
+	struct impl;
+	std::unique_ptr<impl> impl_;
+	header header_;
+};
 
-namespace audiorw {
+#if AUDIORW_WITH_VORBIS
+// Reads Ogg Vorbis with stb_vorbis, which comes with miniaudio. The frame
+// count is the granule position of the last page. A seek bisects the file
+// for a page shortly before the target and decodes on from there, where
+// miniaudio's streaming backend would decode from the start. Only the
+// first logical stream of a chained file is read.
+struct scope_vorbis_reader {
+	scope_vorbis_reader(byte_stream_reader stream, void* user_data);
+	scope_vorbis_reader(scope_vorbis_reader&& rhs) noexcept;
+	scope_vorbis_reader& operator=(scope_vorbis_reader&& rhs) noexcept;
+	~scope_vorbis_reader();
+	auto get_header() const -> const header& { return header_; }
+	auto read_frames(std::span<float> buffer) -> ads::frame_count;
+	auto seek(ads::frame_idx pos) -> bool;
+private:
+	struct impl;
+	std::unique_ptr<impl> impl_;
+	header header_;
+};
+#endif
+
+using decoder = std::variant<
+	scope_ma_decoder,
+	scope_wav_reader
+#if AUDIORW_WITH_WAVPACK
+	, scope_wavpack_reader
+#endif
+#if AUDIORW_WITH_VORBIS
+	, scope_vorbis_reader
+#endif
+>;
+
+// Adds the time spent in its scope to a nanosecond counter.
+struct scope_counter_timer {
+	scope_counter_timer(audiorw::format format, counters::counter c);
+	~scope_counter_timer();
+private:
+	audiorw::format format_;
+	counters::counter counter_;
+	std::chrono::steady_clock::time_point start_;
+};
 
-struct item;
+// A byte stream's files_opened and bytes_read. Its format isn't known
+// until a decoder has been made from it, so they are unattributed until
+// then, and are moved to the format's row when set_format() is called.
+struct stream_counters {
+	auto on_open() -> void;
+	auto on_read(uint64_t bytes) -> void;
+	auto set_format(audiorw::format format) -> void;
+private:
+	std::optional<audiorw::format> format_;
+	uint64_t files_opened_ = 0;
+	uint64_t bytes_read_   = 0;
+};
 
-enum class format_hint {
-	// Audio format will be deduced by trying to read
-	// the header as each supported type, starting
-	// with the one specified
-	try_flac_first,
-	try_mp3_first,
-	try_wav_first,
-	try_wavpack_first,
+// Moves counts which were added without a format to the format's row, for
+// reads whose format is only known after the stream has gone.
+auto attribute_reads(audiorw::format format, uint64_t files_opened, uint64_t bytes_read) -> void;
 
-	// Only the specified type will be tried.
-	try_flac_only,
-	try_mp3_only,
-	try_wav_only,
-	try_wavpack_only,
-};
+} // audiorw::detail
 
-enum class operation_result { abort, success };
+namespace audiorw {
 
 struct stream_frames_from_ads {
 	stream_frames_from_ads(const ads::fully_dynamic<float>& frames);
@@ -132,24 +266,33 @@ private:
 };
 
 struct stream_bytes_from_fs_path {
-	stream_bytes_from_fs_path(const std::filesystem::path& path);
+	stream_bytes_from_fs_path(const std::filesystem::path& path, cache_policy policy = cache_policy::normal);
 	auto close() -> bool;
 	auto get_length() -> std::optional<size_t>;
 	auto get_pos() -> size_t;
 	auto push_back_byte(std::byte v) -> bool;
 	auto read_bytes(std::span<std::byte> buffer) -> size_t;
 	auto seek(int64_t offset, std::ios::seekdir mode) -> bool;
+	auto set_counter_format(audiorw::format format) -> void { counters_.set_format(format); }
 private:
+	detail::tracked_buffer<char> io_buffer_{memory_category::io};
+	detail::stream_counters counters_;
 	std::ifstream file_;
+	// Only one of file_ and direct_ is open.
+	std::optional<detail::direct_file_reader> direct_;
+	std::optional<detail::cache_dropper> dropper_;
 };
 
 struct stream_bytes_to_fs_path {
-	stream_bytes_to_fs_path(const std::filesystem::path& path);
+	stream_bytes_to_fs_path(const std::filesystem::path& path, cache_policy policy = cache_policy::normal);
 	auto commit() -> void;
 	auto seek(int64_t offset, std::ios::seekdir mode) -> bool;
 	auto write_bytes(std::span<const std::byte> buffer) -> size_t;
 private:
 	detail::atomic_file_writer writer_;
+	std::optional<detail::cache_dropper> dropper_;
+	// Tracked here because asking the stream flushes its buffer.
+	uint64_t pos_ = 0;
 };
 
 struct stream_item_from_fs_path {
@@ -179,6 +322,7 @@ struct stream_item_to_item {
 private:
 	item* item_;
 	size_t pos_ = 0;
+	size_t storage_bytes_ = 0;
 };
 
 struct stream_bytes_to_std_vector {
@@ -195,8 +339,10 @@ private:
 
 namespace audiorw::stream::bytes {
 
-[[nodiscard]] inline auto from(const std::filesystem::path& path) { return stream_bytes_from_fs_path{path}; }
-[[nodiscard]] inline auto to(const std::filesystem::path& path)   { return stream_bytes_to_fs_path{path}; }
+[[nodiscard]] inline auto from(const std::filesystem::path& path)                      { return stream_bytes_from_fs_path{path}; }
+[[nodiscard]] inline auto from(const std::filesystem::path& path, cache_policy policy) { return stream_bytes_from_fs_path{path, policy}; }
+[[nodiscard]] inline auto to(const std::filesystem::path& path)                        { return stream_bytes_to_fs_path{path}; }
+[[nodiscard]] inline auto to(const std::filesystem::path& path, cache_policy policy)   { return stream_bytes_to_fs_path{path, policy}; }
 [[nodiscard]] inline auto to(std::vector<std::byte>* vector)      { return stream_bytes_to_std_vector{vector}; }
 
 } // audiorw::stream::bytes
@@ -219,6 +365,7 @@ namespace audiorw::stream::item {
 namespace audiorw::concepts {
 
 template <typename Fn> concept commit_fn       = requires(Fn fn) { { fn() } -> std::same_as<void>; };
+template <typename Fn> concept read_bytes_fn   = requires(Fn fn, std::span<std::byte> buffer) { { fn(buffer) } -> std::same_as<size_t>; };
 template <typename Fn> concept read_frames_fn  = requires(Fn fn, std::span<float> buffer) { { fn(buffer) } -> std::same_as<ads::frame_count>; };
 template <typename Fn> concept seek_bytes_fn   = requires(Fn fn) { { fn(int64_t{}, std::ios::seekdir{}) } -> std::same_as<bool>; };
 template <typename Fn> concept should_abort_fn = requires(Fn fn) { { fn() } -> std::same_as<bool>; };
@@ -235,6 +382,22 @@ requires(T x, std::span<std::byte> buffer, std::byte b) {
 	{ x.seek(int64_t{}, std::ios::seekdir{}) } -> std::same_as<bool>;
 };
 
+// Byte input streams can optionally report that they can't seek freely.
+// Streams without can_seek() are assumed to be seekable.
+template <typename T>
+concept seek_aware_byte_input_stream =
+byte_input_stream<T> &&
+requires(const T x) {
+	{ x.can_seek() } -> std::same_as<bool>;
+};
+
+// Something bytes can be pulled from, e.g. a pipe or a socket.
+template <typename T>
+concept forward_byte_source =
+requires(T x, std::span<std::byte> buffer) {
+	{ x.read_bytes(buffer) } -> std::same_as<size_t>;
+};
+
 template <typename T>
 concept frame_input_stream =
 requires(T x, std::span<float> buffer) {
@@ -262,11 +425,133 @@ requires(T x, std::span<const float> buffer, audiorw::header header) {
 
 namespace audiorw {
 
+template <concepts::read_bytes_fn ReadBytesFn>
+struct generic_byte_source {
+	ReadBytesFn read_bytes;
+};
+
 template <concepts::read_frames_fn ReadFramesFn>
 struct generic_frame_input_stream {
 	ReadFramesFn read_frames;
 };
 
+struct stream_bytes_from_std_istream {
+	stream_bytes_from_std_istream(std::istream* stream);
+	auto read_bytes(std::span<std::byte> buffer) -> size_t;
+	auto set_counter_format(audiorw::format format) -> void { counters_.set_format(format); }
+private:
+	std::istream* stream_;
+	detail::stream_counters counters_;
+};
+
+namespace detail {
+
+static constexpr auto DEFAULT_REWIND_CAPACITY = size_t{1 << 20};
+
+} // detail
+
+// Turns a forward-only byte source into a byte_input_stream by keeping the
+// most recently read bytes around. It is always possible to seek back at
+// least rewind_capacity bytes from the furthest point read so far, which is
+// enough for format probing and the small back-seeks decoders do. Seeking
+// forward reads through the source. The length is unknown and can_seek()
+// is false so the backends don't rely on seeking.
+template <concepts::forward_byte_source Source>
+struct rewind_byte_input_stream {
+	rewind_byte_input_stream(Source source, size_t rewind_capacity = detail::DEFAULT_REWIND_CAPACITY)
+		: source_{std::move(source)}
+		, capacity_{rewind_capacity}
+	{
+	}
+	auto can_seek() const -> bool { return false; }
+	auto close() -> bool {
+		if constexpr (requires { { source_.close() } -> std::same_as<bool>; }) { return source_.close(); }
+		else                                                                   { return true; }
+	}
+	auto get_length() -> std::optional<size_t> { return std::nullopt; }
+	auto get_pos() -> size_t { return pos_; }
+	auto set_counter_format(audiorw::format format) -> void {
+		if constexpr (requires { source_.set_counter_format(format); }) { source_.set_counter_format(format); }
+	}
+	auto push_back_byte(std::byte v) -> bool {
+		if (pos_ <= buffer_start_) {
+			return false;
+		}
+		pos_--;
+		return true;
+	}
+	auto read_bytes(std::span<std::byte> buffer) -> size_t {
+		fill_to(pos_ + buffer.size(), pos_);
+		const auto n   = std::min(buffer.size(), get_buffer_end() - pos_);
+		const auto beg = buffer_.begin() + (pos_ - buffer_start_);
+		std::copy(beg, beg + n, buffer.begin());
+		pos_ += n;
+		trim();
+		return n;
+	}
+	auto seek(int64_t offset, std::ios::seekdir mode) -> bool {
+		auto target = int64_t{};
+		switch (mode) {
+			case std::ios::beg: { target = offset; break; }
+			case std::ios::cur: { target = int64_t(pos_) + offset; break; }
+			default:            { return false; }
+		}
+		if (target < int64_t(buffer_start_)) {
+			return false;
+		}
+		fill_to(size_t(target), size_t(target));
+		if (size_t(target) > get_buffer_end()) {
+			// The bytes skipped on the way may have been dropped, in which
+			// case the stream is left at its end.
+			if (pos_ < buffer_start_) {
+				pos_ = get_buffer_end();
+			}
+			return false;
+		}
+		pos_ = size_t(target);
+		trim();
+		return true;
+	}
+private:
+	auto get_buffer_end() const -> size_t { return buffer_start_ + buffer_.size(); }
+	// Reads from the source until the buffer reaches end, in pieces no
+	// bigger than the capacity. Whatever falls outside the rewind window of
+	// new_pos is dropped as it goes, so a long forward seek doesn't buffer
+	// everything it skips over.
+	auto fill_to(size_t end, size_t new_pos) -> void {
+		const auto piece_size = std::max(capacity_, size_t{1});
+		while (!at_end_ && get_buffer_end() < end) {
+			const auto old_size = buffer_.size();
+			const auto wanted   = std::min(end - get_buffer_end(), piece_size);
+			buffer_.resize(old_size + wanted);
+			const auto got = source_.read_bytes({buffer_.data() + old_size, wanted});
+			buffer_.resize(old_size + got);
+			at_end_ = got == 0;
+			discard_behind(new_pos);
+		}
+	}
+	auto trim() -> void {
+		discard_behind(pos_);
+	}
+	// Discarding only once twice the capacity is behind pos keeps the cost
+	// of erasing from the front amortized.
+	auto discard_behind(size_t pos) -> void {
+		const auto behind = std::min(pos, get_buffer_end()) - buffer_start_;
+		if (behind > capacity_ * 2) {
+			const auto discard = behind - capacity_;
+			buffer_.erase(buffer_.begin(), buffer_.begin() + discard);
+			buffer_start_ += discard;
+		}
+	}
+	Source source_;
+	size_t capacity_;
+	std::vector<std::byte> buffer_;
+	// Stream position of buffer_[0].
+	size_t buffer_start_ = 0;
+	size_t pos_          = 0;
+	bool at_end_         = false;
+};
+
 template <concepts::commit_fn CommitFn, concepts::seek_bytes_fn SeekBytesFn, concepts::write_bytes_fn WriteBytesFn>
 struct generic_byte_output_stream {
 	CommitFn commit;
@@ -274,58 +559,136 @@ struct generic_byte_output_stream {
 	WriteBytesFn write_bytes;
 };
 
-enum class storage_type {
-	int_,
-	float_,
-	normalized_float_,
-};
-
-using frames = ads::fully_dynamic<float>;
-
-struct item {
-	audiorw::header header;
-	audiorw::frames frames;
-};
-
 namespace detail {
 
-static constexpr auto CHUNK_SIZE = 1 << 14;
+static constexpr auto CHUNK_SIZE     = 1 << 14;
+static constexpr auto IO_BUFFER_SIZE = 1 << 16;
 
 using formats_to_try = boost::container::small_vector<format, 4>;
 
 struct scope_ma_encoder {
-	scope_ma_encoder(ma_encoder_write_proc on_write, ma_encoder_seek_proc on_seek, void* user_data, const ma_encoder_config& config);
+	scope_ma_encoder(ma_encoder_write_proc on_write, ma_encoder_seek_proc on_seek, void* user_data, ma_encoder_config config, const ma_allocation_callbacks* allocation_callbacks = nullptr);
 	auto write_pcm_frames(const void* frames, ma_uint64 frame_count) -> ma_uint64;
 private:
 	using encoder_uptr = std::unique_ptr<ma_encoder, decltype(&ma_encoder_uninit)>;
 	encoder_uptr encoder_;
 };
 
+// WAV files are written here rather than by miniaudio so that they can be
+// promoted to RF64 when they're too large for RIFF.
+struct wav_encoder {
+	static constexpr auto MAX_HEADER_SIZE = size_t{80};
+	// frame_count is how many frames will be written, if it is known. If it
+	// isn't, or they won't fit in a RIFF file, the header has room for a
+	// ds64 chunk.
+	wav_encoder(const audiorw::header& header, storage_type type, std::optional<uint64_t> frame_count);
+	[[nodiscard]] auto get_block_align() const -> size_t { return block_align_; }
+	[[nodiscard]] auto get_header() const -> std::span<const std::byte> { return {header_.data(), header_size_}; }
+	// Converts interleaved frames to block_align bytes each.
+	auto encode(std::span<const float> buffer, std::byte* out) const -> void;
+	// Updates the header for the number of frames actually written. It
+	// stays the same size, so it can be written over the original.
+	auto finish(uint64_t frames_written) -> std::span<const std::byte>;
+private:
+	audiorw::header header_info_;
+	storage_type type_;
+	size_t block_align_;
+	size_t header_size_;
+	std::array<std::byte, MAX_HEADER_SIZE> header_;
+};
+
+#if AUDIORW_WITH_FLAC
+// FLAC frames are encoded in batches of blocks, in parallel. Floats are
+// clipped and quantized to the header's bit depth, or to 24 bits if it is
+// deeper than FLAC allows.
+struct flac_encoder {
+	flac_encoder(const audiorw::header& header, const flac_options& options);
+	flac_encoder(flac_encoder&& rhs) noexcept;
+	~flac_encoder();
+	// Every batch except the last must be exactly this many frames.
+	[[nodiscard]] auto get_batch_frames() const -> size_t;
+	// The stream marker, STREAMINFO and SEEKTABLE. Written first, then
+	// written again after finish() so that the sizes, MD5 and seek points
+	// are filled in. It stays the same size.
+	[[nodiscard]] auto get_metadata() const -> std::span<const std::byte>;
+	// Interleaved frames in, encoded frames out. The returned bytes are
+	// valid until the next call.
+	auto encode(std::span<const float> buffer) -> std::span<const std::byte>;
+	auto finish() -> std::span<const std::byte>;
+private:
+	struct impl;
+	std::unique_ptr<impl> impl_;
+};
+#endif
+
+#if AUDIORW_WITH_WAVPACK
 struct scope_wavpack_writer {
-	scope_wavpack_writer(const audiorw::header& header, storage_type type, WavpackBlockOutput blockout, void* user_data);
+	scope_wavpack_writer(const audiorw::header& header, storage_type type, const wavpack_options& options, WavpackBlockOutput blockout, void* user_data);
 	~scope_wavpack_writer();
 	auto context() { return context_; }
 private:
 	WavpackContext* context_;
 };
 
+// The running MD5 of the samples written so far, for WavpackStoreMD5Sum().
+// With an executor, each chunk is hashed by a helper task while the caller
+// reads and packs the next one. Without one it's hashed there and then.
+struct wavpack_md5 {
+	wavpack_md5(std::optional<executor_ref> executor, size_t bytes_per_sample);
+	wavpack_md5(const wavpack_md5&) = delete;
+	wavpack_md5& operator=(const wavpack_md5&) = delete;
+	~wavpack_md5();
+	// The samples are copied, so they can be reused as soon as this returns.
+	// Waits for the previous chunk to be hashed first.
+	auto add(std::span<const int32_t> samples) -> void;
+	[[nodiscard]] auto finish() -> md5_digest;
+private:
+	struct state;
+	static auto hash_pending(const std::shared_ptr<state>& s, bool discard) -> void;
+	auto wait() -> void;
+	std::optional<executor_ref> executor_;
+	std::shared_ptr<state> state_;
+};
+#endif
+
 [[nodiscard]] auto get_formats_to_try(format_hint hint) -> formats_to_try;
 [[nodiscard]] auto get_header(const detail::decoder* decoder) -> header;
 [[nodiscard]] auto ma_to_std_seek_mode(ma_seek_origin) -> std::ios_base::seekdir;
-[[nodiscard]] auto make_wavpack_config(const audiorw::header& header, storage_type type) -> WavpackConfig;
-[[nodiscard]] auto read_frames(detail::decoder* decoder, float* buffer, ads::frame_count frames_to_read) -> ads::frame_count;
-[[nodiscard]] auto read_frames(scope_ma_decoder* decoder, float* buffer, ads::frame_count frames_to_read) -> ads::frame_count;
-[[nodiscard]] auto read_frames(scope_wavpack_reader* decoder, float* buffer, ads::frame_count frames_to_read) -> ads::frame_count;
+[[nodiscard]] auto make_tmp_file_path(std::filesystem::path path) -> std::filesystem::path;
+[[nodiscard]] auto read_frames(detail::decoder* decoder, std::span<float> buffer) -> ads::frame_count;
+[[nodiscard]] auto read_frames(scope_ma_decoder* decoder, std::span<float> buffer) -> ads::frame_count;
+[[nodiscard]] auto read_frames(scope_wav_reader* decoder, std::span<float> buffer) -> ads::frame_count;
 [[nodiscard]] auto seek(detail::decoder* decoder, ads::frame_idx pos) -> bool;
 [[nodiscard]] auto seek(scope_ma_decoder* decoder, ads::frame_idx pos) -> bool;
-[[nodiscard]] auto seek(scope_wavpack_reader* decoder, ads::frame_idx pos) -> bool;
-[[nodiscard]] auto stream_read_float_frames(scope_wavpack_reader* stream, float* buffer, ads::frame_count frames_to_read) -> ads::frame_count;
-[[nodiscard]] auto stream_read_int_frames(scope_wavpack_reader* stream, float* buffer, ads::frame_count frames_to_read) -> ads::frame_count;
+[[nodiscard]] auto seek(scope_wav_reader* decoder, ads::frame_idx pos) -> bool;
 [[nodiscard]] auto to_ma_encoding_format(audiorw::format format) -> ma_encoding_format;
 [[nodiscard]] auto to_ma_format(int bit_depth, storage_type type) -> ma_format;
 [[nodiscard]] auto to_operation_result(try_read_result r) -> operation_result;
 [[nodiscard]] auto to_try_read_result(operation_result r) -> try_read_result;
+
+#if AUDIORW_WITH_VORBIS
+[[nodiscard]] auto read_frames(scope_vorbis_reader* decoder, std::span<float> buffer) -> ads::frame_count;
+[[nodiscard]] auto seek(scope_vorbis_reader* decoder, ads::frame_idx pos) -> bool;
+#endif
+
+#if AUDIORW_WITH_WAVPACK
+[[nodiscard]] auto make_wavpack_config(const audiorw::header& header, storage_type type) -> WavpackConfig;
+// Scales the samples to ints of the bit depth, in place.
+[[nodiscard]] auto wavpack_float_to_int(std::span<float> samples, int bit_depth) -> std::span<int32_t>;
+// Packs one chunk of interleaved samples. If md5 is set, the samples are
+// added to it first, so that a helper task can hash them while they are
+// being packed.
+[[nodiscard]] auto wavpack_pack_samples(WavpackContext* context, std::span<int32_t> samples, size_t frames, wavpack_md5* md5) -> bool;
+// The samples as they are laid out in the WAV file they came from, or
+// would go to, which is what WavPack's MD5 is of. qmode is from
+// WavpackGetQualifyMode().
+auto format_wavpack_md5_bytes(std::span<const int32_t> samples, size_t bytes_per_sample, int qmode, tracked_buffer<std::byte>* bytes) -> void;
+[[nodiscard]] auto read_frames(scope_wavpack_reader* decoder, std::span<float> buffer) -> ads::frame_count;
+[[nodiscard]] auto seek(scope_wavpack_reader* decoder, ads::frame_idx pos) -> bool;
+[[nodiscard]] auto stream_read_float_frames(scope_wavpack_reader* stream, std::span<float> buffer) -> ads::frame_count;
+[[nodiscard]] auto stream_read_int_frames(scope_wavpack_reader* stream, std::span<float> buffer) -> ads::frame_count;
 [[nodiscard]] auto wavpack_to_std_seek_mode(int mode) -> std::ios_base::seekdir;
+#endif
 
 template <concepts::byte_input_stream Stream> [[nodiscard]]
 auto ma_on_decoder_read(ma_decoder* decoder, void* buffer, size_t bytes_to_read, size_t* bytes_read) -> ma_result {
@@ -355,18 +718,27 @@ auto ma_on_encoder_seek(ma_encoder* encoder, ma_int64 offset, ma_seek_origin ori
 	return stream.seek(offset, ma_to_std_seek_mode(origin)) ? MA_SUCCESS : MA_ERROR;
 }
 
+#if AUDIORW_WITH_WAVPACK
 template <concepts::byte_output_stream Stream> [[nodiscard]]
 auto wavpack_write_blockout(void* puserdata, void* data, int32_t bcount) -> int {
 	auto& stream = *reinterpret_cast<Stream*>(puserdata);
 	const auto data_as_bytes = reinterpret_cast<const std::byte*>(data);
 	return stream.write_bytes({data_as_bytes, static_cast<size_t>(bcount)});
 }
+#endif
 
+template <concepts::byte_input_stream Stream> [[nodiscard]]
+auto can_seek(Stream* stream) -> bool {
+	if constexpr (concepts::seek_aware_byte_input_stream<Stream>) { return stream->can_seek(); }
+	else                                                          { return true; }
+}
+
+#if AUDIORW_WITH_WAVPACK
 template <concepts::byte_input_stream Stream> [[nodiscard]]
 auto make_wavpack_stream_reader() -> WavpackStreamReader64 {
 	WavpackStreamReader64 sr;
 	sr.can_seek = [](void* puserdata) -> int {
-		return puserdata ? 1 : 0;
+		return puserdata && can_seek(reinterpret_cast<Stream*>(puserdata)) ? 1 : 0;
 	};
 	sr.close = [](void* puserdata) -> int {
 		auto& stream = *reinterpret_cast<Stream*>(puserdata);
@@ -395,13 +767,27 @@ auto make_wavpack_stream_reader() -> WavpackStreamReader64 {
 	};
 	sr.set_pos_abs = [](void* puserdata, int64_t pos) -> int {
 		auto& stream = *reinterpret_cast<Stream*>(puserdata);
-		stream.seek(pos, std::ios::beg);
-		return 0;
+		return stream.seek(pos, std::ios::beg) ? 0 : -1;
 	};
 	sr.set_pos_rel = [](void* puserdata, int64_t delta, int mode) -> int {
 		auto& stream = *reinterpret_cast<Stream*>(puserdata);
-		stream.seek(delta, wavpack_to_std_seek_mode(mode));
-		return 0;
+		return stream.seek(delta, wavpack_to_std_seek_mode(mode)) ? 0 : -1;
+	};
+	return sr;
+}
+#endif
+
+template <concepts::byte_input_stream Stream> [[nodiscard]]
+auto make_byte_stream_reader() -> byte_stream_reader {
+	byte_stream_reader sr;
+	sr.get_length = [](void* user_data) -> std::optional<size_t> {
+		return reinterpret_cast<Stream*>(user_data)->get_length();
+	};
+	sr.read_bytes = [](void* user_data, std::span<std::byte> buffer) -> size_t {
+		return reinterpret_cast<Stream*>(user_data)->read_bytes(buffer);
+	};
+	sr.seek = [](void* user_data, uint64_t pos) -> bool {
+		return reinterpret_cast<Stream*>(user_data)->seek(int64_t(pos), std::ios::beg);
 	};
 	return sr;
 }
@@ -412,8 +798,9 @@ auto ma_write(const audiorw::header& header, concepts::frame_input_stream auto*
 	// is closed. (miniaudio will try to keep writing to the file when the encoder is uninitialized.)
 	{
 		auto config           = ma_encoder_config_init(to_ma_encoding_format(header.format), to_ma_format(header.bit_depth, type), header.channel_count.value, header.SR);
-		auto encoder          = scope_ma_encoder{ma_on_encoder_write<OutStream>, ma_on_encoder_seek<OutStream>, out, config};
-		auto sample_buffer    = std::vector<float>{};
+		auto callbacks        = make_allocation_callbacks(get_memory_tracker());
+		auto encoder          = scope_ma_encoder{ma_on_encoder_write<OutStream>, ma_on_encoder_seek<OutStream>, out, config, &callbacks};
+		auto sample_buffer    = tracked_buffer<float>{};
 		auto frames_remaining = header.frame_count;
 		auto pos              = 0;
 		while (frames_remaining > 0UL) {
@@ -427,10 +814,14 @@ auto ma_write(const audiorw::header& header, concepts::frame_input_stream auto*
 			if (frames_read != frames_to_process) {
 				throw std::runtime_error{"Error reading frames"};
 			}
-			const auto frames_written = encoder.write_pcm_frames(sample_buffer.data(), frames_to_process);
+			const auto frames_written = [&] {
+				auto timer = scope_counter_timer{header.format, counters::counter::encode_ns};
+				return encoder.write_pcm_frames(sample_buffer.data(), frames_to_process);
+			}();
 			if (frames_written != frames_to_process) {
 				throw std::runtime_error{"Error writing PCM frames"};
 			}
+			counters::add(header.format, counters::counter::frames_encoded, frames_written);
 			frames_remaining -= frames_written;
 			pos              += frames_written;
 		}
@@ -439,9 +830,97 @@ auto ma_write(const audiorw::header& header, concepts::frame_input_stream auto*
 	return operation_result::success;
 }
 
+auto write_all(concepts::byte_output_stream auto* out, std::span<const std::byte> bytes) -> void {
+	if (out->write_bytes(bytes) != bytes.size()) {
+		throw std::runtime_error{"Error writing bytes"};
+	}
+}
+
+// Writes over the start of the stream and leaves it at the end.
+auto rewrite_header(concepts::byte_output_stream auto* out, std::span<const std::byte> header) -> void {
+	if (!out->seek(0, std::ios::beg)) {
+		throw std::runtime_error{"Failed to seek"};
+	}
+	write_all(out, header);
+	if (!out->seek(0, std::ios::end)) {
+		throw std::runtime_error{"Failed to seek"};
+	}
+}
+
+// Pads the data chunk and writes the final header over the original.
+auto wav_finish(wav_encoder* encoder, concepts::byte_output_stream auto* out, uint64_t frames_written) -> void {
+	if ((frames_written * encoder->get_block_align()) & 1) {
+		const auto pad = std::byte{0};
+		write_all(out, {&pad, 1});
+	}
+	rewrite_header(out, encoder->finish(frames_written));
+}
+
+auto wav_write(const audiorw::header& header, concepts::frame_input_stream auto* in, concepts::byte_output_stream auto* out, storage_type type, concepts::should_abort_fn auto should_abort) -> operation_result {
+	auto encoder          = wav_encoder{header, type, header.frame_count.value};
+	auto sample_buffer    = tracked_buffer<float>{};
+	auto byte_buffer      = tracked_buffer<std::byte>{memory_category::io};
+	auto frames_remaining = header.frame_count;
+	write_all(out, encoder.get_header());
+	while (frames_remaining > 0UL) {
+		if (should_abort()) {
+			return operation_result::abort;
+		}
+		const auto frames_to_process  = std::min(frames_remaining.value, uint64_t(CHUNK_SIZE));
+		const auto samples_to_process = header.channel_count.value * frames_to_process;
+		sample_buffer.resize(samples_to_process);
+		byte_buffer.resize(frames_to_process * encoder.get_block_align());
+		const auto frames_read = in->read_frames(sample_buffer);
+		if (frames_read != frames_to_process) {
+			throw std::runtime_error{"Error reading frames"};
+		}
+		{
+			auto timer = scope_counter_timer{format::wav, counters::counter::encode_ns};
+			encoder.encode(sample_buffer, byte_buffer.data());
+		}
+		write_all(out, {byte_buffer.data(), byte_buffer.size()});
+		counters::add(format::wav, counters::counter::frames_encoded, frames_to_process);
+		frames_remaining -= frames_to_process;
+	}
+	wav_finish(&encoder, out, header.frame_count.value);
+	out->commit();
+	return operation_result::success;
+}
+
+#if AUDIORW_WITH_FLAC
+auto flac_write(const audiorw::header& header, concepts::frame_input_stream auto* in, concepts::byte_output_stream auto* out, concepts::should_abort_fn auto should_abort, const flac_options& options) -> operation_result {
+	auto encoder          = flac_encoder{header, options};
+	auto sample_buffer    = tracked_buffer<float>{};
+	auto frames_remaining = header.frame_count;
+	write_all(out, encoder.get_metadata());
+	while (frames_remaining > 0UL) {
+		if (should_abort()) {
+			return operation_result::abort;
+		}
+		const auto frames_to_process = std::min(frames_remaining.value, uint64_t(encoder.get_batch_frames()));
+		sample_buffer.resize(header.channel_count.value * frames_to_process);
+		const auto frames_read = in->read_frames(sample_buffer);
+		if (frames_read != frames_to_process) {
+			throw std::runtime_error{"Error reading frames"};
+		}
+		const auto bytes = [&] {
+			auto timer = scope_counter_timer{format::flac, counters::counter::encode_ns};
+			return encoder.encode(sample_buffer);
+		}();
+		write_all(out, bytes);
+		counters::add(format::flac, counters::counter::frames_encoded, frames_to_process);
+		frames_remaining -= frames_to_process;
+	}
+	rewrite_header(out, encoder.finish());
+	out->commit();
+	return operation_result::success;
+}
+#endif
+
+#if AUDIORW_WITH_WAVPACK
 [[nodiscard]]
-auto wavpack_write_float_chunks(const audiorw::header& header, concepts::frame_input_stream auto* in, WavpackContext* context, concepts::should_abort_fn auto should_abort) -> operation_result {
-	auto sample_buffer    = std::vector<float>{};
+auto wavpack_write_float_chunks(const audiorw::header& header, concepts::frame_input_stream auto* in, WavpackContext* context, wavpack_md5* md5, concepts::should_abort_fn auto should_abort) -> operation_result {
+	auto sample_buffer    = tracked_buffer<float>{};
     auto frames_remaining = header.frame_count;
 	auto pos              = 0;
 	while (frames_remaining > 0UL) {
@@ -456,10 +935,14 @@ auto wavpack_write_float_chunks(const audiorw::header& header, concepts::frame_i
 			throw std::runtime_error{"Error reading frames"};
 		}
 		const auto buffer_as_ints = reinterpret_cast<int32_t*>(sample_buffer.data());
-		const auto frames_written = WavpackPackSamples(context, buffer_as_ints, frames_to_process);
-		if (frames_written != frames_to_process) {
+		const auto packed = [&] {
+			auto timer = scope_counter_timer{format::wavpack, counters::counter::encode_ns};
+			return wavpack_pack_samples(context, {buffer_as_ints, samples_to_process}, frames_to_process, md5);
+		}();
+		if (!packed) {
 			throw std::runtime_error{"Error packing WavPack samples"};
 		}
+		counters::add(format::wavpack, counters::counter::frames_encoded, frames_to_process);
 		frames_remaining -= frames_to_process;
 		pos              += frames_to_process;
 	}
@@ -467,10 +950,8 @@ auto wavpack_write_float_chunks(const audiorw::header& header, concepts::frame_i
 }
 
 [[nodiscard]]
-auto wavpack_write_int_chunks(const audiorw::header& header, concepts::frame_input_stream auto* in, WavpackContext* context, concepts::should_abort_fn auto should_abort) -> operation_result {
-	static_assert (sizeof(float) == sizeof(int32_t));
-	const auto int_scale  = (1 << (header.bit_depth - 1)) - 1;
-	auto sample_buffer    = std::vector<float>{};
+auto wavpack_write_int_chunks(const audiorw::header& header, concepts::frame_input_stream auto* in, WavpackContext* context, wavpack_md5* md5, concepts::should_abort_fn auto should_abort) -> operation_result {
+	auto sample_buffer    = tracked_buffer<float>{};
     auto frames_remaining = header.frame_count;
 	auto pos              = 0;
 	while (frames_remaining > 0UL) {
@@ -484,14 +965,18 @@ auto wavpack_write_int_chunks(const audiorw::header& header, concepts::frame_inp
 		if (frames_read != frames_to_process) {
 			throw std::runtime_error{"Error reading frames"};
 		}
-		const auto buffer_as_ints = reinterpret_cast<int32_t*>(sample_buffer.data());
-		for (int i = 0; i < sample_buffer.size(); i++) {
-			buffer_as_ints[i] = static_cast<int32_t>(double(sample_buffer[i]) * int_scale);
-		}
-		const auto frames_written = WavpackPackSamples(context, buffer_as_ints, frames_to_process);
-		if (frames_written != frames_to_process) {
+		const auto buffer_as_ints = [&] {
+			auto timer = scope_counter_timer{format::wavpack, counters::counter::convert_ns};
+			return wavpack_float_to_int({sample_buffer.data(), samples_to_process}, header.bit_depth);
+		}();
+		const auto packed = [&] {
+			auto timer = scope_counter_timer{format::wavpack, counters::counter::encode_ns};
+			return wavpack_pack_samples(context, buffer_as_ints, frames_to_process, md5);
+		}();
+		if (!packed) {
 			throw std::runtime_error{"Error packing WavPack samples"};
 		}
+		counters::add(format::wavpack, counters::counter::frames_encoded, frames_to_process);
 		frames_remaining -= frames_to_process;
 		pos              += frames_to_process;
 	}
@@ -499,21 +984,33 @@ auto wavpack_write_int_chunks(const audiorw::header& header, concepts::frame_inp
 }
 
 [[nodiscard]]
-auto wavpack_write_chunks(const audiorw::header& header, concepts::frame_input_stream auto* in, WavpackContext* context, storage_type type, concepts::should_abort_fn auto should_abort) -> operation_result {
+auto wavpack_write_chunks(const audiorw::header& header, concepts::frame_input_stream auto* in, WavpackContext* context, storage_type type, wavpack_md5* md5, concepts::should_abort_fn auto should_abort) -> operation_result {
 	switch (type) {
-		case storage_type::float_:            { return wavpack_write_float_chunks(header, in, context, should_abort); }
-		case storage_type::normalized_float_: { return wavpack_write_float_chunks(header, in, context, should_abort); }
-		case storage_type::int_:              { return wavpack_write_int_chunks(header, in, context, should_abort); }
+		case storage_type::float_:            { return wavpack_write_float_chunks(header, in, context, md5, should_abort); }
+		case storage_type::normalized_float_: { return wavpack_write_float_chunks(header, in, context, md5, should_abort); }
+		case storage_type::int_:              { return wavpack_write_int_chunks(header, in, context, md5, should_abort); }
 		default:                              { throw std::runtime_error{"Invalid storage type"}; }
 	}
 }
 
 [[nodiscard]]
-auto wavpack_write(const audiorw::header& header, concepts::frame_input_stream auto* in, concepts::byte_output_stream auto* out, storage_type type, concepts::should_abort_fn auto should_abort) -> operation_result {
+auto wavpack_write(const audiorw::header& header, concepts::frame_input_stream auto* in, concepts::byte_output_stream auto* out, storage_type type, concepts::should_abort_fn auto should_abort, const wavpack_options& options) -> operation_result {
 	using OutStream = std::remove_reference_t<decltype(*out)>;
-	auto writer = scope_wavpack_writer{header, type, wavpack_write_blockout<OutStream>, out};
-	auto result = wavpack_write_chunks(header, in, writer.context(), type, should_abort);
+	auto writer = scope_wavpack_writer{header, type, options, wavpack_write_blockout<OutStream>, out};
+	auto md5    = std::optional<wavpack_md5>{};
+	if (options.store_md5) {
+		md5.emplace(options.executor, size_t(WavpackGetBytesPerSample(writer.context())));
+	}
+	auto result = wavpack_write_chunks(header, in, writer.context(), type, md5 ? &*md5 : nullptr, should_abort);
 	if (result == operation_result::success) {
+		// The MD5 goes in the last block, so it has to be stored before
+		// that is flushed.
+		if (md5) {
+			auto digest = md5->finish();
+			if (!WavpackStoreMD5Sum(writer.context(), digest.data())) {
+				throw std::runtime_error(WavpackGetErrorMessage(writer.context()));
+			}
+		}
 		if (!WavpackFlushSamples(writer.context())) {
 			throw std::runtime_error("Write error");
 		}
@@ -521,14 +1018,16 @@ auto wavpack_write(const audiorw::header& header, concepts::frame_input_stream a
 	}
 	return result;
 }
+#endif
 
 [[nodiscard]]
 auto ma_try_read(concepts::item_output_stream auto* out, audiorw::format format, ma_decoder_read_proc on_read, ma_decoder_seek_proc on_seek, void* user_data, concepts::should_abort_fn auto should_abort) -> try_read_result {
-	auto decoder = scope_ma_decoder{on_read, on_seek, user_data, format};
+	auto callbacks = make_allocation_callbacks(get_memory_tracker());
+	auto decoder   = scope_ma_decoder{on_read, on_seek, user_data, format, &callbacks};
 	// NOTE: For mp3s get_header() will decode the entire file immediately.
 	const auto header = decoder.get_header(format);
 	out->write_header(header);
-	auto buffer           = std::vector<float>{};
+	auto buffer           = tracked_buffer<float>{};
 	auto frames_remaining = header.frame_count;
 	while (frames_remaining > 0UL) {
 		if (should_abort()) {
@@ -537,10 +1036,14 @@ auto ma_try_read(concepts::item_output_stream auto* out, audiorw::format format,
 		const auto frames_to_read  = std::min(frames_remaining.value, uint64_t(CHUNK_SIZE));
 		const auto samples_to_read = header.channel_count.value * frames_to_read;
 		buffer.resize(samples_to_read);
-		const auto frames_read = decoder.read_pcm_frames(buffer.data(), frames_to_read);
+		const auto frames_read = [&] {
+			auto timer = scope_counter_timer{format, counters::counter::decode_ns};
+			return decoder.read_pcm_frames(buffer.data(), frames_to_read);
+		}();
 		if (frames_read != frames_to_read) {
 			throw std::runtime_error{"Error reading PCM frames"};
 		}
+		counters::add(format, counters::counter::frames_decoded, frames_read);
 		const auto frames_written = out->write_frames({buffer});
 		if (frames_written != frames_to_read) {
 			throw std::runtime_error{"Error reading frames"};
@@ -553,13 +1056,18 @@ auto ma_try_read(concepts::item_output_stream auto* out, audiorw::format format,
 [[nodiscard]]
 auto ma_try_read(concepts::byte_input_stream auto* in, concepts::item_output_stream auto* out, audiorw::format format, concepts::should_abort_fn auto should_abort) -> try_read_result {
 	using InStream = std::remove_reference_t<decltype(*in)>;
-	try         { return ma_try_read(out, format, ma_on_decoder_read<InStream>, ma_on_decoder_seek<InStream>, in, should_abort); }
-	catch (...) { return try_read_result::fail; }
+	try {
+		return ma_try_read(out, format, ma_on_decoder_read<InStream>, ma_on_decoder_seek<InStream>, in, should_abort);
+	}
+	catch (...) {
+		return try_read_result::fail;
+	}
 }
 
+#if AUDIORW_WITH_WAVPACK
 [[nodiscard]]
 auto wavpack_read_float_chunks(concepts::item_output_stream auto* out, WavpackContext* context, const audiorw::header& header, concepts::should_abort_fn auto should_abort) -> operation_result {
-	auto buffer           = std::vector<float>{};
+	auto buffer           = tracked_buffer<float>{};
 	auto frames_remaining = header.frame_count;
 	while (frames_remaining > 0UL) {
 		if (should_abort()) {
@@ -569,10 +1077,14 @@ auto wavpack_read_float_chunks(concepts::item_output_stream auto* out, WavpackCo
 		const auto samples_to_read = header.channel_count.value * frames_to_read;
 		buffer.resize(samples_to_read);
 		auto buffer_as_ints = reinterpret_cast<int32_t*>(buffer.data());
-		const auto frames_read = WavpackUnpackSamples(context, buffer_as_ints, frames_to_read);
+		const auto frames_read = [&] {
+			auto timer = scope_counter_timer{format::wavpack, counters::counter::decode_ns};
+			return WavpackUnpackSamples(context, buffer_as_ints, frames_to_read);
+		}();
 		if (frames_read != frames_to_read) {
 			throw std::runtime_error{"Error unpacking WavPack samples"};
 		}
+		counters::add(format::wavpack, counters::counter::frames_decoded, frames_read);
 		const auto frames_written = out->write_frames({buffer});
 		if (frames_written != frames_to_read) {
 			throw std::runtime_error{"Error reading frames"};
@@ -586,7 +1098,7 @@ auto wavpack_read_float_chunks(concepts::item_output_stream auto* out, WavpackCo
 auto wavpack_read_int_chunks(concepts::item_output_stream auto* out, WavpackContext* context, const audiorw::header& header, concepts::should_abort_fn auto should_abort) -> operation_result {
 	static_assert (sizeof(float) == sizeof(int32_t));
 	const auto divisor    = (1 << (header.bit_depth - 1)) - 1;
-	auto buffer           = std::vector<float>{};
+	auto buffer           = tracked_buffer<float>{};
 	auto frames_remaining = header.frame_count;
 	while (frames_remaining > 0UL) {
 		if (should_abort()) {
@@ -596,12 +1108,19 @@ auto wavpack_read_int_chunks(concepts::item_output_stream auto* out, WavpackCont
 		const auto samples_to_read = header.channel_count.value * frames_to_read;
 		buffer.resize(samples_to_read);
 		auto buffer_as_ints = reinterpret_cast<int32_t*>(buffer.data());
-		const auto frames_read = WavpackUnpackSamples(context, buffer_as_ints, frames_to_read);
+		const auto frames_read = [&] {
+			auto timer = scope_counter_timer{format::wavpack, counters::counter::decode_ns};
+			return WavpackUnpackSamples(context, buffer_as_ints, frames_to_read);
+		}();
 		if (frames_read != frames_to_read) {
 			throw std::runtime_error{"Error unpacking WavPack samples"};
 		}
-		for (auto i = 0; i < buffer.size(); i++) {
-			buffer.data()[i] = static_cast<float>(buffer_as_ints[i]) / divisor;
+		counters::add(format::wavpack, counters::counter::frames_decoded, frames_read);
+		{
+			auto timer = scope_counter_timer{format::wavpack, counters::counter::convert_ns};
+			for (auto i = 0; i < buffer.size(); i++) {
+				buffer.data()[i] = static_cast<float>(buffer_as_ints[i]) / divisor;
+			}
 		}
 		const auto frames_written = out->write_frames({buffer});
 		if (frames_written != frames_to_read) {
@@ -623,11 +1142,120 @@ auto wavpack_read(concepts::byte_input_stream auto* in, concepts::item_output_st
 	if (float_mode) { return wavpack_read_float_chunks(out, reader.context(), header, should_abort); }
 	else            { return wavpack_read_int_chunks(out, reader.context(), header, should_abort); }
 }
+#endif
+
+// Streams which count their reads are told which format they held once a
+// decoder has been made from them.
+auto set_counter_format(concepts::byte_input_stream auto* in, audiorw::format format) -> void {
+	if constexpr (requires { in->set_counter_format(format); }) {
+		in->set_counter_format(format);
+	}
+}
+
+auto rewind_for_probe(concepts::byte_input_stream auto* in) -> void {
+	// With a non-seekable input this fails if the previous attempt read
+	// further than the rewind buffer holds.
+	if (!in->seek(0, std::ios::beg)) {
+		throw std::runtime_error{"Failed to rewind input to try the next format"};
+	}
+}
+
+[[nodiscard]]
+auto try_make_wav_reader(concepts::byte_input_stream auto* in) -> std::optional<scope_wav_reader> {
+	using Stream = std::remove_reference_t<decltype(*in)>;
+	try {
+		return scope_wav_reader{make_byte_stream_reader<Stream>(), in};
+	}
+	catch (const std::runtime_error&) {
+		return std::nullopt;
+	}
+}
+
+// For the native readers, which all have get_header() and read_frames().
+[[nodiscard]]
+auto reader_read(auto* reader, concepts::item_output_stream auto* out, concepts::should_abort_fn auto should_abort) -> operation_result {
+	const auto header = reader->get_header();
+	out->write_header(header);
+	auto buffer           = tracked_buffer<float>{};
+	auto frames_remaining = header.frame_count;
+	while (frames_remaining > 0UL) {
+		if (should_abort()) {
+			return operation_result::abort;
+		}
+		const auto frames_to_read  = std::min(frames_remaining.value, uint64_t(CHUNK_SIZE));
+		const auto samples_to_read = header.channel_count.value * frames_to_read;
+		buffer.resize(samples_to_read);
+		const auto frames_read = [&] {
+			auto timer = scope_counter_timer{header.format, counters::counter::decode_ns};
+			return reader->read_frames(buffer);
+		}();
+		if (frames_read != frames_to_read) {
+			throw std::runtime_error{"Error reading PCM frames"};
+		}
+		counters::add(header.format, counters::counter::frames_decoded, frames_read.value);
+		const auto frames_written = out->write_frames({buffer});
+		if (frames_written != frames_to_read) {
+			throw std::runtime_error{"Error reading frames"};
+		}
+		frames_remaining -= frames_to_read;
+	}
+	return operation_result::success;
+}
+
+// Encodings the native reader doesn't handle, e.g. ADPCM, still go
+// through miniaudio.
+[[nodiscard]]
+auto wav_try_read(concepts::byte_input_stream auto* in, concepts::item_output_stream auto* out, concepts::should_abort_fn auto should_abort) -> try_read_result {
+	auto reader = try_make_wav_reader(in);
+	if (!reader) {
+		rewind_for_probe(in);
+		return detail::ma_try_read(in, out, format::wav, should_abort);
+	}
+	try {
+		return to_try_read_result(reader_read(&*reader, out, should_abort));
+	}
+	catch (...) {
+		return try_read_result::fail;
+	}
+}
+
+#if AUDIORW_WITH_VORBIS
+[[nodiscard]]
+auto try_make_vorbis_reader(concepts::byte_input_stream auto* in) -> std::optional<scope_vorbis_reader> {
+	using Stream = std::remove_reference_t<decltype(*in)>;
+	try {
+		return scope_vorbis_reader{make_byte_stream_reader<Stream>(), in};
+	}
+	catch (const std::runtime_error&) {
+		return std::nullopt;
+	}
+}
+
+[[nodiscard]]
+auto vorbis_try_read(concepts::byte_input_stream auto* in, concepts::item_output_stream auto* out, concepts::should_abort_fn auto should_abort) -> try_read_result {
+	auto reader = try_make_vorbis_reader(in);
+	if (!reader) {
+		return try_read_result::fail;
+	}
+	try {
+		return to_try_read_result(reader_read(&*reader, out, should_abort));
+	}
+	catch (...) {
+		return try_read_result::fail;
+	}
+}
+#endif
 
 [[nodiscard]]
 auto try_read(concepts::byte_input_stream auto* in, concepts::item_output_stream auto* out, audiorw::format format, concepts::should_abort_fn auto should_abort) -> try_read_result {
 	switch (format) {
+		case format::wav:     { return detail::wav_try_read(in, out, should_abort); }
+#if AUDIORW_WITH_WAVPACK
 		case format::wavpack: { return to_try_read_result(detail::wavpack_read(in, out, should_abort)); }
+#endif
+#if AUDIORW_WITH_VORBIS
+		case format::vorbis:  { return detail::vorbis_try_read(in, out, should_abort); }
+#endif
 		default:              { return detail::ma_try_read(in, out, format, should_abort); }
 	}
 }
@@ -637,11 +1265,13 @@ auto read(concepts::byte_input_stream auto* in, concepts::item_output_stream aut
 	for (auto format : get_formats_to_try(hint)) {
 		switch (const auto r = try_read(in, out, format, should_abort)) {
 			case try_read_result::fail: {
-				in->seek(0, std::ios::beg);
+				counters::add(format, counters::counter::probe_failures);
+				rewind_for_probe(in);
 				out->seek({0});
 				continue;
 			}
 			default: {
+				set_counter_format(in, format);
 				return to_operation_result(r);
 			}
 		}
@@ -652,24 +1282,49 @@ auto read(concepts::byte_input_stream auto* in, concepts::item_output_stream aut
 [[nodiscard]]
 auto fn_always(auto value) { return [value]{ return value; }; }
 
+#if AUDIORW_WITH_WAVPACK
 [[nodiscard]]
 auto try_make_wavpack_decoder(concepts::byte_input_stream auto* in) -> std::optional<detail::decoder> {
 	using Stream = std::remove_reference_t<decltype(*in)>;
-	try         { return scope_wavpack_reader{make_wavpack_stream_reader<std::remove_reference_t<Stream>>(), in}; }
-	catch (...) { return std::nullopt; }
+	try {
+		return scope_wavpack_reader{make_wavpack_stream_reader<std::remove_reference_t<Stream>>(), in};
+	}
+	catch (...) {
+		return std::nullopt;
+	}
 }
+#endif
 
 [[nodiscard]]
 auto try_make_ma_decoder(concepts::byte_input_stream auto* in, audiorw::format format) -> std::optional<detail::decoder> {
 	using Stream = std::remove_reference_t<decltype(*in)>;
-	try         { return scope_ma_decoder{ma_on_decoder_read<Stream>, ma_on_decoder_seek<Stream>, in, format}; }
-	catch (...) { return std::nullopt; }
+	try {
+		return scope_ma_decoder{ma_on_decoder_read<Stream>, ma_on_decoder_seek<Stream>, in, format};
+	}
+	catch (...) {
+		return std::nullopt;
+	}
+}
+
+[[nodiscard]]
+auto try_make_wav_decoder(concepts::byte_input_stream auto* in) -> std::optional<detail::decoder> {
+	if (auto reader = try_make_wav_reader(in)) {
+		return std::move(reader).value();
+	}
+	rewind_for_probe(in);
+	return try_make_ma_decoder(in, format::wav);
 }
 
 [[nodiscard]]
 auto try_make_decoder(concepts::byte_input_stream auto* in, audiorw::format format) -> std::optional<detail::decoder> {
 	switch (format) {
+		case audiorw::format::wav:     { return try_make_wav_decoder(in); }
+#if AUDIORW_WITH_WAVPACK
 		case audiorw::format::wavpack: { return try_make_wavpack_decoder(in); }
+#endif
+#if AUDIORW_WITH_VORBIS
+		case audiorw::format::vorbis:  { return try_make_vorbis_reader(in); }
+#endif
 		default:                       { return try_make_ma_decoder(in, format); }
 	}
 }
@@ -679,51 +1334,404 @@ auto make_decoder(concepts::byte_input_stream auto* in, format_hint hint) -> det
 	const auto formats_to_try = detail::get_formats_to_try(hint);
 	for (auto format : formats_to_try) {
 		if (auto decoder = try_make_decoder(in, format)) {
+			set_counter_format(in, format);
 			return std::move(decoder).value();
 		}
-		in->seek(0, std::ios::beg);
+		counters::add(format, counters::counter::probe_failures);
+		rewind_for_probe(in);
 	}
 	throw std::runtime_error{"Failed to make decoder"};
 }
 
 } // detail
 
-[[nodiscard]] auto get_known_file_extensions() -> std::array<std::string_view, 4>;
-[[nodiscard]] auto make_format_hint(const std::filesystem::path& file_path, bool try_all = false) -> std::optional<format_hint>;
+// Streams frames out of any byte_input_stream, which it takes ownership of.
+template <concepts::byte_input_stream Stream>
+struct stream_item_from_byte_stream {
+	stream_item_from_byte_stream(Stream stream, format_hint hint)
+		: in_{std::make_unique<Stream>(std::move(stream))}
+		, decoder_{detail::make_decoder(in_.get(), hint)}
+	{
+	}
+	// NOTE: For mp3s get_header() will have to decode the entire file immediately,
+	// and with a non-seekable stream it then fails to get back to the start.
+	auto get_header() const -> header                         { return detail::get_header(&decoder_); }
+	auto read_frames(std::span<float> buffer) -> ads::frame_count { return detail::read_frames(&decoder_, buffer); }
+	auto seek(ads::frame_idx pos) -> bool                      { return detail::seek(&decoder_, pos); }
+private:
+	std::unique_ptr<Stream> in_;
+	detail::decoder decoder_;
+};
+
+// Exposes the [offset, offset + length) window of another stream, e.g. one
+// sound in a container file holding many of them back to back, so that it
+// can be decoded in place. Positions and the length are relative to the
+// window. The underlying stream isn't owned. Several windows can share it
+// as long as only one is used at a time, because each window seeks it to
+// its own position before reading.
+template <concepts::byte_input_stream Stream>
+struct stream_bytes_window {
+	stream_bytes_window(Stream* stream, size_t offset, size_t length)
+		: stream_{stream}
+		, offset_{offset}
+		, length_{length}
+	{
+		if (const auto stream_length = stream_->get_length()) {
+			if (offset_ > *stream_length || length_ > *stream_length - offset_) {
+				throw std::runtime_error{"Stream window is out of range"};
+			}
+		}
+	}
+	auto can_seek() const -> bool { return detail::can_seek(stream_); }
+	auto close() -> bool { return true; }
+	auto get_length() -> std::optional<size_t> { return length_; }
+	auto get_pos() -> size_t { return pos_; }
+	auto push_back_byte(std::byte v) -> bool {
+		if (pos_ == 0) {
+			return false;
+		}
+		pos_--;
+		return true;
+	}
+	auto read_bytes(std::span<std::byte> buffer) -> size_t {
+		const auto n = std::min(buffer.size(), length_ - pos_);
+		if (n == 0) {
+			return 0;
+		}
+		if (stream_->get_pos() != offset_ + pos_ && !stream_->seek(int64_t(offset_ + pos_), std::ios::beg)) {
+			return 0;
+		}
+		const auto bytes_read = stream_->read_bytes(buffer.first(n));
+		pos_ += bytes_read;
+		return bytes_read;
+	}
+	auto seek(int64_t offset, std::ios::seekdir mode) -> bool {
+		auto target = int64_t{};
+		switch (mode) {
+			case std::ios::beg: { target = offset; break; }
+			case std::ios::cur: { target = int64_t(pos_) + offset; break; }
+			case std::ios::end: { target = int64_t(length_) + offset; break; }
+			default:            { return false; }
+		}
+		if (target < 0 || target > int64_t(length_)) {
+			return false;
+		}
+		pos_ = size_t(target);
+		return true;
+	}
+private:
+	Stream* stream_;
+	size_t offset_;
+	size_t length_;
+	size_t pos_ = 0;
+};
+
+// Writes a WAV file a buffer at a time, for when the length isn't known
+// up front, e.g. a recording. header.frame_count is ignored. Room is left
+// in the header to promote the file to RF64 if it grows past 4 GiB, so
+// there is no limit on its size. The header is only finalized by
+// commit(), so the output stream has to be able to seek back to it.
+template <concepts::byte_output_stream Stream>
+struct stream_frames_to_wav {
+	stream_frames_to_wav(Stream* out, const audiorw::header& header, storage_type type)
+		: out_{out}
+		, encoder_{header, type, std::nullopt}
+		, channel_count_{header.channel_count.value}
+		, bytes_{memory_category::io}
+	{
+		detail::write_all(out_, encoder_.get_header());
+	}
+	// buffer holds interleaved frames.
+	auto write_frames(std::span<const float> buffer) -> ads::frame_count {
+		const auto frames = buffer.size() / channel_count_;
+		bytes_.resize(frames * encoder_.get_block_align());
+		{
+			auto timer = detail::scope_counter_timer{format::wav, counters::counter::encode_ns};
+			encoder_.encode(buffer.first(frames * channel_count_), bytes_.data());
+		}
+		detail::write_all(out_, {bytes_.data(), bytes_.size()});
+		counters::add(format::wav, counters::counter::frames_encoded, frames);
+		frames_written_ += frames;
+		return {frames};
+	}
+	auto commit() -> void {
+		detail::wav_finish(&encoder_, out_, frames_written_);
+		out_->commit();
+	}
+	[[nodiscard]] auto get_frames_written() const -> ads::frame_count { return {frames_written_}; }
+private:
+	Stream* out_;
+	detail::wav_encoder encoder_;
+	uint64_t channel_count_;
+	detail::tracked_buffer<std::byte> bytes_;
+	uint64_t frames_written_ = 0;
+};
+
+} // audiorw
+
+namespace audiorw::stream::bytes {
+
+[[nodiscard]] inline auto from(std::istream* stream) { return stream_bytes_from_std_istream{stream}; }
+
+template <concepts::forward_byte_source Source> [[nodiscard]]
+auto with_rewind_buffer(Source source, size_t rewind_capacity = detail::DEFAULT_REWIND_CAPACITY) {
+	return rewind_byte_input_stream<Source>{std::move(source), rewind_capacity};
+}
+
+template <concepts::byte_input_stream Stream> [[nodiscard]]
+auto window(Stream* stream, size_t offset, size_t length) { return stream_bytes_window<Stream>{stream, offset, length}; }
+
+// A window of bytes already in memory, e.g. a memory-mapped file, is just a
+// smaller span, so nothing is copied.
+[[nodiscard]] inline
+auto window(std::span<const std::byte> bytes, size_t offset, size_t length) {
+	if (offset > bytes.size() || length > bytes.size() - offset) {
+		throw std::runtime_error{"Stream window is out of range"};
+	}
+	return byte_input_stream{bytes.subspan(offset, length)};
+}
+
+} // audiorw::stream::bytes
+
+namespace audiorw::stream::frames {
+
+template <concepts::byte_output_stream Stream> [[nodiscard]]
+auto to_wav(Stream* out, const audiorw::header& header, storage_type type) { return stream_frames_to_wav<Stream>{out, header, type}; }
+
+} // audiorw::stream::frames
+
+namespace audiorw::stream::item {
+
+template <concepts::byte_input_stream Stream> [[nodiscard]]
+auto from(Stream stream, format_hint hint) { return stream_item_from_byte_stream<Stream>{std::move(stream), hint}; }
+
+} // audiorw::stream::item
+
+namespace audiorw {
 
 auto read(concepts::byte_input_stream auto* in, concepts::item_output_stream auto* out, audiorw::format_hint hint, concepts::should_abort_fn auto should_abort) -> operation_result {
-	return detail::read(in, out, hint, std::move(should_abort));
+	try {
+		return detail::read(in, out, hint, std::move(should_abort));
+	}
+	catch (...) {
+		counters::add(counters::counter::exceptions);
+		throw;
+	}
 }
 
 auto read(concepts::byte_input_stream auto* in, concepts::item_output_stream auto* out, audiorw::format_hint hint) -> operation_result {
-	return read(in, out, hint, detail::fn_always(false));
+	return audiorw::read(in, out, hint, detail::fn_always(false));
+}
+
+auto read(concepts::byte_input_stream auto* in, concepts::item_output_stream auto* out, audiorw::format_hint hint, concepts::should_abort_fn auto should_abort, memory_report* report) -> operation_result {
+	auto tracker = detail::scope_memory_tracker{report};
+	return audiorw::read(in, out, hint, std::move(should_abort));
 }
 
 [[nodiscard]]
-auto read(const std::filesystem::path& path, audiorw::format_hint hint, concepts::should_abort_fn auto should_abort) -> std::optional<item> {
-	auto item = audiorw::item{};
-	auto in   = audiorw::stream::bytes::from(path);
-	auto out  = audiorw::stream::item::to(&item);
-	auto result = audiorw::read(&in, &out, audiorw::format_hint::try_wav_only, should_abort);
+auto read(const std::filesystem::path& path, audiorw::format_hint hint, concepts::should_abort_fn auto should_abort, memory_report* report) -> std::optional<item> {
+	// The tracker is installed before the streams are created so that their
+	// I/O buffers are counted.
+	auto tracker = detail::scope_memory_tracker{report};
+	auto item    = audiorw::item{};
+	auto in      = audiorw::stream::bytes::from(path);
+	auto out     = audiorw::stream::item::to(&item);
+	auto result  = audiorw::read(&in, &out, hint, should_abort);
 	if (result == audiorw::operation_result::success) { return std::move(item); }
 	else                                              { return std::nullopt; }
 }
 
+[[nodiscard]]
+auto read(const std::filesystem::path& path, audiorw::format_hint hint, concepts::should_abort_fn auto should_abort) -> std::optional<item> {
+	return audiorw::read(path, hint, std::move(should_abort), nullptr);
+}
+
 auto write(const audiorw::header& header, concepts::frame_input_stream auto* in, concepts::byte_output_stream auto* out, storage_type type, concepts::should_abort_fn auto should_abort) -> operation_result {
-	switch (header.format) {
-		case format::wavpack: { return detail::wavpack_write(header, in, out, type, std::move(should_abort)); }
-		default:              { return detail::ma_write(header, in, out, type, std::move(should_abort)); }
+	if (!is_supported(header.format)) {
+		throw std::runtime_error{"audiorw was built without support for this format"};
+	}
+	try {
+		switch (header.format) {
+#if AUDIORW_WITH_FLAC
+			case format::flac:    { return detail::flac_write(header, in, out, std::move(should_abort), flac_options{}); }
+#endif
+			case format::wav:     { return detail::wav_write(header, in, out, type, std::move(should_abort)); }
+#if AUDIORW_WITH_WAVPACK
+			case format::wavpack: { return detail::wavpack_write(header, in, out, type, std::move(should_abort), wavpack_options{}); }
+#endif
+			default:              { return detail::ma_write(header, in, out, type, std::move(should_abort)); }
+		}
+	}
+	catch (...) {
+		counters::add(header.format, counters::counter::exceptions);
+		throw;
 	}
 }
 
 auto write(const audiorw::header& header, concepts::frame_input_stream auto* in, concepts::byte_output_stream auto* out, storage_type type) -> operation_result {
-	return write(header, in, out, type, detail::fn_always(false));
+	return audiorw::write(header, in, out, type, detail::fn_always(false));
+}
+
+auto write(const audiorw::header& header, concepts::frame_input_stream auto* in, concepts::byte_output_stream auto* out, storage_type type, concepts::should_abort_fn auto should_abort, memory_report* report) -> operation_result {
+	auto tracker = detail::scope_memory_tracker{report};
+	return audiorw::write(header, in, out, type, std::move(should_abort));
+}
+
+auto write(const audiorw::item& item, const std::filesystem::path& path, storage_type type, concepts::should_abort_fn auto should_abort, memory_report* report) -> operation_result {
+	auto tracker = detail::scope_memory_tracker{report};
+	auto in      = audiorw::stream::frames::from(item);
+	auto out     = audiorw::stream::bytes::to(path);
+	return audiorw::write(item.header, &in, &out, type, should_abort);
 }
 
 auto write(const audiorw::item& item, const std::filesystem::path& path, storage_type type, concepts::should_abort_fn auto should_abort) -> operation_result {
-	auto in  = audiorw::stream::frames::from(&item);
+	return audiorw::write(item, path, type, std::move(should_abort), nullptr);
+}
+
+#if AUDIORW_WITH_FLAC
+// Like write() with a FLAC header, but with control over the encoder.
+auto write_flac(const audiorw::header& header, concepts::frame_input_stream auto* in, concepts::byte_output_stream auto* out, const flac_options& options, concepts::should_abort_fn auto should_abort) -> operation_result {
+	try {
+		return detail::flac_write(header, in, out, std::move(should_abort), options);
+	}
+	catch (...) {
+		counters::add(format::flac, counters::counter::exceptions);
+		throw;
+	}
+}
+
+auto write_flac(const audiorw::header& header, concepts::frame_input_stream auto* in, concepts::byte_output_stream auto* out, const flac_options& options) -> operation_result {
+	return audiorw::write_flac(header, in, out, options, detail::fn_always(false));
+}
+
+auto write_flac(const audiorw::item& item, const std::filesystem::path& path, const flac_options& options, concepts::should_abort_fn auto should_abort) -> operation_result {
+	auto in  = audiorw::stream::frames::from(item);
+	auto out = audiorw::stream::bytes::to(path);
+	return audiorw::write_flac(item.header, &in, &out, options, should_abort);
+}
+#endif
+
+#if AUDIORW_WITH_WAVPACK
+// Like write() with a WavPack header, but with control over the encoder.
+auto write_wavpack(const audiorw::header& header, concepts::frame_input_stream auto* in, concepts::byte_output_stream auto* out, storage_type type, const wavpack_options& options, concepts::should_abort_fn auto should_abort) -> operation_result {
+	try {
+		return detail::wavpack_write(header, in, out, type, std::move(should_abort), options);
+	}
+	catch (...) {
+		counters::add(format::wavpack, counters::counter::exceptions);
+		throw;
+	}
+}
+
+auto write_wavpack(const audiorw::header& header, concepts::frame_input_stream auto* in, concepts::byte_output_stream auto* out, storage_type type, const wavpack_options& options) -> operation_result {
+	return audiorw::write_wavpack(header, in, out, type, options, detail::fn_always(false));
+}
+
+auto write_wavpack(const audiorw::item& item, const std::filesystem::path& path, storage_type type, const wavpack_options& options, concepts::should_abort_fn auto should_abort) -> operation_result {
+	auto in  = audiorw::stream::frames::from(item);
 	auto out = audiorw::stream::bytes::to(path);
-	return write(item.header, &in, &out, type, should_abort);
+	return audiorw::write_wavpack(item.header, &in, &out, type, options, should_abort);
+}
+#endif
+
+} // audiorw
+
+namespace audiorw::detail {
+
+// Samples decoded at a time when the destination is planar. The chunk is
+// on the stack so that read_into() doesn't allocate.
+static constexpr auto READ_INTO_CHUNK_SAMPLES = size_t{4096};
+
+// Seeks to start. Returns the number of frames that can be read from there,
+// which is zero if start is past the end.
+[[nodiscard]] inline
+auto prepare_read_into(detail::decoder* decoder, const audiorw::header& header, ads::frame_idx start) -> uint64_t {
+	if (start.value >= header.frame_count.value) {
+		return 0;
+	}
+	if (start.value > 0 && !detail::seek(decoder, start)) {
+		throw std::runtime_error{"Failed to seek"};
+	}
+	return header.frame_count.value - start.value;
+}
+
+} // audiorw::detail
+
+namespace audiorw {
+
+// Decodes frames [start, start + interleaved.size() / channel_count) into
+// the caller's buffer, stopping early at the end of the file. Frames go
+// straight from the decoder into the buffer. Apart from the decoder's own
+// state, nothing is allocated.
+// NOTE: For mp3s the entire file has to be decoded to get the header.
+auto read_into(concepts::byte_input_stream auto* in, format_hint hint, std::span<float> interleaved, ads::frame_idx start = {0}) -> read_into_result {
+	try {
+		auto decoder      = detail::make_decoder(in, hint);
+		auto result       = read_into_result{detail::get_header(&decoder), {0}};
+		const auto chs    = result.header.channel_count.value;
+		const auto frames = std::min(interleaved.size() / chs, detail::prepare_read_into(&decoder, result.header, start));
+		auto& written     = result.frames_written.value;
+		while (written < frames) {
+			const auto n = detail::read_frames(&decoder, interleaved.subspan(written * chs, (frames - written) * chs)).value;
+			if (n == 0) {
+				break;
+			}
+			written += n;
+		}
+		return result;
+	}
+	catch (...) {
+		counters::add(counters::counter::exceptions);
+		throw;
+	}
+}
+
+// As above, but into one span per channel. The number of frames is limited
+// by the shortest span. If there are more spans than channels the extra
+// ones aren't touched. If there are fewer, the extra channels are dropped.
+auto read_into(concepts::byte_input_stream auto* in, format_hint hint, std::span<const std::span<float>> channels, ads::frame_idx start = {0}) -> read_into_result {
+	try {
+		auto decoder   = detail::make_decoder(in, hint);
+		auto result    = read_into_result{detail::get_header(&decoder), {0}};
+		const auto chs = result.header.channel_count.value;
+		if (chs > detail::READ_INTO_CHUNK_SAMPLES) {
+			throw std::runtime_error{"Too many channels"};
+		}
+		const auto out_chs = std::min(chs, channels.size());
+		auto frames = detail::prepare_read_into(&decoder, result.header, start);
+		for (size_t c = 0; c < out_chs; c++) {
+			frames = std::min<uint64_t>(frames, channels[c].size());
+		}
+		if (auto reader = std::get_if<detail::scope_wav_reader>(&decoder)) {
+			// WAV samples can be converted and deinterleaved in one pass.
+			auto timer = detail::scope_counter_timer{format::wav, counters::counter::decode_ns};
+			result.frames_written = reader->read_frames(channels.first(out_chs), 0, frames);
+			counters::add(format::wav, counters::counter::frames_decoded, result.frames_written.value);
+			return result;
+		}
+		float chunk[detail::READ_INTO_CHUNK_SAMPLES];
+		const auto chunk_frames = detail::READ_INTO_CHUNK_SAMPLES / chs;
+		auto& written = result.frames_written.value;
+		while (written < frames) {
+			const auto wanted = std::min<uint64_t>(chunk_frames, frames - written);
+			const auto n      = detail::read_frames(&decoder, {chunk, wanted * chs}).value;
+			if (n == 0) {
+				break;
+			}
+			for (size_t c = 0; c < out_chs; c++) {
+				const auto dst = channels[c].data() + written;
+				for (size_t i = 0; i < n; i++) {
+					dst[i] = chunk[(i * chs) + c];
+				}
+			}
+			written += n;
+		}
+		return result;
+	}
+	catch (...) {
+		counters::add(counters::counter::exceptions);
+		throw;
+	}
 }
 
 } // audiorw
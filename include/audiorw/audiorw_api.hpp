@@ -0,0 +1,377 @@
+#pragma once
+
+#include <ads.hpp>
+#include <array>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <ios>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "audiorw_config.hpp"
+#include "audiorw_executor.hpp"
+
+// The part of the API which is compiled into the library. It only needs
+// the standard library and ads, so translation units which include this
+// instead of audiorw.hpp don't parse miniaudio, WavPack, Boost or the
+// templated chunk loops. audiorw.hpp includes this and adds the template
+// overloads for arbitrary stream types.
+
+namespace audiorw {
+
+enum class format {
+	flac,
+	mp3,
+	wav,
+	wavpack,
+	vorbis,
+};
+
+struct header {
+	audiorw::format format;
+	ads::channel_count channel_count;
+	ads::frame_count frame_count;
+	int SR        = 44100;
+	int bit_depth = 32;
+};
+
+// Whether the format's codec was compiled in. Formats which aren't are
+// never tried when reading, and throw when writing.
+[[nodiscard]] constexpr
+auto is_supported(format f) -> bool {
+	switch (f) {
+		case format::flac:    { return AUDIORW_WITH_FLAC; }
+		case format::mp3:     { return AUDIORW_WITH_MP3; }
+		case format::wav:     { return true; }
+		case format::wavpack: { return AUDIORW_WITH_WAVPACK; }
+		case format::vorbis:  { return AUDIORW_WITH_VORBIS; }
+		default:              { return false; }
+	}
+}
+
+static constexpr auto SUPPORTED_FORMAT_COUNT = size_t{1} + AUDIORW_WITH_FLAC + AUDIORW_WITH_MP3 + AUDIORW_WITH_VORBIS + AUDIORW_WITH_WAVPACK;
+
+} // audiorw
+
+namespace audiorw::counters {
+
+// Process-wide performance counters. These are always on and cost
+// one relaxed atomic add per update, so they are only updated per
+// chunk or per call, never per sample.
+enum class counter {
+	files_opened,
+	probe_failures,
+	bytes_read,
+	bytes_written,
+	frames_decoded,
+	frames_encoded,
+	seeks,
+	decode_ns,
+	convert_ns,
+	encode_ns,
+	exceptions,
+};
+
+static constexpr auto COUNTER_COUNT = size_t(counter::exceptions) + 1;
+static constexpr auto FORMAT_COUNT  = size_t(format::vorbis) + 1;
+
+struct snapshot {
+	// One row per format. The last row holds counts which can't be
+	// attributed to a format, e.g. bytes read from a file whose format
+	// couldn't be identified. Reads are moved to their format's row once
+	// it is. exceptions only counts exceptions which reach the caller, not
+	// formats failing to probe, which are probe_failures.
+	std::array<std::array<uint64_t, COUNTER_COUNT>, FORMAT_COUNT + 1> values = {};
+	[[nodiscard]] auto get(counter c) const -> uint64_t;
+	[[nodiscard]] auto get(audiorw::format format, counter c) const -> uint64_t;
+	[[nodiscard]] auto get_unattributed(counter c) const -> uint64_t;
+};
+
+auto add(counter c, uint64_t n = 1) -> void;
+auto add(audiorw::format format, counter c, uint64_t n = 1) -> void;
+auto reset() -> void;
+[[nodiscard]] auto get_snapshot() -> snapshot;
+// Text exposition format, one "audiorw_<counter>{format="<format>"} <value>" line per non-zero counter.
+[[nodiscard]] auto to_text(const snapshot& s) -> std::string;
+
+} // audiorw::counters
+
+namespace audiorw {
+
+enum class memory_category {
+	item_storage,
+	scratch,
+	decoder,
+	io,
+};
+
+static constexpr auto MEMORY_CATEGORY_COUNT = size_t(memory_category::io) + 1;
+
+// Filled in by the read/write overloads which accept a memory_report*.
+// Decoder internals are only visible for the miniaudio backends (through
+// its allocation callbacks). WavPack allocations are not counted.
+struct memory_report {
+	std::array<size_t, MEMORY_CATEGORY_COUNT> peak_bytes = {};
+	size_t peak_total_bytes = 0;
+	size_t allocation_count = 0;
+	[[nodiscard]] auto get_peak_bytes(memory_category category) const { return peak_bytes[size_t(category)]; }
+};
+
+struct flac_options {
+	// 0 (fastest) to 8 (smallest), as with the reference encoder.
+	int compression_level = 5;
+	// Blocks are encoded in parallel on this. If not set, they are encoded
+	// on the calling thread.
+	std::optional<executor_ref> executor;
+};
+
+struct wavpack_options {
+	// Stores an MD5 of the audio, as WavPack defines it, so that verify()
+	// can check the file later without the source.
+	bool store_md5 = false;
+	// If set, the MD5 is computed by a task on this while the encoder packs
+	// the next chunk. Otherwise it's computed on the calling thread.
+	std::optional<executor_ref> executor;
+};
+
+} // audiorw
+
+namespace audiorw {
+
+enum class format_hint {
+	// Audio format will be deduced by trying to read
+	// the header as each supported type, starting
+	// with the one specified
+	try_flac_first,
+	try_mp3_first,
+	try_wav_first,
+	try_wavpack_first,
+	try_vorbis_first,
+
+	// Only the specified type will be tried.
+	try_flac_only,
+	try_mp3_only,
+	try_wav_only,
+	try_wavpack_only,
+	try_vorbis_only,
+};
+
+enum class operation_result { abort, success };
+
+// How a file stream uses the OS page cache.
+enum class cache_policy {
+	normal,
+	// The file's pages are dropped from the cache once the stream has moved
+	// past them, and the rest when it is closed. For one-shot traffic that
+	// shouldn't evict other processes' working sets.
+	drop_behind,
+	// Reads bypass the cache entirely, through an aligned buffer. Falls
+	// back to drop_behind where the file system doesn't support it.
+	// Output streams treat this as drop_behind.
+	direct,
+};
+
+enum class storage_type {
+	int_,
+	float_,
+	normalized_float_,
+};
+
+using frames = ads::fully_dynamic<float>;
+
+struct item {
+	audiorw::header header;
+	audiorw::frames frames;
+};
+
+struct read_into_result {
+	audiorw::header header;
+	ads::frame_count frames_written;
+};
+
+} // audiorw
+
+namespace audiorw {
+
+// Type-erased streams, so that a stream of any type can be passed to the
+// compiled functions below without instantiating anything for it. Each
+// is a pointer to the stream and a table of functions for its type. The
+// stream isn't owned. They satisfy the stream concepts in audiorw.hpp.
+struct any_byte_input_stream {
+	template <typename Stream>
+	explicit any_byte_input_stream(Stream* stream) : vtable_{&VTABLE<Stream>}, stream_{stream} {}
+	auto can_seek() const -> bool                             { return vtable_->can_seek(stream_); }
+	auto close() -> bool                                      { return vtable_->close(stream_); }
+	auto get_length() -> std::optional<size_t>                { return vtable_->get_length(stream_); }
+	auto get_pos() -> size_t                                  { return vtable_->get_pos(stream_); }
+	auto push_back_byte(std::byte v) -> bool                  { return vtable_->push_back_byte(stream_, v); }
+	auto read_bytes(std::span<std::byte> buffer) -> size_t    { return vtable_->read_bytes(stream_, buffer); }
+	auto seek(int64_t offset, std::ios::seekdir mode) -> bool { return vtable_->seek(stream_, offset, mode); }
+	auto set_counter_format(audiorw::format format) -> void   { vtable_->set_counter_format(stream_, format); }
+private:
+	struct vtable {
+		bool (*can_seek)(void* stream);
+		bool (*close)(void* stream);
+		std::optional<size_t> (*get_length)(void* stream);
+		size_t (*get_pos)(void* stream);
+		bool (*push_back_byte)(void* stream, std::byte v);
+		size_t (*read_bytes)(void* stream, std::span<std::byte> buffer);
+		bool (*seek)(void* stream, int64_t offset, std::ios::seekdir mode);
+		void (*set_counter_format)(void* stream, audiorw::format format);
+	};
+	template <typename Stream>
+	static constexpr auto VTABLE = vtable{
+		.can_seek = [](void* stream) -> bool {
+			if constexpr (requires(const Stream& x) { { x.can_seek() } -> std::same_as<bool>; }) { return static_cast<Stream*>(stream)->can_seek(); }
+			else                                                                                { return true; }
+		},
+		.close          = [](void* stream) { return static_cast<Stream*>(stream)->close(); },
+		.get_length     = [](void* stream) { return static_cast<Stream*>(stream)->get_length(); },
+		.get_pos        = [](void* stream) { return static_cast<Stream*>(stream)->get_pos(); },
+		.push_back_byte = [](void* stream, std::byte v) { return static_cast<Stream*>(stream)->push_back_byte(v); },
+		.read_bytes     = [](void* stream, std::span<std::byte> buffer) { return static_cast<Stream*>(stream)->read_bytes(buffer); },
+		.seek           = [](void* stream, int64_t offset, std::ios::seekdir mode) { return static_cast<Stream*>(stream)->seek(offset, mode); },
+		.set_counter_format = [](void* stream, audiorw::format format) {
+			if constexpr (requires(Stream& x) { x.set_counter_format(format); }) { static_cast<Stream*>(stream)->set_counter_format(format); }
+		},
+	};
+	const vtable* vtable_;
+	void* stream_;
+};
+
+struct any_byte_output_stream {
+	template <typename Stream>
+	explicit any_byte_output_stream(Stream* stream) : vtable_{&VTABLE<Stream>}, stream_{stream} {}
+	auto commit() -> void                                          { vtable_->commit(stream_); }
+	auto seek(int64_t offset, std::ios::seekdir mode) -> bool      { return vtable_->seek(stream_, offset, mode); }
+	auto write_bytes(std::span<const std::byte> buffer) -> size_t { return vtable_->write_bytes(stream_, buffer); }
+private:
+	struct vtable {
+		void (*commit)(void* stream);
+		bool (*seek)(void* stream, int64_t offset, std::ios::seekdir mode);
+		size_t (*write_bytes)(void* stream, std::span<const std::byte> buffer);
+	};
+	template <typename Stream>
+	static constexpr auto VTABLE = vtable{
+		.commit      = [](void* stream) { static_cast<Stream*>(stream)->commit(); },
+		.seek        = [](void* stream, int64_t offset, std::ios::seekdir mode) { return static_cast<Stream*>(stream)->seek(offset, mode); },
+		.write_bytes = [](void* stream, std::span<const std::byte> buffer) { return static_cast<Stream*>(stream)->write_bytes(buffer); },
+	};
+	const vtable* vtable_;
+	void* stream_;
+};
+
+struct any_frame_input_stream {
+	template <typename Stream>
+	explicit any_frame_input_stream(Stream* stream) : vtable_{&VTABLE<Stream>}, stream_{stream} {}
+	auto read_frames(std::span<float> buffer) -> ads::frame_count { return vtable_->read_frames(stream_, buffer); }
+private:
+	struct vtable {
+		ads::frame_count (*read_frames)(void* stream, std::span<float> buffer);
+	};
+	template <typename Stream>
+	static constexpr auto VTABLE = vtable{
+		.read_frames = [](void* stream, std::span<float> buffer) { return static_cast<Stream*>(stream)->read_frames(buffer); },
+	};
+	const vtable* vtable_;
+	void* stream_;
+};
+
+struct any_item_output_stream {
+	template <typename Stream>
+	explicit any_item_output_stream(Stream* stream) : vtable_{&VTABLE<Stream>}, stream_{stream} {}
+	auto commit() -> void                                              { vtable_->commit(stream_); }
+	auto seek(ads::frame_idx pos) -> bool                              { return vtable_->seek(stream_, pos); }
+	auto write_header(audiorw::header header) -> void                  { vtable_->write_header(stream_, header); }
+	auto write_frames(std::span<const float> buffer) -> ads::frame_count { return vtable_->write_frames(stream_, buffer); }
+private:
+	struct vtable {
+		void (*commit)(void* stream);
+		bool (*seek)(void* stream, ads::frame_idx pos);
+		void (*write_header)(void* stream, audiorw::header header);
+		ads::frame_count (*write_frames)(void* stream, std::span<const float> buffer);
+	};
+	template <typename Stream>
+	static constexpr auto VTABLE = vtable{
+		.commit       = [](void* stream) { static_cast<Stream*>(stream)->commit(); },
+		.seek         = [](void* stream, ads::frame_idx pos) { return static_cast<Stream*>(stream)->seek(pos); },
+		.write_header = [](void* stream, audiorw::header header) { static_cast<Stream*>(stream)->write_header(header); },
+		.write_frames = [](void* stream, std::span<const float> buffer) { return static_cast<Stream*>(stream)->write_frames(buffer); },
+	};
+	const vtable* vtable_;
+	void* stream_;
+};
+
+// An open file or stream, ready to read frames from. The same thing as
+// the stream::item::from() streams in audiorw.hpp, but the decoder is
+// behind a pointer so that its layout doesn't need the codec headers.
+struct decoder_handle {
+	decoder_handle(const std::filesystem::path& path, format_hint hint);
+	decoder_handle(std::span<const std::byte> bytes, format_hint hint);
+	// The stream has to outlive the handle.
+	decoder_handle(any_byte_input_stream stream, format_hint hint);
+	decoder_handle(decoder_handle&& rhs) noexcept;
+	decoder_handle& operator=(decoder_handle&& rhs) noexcept;
+	~decoder_handle();
+	// NOTE: For mp3s get_header() will have to decode the entire file immediately.
+	[[nodiscard]] auto get_header() const -> header;
+	auto read_frames(std::span<float> buffer) -> ads::frame_count;
+	auto seek(ads::frame_idx pos) -> bool;
+private:
+	struct impl;
+	std::unique_ptr<impl> impl_;
+};
+
+// The other way round: frames are pushed in as they become available,
+// instead of write() pulling them from a stream. WAV, FLAC and WavPack
+// can be written, with the default options. Exactly header.frame_count
+// frames have to be written, then finish() writes the final header and
+// commits the output. If finish() isn't called nothing is committed.
+struct encoder_handle {
+	encoder_handle(const audiorw::header& header, const std::filesystem::path& path, storage_type type);
+	encoder_handle(const audiorw::header& header, std::vector<std::byte>* out, storage_type type);
+	// The stream has to outlive the handle.
+	encoder_handle(const audiorw::header& header, any_byte_output_stream stream, storage_type type);
+	encoder_handle(encoder_handle&& rhs) noexcept;
+	encoder_handle& operator=(encoder_handle&& rhs) noexcept;
+	~encoder_handle();
+	// Interleaved, and a whole number of frames.
+	auto write_frames(std::span<const float> buffer) -> ads::frame_count;
+	auto finish() -> void;
+private:
+	struct impl;
+	std::unique_ptr<impl> impl_;
+};
+
+[[nodiscard]] auto get_known_file_extensions() -> std::array<std::string_view, SUPPORTED_FORMAT_COUNT>;
+[[nodiscard]] auto make_format_hint(const std::filesystem::path& file_path, bool try_all = false) -> std::optional<format_hint>;
+
+// The read() and write() overloads from audiorw.hpp, compiled once in the
+// library for the common streams. Anything else can go through the
+// any_* streams. should_abort can be empty.
+[[nodiscard]] auto read(const std::filesystem::path& path, format_hint hint, const std::function<bool()>& should_abort = {}) -> std::optional<item>;
+[[nodiscard]] auto read(std::span<const std::byte> bytes, format_hint hint, const std::function<bool()>& should_abort = {}) -> std::optional<item>;
+auto read(any_byte_input_stream* in, any_item_output_stream* out, format_hint hint, const std::function<bool()>& should_abort = {}) -> operation_result;
+auto write(const audiorw::item& item, const std::filesystem::path& path, storage_type type, const std::function<bool()>& should_abort = {}) -> operation_result;
+auto write(const audiorw::item& item, std::vector<std::byte>* out, storage_type type, const std::function<bool()>& should_abort = {}) -> operation_result;
+auto write(const audiorw::header& header, const audiorw::frames& frames, const std::filesystem::path& path, storage_type type, const std::function<bool()>& should_abort = {}) -> operation_result;
+auto write(const audiorw::header& header, const audiorw::frames& frames, std::vector<std::byte>* out, storage_type type, const std::function<bool()>& should_abort = {}) -> operation_result;
+auto write(const audiorw::header& header, any_frame_input_stream* in, any_byte_output_stream* out, storage_type type, const std::function<bool()>& should_abort = {}) -> operation_result;
+
+auto read_into(const std::filesystem::path& path, format_hint hint, std::span<float> interleaved, ads::frame_idx start = {0}) -> read_into_result;
+auto read_into(const std::filesystem::path& path, format_hint hint, std::span<const std::span<float>> channels, ads::frame_idx start = {0}) -> read_into_result;
+
+#if AUDIORW_WITH_FLAC
+auto write_flac(const audiorw::item& item, const std::filesystem::path& path, const flac_options& options) -> operation_result;
+#endif
+#if AUDIORW_WITH_WAVPACK
+auto write_wavpack(const audiorw::item& item, const std::filesystem::path& path, storage_type type, const wavpack_options& options) -> operation_result;
+#endif
+
+} // audiorw
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <string_view>
+#include "audiorw.hpp"
+#include "audiorw_file.hpp"
+
+// A sample bank is a single file holding many sounds, laid out so that it
+// can be memory-mapped and used without parsing anything:
+//
+//   bank_file_header
+//   bank_entry[entry_count]  sorted by name
+//   bank_block[...]          block indices of the entries that have one
+//   names                    UTF-8, not null-terminated
+//   blobs                    each one starts on a BANK_ALIGNMENT boundary
+//
+// All integers are little-endian.
+namespace audiorw {
+
+static constexpr auto BANK_ALIGNMENT = size_t{4096};
+
+enum class bank_blob : uint32_t {
+	// Interleaved 32-bit floats.
+	raw_float,
+	// A complete audio file in the format given by bank_entry::format.
+	audio_file,
+};
+
+struct bank_entry {
+	uint64_t name_offset;
+	uint32_t name_size;
+	bank_blob blob;
+	// From the start of the bank file.
+	uint64_t offset;
+	uint64_t length;
+	uint64_t frame_count;
+	uint32_t format;
+	uint32_t channel_count;
+	int32_t SR;
+	int32_t bit_depth;
+	uint64_t block_index_offset;
+	uint32_t block_count;
+	uint32_t reserved;
+};
+
+// Where a block of frames which can be decoded on its own starts. Only
+// WavPack blobs have these.
+struct bank_block {
+	uint64_t frame;
+	// From the start of the blob.
+	uint64_t offset;
+};
+
+static_assert(sizeof(bank_entry) == 72);
+static_assert(sizeof(bank_block) == 16);
+
+} // audiorw
+
+namespace audiorw::detail::bank {
+
+static constexpr auto VERSION = uint32_t{1};
+static constexpr char MAGIC[8] = {'A', 'U', 'R', 'W', 'B', 'A', 'N', 'K'};
+
+struct file_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t entry_count;
+	uint64_t index_offset;
+	uint64_t blocks_offset;
+	uint64_t block_count;
+	uint64_t names_offset;
+	uint64_t names_size;
+	uint32_t alignment;
+	uint32_t reserved;
+};
+
+static_assert(sizeof(file_header) == 64);
+
+} // audiorw::detail::bank
+
+namespace audiorw {
+
+// Reads a sample bank. Opening it maps the file and checks the file
+// header. Nothing else is read until it is asked for.
+struct sample_bank {
+	sample_bank(const std::filesystem::path& path);
+	// Sorted by name.
+	[[nodiscard]] auto get_entries() const -> std::span<const bank_entry> { return entries_; }
+	[[nodiscard]] auto find(std::string_view name) const -> const bank_entry*;
+	[[nodiscard]] auto get_blocks(const bank_entry& entry) const -> std::span<const bank_block>;
+	[[nodiscard]] auto get_bytes(const bank_entry& entry) const -> std::span<const std::byte>;
+	[[nodiscard]] auto get_header(const bank_entry& entry) const -> header;
+	[[nodiscard]] auto get_name(const bank_entry& entry) const -> std::string_view;
+	// Decodes straight out of the mapping.
+	[[nodiscard]] auto read(const bank_entry& entry) const -> std::optional<item>;
+private:
+	mapped_file file_;
+	std::span<const bank_entry> entries_;
+	std::span<const bank_block> blocks_;
+	std::string_view names_;
+};
+
+// Builds a sample bank. Blobs are spooled to a temporary file next to the
+// destination, and the bank is only written to its final path by commit().
+struct sample_bank_writer {
+	sample_bank_writer(const std::filesystem::path& path);
+	sample_bank_writer(sample_bank_writer&&) noexcept = default;
+	sample_bank_writer& operator=(sample_bank_writer&&) noexcept = default;
+	~sample_bank_writer();
+	// For bank_blob::audio_file the item is encoded as item.header.format,
+	// which must be WAV or WavPack.
+	auto add(std::string name, const item& item, bank_blob blob, storage_type type = storage_type::int_) -> void;
+	// Stores the file as it is, without decoding it.
+	auto add(std::string name, const std::filesystem::path& file, format_hint hint) -> void;
+	// Throws if two entries have the same name.
+	auto commit() -> void;
+private:
+	struct pending_entry {
+		std::string name;
+		bank_entry entry;
+		std::vector<bank_block> blocks;
+	};
+	auto add_blob(std::string name, const header& header, bank_blob blob, std::span<const std::byte> bytes) -> void;
+	std::filesystem::path path_;
+	std::filesystem::path spool_path_;
+	detail::native_file spool_;
+	uint64_t spool_size_ = 0;
+	std::vector<pending_entry> entries_;
+};
+
+} // audiorw
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "audiorw.hpp"
+#include "audiorw_executor.hpp"
+#include "audiorw_throttle.hpp"
+
+namespace audiorw {
+
+enum class storage_device {
+	// Detected per file where the platform allows it, otherwise ssd.
+	automatic,
+	// Many files are read at the same time.
+	ssd,
+	// Files on the same disk are read one at a time to avoid seek thrashing.
+	hdd,
+};
+
+struct read_many_request {
+	std::filesystem::path path;
+	// If not set, the hint is deduced from the file extension, falling
+	// back to trying every format.
+	std::optional<format_hint> hint;
+	// Higher priority files are read first.
+	int priority = priority::normal;
+};
+
+struct read_many_result {
+	// Not set if reading failed or was aborted. If reading failed, error
+	// holds the exception.
+	std::optional<audiorw::item> item;
+	std::exception_ptr error;
+};
+
+struct read_many_options {
+	// If not set, the files are read and decoded one at a time on the
+	// calling thread.
+	std::optional<executor_ref> executor;
+	// Shared by every file in the batch.
+	std::function<bool()> should_abort;
+	// Called from the executor as each file finishes, with the index of
+	// the request. The item can be moved out of the result, otherwise it
+	// is kept for the returned vector.
+	std::function<void(size_t index, read_many_result* result)> on_complete;
+	storage_device device = storage_device::automatic;
+	// Overrides the per-device number of files being read at once.
+	std::optional<size_t> max_io_concurrency;
+	// Limits the total size of files which have been read into memory but
+	// not decoded yet. A file bigger than this is still read, on its own.
+	size_t max_bytes_in_flight = size_t{256} << 20;
+	// If set, file reads go through the throttle as the given class.
+	io_throttle* throttle = nullptr;
+	io_class throttle_class = io_class::background;
+};
+
+// Reads every file over the executor and blocks until they are all
+// done. Each file is read into memory in one go, with the number of
+// files being read at once limited per storage device and the bytes held
+// limited by max_bytes_in_flight, then decoded as a separate task. If
+// on_complete throws, the exception is stored in that file's result.
+// Must not be called from one of the executor's own tasks.
+[[nodiscard]] auto read_many(std::span<const read_many_request> requests, const read_many_options& options = {}) -> std::vector<read_many_result>;
+[[nodiscard]] auto read_many(std::span<const std::filesystem::path> paths, const read_many_options& options = {}) -> std::vector<read_many_result>;
+
+} // audiorw
+
+namespace audiorw::detail {
+
+struct storage_device_info {
+	std::string id;
+	storage_device device = storage_device::ssd;
+};
+
+[[nodiscard]] auto get_storage_device_info(const std::filesystem::path& path) -> storage_device_info;
+
+} // audiorw::detail
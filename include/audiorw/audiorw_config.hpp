@@ -0,0 +1,17 @@
+#pragma once
+
+// Which codecs are compiled in. The AUDIORW_WITH_* CMake options set
+// these, along with the matching MA_NO_* defines for miniaudio. WAV is
+// always available.
+#ifndef AUDIORW_WITH_FLAC
+#define AUDIORW_WITH_FLAC 1
+#endif
+#ifndef AUDIORW_WITH_MP3
+#define AUDIORW_WITH_MP3 1
+#endif
+#ifndef AUDIORW_WITH_VORBIS
+#define AUDIORW_WITH_VORBIS 1
+#endif
+#ifndef AUDIORW_WITH_WAVPACK
+#define AUDIORW_WITH_WAVPACK 1
+#endif
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <concepts>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <thread>
+
+namespace audiorw {
+
+// Tasks must not throw. An executor has nowhere to send the exception, so
+// as with std::thread, one escaping a task run by work_stealing_pool calls
+// std::terminate. The tasks audiorw submits catch their own exceptions and
+// hand them back to the caller.
+using task = std::function<void()>;
+
+// Higher priority tasks are started first. Executors which don't
+// support priorities are free to ignore them.
+namespace priority {
+
+static constexpr auto background = -1;
+static constexpr auto normal     = 0;
+static constexpr auto foreground = 1;
+
+} // priority
+
+} // audiorw
+
+namespace audiorw::concepts {
+
+// Anything which can run tasks. Priority support and reporting the
+// amount of parallelism available are optional.
+template <typename T>
+concept executor =
+requires(T x, audiorw::task fn) {
+	{ x.submit(std::move(fn)) } -> std::same_as<void>;
+};
+
+template <typename T>
+concept prioritized_executor =
+requires(T x, audiorw::task fn, int priority) {
+	{ x.submit(std::move(fn), priority) } -> std::same_as<void>;
+};
+
+template <typename T>
+concept concurrent_executor =
+requires(const T x) {
+	{ x.get_concurrency() } -> std::same_as<size_t>;
+};
+
+} // audiorw::concepts
+
+namespace audiorw {
+
+// Non-owning, type-erased reference to an executor. This is what the
+// parallel APIs in audiorw accept, so they never spawn threads of their own.
+struct executor_ref {
+	template <concepts::executor Executor>
+	executor_ref(Executor* executor)
+		: executor_{executor}
+		, submit_{[](void* executor, task fn, int priority) {
+			auto& x = *static_cast<Executor*>(executor);
+			if constexpr (concepts::prioritized_executor<Executor>) { x.submit(std::move(fn), priority); }
+			else                                                    { x.submit(std::move(fn)); }
+		}}
+		, get_concurrency_{[](const void* executor) -> size_t {
+			const auto& x = *static_cast<const Executor*>(executor);
+			if constexpr (concepts::concurrent_executor<Executor>) { return x.get_concurrency(); }
+			else                                                  { return std::thread::hardware_concurrency(); }
+		}}
+	{
+	}
+	auto submit(task fn, int priority = priority::normal) const -> void { submit_(executor_, std::move(fn), priority); }
+	auto get_concurrency() const -> size_t { return get_concurrency_(executor_); }
+private:
+	void* executor_;
+	void (*submit_)(void* executor, task fn, int priority);
+	size_t (*get_concurrency_)(const void* executor);
+};
+
+// Runs every task immediately on the calling thread. Useful for
+// deterministic single-threaded runs.
+struct inline_executor {
+	auto submit(task fn) -> void { fn(); }
+	auto submit(task fn, int) -> void { fn(); }
+	auto get_concurrency() const -> size_t { return 1; }
+};
+
+// A fixed-size thread pool. Each worker has its own deque of tasks and
+// steals from the others when it runs out. Tasks submitted from outside
+// the pool, or with a non-normal priority, go through a shared priority
+// queue. The destructor runs any remaining tasks before joining.
+struct work_stealing_pool {
+	work_stealing_pool();
+	work_stealing_pool(size_t thread_count);
+	~work_stealing_pool();
+	work_stealing_pool(const work_stealing_pool&) = delete;
+	work_stealing_pool& operator=(const work_stealing_pool&) = delete;
+	auto submit(task fn) -> void;
+	auto submit(task fn, int priority) -> void;
+	auto get_concurrency() const -> size_t;
+private:
+	struct impl;
+	std::unique_ptr<impl> impl_;
+};
+
+// A pool which is created on first use, for callers who want one without
+// managing it themselves. audiorw only runs on it when it's passed in.
+[[nodiscard]] auto get_default_executor() -> executor_ref;
+
+} // audiorw
+
+namespace audiorw::detail {
+
+// The parallel APIs take an optional executor. Without one they run on
+// the calling thread, so that nothing goes to a pool the caller didn't
+// ask for.
+[[nodiscard]] auto executor_or_inline(const std::optional<executor_ref>& executor) -> executor_ref;
+
+// Calls fn(i) for every i in [0, count) using the executor, and waits for
+// all of them to finish. The calling thread works through the indices
+// too, so this can't deadlock if it's called from one of the executor's
+// own tasks. The first exception thrown by fn is rethrown.
+auto parallel_for(executor_ref executor, size_t count, std::function<void(size_t)> fn, int priority = priority::normal) -> void;
+
+} // audiorw::detail
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <span>
+
+namespace audiorw::detail {
+
+static constexpr auto DIRECT_IO_ALIGNMENT = size_t{4096};
+
+// A file opened with the platform API, for positional reads and writes
+// which don't disturb any other user of the file.
+struct native_file {
+	enum class mode {
+		read,
+		// Reads bypass the OS cache. Offsets, sizes and buffer addresses
+		// must be multiples of DIRECT_IO_ALIGNMENT. Throws if the platform
+		// or file system doesn't support it.
+		read_direct,
+		// Creates the file, or truncates it if it already exists.
+		write,
+	};
+	native_file() = default;
+	native_file(const std::filesystem::path& path, mode m);
+	native_file(native_file&& rhs) noexcept;
+	native_file& operator=(native_file&& rhs) noexcept;
+	~native_file();
+	[[nodiscard]] auto is_open() const -> bool;
+	[[nodiscard]] auto get_size() const -> uint64_t;
+	// Returns fewer bytes than requested only at the end of the file.
+	[[nodiscard]] auto read_at(uint64_t offset, std::span<std::byte> buffer) const -> size_t;
+	// A single read, which may return fewer bytes than requested.
+	[[nodiscard]] auto read_some_at(uint64_t offset, std::span<std::byte> buffer) const -> size_t;
+	auto write_at(uint64_t offset, std::span<const std::byte> buffer) -> void;
+	auto set_size(uint64_t size) -> void;
+	// Starts reading the range into the OS cache. Where there's no way to
+	// ask for that, the range is read and discarded, so this may block.
+	auto will_need(uint64_t offset, uint64_t length) const -> void;
+	// Asks the OS to drop the range from its cache. Dirty pages are
+	// written back first if write_back is set, otherwise only clean pages
+	// are dropped. A length of 0 means to the end of the file.
+	auto dont_need(uint64_t offset, uint64_t length, bool write_back) const -> void;
+	auto close() -> void;
+#if defined(_WIN32)
+	[[nodiscard]] auto get_native_handle() const -> void* { return handle_; }
+private:
+	void* handle_ = nullptr;
+#else
+	[[nodiscard]] auto get_native_handle() const -> int { return fd_; }
+private:
+	int fd_ = -1;
+#endif
+};
+
+// Sequential reads through an aligned buffer from a file opened with
+// mode::read_direct, for callers that want ordinary unaligned reads.
+struct direct_file_reader {
+	static constexpr auto BUFFER_SIZE = size_t{1 << 20};
+	direct_file_reader(const std::filesystem::path& path);
+	[[nodiscard]] auto get_length() const -> uint64_t { return size_; }
+	[[nodiscard]] auto get_pos() const -> uint64_t { return pos_; }
+	auto close() -> void { file_.close(); }
+	auto read_bytes(std::span<std::byte> buffer) -> size_t;
+	auto seek(uint64_t pos) -> void { pos_ = pos; }
+private:
+	struct aligned_delete { auto operator()(std::byte* p) const -> void; };
+	native_file file_;
+	std::unique_ptr<std::byte[], aligned_delete> buffer_;
+	uint64_t size_          = 0;
+	uint64_t pos_           = 0;
+	uint64_t buffer_offset_ = 0;
+	size_t buffer_size_     = 0;
+};
+
+// Drops a file's pages from the OS cache a little way behind a stream's
+// position as it moves through the file, and the rest at the end. Uses a
+// separate handle so it works alongside std::fstream. Does nothing on
+// Windows, which has no equivalent.
+struct cache_dropper {
+	// Dropping is done in steps of this many bytes.
+	static constexpr auto INTERVAL = uint64_t{1 << 23};
+	// Pages this close behind the position are kept for decoders that seek
+	// back a little.
+	static constexpr auto LAG      = uint64_t{1 << 20};
+	cache_dropper(const std::filesystem::path& path, bool write_back);
+	cache_dropper(cache_dropper&&) noexcept = default;
+	cache_dropper& operator=(cache_dropper&&) noexcept = default;
+	~cache_dropper();
+	// Call with the number of bytes just read or written. Returns true
+	// when it is time to call drop_behind().
+	[[nodiscard]] auto count(uint64_t bytes) -> bool;
+	auto drop_behind(uint64_t pos) -> void;
+	auto drop_all() -> void;
+private:
+	native_file file_;
+	bool write_back_;
+	uint64_t counted_ = 0;
+	uint64_t dropped_ = 0;
+};
+
+// Lets a reader sleep until a file it is following changes. Uses inotify
+// on Linux. Elsewhere it just sleeps for the timeout, i.e. polling.
+struct file_watch {
+	file_watch() = default;
+	file_watch(const std::filesystem::path& path);
+	file_watch(file_watch&& rhs) noexcept;
+	file_watch& operator=(file_watch&& rhs) noexcept;
+	~file_watch();
+	// Returns when the file has been written to or the timeout expires,
+	// whichever happens first.
+	auto wait(std::chrono::milliseconds timeout) -> void;
+private:
+	int fd_ = -1;
+};
+
+} // audiorw::detail
+
+namespace audiorw {
+
+// A read-only memory mapping of a whole file. Pass get_bytes() to
+// stream::bytes::window() or stream::item::from() to decode straight out
+// of the mapping. The mapping stays valid after the file is modified or
+// deleted but what it then contains is up to the platform, so it should
+// only be used for files that aren't being written to.
+struct mapped_file {
+	mapped_file() = default;
+	mapped_file(const std::filesystem::path& path);
+	mapped_file(mapped_file&& rhs) noexcept;
+	mapped_file& operator=(mapped_file&& rhs) noexcept;
+	~mapped_file();
+	[[nodiscard]] auto get_bytes() const -> std::span<const std::byte> { return {data_, size_}; }
+	[[nodiscard]] auto is_open() const -> bool { return data_ != nullptr; }
+private:
+	auto unmap() -> void;
+	const std::byte* data_ = nullptr;
+	size_t size_           = 0;
+};
+
+} // audiorw
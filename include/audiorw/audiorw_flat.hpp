@@ -0,0 +1,128 @@
+#pragma once
+
+#include <memory_resource>
+#include "audiorw.hpp"
+
+namespace audiorw {
+
+// Float samples in storage that audiorw owns, allocated from a memory
+// resource. The contents are left uninitialized when it is resized.
+struct sample_buffer {
+	sample_buffer(std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+	sample_buffer(sample_buffer&& rhs) noexcept;
+	sample_buffer& operator=(sample_buffer&& rhs) noexcept;
+	~sample_buffer();
+	[[nodiscard]] auto begin() const -> float* { return data_; }
+	[[nodiscard]] auto end() const -> float*   { return data_ + size_; }
+	[[nodiscard]] auto data() const -> float*  { return data_; }
+	[[nodiscard]] auto size() const -> size_t  { return size_; }
+	[[nodiscard]] auto get_resource() const -> std::pmr::memory_resource* { return resource_; }
+	auto operator[](size_t index) const -> float& { return data_[index]; }
+	// The existing storage is kept if it is already the right size.
+	auto reset(size_t size) -> void;
+private:
+	static constexpr auto ALIGNMENT = size_t{64};
+	auto release() -> void;
+	std::pmr::memory_resource* resource_;
+	float* data_ = nullptr;
+	size_t size_ = 0;
+};
+
+enum class frame_layout {
+	// Channel c's frames are at [c * frame_count, (c + 1) * frame_count).
+	planar,
+	// Frame f's samples are at [f * channel_count, (f + 1) * channel_count).
+	// This is what the decoders produce and the encoders consume, so
+	// reading into or writing from it copies straight through.
+	interleaved,
+};
+
+// Like audiorw::item, but the frames are a single block of memory which
+// can come from any memory resource, e.g. huge_page_memory_resource, and
+// can be laid out either way.
+struct flat_item {
+	audiorw::header header;
+	frame_layout layout = frame_layout::planar;
+	sample_buffer samples;
+	// Only for planar items.
+	[[nodiscard]] auto get_channel(size_t channel) const -> std::span<float>;
+};
+
+struct stream_frames_from_flat_item {
+	stream_frames_from_flat_item(const flat_item& item);
+	auto read_frames(std::span<float> buffer) -> ads::frame_count;
+private:
+	const flat_item& item_;
+	size_t pos_ = 0;
+};
+
+struct stream_item_to_flat_item {
+	stream_item_to_flat_item(flat_item* item);
+	auto commit() -> void {}
+	auto seek(ads::frame_idx pos) -> bool;
+	// Storage comes from the resource the item's sample buffer was made
+	// with, laid out as item->layout says.
+	auto write_header(audiorw::header header) -> void;
+	auto write_frames(std::span<const float> buffer) -> ads::frame_count;
+private:
+	flat_item* item_;
+	size_t pos_ = 0;
+	size_t storage_bytes_ = 0;
+};
+
+} // audiorw
+
+namespace audiorw::stream::frames {
+
+[[nodiscard]] inline auto from(const flat_item& item) { return stream_frames_from_flat_item{item}; }
+
+} // audiorw::stream::frames
+
+namespace audiorw::stream::item {
+
+[[nodiscard]] inline auto to(flat_item* item) { return stream_item_to_flat_item{item}; }
+
+} // audiorw::stream::item
+
+namespace audiorw {
+
+// With a sample_buffer_pool as the resource, the storage of items that
+// have been destroyed is reused, so reading many files one after the other
+// doesn't keep allocating.
+[[nodiscard]]
+auto read(concepts::byte_input_stream auto* in, audiorw::format_hint hint, frame_layout layout, std::pmr::memory_resource* resource, concepts::should_abort_fn auto should_abort) -> std::optional<flat_item> {
+	auto item   = flat_item{.header = {}, .layout = layout, .samples = sample_buffer{resource}};
+	auto out    = audiorw::stream::item::to(&item);
+	auto result = audiorw::read(in, &out, hint, should_abort);
+	if (result == audiorw::operation_result::success) { return item; }
+	else                                              { return std::nullopt; }
+}
+
+[[nodiscard]]
+auto read(concepts::byte_input_stream auto* in, audiorw::format_hint hint, frame_layout layout, std::pmr::memory_resource* resource) -> std::optional<flat_item> {
+	return audiorw::read(in, hint, layout, resource, detail::fn_always(false));
+}
+
+[[nodiscard]]
+auto read(const std::filesystem::path& path, audiorw::format_hint hint, frame_layout layout, std::pmr::memory_resource* resource, concepts::should_abort_fn auto should_abort) -> std::optional<flat_item> {
+	auto in = audiorw::stream::bytes::from(path);
+	return audiorw::read(&in, hint, layout, resource, std::move(should_abort));
+}
+
+[[nodiscard]]
+auto read(const std::filesystem::path& path, audiorw::format_hint hint, std::pmr::memory_resource* resource, concepts::should_abort_fn auto should_abort) -> std::optional<flat_item> {
+	return audiorw::read(path, hint, frame_layout::planar, resource, std::move(should_abort));
+}
+
+[[nodiscard]] auto read(const std::filesystem::path& path, audiorw::format_hint hint, frame_layout layout, std::pmr::memory_resource* resource = std::pmr::get_default_resource()) -> std::optional<flat_item>;
+[[nodiscard]] auto read(const std::filesystem::path& path, audiorw::format_hint hint, std::pmr::memory_resource* resource) -> std::optional<flat_item>;
+
+auto write(const flat_item& item, const std::filesystem::path& path, storage_type type, concepts::should_abort_fn auto should_abort) -> operation_result {
+	auto in  = audiorw::stream::frames::from(item);
+	auto out = audiorw::stream::bytes::to(path);
+	return audiorw::write(item.header, &in, &out, type, should_abort);
+}
+
+auto write(const flat_item& item, const std::filesystem::path& path, storage_type type) -> operation_result;
+
+} // audiorw
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <functional>
+#include "audiorw.hpp"
+#include "audiorw_file.hpp"
+#include "audiorw_wav.hpp"
+
+namespace audiorw {
+
+struct follow_options {
+	// How often the file size is checked while waiting, if change
+	// notifications aren't available or are missed.
+	std::chrono::milliseconds poll_interval = std::chrono::milliseconds{10};
+	// If the file doesn't grow for this long it is assumed to be
+	// finished. If not set, waits until should_stop returns true.
+	std::optional<std::chrono::milliseconds> idle_timeout;
+	std::function<bool()> should_stop;
+};
+
+// Byte stream over a file that is still being written. Reads which reach
+// the current end of the file wait for more data to arrive. The length is
+// unknown and can_seek() is false.
+struct stream_bytes_following_fs_path {
+	stream_bytes_following_fs_path(const std::filesystem::path& path, follow_options options = {});
+	auto can_seek() const -> bool { return false; }
+	auto close() -> bool;
+	auto get_length() -> std::optional<size_t> { return std::nullopt; }
+	auto get_pos() -> size_t { return pos_; }
+	auto push_back_byte(std::byte v) -> bool;
+	auto read_bytes(std::span<std::byte> buffer) -> size_t;
+	auto seek(int64_t offset, std::ios::seekdir mode) -> bool;
+	auto set_counter_format(audiorw::format format) -> void { counters_.set_format(format); }
+	// Reads whatever is there right now, without waiting or moving the read position.
+	[[nodiscard]] auto read_at(uint64_t offset, std::span<std::byte> buffer) const -> size_t;
+	[[nodiscard]] auto get_file_size() const -> uint64_t;
+	// Waits until the file is at least size bytes long. Returns false if it
+	// stopped growing (see follow_options::idle_timeout) or should_stop
+	// returned true first.
+	[[nodiscard]] auto wait_for_size(uint64_t size) -> bool;
+private:
+	detail::native_file file_;
+	detail::file_watch watch_;
+	follow_options options_;
+	detail::stream_counters counters_;
+	uint64_t pos_       = 0;
+	uint64_t last_size_ = 0;
+	std::chrono::steady_clock::time_point last_growth_;
+};
+
+} // audiorw
+
+namespace audiorw::detail {
+
+// Follows a growing WAV file by re-reading its sizes rather than trusting
+// the header it had when it was opened.
+struct wav_follower {
+	wav_follower(stream_bytes_following_fs_path in, const wav::layout& layout);
+	auto get_header() const -> header;
+	auto refresh() -> ads::frame_count;
+	auto read_frames(std::span<float> buffer) -> ads::frame_count;
+	auto seek(ads::frame_idx pos) -> bool;
+private:
+	auto read_size_field(uint64_t offset) -> std::optional<uint64_t>;
+	stream_bytes_following_fs_path in_;
+	wav::layout layout_;
+	tracked_buffer<std::byte> bytes_;
+	uint64_t frames_available_ = 0;
+	uint64_t last_file_size_   = 0;
+	uint64_t pos_              = 0;
+	// Set once the RIFF and data sizes agree with the file size, meaning
+	// the writer has finalized the file.
+	bool finished_             = false;
+};
+
+[[nodiscard]] auto try_make_wav_follower(const std::filesystem::path& path, const follow_options& options) -> std::optional<wav_follower>;
+
+} // audiorw::detail
+
+namespace audiorw {
+
+// Streams frames from a WAV or WavPack file while it is still being
+// recorded, without reopening or re-probing it.
+struct stream_item_following_fs_path {
+	stream_item_following_fs_path(const std::filesystem::path& path, format_hint hint, follow_options options = {});
+	// For WAV files frame_count is the number of frames available as of the
+	// last refresh. For WavPack files it is whatever the file header says,
+	// which may be unknown while recording.
+	auto get_header() const -> header;
+	// Re-reads the sizes from the file and returns the number of frames available.
+	auto refresh() -> ads::frame_count;
+	// Waits until at least one frame can be read, then reads as many as are
+	// available, up to the size of the buffer. Returns zero once the file
+	// has been finalized or has stopped growing, or should_stop returns true.
+	auto read_frames(std::span<float> buffer) -> ads::frame_count;
+	auto seek(ads::frame_idx pos) -> bool;
+private:
+	using wavpack_follower = stream_item_from_byte_stream<stream_bytes_following_fs_path>;
+	std::variant<detail::wav_follower, wavpack_follower> impl_;
+};
+
+} // audiorw
+
+namespace audiorw::stream::item {
+
+[[nodiscard]] inline auto follow(const std::filesystem::path& path, format_hint hint, follow_options options = {}) { return stream_item_following_fs_path{path, hint, std::move(options)}; }
+
+} // audiorw::stream::item
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+namespace audiorw {
+
+using md5_digest = std::array<uint8_t, 16>;
+
+} // audiorw
+
+namespace audiorw::detail {
+
+// RFC 1321. For the checksums of the audio data that FLAC and WavPack
+// files carry, not for anything security related.
+struct md5 {
+	auto update(std::span<const std::byte> bytes) -> void;
+	// Resets the state, ready for the next message.
+	[[nodiscard]] auto finish() -> md5_digest;
+private:
+	auto process(const std::byte* block) -> void;
+	std::array<uint32_t, 4> state_ = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476};
+	std::array<std::byte, 64> buffer_ = {};
+	uint64_t length_ = 0;
+};
+
+} // audiorw::detail
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <span>
+#include "audiorw_executor.hpp"
+
+namespace audiorw {
+
+enum class huge_pages {
+	// Transparent huge pages, requested with madvise(MADV_HUGEPAGE). Only
+	// has an effect if the kernel has them enabled in "madvise" or
+	// "always" mode.
+	transparent,
+	// Pages from the reserved hugetlb pool (MAP_HUGETLB on Linux, large
+	// pages on Windows). Falls back to transparent if none are available.
+	explicit_,
+};
+
+struct huge_page_options {
+	huge_pages mode = huge_pages::transparent;
+	// Smaller allocations come from the upstream resource.
+	size_t threshold = size_t{1} << 21;
+	// Touch every page of each new allocation up front, spread over the
+	// executor, so that the faults aren't taken one at a time by whoever
+	// writes to it first.
+	bool prefault = false;
+	// If not set, the pages are touched on the calling thread.
+	std::optional<executor_ref> executor;
+};
+
+// A memory resource for large sample buffers. Allocations of at least
+// options.threshold bytes are mapped directly from the OS, aligned to and
+// rounded up to the huge page size. Everything else is passed upstream.
+// Thread safe if the upstream resource is.
+struct huge_page_memory_resource : std::pmr::memory_resource {
+	huge_page_memory_resource(huge_page_options options = {}, std::pmr::memory_resource* upstream = std::pmr::get_default_resource());
+private:
+	auto do_allocate(size_t bytes, size_t alignment) -> void* override;
+	auto do_deallocate(void* p, size_t bytes, size_t alignment) -> void override;
+	auto do_is_equal(const std::pmr::memory_resource& other) const noexcept -> bool override;
+	huge_page_options options_;
+	std::pmr::memory_resource* upstream_;
+};
+
+struct sample_buffer_pool_options {
+	// Freed blocks are kept for reuse until they add up to this many
+	// bytes. Beyond that they go back upstream.
+	size_t max_cached_bytes = size_t{1} << 30;
+};
+
+// A memory resource which keeps freed blocks and hands them out again for
+// allocations of a similar size, so that reading many files one after the
+// other reaches a steady state where nothing is allocated upstream. Sizes
+// are rounded up to classes no more than 1/8 apart. Unlike
+// std::pmr::synchronized_pool_resource it pools blocks of any size, which
+// matters because sample buffers are usually megabytes. Thread safe.
+struct sample_buffer_pool : std::pmr::memory_resource {
+	sample_buffer_pool(sample_buffer_pool_options options = {}, std::pmr::memory_resource* upstream = std::pmr::get_default_resource());
+	sample_buffer_pool(const sample_buffer_pool&) = delete;
+	sample_buffer_pool& operator=(const sample_buffer_pool&) = delete;
+	~sample_buffer_pool();
+	[[nodiscard]] auto get_cached_bytes() const -> size_t;
+	// Returns all the cached blocks upstream.
+	auto release() -> void;
+private:
+	auto do_allocate(size_t bytes, size_t alignment) -> void* override;
+	auto do_deallocate(void* p, size_t bytes, size_t alignment) -> void override;
+	auto do_is_equal(const std::pmr::memory_resource& other) const noexcept -> bool override;
+	struct impl;
+	std::unique_ptr<impl> impl_;
+};
+
+} // audiorw
+
+namespace audiorw::detail {
+
+static constexpr auto HUGE_PAGE_SIZE = size_t{1} << 21;
+
+// Writes to one byte in every page, in parallel. Only for memory whose
+// contents don't matter yet.
+auto prefault(std::span<std::byte> bytes, executor_ref executor) -> void;
+
+} // audiorw::detail
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "audiorw.hpp"
+#include "audiorw_executor.hpp"
+
+namespace audiorw {
+
+struct prefetch_byte_range {
+	std::filesystem::path path;
+	uint64_t offset = 0;
+	// To the end of the file if not set.
+	std::optional<uint64_t> length;
+};
+
+// The frames of an audio file which are about to be read. The header is
+// always prefetched too.
+struct prefetch_frame_range {
+	std::filesystem::path path;
+	format_hint hint     = format_hint::try_wav_first;
+	ads::frame_idx start = {0};
+	// To the end of the file if not set.
+	std::optional<ads::frame_count> count;
+};
+
+struct prefetch_options {
+	// If not set, the files are opened and the OS is asked to read them on
+	// the calling thread. The reading itself still happens in the
+	// background.
+	std::optional<executor_ref> executor;
+	int priority = priority::background;
+};
+
+// With an executor these return at once. The files are opened and the OS
+// is asked to start reading them into its cache from tasks on it, so a
+// load that follows shortly after finds the data already there.
+// Prefetching is only a hint, so files which can't be opened are skipped
+// silently.
+auto prefetch(std::span<const std::filesystem::path> paths, const prefetch_options& options = {}) -> void;
+auto prefetch(std::span<const prefetch_byte_range> ranges, const prefetch_options& options = {}) -> void;
+// Only the bytes which decoding the frames will touch are prefetched. For
+// WAV files they are computed exactly. For FLAC files the seek table is
+// used if there is one. Otherwise the range is estimated from the total
+// frame count, with a margin. MP3 files are prefetched in full.
+auto prefetch(std::span<const prefetch_frame_range> ranges, const prefetch_options& options = {}) -> void;
+
+} // audiorw
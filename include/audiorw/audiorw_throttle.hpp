@@ -0,0 +1,129 @@
+#pragma once
+
+#include <mutex>
+#include "audiorw.hpp"
+
+namespace audiorw {
+
+enum class io_class {
+	// Never waits for the shared budget, only for its own class limits.
+	foreground,
+	// Waits for both its own class limits and the shared budget.
+	background,
+};
+
+static constexpr auto IO_CLASS_COUNT = size_t(io_class::background) + 1;
+
+struct io_limits {
+	// Zero means unlimited.
+	double bytes_per_second = 0;
+	double ops_per_second   = 0;
+};
+
+} // audiorw
+
+namespace audiorw::detail {
+
+// A token bucket which is allowed to go into debt, so that a request
+// larger than the bucket still goes through, and the time it would take
+// to pay the debt off is returned instead.
+struct token_bucket {
+	auto set_rate(double tokens_per_second) -> void;
+	[[nodiscard]] auto reserve(double tokens, std::chrono::steady_clock::time_point now) -> std::chrono::steady_clock::time_point;
+	auto refund(double tokens) -> void;
+private:
+	double rate_   = 0;
+	double tokens_ = 0;
+	std::chrono::steady_clock::time_point last_refill_ = {};
+};
+
+} // audiorw::detail
+
+namespace audiorw {
+
+// Limits bytes/s and IOPS per io_class. Background jobs additionally
+// share one budget between them. Leaving the shared budget below what
+// the disk can do keeps guaranteed headroom for foreground streaming.
+// One throttle is meant to be shared by every job that touches the
+// same disk.
+struct io_throttle {
+	io_throttle(io_limits shared_budget = {});
+	auto set_limits(io_class c, io_limits limits) -> void;
+	auto set_shared_budget(io_limits limits) -> void;
+	// Blocks until one operation of the given size is allowed.
+	auto acquire(io_class c, size_t bytes) -> void;
+	// Gives back bytes which were acquired but not transferred, e.g. by a
+	// short read at the end of a file or from a pipe.
+	auto refund(io_class c, size_t bytes) -> void;
+private:
+	struct buckets {
+		detail::token_bucket bytes;
+		detail::token_bucket ops;
+	};
+	std::mutex mutex_;
+	std::array<buckets, IO_CLASS_COUNT> classes_;
+	buckets shared_;
+};
+
+template <concepts::byte_input_stream Stream>
+struct throttled_byte_input_stream {
+	throttled_byte_input_stream(Stream* stream, io_throttle* throttle, io_class c)
+		: stream_{stream}
+		, throttle_{throttle}
+		, class_{c}
+	{
+	}
+	auto can_seek() const -> bool                           { return detail::can_seek(stream_); }
+	auto close() -> bool                                    { return stream_->close(); }
+	auto get_length() -> std::optional<size_t>              { return stream_->get_length(); }
+	auto get_pos() -> size_t                                { return stream_->get_pos(); }
+	auto push_back_byte(std::byte v) -> bool                { return stream_->push_back_byte(v); }
+	auto seek(int64_t offset, std::ios::seekdir mode) -> bool { return stream_->seek(offset, mode); }
+	auto set_counter_format(audiorw::format format) -> void {
+		if constexpr (requires { stream_->set_counter_format(format); }) { stream_->set_counter_format(format); }
+	}
+	auto read_bytes(std::span<std::byte> buffer) -> size_t {
+		throttle_->acquire(class_, buffer.size());
+		const auto bytes_read = stream_->read_bytes(buffer);
+		throttle_->refund(class_, buffer.size() - bytes_read);
+		return bytes_read;
+	}
+private:
+	Stream* stream_;
+	io_throttle* throttle_;
+	io_class class_;
+};
+
+template <concepts::byte_output_stream Stream>
+struct throttled_byte_output_stream {
+	throttled_byte_output_stream(Stream* stream, io_throttle* throttle, io_class c)
+		: stream_{stream}
+		, throttle_{throttle}
+		, class_{c}
+	{
+	}
+	auto commit() -> void                                     { stream_->commit(); }
+	auto seek(int64_t offset, std::ios::seekdir mode) -> bool { return stream_->seek(offset, mode); }
+	auto write_bytes(std::span<const std::byte> buffer) -> size_t {
+		throttle_->acquire(class_, buffer.size());
+		const auto bytes_written = stream_->write_bytes(buffer);
+		throttle_->refund(class_, buffer.size() - bytes_written);
+		return bytes_written;
+	}
+private:
+	Stream* stream_;
+	io_throttle* throttle_;
+	io_class class_;
+};
+
+} // audiorw
+
+namespace audiorw::stream::bytes {
+
+template <concepts::byte_input_stream Stream> [[nodiscard]]
+auto throttle(Stream* stream, io_throttle* throttle, io_class c) { return throttled_byte_input_stream<Stream>{stream, throttle, c}; }
+
+template <concepts::byte_output_stream Stream> [[nodiscard]]
+auto throttle(Stream* stream, io_throttle* throttle, io_class c) { return throttled_byte_output_stream<Stream>{stream, throttle, c}; }
+
+} // audiorw::stream::bytes
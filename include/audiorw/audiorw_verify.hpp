@@ -0,0 +1,67 @@
+#pragma once
+
+#include "audiorw.hpp"
+#include "audiorw_executor.hpp"
+
+namespace audiorw {
+
+enum class verify_status {
+	ok,
+	// The audio doesn't match a checksum stored in the file.
+	corrupt,
+	// The file's structure is broken, e.g. it is shorter than its header
+	// says or a writer never finished it.
+	malformed,
+	// The file couldn't be opened, or isn't in a format that can be read.
+	unreadable,
+	aborted,
+};
+
+struct verify_result {
+	verify_status status = verify_status::ok;
+	// Not set if the format couldn't be identified.
+	std::optional<audiorw::format> format;
+	// What was wrong, for logging. Empty if the file is ok.
+	std::string message;
+	uint64_t frames_decoded = 0;
+	// FLAC frames or WavPack blocks which failed their CRC.
+	uint64_t crc_errors = 0;
+	// Whether the file stores an MD5 of its audio and it was compared.
+	bool md5_checked = false;
+};
+
+struct verify_options {
+	// If not set, the files are verified one at a time on the calling
+	// thread.
+	std::optional<executor_ref> executor;
+	// Shared by every file.
+	std::function<bool()> should_abort;
+	// Called from the executor as each file finishes, with its index.
+	std::function<void(size_t index, const verify_result& result)> on_complete;
+	// Verifying an archive reads every byte of it once, which would
+	// otherwise push everything else out of the page cache.
+	cache_policy cache = cache_policy::drop_behind;
+};
+
+// Decodes every file to check its integrity, without keeping any of the
+// audio. Samples are decoded as integers into a small scratch buffer and
+// thrown away, so the cost is the reading, not allocation or conversion.
+// - FLAC: every frame's header CRC-8 and CRC-16, and the STREAMINFO MD5.
+// - WavPack: every block's CRC, and the MD5 if one was stored.
+// - WAV: the chunk sizes against the file's length, and that all of the
+//   sample data can be read.
+// Anything else is decoded with the normal reader to check that it can
+// be. Files are verified in parallel over the executor, and this blocks
+// until they are all done.
+[[nodiscard]] auto verify(std::span<const std::filesystem::path> paths, const verify_options& options = {}) -> std::vector<verify_result>;
+[[nodiscard]] auto verify(const std::filesystem::path& path, const verify_options& options = {}) -> verify_result;
+
+} // audiorw
+
+namespace audiorw::detail::flac {
+
+// Reads a FLAC stream from its fLaC marker, which has to be at the
+// stream's current position, start.
+[[nodiscard]] auto verify(byte_stream_reader stream, void* user_data, uint64_t start, const std::function<bool()>& should_abort) -> verify_result;
+
+} // audiorw::detail::flac
@@ -0,0 +1,264 @@
+#pragma once
+
+#include <cstring>
+#include "audiorw.hpp"
+#include "audiorw_executor.hpp"
+#include "audiorw_flat.hpp"
+
+namespace audiorw::concepts {
+
+template <typename Fn> concept read_at_fn        = requires(Fn fn, uint64_t offset, std::span<std::byte> buffer) { { fn(offset, buffer) } -> std::same_as<size_t>; };
+template <typename Fn> concept read_frames_at_fn = requires(Fn fn, ads::frame_idx pos, std::span<float> buffer) { { fn(pos, buffer) } -> std::same_as<void>; };
+
+} // audiorw::concepts
+
+// Just enough knowledge of the RIFF/WAVE container for the features which
+// need to work with WAV files directly rather than through miniaudio.
+namespace audiorw::detail::wav {
+
+enum class sample_format { u8, s16, s24, s32, f32, f64 };
+
+struct layout {
+	sample_format format;
+	uint16_t channel_count   = 0;
+	uint32_t SR              = 0;
+	uint16_t bits_per_sample = 0;
+	uint16_t block_align     = 0;
+	// Offset of the first byte of sample data.
+	uint64_t data_offset     = 0;
+	// As written in the file. Writers which haven't finished yet often
+	// leave this as 0 or 0xFFFFFFFF.
+	uint64_t data_size       = 0;
+	// Offsets of the RIFF and data chunk size fields, so that they can be
+	// re-read while the file is growing. For RF64 and BW64 files they point
+	// into the ds64 chunk, where the fields are 64 bits.
+	uint64_t riff_size_field_offset = 4;
+	uint64_t data_size_field_offset = 0;
+	size_t size_field_bytes         = 4;
+};
+
+static constexpr auto WAVE_FORMAT_PCM        = uint16_t{0x0001};
+static constexpr auto WAVE_FORMAT_IEEE_FLOAT = uint16_t{0x0003};
+static constexpr auto WAVE_FORMAT_EXTENSIBLE = uint16_t{0xFFFE};
+static constexpr auto UNKNOWN_DATA_SIZE_32   = uint32_t{0xFFFFFFFF};
+
+template <typename T> [[nodiscard]]
+auto load_le(const std::byte* bytes) -> T {
+	auto value = T{0};
+	for (size_t i = 0; i < sizeof(T); i++) {
+		value |= T(std::to_integer<uint8_t>(bytes[i])) << (i * 8);
+	}
+	return value;
+}
+
+template <typename T>
+auto store_le(std::byte* bytes, T value) -> void {
+	for (size_t i = 0; i < sizeof(T); i++) {
+		bytes[i] = std::byte(uint8_t(value >> (i * 8)));
+	}
+}
+
+[[nodiscard]] inline
+auto is_id(const std::byte* bytes, const char (&id)[5]) -> bool {
+	return std::memcmp(bytes, id, 4) == 0;
+}
+
+// RF64 (EBU Tech 3306) and BW64 (ITU-R BS.2088) are the same as RIFF
+// except that the sizes which don't fit in 32 bits are in a ds64 chunk.
+[[nodiscard]] inline
+auto is_riff_id(const std::byte* bytes) -> bool {
+	return is_id(bytes, "RIFF") || is_id(bytes, "RF64") || is_id(bytes, "BW64");
+}
+
+static constexpr auto PCM_HEADER_SIZE = size_t{44};
+// ds64 holds the RIFF size, data size, and frame count, then an empty table.
+static constexpr auto DS64_SIZE        = size_t{28};
+static constexpr auto RF64_HEADER_SIZE = PCM_HEADER_SIZE + 8 + DS64_SIZE;
+
+[[nodiscard]] auto get_bytes_per_sample(sample_format format) -> size_t;
+[[nodiscard]] auto get_format_tag(sample_format format) -> uint16_t;
+[[nodiscard]] auto get_sample_format(uint16_t format_tag, uint16_t bits_per_sample) -> std::optional<sample_format>;
+// The same mapping as the miniaudio encoder uses.
+[[nodiscard]] auto get_sample_format(int bit_depth, storage_type type) -> sample_format;
+// The layout of a file written with make_pcm_header().
+[[nodiscard]] auto make_layout(const audiorw::header& header, storage_type type) -> layout;
+// Whether a file with a header of header_size bytes and this much data
+// can have its sizes written in 32 bits.
+[[nodiscard]] auto fits_in_riff(size_t header_size, uint64_t data_size) -> bool;
+// A canonical 44 byte header. The sizes must fit in 32 bits.
+[[nodiscard]] auto make_pcm_header(const layout& layout) -> std::array<std::byte, PCM_HEADER_SIZE>;
+// A header with room for a ds64 chunk. If the sizes fit in 32 bits it is
+// plain RIFF with a JUNK chunk in that space, otherwise it is RF64. Either
+// can be written over the other once the final size is known.
+[[nodiscard]] auto make_rf64_header(const layout& layout, uint64_t frame_count) -> std::array<std::byte, RF64_HEADER_SIZE>;
+[[nodiscard]] auto to_header(const layout& layout, uint64_t frame_count) -> audiorw::header;
+// Converts interleaved samples to interleaved floats. dst.size() samples are converted.
+auto convert_to_float(sample_format format, const std::byte* src, std::span<float> dst) -> void;
+// Converts interleaved samples to one buffer per channel in a single pass.
+// If there are fewer buffers than channels the rest are skipped.
+auto convert_to_float(sample_format format, const std::byte* src, size_t frame_count, size_t channel_count, std::span<float* const> dst) -> void;
+// Converts interleaved floats to interleaved samples. src.size() samples
+// are converted. Integer formats are clipped to [-1, 1].
+auto convert_from_float(sample_format format, std::span<const float> src, std::byte* dst) -> void;
+
+// Walks the chunks up to the data chunk. Returns nullopt if this isn't a
+// WAV file, or it uses a sample format that isn't handled here.
+[[nodiscard]]
+auto parse_layout(concepts::read_at_fn auto read_at) -> std::optional<layout> {
+	std::byte riff[12];
+	if (read_at(0, riff) != sizeof(riff)) {
+		return std::nullopt;
+	}
+	if (!is_riff_id(riff) || !is_id(riff + 8, "WAVE")) {
+		return std::nullopt;
+	}
+	auto out       = layout{};
+	auto have_fmt  = false;
+	auto ds64_data = std::optional<uint64_t>{};
+	auto pos       = uint64_t{sizeof(riff)};
+	for (;;) {
+		std::byte chunk[8];
+		if (read_at(pos, chunk) != sizeof(chunk)) {
+			return std::nullopt;
+		}
+		const auto size = uint64_t{load_le<uint32_t>(chunk + 4)};
+		if (is_id(chunk, "ds64") && !is_id(riff, "RIFF")) {
+			std::byte ds64[16];
+			if (size < sizeof(ds64) || read_at(pos + 8, ds64) != sizeof(ds64)) {
+				return std::nullopt;
+			}
+			ds64_data                  = load_le<uint64_t>(ds64 + 8);
+			out.riff_size_field_offset = pos + 8;
+			out.data_size_field_offset = pos + 16;
+			out.size_field_bytes       = 8;
+		}
+		else if (is_id(chunk, "fmt ")) {
+			std::byte fmt[40] = {};
+			const auto fmt_size = std::min(size, uint64_t{sizeof(fmt)});
+			if (fmt_size < 16 || read_at(pos + 8, {fmt, size_t(fmt_size)}) != fmt_size) {
+				return std::nullopt;
+			}
+			auto format_tag     = load_le<uint16_t>(fmt);
+			out.channel_count   = load_le<uint16_t>(fmt + 2);
+			out.SR              = load_le<uint32_t>(fmt + 4);
+			out.block_align     = load_le<uint16_t>(fmt + 12);
+			out.bits_per_sample = load_le<uint16_t>(fmt + 14);
+			if (format_tag == WAVE_FORMAT_EXTENSIBLE && fmt_size >= 26) {
+				// The first two bytes of the sub-format GUID are the actual format tag.
+				format_tag = load_le<uint16_t>(fmt + 24);
+			}
+			const auto format = get_sample_format(format_tag, out.bits_per_sample);
+			if (!format || out.channel_count == 0 || out.block_align != out.channel_count * get_bytes_per_sample(*format)) {
+				return std::nullopt;
+			}
+			out.format = *format;
+			have_fmt   = true;
+		}
+		else if (is_id(chunk, "data")) {
+			if (!have_fmt) {
+				return std::nullopt;
+			}
+			out.data_offset = pos + 8;
+			if (ds64_data && size == UNKNOWN_DATA_SIZE_32) {
+				out.data_size = *ds64_data;
+				return out;
+			}
+			out.riff_size_field_offset = 4;
+			out.data_size_field_offset = pos + 4;
+			out.size_field_bytes       = 4;
+			out.data_size              = size;
+			return out;
+		}
+		// Chunks are padded to an even size.
+		pos += 8 + size + (size & 1);
+	}
+}
+
+[[nodiscard]]
+auto parse_layout(concepts::byte_input_stream auto* in) -> std::optional<layout> {
+	return parse_layout([in](uint64_t offset, std::span<std::byte> buffer) -> size_t {
+		if (!in->seek(int64_t(offset), std::ios::beg)) {
+			return 0;
+		}
+		return in->read_bytes(buffer);
+	});
+}
+
+} // audiorw::detail::wav
+
+namespace audiorw {
+
+struct parallel_write_options {
+	// If not set, the frame ranges are converted and written one at a time
+	// on the calling thread.
+	std::optional<executor_ref> executor;
+	// Each task converts and writes this many frames.
+	size_t frames_per_task = size_t{1} << 16;
+};
+
+using read_frames_at_function = std::function<void(ads::frame_idx pos, std::span<float> buffer)>;
+
+} // audiorw
+
+namespace audiorw::detail::wav {
+
+auto write_parallel(const audiorw::header& header, storage_type type, read_frames_at_function read_frames_at, const std::filesystem::path& path, std::function<bool()> should_abort, const parallel_write_options& options) -> operation_result;
+
+} // audiorw::detail::wav
+
+namespace audiorw {
+
+// Writes a PCM WAV file. Because every frame's position in the file is
+// known up front, the file is preallocated and frame ranges are converted
+// and written at their offsets by tasks on the executor, all at once. The
+// header is written last, as RF64 if the file is too large for RIFF.
+// header.format is ignored.
+// read_frames_at(pos, buffer) has to fill buffer with the interleaved
+// frames starting at pos. It and should_abort are called from several
+// threads at once. Like the other writers, the file only appears at path
+// once it is complete.
+auto write_wav_parallel(const audiorw::header& header, concepts::read_frames_at_fn auto read_frames_at, const std::filesystem::path& path, storage_type type, concepts::should_abort_fn auto should_abort, const parallel_write_options& options = {}) -> operation_result {
+	return detail::wav::write_parallel(header, type, std::move(read_frames_at), path, std::move(should_abort), options);
+}
+
+auto write_wav_parallel(const audiorw::item& item, const std::filesystem::path& path, storage_type type, const parallel_write_options& options = {}) -> operation_result;
+auto write_wav_parallel(const flat_item& item, const std::filesystem::path& path, storage_type type, const parallel_write_options& options = {}) -> operation_result;
+
+} // audiorw
+
+namespace audiorw {
+
+// One channel of interleaved frames, i.e. every channel_count'th sample.
+struct strided_channel_view {
+	const float* data  = nullptr;
+	size_t stride      = 1;
+	size_t frame_count = 0;
+	[[nodiscard]] auto operator[](size_t frame) const -> float { return data[frame * stride]; }
+	[[nodiscard]] auto size() const -> size_t { return frame_count; }
+};
+
+// The samples of a 32 bit float WAV file, viewed straight out of a memory
+// mapping of it. Nothing is decoded or copied, so opening even a very
+// large file is instant, and pages are only read from the disk as they
+// are touched. The views it hands out point into the mapping, so they
+// are only valid for as long as this object lives. Throws if the file
+// isn't 32 bit float WAV.
+struct mapped_wav {
+	mapped_wav(const std::filesystem::path& path);
+	[[nodiscard]] auto get_header() const -> const audiorw::header& { return header_; }
+	// Frame f's samples are at [f * channel_count, (f + 1) * channel_count).
+	[[nodiscard]] auto get_interleaved() const -> std::span<const float> { return samples_; }
+	[[nodiscard]] auto get_channel(size_t channel) const -> strided_channel_view;
+	// Only for mono files, where the channel is contiguous.
+	[[nodiscard]] auto get_planar() const -> std::span<const float>;
+private:
+	mapped_file file_;
+	audiorw::header header_;
+	std::span<const float> samples_;
+};
+
+// Returns nullopt rather than throwing if the file can't be viewed, e.g.
+// because it is in some other sample format and has to be read() instead.
+[[nodiscard]] auto try_map_wav(const std::filesystem::path& path) -> std::optional<mapped_wav>;
+
+} // audiorw
@@ -1,6 +1,18 @@
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <mutex>
 #include <stdexcept>
 #define NOMINMAX
+#include "audiorw_config.hpp"
+#if AUDIORW_WITH_VORBIS
+// stb_vorbis has to be declared before miniaudio's implementation so that
+// miniaudio's Vorbis backend is compiled in. It is implemented at the end.
+#define STB_VORBIS_HEADER_ONLY
+#include "extras/stb_vorbis.c"
+#endif
 #define MINIAUDIO_IMPLEMENTATION
 #include "audiorw.hpp"
 #include "miniaudio.h"
@@ -14,20 +26,225 @@ struct format_info {
 	audiorw::format_hint hint_all;
 };
 
-using format_info_table = std::array<format_info, 4>;
+using format_info_table = std::array<format_info, SUPPORTED_FORMAT_COUNT>;
 
+// Only the formats which were built in, so that files with the extension
+// of a format which wasn't aren't given a hint which can't succeed.
 [[nodiscard]] constexpr
 auto make_format_info_table() -> format_info_table {
 	format_info_table table;
-	table[size_t(format::flac)]    = { .format = format::flac,    .ext = ".FLAC", .hint_only = format_hint::try_flac_only,    .hint_all = format_hint::try_flac_first };
-	table[size_t(format::mp3)]     = { .format = format::mp3,     .ext = ".MP3",  .hint_only = format_hint::try_mp3_only,     .hint_all = format_hint::try_mp3_first };
-	table[size_t(format::wav)]     = { .format = format::wav,     .ext = ".WAV",  .hint_only = format_hint::try_wav_only,     .hint_all = format_hint::try_wav_first };
-	table[size_t(format::wavpack)] = { .format = format::wavpack, .ext = ".WV",   .hint_only = format_hint::try_wavpack_only, .hint_all = format_hint::try_wavpack_first };
+	size_t i = 0;
+#if AUDIORW_WITH_FLAC
+	table[i++] = { .format = format::flac,    .ext = ".FLAC", .hint_only = format_hint::try_flac_only,    .hint_all = format_hint::try_flac_first };
+#endif
+#if AUDIORW_WITH_MP3
+	table[i++] = { .format = format::mp3,     .ext = ".MP3",  .hint_only = format_hint::try_mp3_only,     .hint_all = format_hint::try_mp3_first };
+#endif
+	table[i++] = { .format = format::wav,     .ext = ".WAV",  .hint_only = format_hint::try_wav_only,     .hint_all = format_hint::try_wav_first };
+#if AUDIORW_WITH_WAVPACK
+	table[i++] = { .format = format::wavpack, .ext = ".WV",   .hint_only = format_hint::try_wavpack_only, .hint_all = format_hint::try_wavpack_first };
+#endif
+#if AUDIORW_WITH_VORBIS
+	table[i++] = { .format = format::vorbis,  .ext = ".OGG",  .hint_only = format_hint::try_vorbis_only,  .hint_all = format_hint::try_vorbis_first };
+#endif
 	return table;
 }
 
 static constexpr auto FORMAT_INFO = make_format_info_table();
 
+struct counter_row {
+	alignas(64) std::array<std::atomic<uint64_t>, counters::COUNTER_COUNT> values = {};
+};
+
+using counter_table = std::array<counter_row, counters::FORMAT_COUNT + 1>;
+
+static constexpr auto UNATTRIBUTED_ROW = counters::FORMAT_COUNT;
+
+[[nodiscard]] static
+auto get_counter_table() -> counter_table& {
+	static counter_table table;
+	return table;
+}
+
+[[nodiscard]] static
+auto get_counter_name(counters::counter c) -> std::string_view {
+	switch (c) {
+		case counters::counter::files_opened:   { return "files_opened"; }
+		case counters::counter::probe_failures: { return "probe_failures"; }
+		case counters::counter::bytes_read:     { return "bytes_read"; }
+		case counters::counter::bytes_written:  { return "bytes_written"; }
+		case counters::counter::frames_decoded: { return "frames_decoded"; }
+		case counters::counter::frames_encoded: { return "frames_encoded"; }
+		case counters::counter::seeks:          { return "seeks"; }
+		case counters::counter::decode_ns:      { return "decode_ns"; }
+		case counters::counter::convert_ns:     { return "convert_ns"; }
+		case counters::counter::encode_ns:      { return "encode_ns"; }
+		case counters::counter::exceptions:     { return "exceptions"; }
+		default:                                { throw std::runtime_error{"Invalid counter"}; }
+	}
+}
+
+[[nodiscard]] static
+auto get_counter_row_name(size_t row) -> std::string_view {
+	switch (row) {
+		case size_t(format::flac):    { return "flac"; }
+		case size_t(format::mp3):     { return "mp3"; }
+		case size_t(format::wav):     { return "wav"; }
+		case size_t(format::wavpack): { return "wavpack"; }
+		case size_t(format::vorbis):  { return "vorbis"; }
+		default:                      { return "none"; }
+	}
+}
+
+static thread_local memory_tracker* current_memory_tracker_ = nullptr;
+
+// Each allocation made through the tracked miniaudio callbacks is prefixed
+// with its size so that frees and reallocs can be accounted for.
+static constexpr auto ALLOCATION_PREFIX_SIZE = size_t{16};
+
+[[nodiscard]] static
+auto tracked_malloc(size_t bytes, void* user_data) -> void* {
+	const auto block = static_cast<std::byte*>(std::malloc(bytes + ALLOCATION_PREFIX_SIZE));
+	if (!block) {
+		return nullptr;
+	}
+	*reinterpret_cast<size_t*>(block) = bytes;
+	static_cast<memory_tracker*>(user_data)->on_alloc(memory_category::decoder, bytes);
+	return block + ALLOCATION_PREFIX_SIZE;
+}
+
+static
+auto tracked_free(void* p, void* user_data) -> void {
+	if (!p) {
+		return;
+	}
+	const auto block = static_cast<std::byte*>(p) - ALLOCATION_PREFIX_SIZE;
+	static_cast<memory_tracker*>(user_data)->on_free(memory_category::decoder, *reinterpret_cast<size_t*>(block));
+	std::free(block);
+}
+
+[[nodiscard]] static
+auto tracked_realloc(void* p, size_t bytes, void* user_data) -> void* {
+	if (!p) {
+		return tracked_malloc(bytes, user_data);
+	}
+	const auto new_p = tracked_malloc(bytes, user_data);
+	if (!new_p) {
+		return nullptr;
+	}
+	const auto old_bytes = *reinterpret_cast<size_t*>(static_cast<std::byte*>(p) - ALLOCATION_PREFIX_SIZE);
+	std::memcpy(new_p, p, std::min(old_bytes, bytes));
+	tracked_free(p, user_data);
+	return new_p;
+}
+
+auto memory_tracker::on_alloc(memory_category category, size_t bytes) -> void {
+	if (bytes == 0) {
+		return;
+	}
+	auto& peak = report_.peak_bytes[size_t(category)];
+	current_bytes_[size_t(category)] += bytes;
+	current_total_bytes_             += bytes;
+	peak                     = std::max(peak, current_bytes_[size_t(category)]);
+	report_.peak_total_bytes = std::max(report_.peak_total_bytes, current_total_bytes_);
+	report_.allocation_count++;
+}
+
+auto memory_tracker::on_free(memory_category category, size_t bytes) -> void {
+	auto& current = current_bytes_[size_t(category)];
+	bytes = std::min(bytes, current);
+	current              -= bytes;
+	current_total_bytes_ -= bytes;
+}
+
+scope_memory_tracker::scope_memory_tracker(memory_report* report)
+	: report_{report}
+{
+	if (report_) {
+		prev_tracker_            = current_memory_tracker_;
+		current_memory_tracker_ = &tracker_;
+	}
+}
+
+scope_memory_tracker::~scope_memory_tracker() {
+	if (report_) {
+		current_memory_tracker_ = prev_tracker_;
+		*report_                = tracker_.get_report();
+	}
+}
+
+auto get_memory_tracker() -> memory_tracker* {
+	return current_memory_tracker_;
+}
+
+auto make_allocation_callbacks(memory_tracker* tracker) -> ma_allocation_callbacks {
+	// Null callbacks make miniaudio fall back to its default allocator.
+	auto callbacks = ma_allocation_callbacks{};
+	if (tracker) {
+		callbacks.pUserData = tracker;
+		callbacks.onMalloc  = tracked_malloc;
+		callbacks.onRealloc = tracked_realloc;
+		callbacks.onFree    = tracked_free;
+	}
+	return callbacks;
+}
+
+scope_counter_timer::scope_counter_timer(audiorw::format format, counters::counter c)
+	: format_{format}
+	, counter_{c}
+	, start_{std::chrono::steady_clock::now()}
+{
+}
+
+scope_counter_timer::~scope_counter_timer() {
+	const auto elapsed = std::chrono::steady_clock::now() - start_;
+	counters::add(format_, counter_, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+}
+
+// Takes up to n from the unattributed row, less if reset() has been
+// called since it was added, and adds it to the format's row.
+static
+auto attribute_counter(audiorw::format format, counters::counter c, uint64_t n) -> void {
+	auto& from  = get_counter_table()[UNATTRIBUTED_ROW].values[size_t(c)];
+	auto value  = from.load(std::memory_order_relaxed);
+	auto amount = std::min(value, n);
+	while (!from.compare_exchange_weak(value, value - amount, std::memory_order_relaxed)) {
+		amount = std::min(value, n);
+	}
+	counters::add(format, c, amount);
+}
+
+auto stream_counters::on_open() -> void {
+	if (format_) {
+		counters::add(*format_, counters::counter::files_opened);
+		return;
+	}
+	files_opened_++;
+	counters::add(counters::counter::files_opened);
+}
+
+auto stream_counters::on_read(uint64_t bytes) -> void {
+	if (format_) {
+		counters::add(*format_, counters::counter::bytes_read, bytes);
+		return;
+	}
+	bytes_read_ += bytes;
+	counters::add(counters::counter::bytes_read, bytes);
+}
+
+auto stream_counters::set_format(audiorw::format format) -> void {
+	if (format_) {
+		return;
+	}
+	format_ = format;
+	attribute_reads(format, std::exchange(files_opened_, 0), std::exchange(bytes_read_, 0));
+}
+
+auto attribute_reads(audiorw::format format, uint64_t files_opened, uint64_t bytes_read) -> void {
+	attribute_counter(format, counters::counter::files_opened, files_opened);
+	attribute_counter(format, counters::counter::bytes_read, bytes_read);
+}
+
 [[nodiscard]] static
 auto get_bit_depth(ma_format format) -> int {
 	switch (format) {
@@ -40,7 +257,6 @@ auto get_bit_depth(ma_format format) -> int {
 	}
 }
 
-[[nodiscard]] static
 auto make_tmp_file_path(std::filesystem::path path) -> std::filesystem::path {
 	path += ".tmp";
 	return path;
@@ -48,17 +264,27 @@ auto make_tmp_file_path(std::filesystem::path path) -> std::filesystem::path {
 
 [[nodiscard]] static
 auto get_format(const ma_decoder& decoder) -> format {
-	if (decoder.pBackendVTable == &g_ma_decoding_backend_vtable_flac ) { return format::flac; }
-	if (decoder.pBackendVTable == &g_ma_decoding_backend_vtable_mp3)   { return format::mp3; }
-	if (decoder.pBackendVTable == &g_ma_decoding_backend_vtable_wav)   { return format::wav; }
+#if AUDIORW_WITH_FLAC
+	if (decoder.pBackendVTable == &g_ma_decoding_backend_vtable_flac )      { return format::flac; }
+#endif
+#if AUDIORW_WITH_MP3
+	if (decoder.pBackendVTable == &g_ma_decoding_backend_vtable_mp3)       { return format::mp3; }
+#endif
+	if (decoder.pBackendVTable == &g_ma_decoding_backend_vtable_wav)       { return format::wav; }
+#if AUDIORW_WITH_VORBIS
+	if (decoder.pBackendVTable == &g_ma_decoding_backend_vtable_stbvorbis) { return format::vorbis; }
+#endif
 	throw std::runtime_error{"Invalid audio format"};
 }
 
 atomic_file_writer::atomic_file_writer(const std::filesystem::path& path)
 	: path_{path}
 	, tmp_path_{make_tmp_file_path(path)}
-	, file_{tmp_path_, std::ios::binary}
 {
+	// The buffer has to be set before the file is opened.
+	io_buffer_.resize(IO_BUFFER_SIZE);
+	file_.rdbuf()->pubsetbuf(io_buffer_.data(), io_buffer_.size());
+	file_.open(tmp_path_, std::ios::binary);
 	file_.exceptions(std::ifstream::failbit | std::ifstream::badbit);
 	if (!file_) {
 		throw std::runtime_error{std::format("Failed to open file: '{}'", tmp_path_.string())};
@@ -88,11 +314,14 @@ auto atomic_file_writer::stream() -> std::ofstream& {
 	return file_;
 }
 
-scope_ma_decoder::scope_ma_decoder(ma_decoder_read_proc on_read, ma_decoder_seek_proc on_seek, void* user_data, audiorw::format format)
+scope_ma_decoder::scope_ma_decoder(ma_decoder_read_proc on_read, ma_decoder_seek_proc on_seek, void* user_data, audiorw::format format, const ma_allocation_callbacks* allocation_callbacks)
 	: decoder_{std::make_unique<ma_decoder>().release(), &ma_decoder_uninit}
 {
 	auto config = ma_decoder_config_init(ma_format_f32, 0, 0);
 	config.encodingFormat = to_ma_encoding_format(format);
+	if (allocation_callbacks) {
+		config.allocationCallbacks = *allocation_callbacks;
+	}
 	if (ma_decoder_init(on_read, on_seek, user_data, &config, decoder_.get()) != MA_SUCCESS) {
 		throw std::runtime_error{"Failed to initialize decoder"};
 	}
@@ -120,7 +349,20 @@ auto scope_ma_decoder::get_header(audiorw::format format) const -> header {
 }
 
 auto scope_ma_decoder::get_header() const -> header {
-	return get_header(get_format(*decoder_));
+	return get_header(detail::get_format(*decoder_));
+}
+
+// Unlike get_header(), this doesn't need the length, so it's cheap for MP3s.
+auto scope_ma_decoder::get_channel_count() const -> uint64_t {
+	ma_uint32 dec_channels;
+	if (ma_decoder_get_data_format(decoder_.get(), nullptr, &dec_channels, nullptr, nullptr, 0) != MA_SUCCESS) {
+		throw std::runtime_error{"Failed to get data format from decoder"};
+	}
+	return dec_channels;
+}
+
+auto scope_ma_decoder::get_format() const -> audiorw::format {
+	return detail::get_format(*decoder_);
 }
 
 auto scope_ma_decoder::read_pcm_frames(void* frames, ma_uint64 frame_count) -> ma_uint64 {
@@ -136,9 +378,12 @@ auto scope_ma_decoder::seek_to_pcm_frame(ma_uint64 frame) -> ma_result {
 	return ma_decoder_seek_to_pcm_frame(decoder_.get(), frame);
 }
 
-scope_ma_encoder::scope_ma_encoder(ma_encoder_write_proc on_write, ma_encoder_seek_proc on_seek, void* user_data, const ma_encoder_config& config)
+scope_ma_encoder::scope_ma_encoder(ma_encoder_write_proc on_write, ma_encoder_seek_proc on_seek, void* user_data, ma_encoder_config config, const ma_allocation_callbacks* allocation_callbacks)
 	: encoder_{std::make_unique<ma_encoder>().release(), &ma_encoder_uninit}
 {
+	if (allocation_callbacks) {
+		config.allocationCallbacks = *allocation_callbacks;
+	}
 	if (ma_encoder_init(on_write, on_seek, user_data, &config, encoder_.get()) != MA_SUCCESS) {
 		throw std::runtime_error{"Failed to initialize encoder"};
 	}
@@ -152,6 +397,7 @@ auto scope_ma_encoder::write_pcm_frames(const void* frames, ma_uint64 frame_coun
 	return frames_written;
 }
 
+#if AUDIORW_WITH_WAVPACK
 scope_wavpack_reader::scope_wavpack_reader(WavpackStreamReader64 stream, void* user_data)
 	: stream_reader_{stream}
 {
@@ -191,10 +437,13 @@ scope_wavpack_reader& scope_wavpack_reader::operator=(scope_wavpack_reader&& rhs
 	return *this;
 }
 
-scope_wavpack_writer::scope_wavpack_writer(const audiorw::header& header, storage_type type, WavpackBlockOutput blockout, void* user_data)
+scope_wavpack_writer::scope_wavpack_writer(const audiorw::header& header, storage_type type, const wavpack_options& options, WavpackBlockOutput blockout, void* user_data)
 	: context_{WavpackOpenFileOutput(blockout, user_data, nullptr)}
 {
 	auto config = make_wavpack_config(header, type);
+	if (options.store_md5) {
+		config.flags |= CONFIG_MD5_CHECKSUM;
+	}
 	if (!WavpackSetConfiguration64(context_, &config, header.frame_count.value, nullptr)) {
 		throw std::runtime_error(WavpackGetErrorMessage(context_));
 	}
@@ -207,22 +456,122 @@ scope_wavpack_writer::~scope_wavpack_writer() {
 	WavpackCloseFile(context_);
 }
 
-auto get_formats_to_try(format_hint hint) -> formats_to_try {
-	auto formats = formats_to_try{};
+// Shared with the helper task, which may only get to run after the
+// wavpack_md5 is gone.
+struct wavpack_md5::state {
+	size_t bytes_per_sample;
+	md5 hash;
+	tracked_buffer<int32_t> samples;
+	tracked_buffer<std::byte> bytes;
+	std::mutex mutex;
+	std::condition_variable done;
+	// Set while there are samples which haven't been hashed.
+	bool pending = false;
+	// Set once the helper task or wait() has taken the samples on.
+	bool claimed = false;
+	std::exception_ptr error;
+};
+
+// Whichever of the helper task and wait() gets here first hashes the
+// samples, so wait() can't be left waiting for a task which the executor
+// hasn't started.
+auto wavpack_md5::hash_pending(const std::shared_ptr<state>& s, bool discard) -> void {
+	{
+		auto lock = std::unique_lock{s->mutex};
+		if (!s->pending || s->claimed) {
+			return;
+		}
+		s->claimed = true;
+	}
+	auto error = std::exception_ptr{};
+	if (!discard) {
+		try {
+			format_wavpack_md5_bytes({s->samples.data(), s->samples.size()}, s->bytes_per_sample, 0, &s->bytes);
+			s->hash.update({s->bytes.data(), s->bytes.size()});
+		}
+		catch (...) {
+			error = std::current_exception();
+		}
+	}
+	{
+		auto lock = std::unique_lock{s->mutex};
+		s->pending = false;
+		s->error   = error;
+	}
+	s->done.notify_all();
+}
+
+wavpack_md5::wavpack_md5(std::optional<executor_ref> executor, size_t bytes_per_sample)
+	: executor_{executor}
+	, state_{std::make_shared<state>()}
+{
+	state_->bytes_per_sample = bytes_per_sample;
+}
+
+wavpack_md5::~wavpack_md5() {
+	// The hash isn't needed any more, so samples the helper hasn't started
+	// on are dropped.
+	hash_pending(state_, true);
+	auto lock = std::unique_lock{state_->mutex};
+	state_->done.wait(lock, [this] { return !state_->pending; });
+}
+
+auto wavpack_md5::wait() -> void {
+	hash_pending(state_, false);
+	auto lock = std::unique_lock{state_->mutex};
+	state_->done.wait(lock, [this] { return !state_->pending; });
+	if (state_->error) {
+		std::rethrow_exception(std::exchange(state_->error, {}));
+	}
+}
+
+auto wavpack_md5::add(std::span<const int32_t> samples) -> void {
+	wait();
+	state_->samples.resize(samples.size());
+	std::copy(samples.begin(), samples.end(), state_->samples.data());
+	{
+		auto lock = std::unique_lock{state_->mutex};
+		state_->pending = true;
+		state_->claimed = false;
+	}
+	if (executor_) {
+		executor_->submit([s = state_] { hash_pending(s, false); });
+	}
+	else {
+		hash_pending(state_, false);
+	}
+}
+
+auto wavpack_md5::finish() -> md5_digest {
+	wait();
+	return state_->hash.finish();
+}
+#endif
+
+[[nodiscard]] static
+auto get_all_formats_to_try(format_hint hint) -> formats_to_try {
 	switch (hint) {
-		case format_hint::try_flac_first:    { return { format::flac, format::wav, format::mp3, format::wavpack }; }
-		case format_hint::try_mp3_first:     { return { format::mp3, format::wav, format::flac, format::wavpack }; }
-		case format_hint::try_wav_first:     { return { format::wav, format::mp3, format::flac, format::wavpack }; }
-		case format_hint::try_wavpack_first: { return { format::wavpack, format::wav, format::mp3, format::flac }; }
+		case format_hint::try_flac_first:    { return { format::flac, format::wav, format::mp3, format::wavpack, format::vorbis }; }
+		case format_hint::try_mp3_first:     { return { format::mp3, format::wav, format::flac, format::wavpack, format::vorbis }; }
+		case format_hint::try_wav_first:     { return { format::wav, format::mp3, format::flac, format::wavpack, format::vorbis }; }
+		case format_hint::try_wavpack_first: { return { format::wavpack, format::wav, format::mp3, format::flac, format::vorbis }; }
+		case format_hint::try_vorbis_first:  { return { format::vorbis, format::wav, format::mp3, format::flac, format::wavpack }; }
 		case format_hint::try_flac_only:     { return { format::flac }; }
 		case format_hint::try_mp3_only:      { return { format::mp3 }; }
 		case format_hint::try_wav_only:      { return { format::wav }; }
 		case format_hint::try_wavpack_only:  { return { format::wavpack }; }
+		case format_hint::try_vorbis_only:   { return { format::vorbis }; }
 		default:                             { throw std::runtime_error{"Invalid audio format"}; }
 	}
+}
+
+auto get_formats_to_try(format_hint hint) -> formats_to_try {
+	auto formats = get_all_formats_to_try(hint);
+	formats.erase(std::remove_if(formats.begin(), formats.end(), [](format f) { return !is_supported(f); }), formats.end());
 	return formats;
 }
 
+#if AUDIORW_WITH_WAVPACK
 [[nodiscard]] static
 auto get_wavpack_channel_mask(ads::channel_count chs) -> int {
 	static constexpr auto CFG_MONO   = 4;
@@ -240,13 +589,16 @@ auto get_wavpack_float_norm_exp(storage_type type) -> int {
 		default:                              { return 0; }
 	}
 }
+#endif
 
 auto to_ma_encoding_format(audiorw::format format) -> ma_encoding_format {
 	switch (format) {
-		case audiorw::format::flac: { return ma_encoding_format_flac; }
-		case audiorw::format::mp3:  { return ma_encoding_format_mp3; }
-		case audiorw::format::wav:  { return ma_encoding_format_wav; }
-		default:                    { throw std::runtime_error{"Invalid audio format"}; }
+		case audiorw::format::flac:   { return ma_encoding_format_flac; }
+		case audiorw::format::mp3:    { return ma_encoding_format_mp3; }
+		case audiorw::format::wav:    { return ma_encoding_format_wav; }
+		// Only for decoding. miniaudio can't encode Vorbis.
+		case audiorw::format::vorbis: { return ma_encoding_format_vorbis; }
+		default:                      { throw std::runtime_error{"Invalid audio format"}; }
 	}
 }
 
@@ -285,6 +637,7 @@ auto ma_to_std_seek_mode(ma_seek_origin origin) -> std::ios_base::seekdir {
 	}
 }
 
+#if AUDIORW_WITH_WAVPACK
 auto wavpack_to_std_seek_mode(int mode) -> std::ios_base::seekdir {
 	switch (mode) {
 		case SEEK_SET: { return std::ios_base::beg; }
@@ -305,6 +658,41 @@ auto make_wavpack_config(const audiorw::header& header, storage_type type) -> Wa
 	return config;
 }
 
+auto wavpack_pack_samples(WavpackContext* context, std::span<int32_t> samples, size_t frames, wavpack_md5* md5) -> bool {
+	if (md5) {
+		md5->add(samples);
+	}
+	return WavpackPackSamples(context, samples.data(), uint32_t(frames)) != 0;
+}
+
+auto wavpack_float_to_int(std::span<float> samples, int bit_depth) -> std::span<int32_t> {
+	static_assert (sizeof(float) == sizeof(int32_t));
+	const auto int_scale = (1 << (bit_depth - 1)) - 1;
+	const auto ints      = reinterpret_cast<int32_t*>(samples.data());
+	for (size_t i = 0; i < samples.size(); i++) {
+		ints[i] = static_cast<int32_t>(double(samples[i]) * int_scale);
+	}
+	return {ints, samples.size()};
+}
+
+auto format_wavpack_md5_bytes(std::span<const int32_t> samples, size_t bytes_per_sample, int qmode, tracked_buffer<std::byte>* bytes) -> void {
+	// 8 bit WAV is unsigned. Floats are hashed as their bits.
+	const auto big_endian = (qmode & QMODE_BIG_ENDIAN) != 0;
+	const auto offset     =
+		bytes_per_sample == 1          ? ((qmode & QMODE_SIGNED_BYTES) ? 0 : uint32_t{0x80}) :
+		(qmode & QMODE_UNSIGNED_WORDS) ? uint32_t{1} << ((bytes_per_sample * 8) - 1) : 0;
+	bytes->resize(samples.size() * bytes_per_sample);
+	auto p = bytes->data();
+	for (const auto sample : samples) {
+		const auto value = uint32_t(sample) + offset;
+		for (size_t b = 0; b < bytes_per_sample; b++) {
+			const auto shift = big_endian ? 8 * (bytes_per_sample - 1 - b) : 8 * b;
+			*p++ = std::byte(uint8_t(value >> shift));
+		}
+	}
+}
+#endif
+
 [[nodiscard]] static
 auto to_upper(std::string str) -> std::string {
 	std::transform(str.begin(), str.end(), str.begin(), [](char c) { return std::toupper(c); });
@@ -340,18 +728,22 @@ auto find_format_info(std::string_view ext) -> std::optional<format_info> {
     return std::nullopt;
 }
 
+#if AUDIORW_WITH_WAVPACK
+// WavPack counts in frames, so the buffer holds buffer.size() / chs of them.
 auto stream_read_float_frames(scope_wavpack_reader* stream, std::span<float> buffer) -> ads::frame_count {
 	auto buffer_as_ints = reinterpret_cast<int32_t*>(buffer.data());
-	return {WavpackUnpackSamples(stream->context(), buffer_as_ints, buffer.size())};
+	const auto chs      = stream->get_header().channel_count.value;
+	return {WavpackUnpackSamples(stream->context(), buffer_as_ints, uint32_t(buffer.size() / chs))};
 }
 
 auto stream_read_int_frames(scope_wavpack_reader* stream, std::span<float> buffer) -> ads::frame_count {
 	auto buffer_as_ints = reinterpret_cast<int32_t*>(buffer.data());
 	const auto& header     = stream->get_header();
-	const auto frames_read = WavpackUnpackSamples(stream->context(), buffer_as_ints, buffer.size());
 	const auto chs         = header.channel_count.value;
-	const auto divisor     = (1 < (header.bit_depth -1 )) - 1;
-	for (auto i = 0; i < frames_read * chs; i++) {
+	const auto frames_read = WavpackUnpackSamples(stream->context(), buffer_as_ints, uint32_t(buffer.size() / chs));
+	// The same as wavpack_read_int_chunks(), and what the writer scales by.
+	const auto divisor     = float((int64_t{1} << (header.bit_depth - 1)) - 1);
+	for (size_t i = 0; i < size_t(frames_read) * chs; i++) {
 		buffer[i] = static_cast<float>(buffer_as_ints[i]) / divisor;
 	}
 	return {frames_read};
@@ -371,12 +763,43 @@ auto get_header(const scope_wavpack_reader* decoder) -> header {
 	return decoder->get_header();
 }
 
+[[nodiscard]] static
+auto get_format(const scope_wavpack_reader*) -> audiorw::format {
+	return format::wavpack;
+}
+#endif
+
+#if AUDIORW_WITH_VORBIS
+auto get_header(const scope_vorbis_reader* decoder) -> header {
+	return decoder->get_header();
+}
+
+[[nodiscard]] static
+auto get_format(const scope_vorbis_reader*) -> audiorw::format {
+	return format::vorbis;
+}
+#endif
+
 auto get_header(const scope_ma_decoder* decoder) -> header {
 	return decoder->get_header();
 }
 
+auto get_header(const scope_wav_reader* decoder) -> header {
+	return decoder->get_header();
+}
+
+[[nodiscard]] static
+auto get_format(const scope_ma_decoder* decoder) -> audiorw::format {
+	return decoder->get_format();
+}
+
+[[nodiscard]] static
+auto get_format(const scope_wav_reader*) -> audiorw::format {
+	return format::wav;
+}
+
 auto read_frames(scope_ma_decoder* decoder, std::span<float> buffer) -> ads::frame_count {
-	return {decoder->read_pcm_frames(buffer.data(), buffer.size())};
+	return {decoder->read_pcm_frames(buffer.data(), buffer.size() / decoder->get_channel_count())};
 }
 
 auto seek(scope_ma_decoder* decoder, ads::frame_idx pos) -> bool {
@@ -388,11 +811,20 @@ auto get_header(const detail::decoder* decoder) -> header {
 }
 
 auto read_frames(detail::decoder* decoder, std::span<float> buffer) -> ads::frame_count {
-	return std::visit([buffer](auto& decoder){ return read_frames(&decoder, buffer); }, *decoder);
+	return std::visit([buffer](auto& decoder){
+		const auto format = get_format(&decoder);
+		auto timer        = scope_counter_timer{format, counters::counter::decode_ns};
+		const auto frames = read_frames(&decoder, buffer);
+		counters::add(format, counters::counter::frames_decoded, frames.value);
+		return frames;
+	}, *decoder);
 }
 
 auto seek(detail::decoder* decoder, ads::frame_idx pos) -> bool {
-	return std::visit([pos](auto& decoder){ return seek(&decoder, pos); }, *decoder);
+	return std::visit([pos](auto& decoder){
+		counters::add(get_format(&decoder), counters::counter::seeks);
+		return seek(&decoder, pos);
+	}, *decoder);
 }
 
 auto seek(auto pos, auto offset, auto length, std::ios::seekdir mode) -> decltype(pos) {
@@ -406,10 +838,75 @@ auto seek(auto pos, auto offset, auto length, std::ios::seekdir mode) -> decltyp
 
 } // audiorw::detail
 
+namespace audiorw::counters {
+
+auto snapshot::get(counter c) const -> uint64_t {
+	auto total = uint64_t{0};
+	for (const auto& row : values) {
+		total += row[size_t(c)];
+	}
+	return total;
+}
+
+auto snapshot::get(audiorw::format format, counter c) const -> uint64_t {
+	return values[size_t(format)][size_t(c)];
+}
+
+auto snapshot::get_unattributed(counter c) const -> uint64_t {
+	return values[detail::UNATTRIBUTED_ROW][size_t(c)];
+}
+
+auto add(counter c, uint64_t n) -> void {
+	detail::get_counter_table()[detail::UNATTRIBUTED_ROW].values[size_t(c)].fetch_add(n, std::memory_order_relaxed);
+}
+
+auto add(audiorw::format format, counter c, uint64_t n) -> void {
+	detail::get_counter_table()[size_t(format)].values[size_t(c)].fetch_add(n, std::memory_order_relaxed);
+}
+
+auto reset() -> void {
+	for (auto& row : detail::get_counter_table()) {
+		for (auto& value : row.values) {
+			value.store(0, std::memory_order_relaxed);
+		}
+	}
+}
+
+auto get_snapshot() -> snapshot {
+	auto out          = snapshot{};
+	const auto& table = detail::get_counter_table();
+	for (size_t row = 0; row < table.size(); row++) {
+		for (size_t c = 0; c < COUNTER_COUNT; c++) {
+			out.values[row][c] = table[row].values[c].load(std::memory_order_relaxed);
+		}
+	}
+	return out;
+}
+
+auto to_text(const snapshot& s) -> std::string {
+	auto out = std::string{};
+	for (size_t c = 0; c < COUNTER_COUNT; c++) {
+		for (size_t row = 0; row < s.values.size(); row++) {
+			if (const auto value = s.values[row][c]) {
+				out += "audiorw_";
+				out += detail::get_counter_name(counter(c));
+				out += "{format=\"";
+				out += detail::get_counter_row_name(row);
+				out += "\"} ";
+				out += std::to_string(value);
+				out += "\n";
+			}
+		}
+	}
+	return out;
+}
+
+} // audiorw::counters
+
 namespace audiorw {
 
-auto get_known_file_extensions() -> std::array<std::string_view, 4> {
-	std::array<std::string_view, 4> out;
+auto get_known_file_extensions() -> std::array<std::string_view, SUPPORTED_FORMAT_COUNT> {
+	std::array<std::string_view, SUPPORTED_FORMAT_COUNT> out;
 	std::ranges::transform(detail::FORMAT_INFO, std::begin(out), &detail::format_info::ext);
 	return out;
 }
@@ -461,21 +958,48 @@ auto byte_input_stream::seek(int64_t offset, std::ios::seekdir mode) -> bool {
 
 //########################################################################################
 
-stream_bytes_from_fs_path::stream_bytes_from_fs_path(const std::filesystem::path& path)
-	: file_{path, std::ios::binary}
+stream_bytes_from_fs_path::stream_bytes_from_fs_path(const std::filesystem::path& path, cache_policy policy)
 {
-	file_.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-	if (!file_) {
-		throw std::runtime_error{std::format("Failed to open file: '{}'", path.string())};
+	if (policy == cache_policy::direct) {
+		try {
+			direct_.emplace(path);
+		}
+		catch (const std::runtime_error&) {
+			policy = cache_policy::drop_behind;
+		}
+	}
+	if (!direct_) {
+		// The buffer has to be set before the file is opened.
+		io_buffer_.resize(detail::IO_BUFFER_SIZE);
+		file_.rdbuf()->pubsetbuf(io_buffer_.data(), io_buffer_.size());
+		file_.open(path, std::ios::binary);
+		file_.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+		if (!file_) {
+			throw std::runtime_error{std::format("Failed to open file: '{}'", path.string())};
+		}
 	}
+	if (policy == cache_policy::drop_behind) {
+		dropper_.emplace(path, false);
+	}
+	counters_.on_open();
 }
 
 auto stream_bytes_from_fs_path::close() -> bool {
+	if (direct_) {
+		direct_->close();
+		return true;
+	}
 	file_.close();
+	if (dropper_) {
+		dropper_->drop_all();
+	}
 	return true;
 }
 
 auto stream_bytes_from_fs_path::get_length() -> std::optional<size_t> {
+	if (direct_) {
+		return direct_->get_length();
+	}
 	if (!(file_.is_open() && file_.good())) {
 		throw std::runtime_error{"Failed to get stream length"};
 	}
@@ -487,6 +1011,9 @@ auto stream_bytes_from_fs_path::get_length() -> std::optional<size_t> {
 }
 
 auto stream_bytes_from_fs_path::get_pos() -> size_t {
+	if (direct_) {
+		return direct_->get_pos();
+	}
 	if (!(file_.is_open() && file_.good())) {
 		throw std::runtime_error{"Failed to get stream position"};
 	}
@@ -494,6 +1021,13 @@ auto stream_bytes_from_fs_path::get_pos() -> size_t {
 }
 
 auto stream_bytes_from_fs_path::push_back_byte(std::byte v) -> bool {
+	if (direct_) {
+		if (direct_->get_pos() == 0) {
+			return false;
+		}
+		direct_->seek(direct_->get_pos() - 1);
+		return true;
+	}
 	if (!(file_.is_open() && file_.good())) {
 		throw std::runtime_error{"Failed to put back byte"};
 	}
@@ -503,15 +1037,41 @@ auto stream_bytes_from_fs_path::push_back_byte(std::byte v) -> bool {
 
 auto stream_bytes_from_fs_path::read_bytes(std::span<std::byte> buffer) -> size_t {
 	if (buffer.size() < 1) return 0;
+	if (direct_) {
+		const auto n = direct_->read_bytes(buffer);
+		counters_.on_read(n);
+		return n;
+	}
 	auto char_buffer = reinterpret_cast<char*>(buffer.data());
 	if (!(file_.is_open() && file_.good())) {
 		throw std::runtime_error{"Failed to read bytes"};
 	}
-	file_.read(char_buffer, buffer.size());
-	return file_.gcount();
+	try {
+		file_.read(char_buffer, buffer.size());
+	}
+	catch (const std::ios_base::failure&) {
+		// Reading past the end sets failbit as well as eofbit. That's just
+		// a short read, and the stream has to stay usable for seeking.
+		if (!file_.eof()) {
+			throw;
+		}
+		file_.clear();
+	}
+	const auto n = static_cast<size_t>(file_.gcount());
+	counters_.on_read(n);
+	if (dropper_ && dropper_->count(n)) {
+		dropper_->drop_behind(file_.tellg());
+	}
+	return n;
 }
 
 auto stream_bytes_from_fs_path::seek(int64_t offset, std::ios::seekdir mode) -> bool {
+	if (direct_) {
+		const auto pos    = int64_t(direct_->get_pos());
+		const auto length = int64_t(direct_->get_length());
+		direct_->seek(uint64_t(std::max(int64_t{0}, detail::seek(pos, offset, length, mode))));
+		return true;
+	}
 	if (!(file_.is_open() && file_.good())) {
 		throw std::runtime_error{"Failed to seek"};
 	}
@@ -521,6 +1081,22 @@ auto stream_bytes_from_fs_path::seek(int64_t offset, std::ios::seekdir mode) ->
 
 //########################################################################################
 
+stream_bytes_from_std_istream::stream_bytes_from_std_istream(std::istream* stream)
+	: stream_{stream}
+{
+}
+
+auto stream_bytes_from_std_istream::read_bytes(std::span<std::byte> buffer) -> size_t {
+	if (!stream_->good()) {
+		return 0;
+	}
+	stream_->read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+	counters_.on_read(stream_->gcount());
+	return stream_->gcount();
+}
+
+//########################################################################################
+
 stream_item_from_bytes::stream_item_from_bytes(std::span<const std::byte> bytes, format_hint hint)
 	: in_{std::make_unique<byte_input_stream>(bytes)}
 	, decoder_{detail::make_decoder(in_.get(), hint)}
@@ -600,6 +1176,13 @@ auto stream_item_to_item::seek(ads::frame_idx pos) -> bool {
 auto stream_item_to_item::write_header(audiorw::header header) -> void {
 	item_->header = header;
 	item_->frames = ads::make<float>(header.channel_count, header.frame_count);
+	// The header is written again each time a format probe is retried, and
+	// each time replaces the storage from the last attempt.
+	const auto storage_bytes = header.channel_count.value * header.frame_count.value * sizeof(float);
+	if (auto tracker = detail::get_memory_tracker()) {
+		tracker->on_free(memory_category::item_storage, std::exchange(storage_bytes_, storage_bytes));
+		tracker->on_alloc(memory_category::item_storage, storage_bytes);
+	}
 }
 
 auto stream_item_to_item::write_frames(std::span<const float> buffer) -> ads::frame_count {
@@ -619,13 +1202,21 @@ auto stream_item_to_item::write_frames(std::span<const float> buffer) -> ads::fr
 
 //########################################################################################
 
-stream_bytes_to_fs_path::stream_bytes_to_fs_path(const std::filesystem::path& path)
+stream_bytes_to_fs_path::stream_bytes_to_fs_path(const std::filesystem::path& path, cache_policy policy)
 	: writer_{path}
 {
+	// Writes always go through the cache, so direct is the same as
+	// drop_behind here.
+	if (policy != cache_policy::normal) {
+		dropper_.emplace(writer_.get_tmp_path(), true);
+	}
 }
 
 auto stream_bytes_to_fs_path::commit() -> void {
 	writer_.commit();
+	if (dropper_) {
+		dropper_->drop_all();
+	}
 }
 
 auto stream_bytes_to_fs_path::seek(int64_t offset, std::ios::seekdir mode) -> bool {
@@ -634,6 +1225,11 @@ auto stream_bytes_to_fs_path::seek(int64_t offset, std::ios::seekdir mode) -> bo
 		throw std::runtime_error{"Failed to seek"};
 	}
 	file.seekp(offset, mode);
+	switch (mode) {
+		case std::ios::beg: { pos_ = offset; break; }
+		case std::ios::cur: { pos_ += offset; break; }
+		default:            { pos_ = file.tellp(); break; }
+	}
 	return true;
 }
 
@@ -644,6 +1240,12 @@ auto stream_bytes_to_fs_path::write_bytes(std::span<const std::byte> buffer) ->
 		throw std::runtime_error{"Failed to write bytes"};
 	}
 	file.write(buffer_as_chars, buffer.size());
+	counters::add(counters::counter::bytes_written, buffer.size());
+	pos_ += buffer.size();
+	if (dropper_ && dropper_->count(buffer.size())) {
+		// What is still in the stream's own buffer is well within the lag.
+		dropper_->drop_behind(pos_);
+	}
 	return buffer.size();
 }
 
@@ -669,3 +1271,35 @@ auto stream_bytes_to_std_vector::write_bytes(std::span<const std::byte> buffer)
 //########################################################################################
 
 } // audiorw
+
+namespace audiorw {
+
+auto read_into(const std::filesystem::path& path, format_hint hint, std::span<float> interleaved, ads::frame_idx start) -> read_into_result {
+	auto in = stream::bytes::from(path);
+	return read_into(&in, hint, interleaved, start);
+}
+
+auto read_into(const std::filesystem::path& path, format_hint hint, std::span<const std::span<float>> channels, ads::frame_idx start) -> read_into_result {
+	auto in = stream::bytes::from(path);
+	return read_into(&in, hint, channels, start);
+}
+
+#if AUDIORW_WITH_FLAC
+auto write_flac(const audiorw::item& item, const std::filesystem::path& path, const flac_options& options) -> operation_result {
+	return audiorw::write_flac(item, path, options, detail::fn_always(false));
+}
+#endif
+
+#if AUDIORW_WITH_WAVPACK
+auto write_wavpack(const audiorw::item& item, const std::filesystem::path& path, storage_type type, const wavpack_options& options) -> operation_result {
+	return audiorw::write_wavpack(item, path, type, options, detail::fn_always(false));
+}
+#endif
+
+} // audiorw
+
+#if AUDIORW_WITH_VORBIS
+// Last, so that none of stb_vorbis's macros leak into the code above.
+#undef STB_VORBIS_HEADER_ONLY
+#include "extras/stb_vorbis.c"
+#endif
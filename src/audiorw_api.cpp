@@ -0,0 +1,285 @@
+#include "audiorw_api.hpp"
+#include "audiorw.hpp"
+
+namespace audiorw::detail {
+
+[[nodiscard]] static
+auto make_should_abort(const std::function<bool()>& should_abort) {
+	return [&should_abort] { return should_abort && should_abort(); };
+}
+
+} // audiorw::detail
+
+namespace audiorw {
+
+// Each kind of input is constructed in place, because the decoder keeps a
+// pointer to the stream it reads from.
+struct decoder_handle::impl {
+	impl(const std::filesystem::path& path, format_hint hint)
+		: stream{std::in_place_type<stream_item_from_fs_path>, path, hint}
+	{
+	}
+	impl(std::span<const std::byte> bytes, format_hint hint)
+		: stream{std::in_place_type<stream_item_from_bytes>, bytes, hint}
+	{
+	}
+	impl(any_byte_input_stream in, format_hint hint)
+		: stream{std::in_place_type<stream_item_from_byte_stream<any_byte_input_stream>>, in, hint}
+	{
+	}
+	std::variant<
+		stream_item_from_fs_path,
+		stream_item_from_bytes,
+		stream_item_from_byte_stream<any_byte_input_stream>
+	> stream;
+};
+
+decoder_handle::decoder_handle(const std::filesystem::path& path, format_hint hint)
+	: impl_{std::make_unique<impl>(path, hint)}
+{
+}
+
+decoder_handle::decoder_handle(std::span<const std::byte> bytes, format_hint hint)
+	: impl_{std::make_unique<impl>(bytes, hint)}
+{
+}
+
+decoder_handle::decoder_handle(any_byte_input_stream stream, format_hint hint)
+	: impl_{std::make_unique<impl>(stream, hint)}
+{
+}
+
+decoder_handle::decoder_handle(decoder_handle&& rhs) noexcept = default;
+decoder_handle& decoder_handle::operator=(decoder_handle&& rhs) noexcept = default;
+decoder_handle::~decoder_handle() = default;
+
+auto decoder_handle::get_header() const -> header {
+	return std::visit([](const auto& stream) { return stream.get_header(); }, impl_->stream);
+}
+
+auto decoder_handle::read_frames(std::span<float> buffer) -> ads::frame_count {
+	return std::visit([buffer](auto& stream) { return stream.read_frames(buffer); }, impl_->stream);
+}
+
+auto decoder_handle::seek(ads::frame_idx pos) -> bool {
+	return std::visit([pos](auto& stream) { return stream.seek(pos); }, impl_->stream);
+}
+
+//########################################################################################
+
+// The same encoders write() uses, driven one buffer at a time. The output
+// is type erased so that the encoders are only compiled once.
+struct encoder_handle::impl {
+	struct wav {
+		detail::wav_encoder encoder;
+		detail::tracked_buffer<std::byte> bytes{memory_category::io};
+	};
+#if AUDIORW_WITH_FLAC
+	// Every batch but the last has to be a whole one, so frames are held
+	// here until there are enough.
+	struct flac {
+		detail::flac_encoder encoder;
+		detail::tracked_buffer<float> batch;
+		size_t batch_samples = 0;
+	};
+#endif
+#if AUDIORW_WITH_WAVPACK
+	struct wavpack {
+		wavpack(const audiorw::header& header, storage_type type, any_byte_output_stream* out)
+			: writer{header, type, wavpack_options{}, detail::wavpack_write_blockout<any_byte_output_stream>, out}
+		{
+		}
+		detail::scope_wavpack_writer writer;
+		detail::tracked_buffer<float> samples;
+	};
+#endif
+	template <typename Stream, typename... Args>
+	impl(const audiorw::header& header, storage_type type, std::in_place_type_t<Stream> stream_type, Args&&... args)
+		: header{header}
+		, type{type}
+		, stream{stream_type, std::forward<Args>(args)...}
+		, out{std::visit([](auto& stream) { return any_byte_output_stream{&stream}; }, stream)}
+	{
+		switch (header.format) {
+			case format::wav: {
+				auto& x = encoder.emplace<impl::wav>(detail::wav_encoder{header, type, header.frame_count.value});
+				detail::write_all(&out, x.encoder.get_header());
+				return;
+			}
+#if AUDIORW_WITH_FLAC
+			case format::flac: {
+				auto& x = encoder.emplace<impl::flac>(detail::flac_encoder{header, flac_options{}});
+				x.batch.resize(x.encoder.get_batch_frames() * header.channel_count.value);
+				detail::write_all(&out, x.encoder.get_metadata());
+				return;
+			}
+#endif
+#if AUDIORW_WITH_WAVPACK
+			case format::wavpack: {
+				encoder.emplace<impl::wavpack>(header, type, &out);
+				return;
+			}
+#endif
+			default: {
+				throw std::runtime_error{"Only WAV, FLAC and WavPack can be written through an encoder_handle"};
+			}
+		}
+	}
+	auto encode(impl::wav* x, std::span<const float> buffer) -> void {
+		x->bytes.resize(buffer.size() / header.channel_count.value * x->encoder.get_block_align());
+		x->encoder.encode(buffer, x->bytes.data());
+		detail::write_all(&out, {x->bytes.data(), x->bytes.size()});
+	}
+	auto finish(impl::wav* x) -> void {
+		detail::wav_finish(&x->encoder, &out, frames_written);
+	}
+#if AUDIORW_WITH_FLAC
+	auto encode(impl::flac* x, std::span<const float> buffer) -> void {
+		while (!buffer.empty()) {
+			const auto n = std::min(buffer.size(), x->batch.size() - x->batch_samples);
+			std::copy_n(buffer.begin(), n, x->batch.data() + x->batch_samples);
+			x->batch_samples += n;
+			buffer            = buffer.subspan(n);
+			if (x->batch_samples == x->batch.size()) {
+				detail::write_all(&out, x->encoder.encode({x->batch.data(), x->batch_samples}));
+				x->batch_samples = 0;
+			}
+		}
+	}
+	auto finish(impl::flac* x) -> void {
+		if (x->batch_samples > 0) {
+			detail::write_all(&out, x->encoder.encode({x->batch.data(), x->batch_samples}));
+		}
+		detail::rewrite_header(&out, x->encoder.finish());
+	}
+#endif
+#if AUDIORW_WITH_WAVPACK
+	auto encode(impl::wavpack* x, std::span<const float> buffer) -> void {
+		x->samples.resize(buffer.size());
+		std::copy(buffer.begin(), buffer.end(), x->samples.data());
+		const auto ints = type == storage_type::int_
+			? detail::wavpack_float_to_int({x->samples.data(), x->samples.size()}, header.bit_depth)
+			: std::span{reinterpret_cast<int32_t*>(x->samples.data()), x->samples.size()};
+		if (!detail::wavpack_pack_samples(x->writer.context(), ints, buffer.size() / header.channel_count.value, nullptr)) {
+			throw std::runtime_error{"Error packing WavPack samples"};
+		}
+	}
+	auto finish(impl::wavpack* x) -> void {
+		if (!WavpackFlushSamples(x->writer.context())) {
+			throw std::runtime_error("Write error");
+		}
+	}
+#endif
+	audiorw::header header;
+	storage_type type;
+	std::variant<
+		stream_bytes_to_fs_path,
+		stream_bytes_to_std_vector,
+		any_byte_output_stream
+	> stream;
+	any_byte_output_stream out;
+	std::variant<
+		std::monostate,
+#if AUDIORW_WITH_FLAC
+		impl::flac,
+#endif
+#if AUDIORW_WITH_WAVPACK
+		impl::wavpack,
+#endif
+		impl::wav
+	> encoder;
+	uint64_t frames_written = 0;
+};
+
+encoder_handle::encoder_handle(const audiorw::header& header, const std::filesystem::path& path, storage_type type)
+	: impl_{std::make_unique<impl>(header, type, std::in_place_type<stream_bytes_to_fs_path>, path)}
+{
+}
+
+encoder_handle::encoder_handle(const audiorw::header& header, std::vector<std::byte>* out, storage_type type)
+	: impl_{std::make_unique<impl>(header, type, std::in_place_type<stream_bytes_to_std_vector>, out)}
+{
+}
+
+encoder_handle::encoder_handle(const audiorw::header& header, any_byte_output_stream stream, storage_type type)
+	: impl_{std::make_unique<impl>(header, type, std::in_place_type<any_byte_output_stream>, stream)}
+{
+}
+
+encoder_handle::encoder_handle(encoder_handle&& rhs) noexcept = default;
+encoder_handle& encoder_handle::operator=(encoder_handle&& rhs) noexcept = default;
+encoder_handle::~encoder_handle() = default;
+
+auto encoder_handle::write_frames(std::span<const float> buffer) -> ads::frame_count {
+	auto& x        = *impl_;
+	const auto chs = x.header.channel_count.value;
+	if (buffer.size() % chs != 0) {
+		throw std::runtime_error{"Not a whole number of frames"};
+	}
+	const auto frames = buffer.size() / chs;
+	if (frames > x.header.frame_count.value - x.frames_written) {
+		throw std::runtime_error{"More frames than the header has"};
+	}
+	std::visit([&x, buffer](auto& encoder) {
+		if constexpr (!std::is_same_v<std::decay_t<decltype(encoder)>, std::monostate>) { x.encode(&encoder, buffer); }
+	}, x.encoder);
+	x.frames_written += frames;
+	counters::add(x.header.format, counters::counter::frames_encoded, frames);
+	return {frames};
+}
+
+auto encoder_handle::finish() -> void {
+	auto& x = *impl_;
+	if (x.frames_written != x.header.frame_count.value) {
+		throw std::runtime_error{"Fewer frames than the header has"};
+	}
+	std::visit([&x](auto& encoder) {
+		if constexpr (!std::is_same_v<std::decay_t<decltype(encoder)>, std::monostate>) { x.finish(&encoder); }
+	}, x.encoder);
+	x.out.commit();
+}
+
+//########################################################################################
+
+auto read(const std::filesystem::path& path, format_hint hint, const std::function<bool()>& should_abort) -> std::optional<item> {
+	return audiorw::read(path, hint, detail::make_should_abort(should_abort));
+}
+
+auto read(std::span<const std::byte> bytes, format_hint hint, const std::function<bool()>& should_abort) -> std::optional<item> {
+	auto item   = audiorw::item{};
+	auto in     = audiorw::byte_input_stream{bytes};
+	auto out    = audiorw::stream::item::to(&item);
+	auto result = audiorw::read(&in, &out, hint, detail::make_should_abort(should_abort));
+	if (result == audiorw::operation_result::success) { return std::move(item); }
+	else                                              { return std::nullopt; }
+}
+
+auto read(any_byte_input_stream* in, any_item_output_stream* out, format_hint hint, const std::function<bool()>& should_abort) -> operation_result {
+	return audiorw::read(in, out, hint, detail::make_should_abort(should_abort));
+}
+
+auto write(const audiorw::item& item, const std::filesystem::path& path, storage_type type, const std::function<bool()>& should_abort) -> operation_result {
+	return audiorw::write(item, path, type, detail::make_should_abort(should_abort));
+}
+
+auto write(const audiorw::item& item, std::vector<std::byte>* out, storage_type type, const std::function<bool()>& should_abort) -> operation_result {
+	return audiorw::write(item.header, item.frames, out, type, should_abort);
+}
+
+auto write(const audiorw::header& header, const audiorw::frames& frames, const std::filesystem::path& path, storage_type type, const std::function<bool()>& should_abort) -> operation_result {
+	auto in  = audiorw::stream::frames::from(frames);
+	auto out = audiorw::stream::bytes::to(path);
+	return audiorw::write(header, &in, &out, type, detail::make_should_abort(should_abort));
+}
+
+auto write(const audiorw::header& header, const audiorw::frames& frames, std::vector<std::byte>* out, storage_type type, const std::function<bool()>& should_abort) -> operation_result {
+	auto in        = audiorw::stream::frames::from(frames);
+	auto out_bytes = audiorw::stream::bytes::to(out);
+	return audiorw::write(header, &in, &out_bytes, type, detail::make_should_abort(should_abort));
+}
+
+auto write(const audiorw::header& header, any_frame_input_stream* in, any_byte_output_stream* out, storage_type type, const std::function<bool()>& should_abort) -> operation_result {
+	return audiorw::write(header, in, out, type, detail::make_should_abort(should_abort));
+}
+
+} // audiorw
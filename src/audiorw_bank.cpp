@@ -0,0 +1,319 @@
+#include <bit>
+#include <cstring>
+#include <format>
+#include "audiorw_bank.hpp"
+
+namespace audiorw::detail::bank {
+
+static constexpr auto COPY_BUFFER_SIZE = size_t{1 << 20};
+
+[[nodiscard]] static
+auto align_up(uint64_t value, uint64_t alignment) -> uint64_t {
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+[[nodiscard]] static
+auto get_format_hint(audiorw::format format) -> format_hint {
+	switch (format) {
+		case format::flac:    { return format_hint::try_flac_only; }
+		case format::mp3:     { return format_hint::try_mp3_only; }
+		case format::wav:     { return format_hint::try_wav_only; }
+		case format::wavpack: { return format_hint::try_wavpack_only; }
+		case format::vorbis:  { return format_hint::try_vorbis_only; }
+		default:              { throw std::runtime_error{"Invalid audio format"}; }
+	}
+}
+
+static
+auto check_endianness() -> void {
+	if constexpr (std::endian::native != std::endian::little) {
+		throw std::runtime_error{"Sample banks are only supported on little-endian machines"};
+	}
+}
+
+// Records where each run of frames starts so that readers can seek without
+// walking the blocks themselves.
+[[nodiscard]] static
+auto make_wavpack_block_index(std::span<const std::byte> bytes) -> std::vector<bank_block> {
+	static constexpr auto BLOCK_HEADER_SIZE = size_t{32};
+	static constexpr auto INITIAL_BLOCK     = uint32_t{0x800};
+	auto blocks = std::vector<bank_block>{};
+	auto pos    = size_t{0};
+	while (pos + BLOCK_HEADER_SIZE <= bytes.size()) {
+		const auto block = bytes.data() + pos;
+		if (std::memcmp(block, "wvpk", 4) != 0) {
+			break;
+		}
+		auto load_u32 = [block](size_t offset) { uint32_t v; std::memcpy(&v, block + offset, sizeof(v)); return v; };
+		const auto size          = uint64_t{load_u32(4)} + 8;
+		const auto block_index   = uint64_t{load_u32(16)} | (uint64_t{std::to_integer<uint8_t>(block[10])} << 32);
+		const auto block_samples = load_u32(20);
+		const auto flags         = load_u32(24);
+		// Multichannel files have one block per channel pair for each run.
+		if (block_samples > 0 && (flags & INITIAL_BLOCK)) {
+			blocks.push_back({block_index, pos});
+		}
+		pos += size;
+	}
+	return blocks;
+}
+
+[[nodiscard]] static
+auto encode_raw_float(const item& item) -> std::vector<std::byte> {
+	const auto chs          = item.header.channel_count.value;
+	const auto sample_count = item.header.frame_count.value * chs;
+	auto bytes  = std::vector<std::byte>(sample_count * sizeof(float));
+	auto frames = stream::frames::from(item);
+	auto pos    = size_t{0};
+	while (pos < sample_count) {
+		// Only whole frames are read, so this is advanced by what was read.
+		const auto n    = std::min(sample_count - pos, size_t{1 << 16} / chs * chs);
+		const auto read = frames.read_frames({reinterpret_cast<float*>(bytes.data()) + pos, n}).value;
+		if (read == 0) {
+			throw std::runtime_error{"Failed to read frames"};
+		}
+		pos += read * chs;
+	}
+	return bytes;
+}
+
+[[nodiscard]] static
+auto encode_audio_file(const item& item, storage_type type) -> std::vector<std::byte> {
+	if (item.header.format != format::wav && item.header.format != format::wavpack) {
+		throw std::runtime_error{"Sample bank blobs can only be encoded as WAV or WavPack"};
+	}
+	auto bytes = std::vector<std::byte>{};
+	auto in    = stream::frames::from(item);
+	auto out   = stream::bytes::to(&bytes);
+	audiorw::write(item.header, &in, &out, type);
+	return bytes;
+}
+
+} // audiorw::detail::bank
+
+namespace audiorw {
+
+sample_bank::sample_bank(const std::filesystem::path& path)
+	: file_{path}
+{
+	detail::bank::check_endianness();
+	const auto bytes = file_.get_bytes();
+	const auto fail  = [&path] { return std::runtime_error{std::format("Not a valid sample bank: '{}'", path.string())}; };
+	if (bytes.size() < sizeof(detail::bank::file_header)) {
+		throw fail();
+	}
+	auto fh = detail::bank::file_header{};
+	std::memcpy(&fh, bytes.data(), sizeof(fh));
+	if (std::memcmp(fh.magic, detail::bank::MAGIC, sizeof(fh.magic)) != 0 || fh.version != detail::bank::VERSION) {
+		throw fail();
+	}
+	const auto in_range = [size = bytes.size()](uint64_t offset, uint64_t length) { return offset <= size && length <= size - offset; };
+	if (!in_range(fh.index_offset, uint64_t{fh.entry_count} * sizeof(bank_entry)) ||
+	    !in_range(fh.blocks_offset, fh.block_count * sizeof(bank_block)) ||
+	    !in_range(fh.names_offset, fh.names_size) ||
+	    fh.index_offset % alignof(bank_entry) != 0 ||
+	    fh.blocks_offset % alignof(bank_block) != 0)
+	{
+		throw fail();
+	}
+	// The mapping is page-aligned and the offsets were checked above, so
+	// the tables are used where they are.
+	entries_ = {reinterpret_cast<const bank_entry*>(bytes.data() + fh.index_offset), fh.entry_count};
+	blocks_  = {reinterpret_cast<const bank_block*>(bytes.data() + fh.blocks_offset), size_t(fh.block_count)};
+	names_   = {reinterpret_cast<const char*>(bytes.data() + fh.names_offset), size_t(fh.names_size)};
+}
+
+auto sample_bank::find(std::string_view name) const -> const bank_entry* {
+	const auto less = [this](const bank_entry& entry, std::string_view name) { return get_name(entry) < name; };
+	const auto pos  = std::lower_bound(entries_.begin(), entries_.end(), name, less);
+	if (pos == entries_.end() || get_name(*pos) != name) {
+		return nullptr;
+	}
+	return &*pos;
+}
+
+auto sample_bank::get_blocks(const bank_entry& entry) const -> std::span<const bank_block> {
+	const auto first = entry.block_index_offset;
+	if (first > blocks_.size() || entry.block_count > blocks_.size() - first) {
+		throw std::runtime_error{"Sample bank entry is out of range"};
+	}
+	return blocks_.subspan(size_t(first), entry.block_count);
+}
+
+auto sample_bank::get_bytes(const bank_entry& entry) const -> std::span<const std::byte> {
+	const auto bytes = file_.get_bytes();
+	if (entry.offset > bytes.size() || entry.length > bytes.size() - entry.offset) {
+		throw std::runtime_error{"Sample bank entry is out of range"};
+	}
+	return bytes.subspan(size_t(entry.offset), size_t(entry.length));
+}
+
+auto sample_bank::get_header(const bank_entry& entry) const -> header {
+	auto out = header{};
+	out.format        = static_cast<audiorw::format>(entry.format);
+	out.channel_count = {entry.channel_count};
+	out.frame_count   = {entry.frame_count};
+	out.SR            = entry.SR;
+	out.bit_depth     = entry.bit_depth;
+	return out;
+}
+
+auto sample_bank::get_name(const bank_entry& entry) const -> std::string_view {
+	if (entry.name_offset > names_.size() || entry.name_size > names_.size() - entry.name_offset) {
+		throw std::runtime_error{"Sample bank entry is out of range"};
+	}
+	return names_.substr(size_t(entry.name_offset), entry.name_size);
+}
+
+auto sample_bank::read(const bank_entry& entry) const -> std::optional<item> {
+	const auto bytes = get_bytes(entry);
+	auto item = audiorw::item{};
+	auto out  = stream::item::to(&item);
+	switch (entry.blob) {
+		case bank_blob::raw_float: {
+			const auto header = get_header(entry);
+			if (bytes.size() != header.frame_count.value * header.channel_count.value * sizeof(float)) {
+				throw std::runtime_error{"Sample bank entry is out of range"};
+			}
+			out.write_header(header);
+			out.write_frames({reinterpret_cast<const float*>(bytes.data()), bytes.size() / sizeof(float)});
+			return std::move(item);
+		}
+		case bank_blob::audio_file: {
+			auto in = byte_input_stream{bytes};
+			if (audiorw::read(&in, &out, detail::bank::get_format_hint(static_cast<audiorw::format>(entry.format))) == operation_result::success) {
+				return std::move(item);
+			}
+			return std::nullopt;
+		}
+		default: {
+			throw std::runtime_error{"Invalid sample bank blob type"};
+		}
+	}
+}
+
+//########################################################################################
+
+sample_bank_writer::sample_bank_writer(const std::filesystem::path& path)
+	: path_{path}
+	, spool_path_{std::filesystem::path{path} += ".blobs.tmp"}
+	, spool_{spool_path_, detail::native_file::mode::write}
+{
+	detail::bank::check_endianness();
+}
+
+sample_bank_writer::~sample_bank_writer() {
+	if (spool_path_.empty()) {
+		return;
+	}
+	try {
+		spool_.close();
+		std::filesystem::remove(spool_path_);
+	}
+	catch (...) {}
+}
+
+auto sample_bank_writer::add(std::string name, const item& item, bank_blob blob, storage_type type) -> void {
+	switch (blob) {
+		case bank_blob::raw_float: {
+			auto header = item.header;
+			header.bit_depth = 32;
+			add_blob(std::move(name), header, blob, detail::bank::encode_raw_float(item));
+			return;
+		}
+		case bank_blob::audio_file: {
+			add_blob(std::move(name), item.header, blob, detail::bank::encode_audio_file(item, type));
+			return;
+		}
+		default: {
+			throw std::runtime_error{"Invalid sample bank blob type"};
+		}
+	}
+}
+
+auto sample_bank_writer::add(std::string name, const std::filesystem::path& file, format_hint hint) -> void {
+	const auto in    = detail::native_file{file, detail::native_file::mode::read};
+	auto bytes       = std::vector<std::byte>(in.get_size());
+	if (in.read_at(0, bytes) != bytes.size()) {
+		throw std::runtime_error{std::format("Failed to read file: '{}'", file.string())};
+	}
+	const auto header = stream_item_from_bytes{bytes, hint}.get_header();
+	add_blob(std::move(name), header, bank_blob::audio_file, bytes);
+}
+
+auto sample_bank_writer::add_blob(std::string name, const header& header, bank_blob blob, std::span<const std::byte> bytes) -> void {
+	auto pending = pending_entry{};
+	pending.entry               = {};
+	pending.entry.blob          = blob;
+	pending.entry.offset        = spool_size_;
+	pending.entry.length        = bytes.size();
+	pending.entry.frame_count   = header.frame_count.value;
+	pending.entry.format        = static_cast<uint32_t>(header.format);
+	pending.entry.channel_count = static_cast<uint32_t>(header.channel_count.value);
+	pending.entry.SR            = header.SR;
+	pending.entry.bit_depth     = header.bit_depth;
+	if (blob == bank_blob::audio_file && header.format == format::wavpack) {
+		pending.blocks = detail::bank::make_wavpack_block_index(bytes);
+	}
+	pending.name = std::move(name);
+	spool_.write_at(spool_size_, bytes);
+	spool_size_ = detail::bank::align_up(spool_size_ + bytes.size(), BANK_ALIGNMENT);
+	entries_.push_back(std::move(pending));
+}
+
+auto sample_bank_writer::commit() -> void {
+	std::ranges::sort(entries_, {}, &pending_entry::name);
+	const auto duplicate = std::ranges::adjacent_find(entries_, {}, &pending_entry::name);
+	if (duplicate != entries_.end()) {
+		throw std::runtime_error{std::format("Duplicate sample bank entry name: '{}'", duplicate->name)};
+	}
+	auto fh = detail::bank::file_header{};
+	std::memcpy(fh.magic, detail::bank::MAGIC, sizeof(fh.magic));
+	fh.version       = detail::bank::VERSION;
+	fh.entry_count   = static_cast<uint32_t>(entries_.size());
+	fh.index_offset  = sizeof(fh);
+	fh.blocks_offset = fh.index_offset + (entries_.size() * sizeof(bank_entry));
+	fh.alignment     = static_cast<uint32_t>(BANK_ALIGNMENT);
+	auto names = std::string{};
+	auto index = std::vector<bank_entry>{};
+	auto table = std::vector<bank_block>{};
+	for (auto& pending : entries_) {
+		pending.entry.name_offset        = names.size();
+		pending.entry.name_size          = static_cast<uint32_t>(pending.name.size());
+		pending.entry.block_index_offset = table.size();
+		pending.entry.block_count        = static_cast<uint32_t>(pending.blocks.size());
+		names += pending.name;
+		table.insert(table.end(), pending.blocks.begin(), pending.blocks.end());
+		index.push_back(pending.entry);
+	}
+	fh.block_count  = table.size();
+	fh.names_offset = fh.blocks_offset + (table.size() * sizeof(bank_block));
+	fh.names_size   = names.size();
+	const auto blobs_offset = detail::bank::align_up(fh.names_offset + fh.names_size, BANK_ALIGNMENT);
+	for (auto& entry : index) {
+		entry.offset += blobs_offset;
+	}
+	auto out = stream::bytes::to(path_);
+	auto write = [&out](const void* data, size_t size) {
+		out.write_bytes({static_cast<const std::byte*>(data), size});
+	};
+	write(&fh, sizeof(fh));
+	write(index.data(), index.size() * sizeof(bank_entry));
+	write(table.data(), table.size() * sizeof(bank_block));
+	write(names.data(), names.size());
+	const auto padding = std::vector<std::byte>(blobs_offset - (fh.names_offset + fh.names_size));
+	write(padding.data(), padding.size());
+	auto buffer = std::vector<std::byte>(detail::bank::COPY_BUFFER_SIZE);
+	for (auto pos = uint64_t{0}; pos < spool_size_;) {
+		const auto n = std::min<uint64_t>(buffer.size(), spool_size_ - pos);
+		// The spool file may be shorter than spool_size_ if the last blob
+		// wasn't a multiple of the alignment. The rest is zeroes.
+		const auto got = spool_.read_at(pos, {buffer.data(), size_t(n)});
+		std::fill(buffer.begin() + got, buffer.begin() + n, std::byte{0});
+		write(buffer.data(), size_t(n));
+		pos += n;
+	}
+	out.commit();
+}
+
+} // audiorw
@@ -0,0 +1,309 @@
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include "audiorw_batch.hpp"
+#if defined(__linux__)
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#endif
+
+namespace audiorw::detail {
+
+static constexpr auto HDD_IO_CONCURRENCY = size_t{1};
+// Files are read in pieces of this size so that a throttle sees
+// realistic operation sizes.
+static constexpr auto BATCH_READ_SIZE    = size_t{1 << 20};
+
+struct batch_device_queue {
+	size_t free_slots = 0;
+	// Indices of requests waiting for a slot, highest priority last.
+	std::vector<size_t> waiting;
+};
+
+struct batch {
+	batch(std::span<const read_many_request> requests, const read_many_options& options);
+	auto run() -> std::vector<read_many_result>;
+private:
+	auto should_abort() const -> bool;
+	auto schedule() -> void;
+	auto try_claim() -> std::optional<size_t>;
+	auto start_io(size_t index) -> void;
+	auto finish_io(size_t index) -> void;
+	auto decode(size_t index, std::vector<std::byte> bytes) -> void;
+	auto complete(size_t index) -> void;
+	std::span<const read_many_request> requests_;
+	const read_many_options& options_;
+	executor_ref executor_;
+	std::vector<read_many_result> results_;
+	std::vector<std::string> device_ids_;
+	std::mutex mutex_;
+	std::condition_variable done_;
+	std::map<std::string, batch_device_queue> devices_;
+	std::vector<size_t> sizes_;
+	size_t bytes_in_flight_ = 0;
+	// Set while a thread is in schedule().
+	bool scheduling_ = false;
+	size_t remaining_;
+};
+
+[[nodiscard]] static
+auto get_io_concurrency(storage_device device, const read_many_options& options, executor_ref executor) -> size_t {
+	if (options.max_io_concurrency) {
+		return std::max(*options.max_io_concurrency, size_t{1});
+	}
+	switch (device) {
+		case storage_device::hdd: { return HDD_IO_CONCURRENCY; }
+		default:                  { return std::max(executor.get_concurrency(), size_t{1}); }
+	}
+}
+
+[[nodiscard]] static
+auto get_hint(const read_many_request& request) -> format_hint {
+	if (request.hint) {
+		return *request.hint;
+	}
+	if (const auto hint = make_format_hint(request.path, true)) {
+		return *hint;
+	}
+	return format_hint::try_wav_first;
+}
+
+[[nodiscard]] static
+auto read_all_bytes(concepts::byte_input_stream auto* in) -> std::vector<std::byte> {
+	const auto bytes = in->get_length().value_or(0);
+	auto out         = std::vector<std::byte>(bytes);
+	for (size_t pos = 0; pos < bytes; pos += BATCH_READ_SIZE) {
+		const auto piece = std::span{out}.subspan(pos, std::min(BATCH_READ_SIZE, bytes - pos));
+		if (in->read_bytes(piece) != piece.size()) {
+			throw std::runtime_error{"Error reading file"};
+		}
+	}
+	return out;
+}
+
+[[nodiscard]] static
+auto read_all_bytes(const std::filesystem::path& path, const read_many_options& options) -> std::vector<std::byte> {
+	auto in = stream_bytes_from_fs_path{path};
+	if (options.throttle) {
+		auto throttled = stream::bytes::throttle(&in, options.throttle, options.throttle_class);
+		return read_all_bytes(&throttled);
+	}
+	return read_all_bytes(&in);
+}
+
+batch::batch(std::span<const read_many_request> requests, const read_many_options& options)
+	: requests_{requests}
+	, options_{options}
+	, executor_{executor_or_inline(options.executor)}
+	, results_(requests.size())
+	, remaining_{requests.size()}
+{
+	for (const auto& request : requests_) {
+		auto info = get_storage_device_info(request.path);
+		if (options_.device != storage_device::automatic) {
+			info.device = options_.device;
+		}
+		auto& device = devices_[info.id];
+		device.free_slots = get_io_concurrency(info.device, options_, executor_);
+		device_ids_.push_back(std::move(info.id));
+		auto ec = std::error_code{};
+		const auto size = std::filesystem::file_size(request.path, ec);
+		sizes_.push_back(ec ? 0 : size_t(size));
+	}
+	for (size_t i = 0; i < requests_.size(); i++) {
+		devices_[device_ids_[i]].waiting.push_back(i);
+	}
+	for (auto& [id, device] : devices_) {
+		std::ranges::stable_sort(device.waiting, [this](size_t a, size_t b) {
+			return requests_[a].priority > requests_[b].priority;
+		});
+		std::ranges::reverse(device.waiting);
+	}
+}
+
+auto batch::run() -> std::vector<read_many_result> {
+	schedule();
+	auto lock = std::unique_lock{mutex_};
+	done_.wait(lock, [this] { return remaining_ == 0; });
+	return std::move(results_);
+}
+
+auto batch::should_abort() const -> bool {
+	return options_.should_abort && options_.should_abort();
+}
+
+// Starts every request which has a free slot on its device and fits in the
+// byte budget. Only one thread does this at a time. Anyone else who frees a
+// slot or some of the budget while it's going leaves the rest to it, so
+// with an inline executor, where each request runs to completion inside
+// start_io(), the next one is started from this loop rather than by
+// recursing once per request.
+auto batch::schedule() -> void {
+	{
+		auto lock = std::unique_lock{mutex_};
+		if (scheduling_) {
+			return;
+		}
+		scheduling_ = true;
+	}
+	for (;;) {
+		auto index = std::optional<size_t>{};
+		{
+			auto lock = std::unique_lock{mutex_};
+			// Checking for work and giving up the loop happen under the same
+			// lock, so nothing freed by another thread in between is missed.
+			if (!(index = try_claim())) {
+				scheduling_ = false;
+				return;
+			}
+		}
+		// Tasks are never submitted while the lock is held because an inline
+		// executor runs them immediately.
+		start_io(*index);
+	}
+}
+
+// Takes the next request which can start now, if there is one. A file
+// bigger than the whole budget is still read, once nothing else is held.
+// The mutex must be held.
+auto batch::try_claim() -> std::optional<size_t> {
+	for (auto& [id, device] : devices_) {
+		if (device.free_slots == 0 || device.waiting.empty()) {
+			continue;
+		}
+		const auto index = device.waiting.back();
+		if (bytes_in_flight_ > 0 && bytes_in_flight_ + sizes_[index] > options_.max_bytes_in_flight) {
+			continue;
+		}
+		device.waiting.pop_back();
+		device.free_slots--;
+		bytes_in_flight_ += sizes_[index];
+		return index;
+	}
+	return std::nullopt;
+}
+
+auto batch::start_io(size_t index) -> void {
+	executor_.submit([this, index] {
+		auto bytes = std::vector<std::byte>{};
+		auto ok    = false;
+		if (!should_abort()) {
+			try {
+				bytes = read_all_bytes(requests_[index].path, options_);
+				ok    = true;
+			}
+			catch (...) {
+				results_[index].error = std::current_exception();
+			}
+		}
+		finish_io(index);
+		if (ok) {
+			executor_.submit([this, index, bytes = std::move(bytes)]() mutable {
+				decode(index, std::move(bytes));
+				complete(index);
+			}, requests_[index].priority);
+		}
+		else {
+			complete(index);
+		}
+	}, requests_[index].priority);
+}
+
+auto batch::finish_io(size_t index) -> void {
+	{
+		auto lock = std::unique_lock{mutex_};
+		devices_[device_ids_[index]].free_slots++;
+	}
+	schedule();
+}
+
+auto batch::decode(size_t index, std::vector<std::byte> bytes) -> void {
+	try {
+		auto item = audiorw::item{};
+		auto in   = byte_input_stream{bytes};
+		auto out  = stream::item::to(&item);
+		if (audiorw::read(&in, &out, get_hint(requests_[index]), [this] { return should_abort(); }) == operation_result::success) {
+			// The file was read before its format was known.
+			attribute_reads(item.header.format, 1, bytes.size());
+			results_[index].item = std::move(item);
+		}
+	}
+	catch (...) {
+		results_[index].error = std::current_exception();
+	}
+}
+
+auto batch::complete(size_t index) -> void {
+	// An exception from the callback would otherwise escape the task, and
+	// the batch would never finish.
+	try {
+		if (options_.on_complete) {
+			options_.on_complete(index, &results_[index]);
+		}
+	}
+	catch (...) {
+		if (!results_[index].error) {
+			results_[index].error = std::current_exception();
+		}
+	}
+	{
+		auto lock = std::unique_lock{mutex_};
+		bytes_in_flight_ -= sizes_[index];
+	}
+	schedule();
+	// Once the last request is counted, run() can return and the batch
+	// can go away, so nothing is touched after this.
+	auto lock = std::unique_lock{mutex_};
+	if (--remaining_ == 0) {
+		done_.notify_all();
+	}
+}
+
+auto get_storage_device_info(const std::filesystem::path& path) -> storage_device_info {
+#if defined(__linux__)
+	struct stat st;
+	if (::stat(path.c_str(), &st) != 0) {
+		return {};
+	}
+	auto info = storage_device_info{};
+	info.id   = std::to_string(major(st.st_dev)) + ":" + std::to_string(minor(st.st_dev));
+	// Partitions don't have a queue directory of their own, so the parent
+	// device is checked as well.
+	const auto dir = std::filesystem::path{"/sys/dev/block"} / info.id;
+	for (const auto& rotational : {dir / "queue" / "rotational", dir / ".." / "queue" / "rotational"}) {
+		auto file  = std::ifstream{rotational};
+		auto value = 0;
+		if (file >> value) {
+			info.device = value ? storage_device::hdd : storage_device::ssd;
+			break;
+		}
+	}
+	return info;
+#else
+	auto info = storage_device_info{};
+	info.id   = path.root_name().string();
+	return info;
+#endif
+}
+
+} // audiorw::detail
+
+namespace audiorw {
+
+auto read_many(std::span<const read_many_request> requests, const read_many_options& options) -> std::vector<read_many_result> {
+	if (requests.empty()) {
+		return {};
+	}
+	auto batch = detail::batch{requests, options};
+	return batch.run();
+}
+
+auto read_many(std::span<const std::filesystem::path> paths, const read_many_options& options) -> std::vector<read_many_result> {
+	auto requests = std::vector<read_many_request>{};
+	for (const auto& path : paths) {
+		requests.push_back({.path = path, .hint = std::nullopt, .priority = priority::normal});
+	}
+	return read_many(requests, options);
+}
+
+} // audiorw
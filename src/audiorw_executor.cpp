@@ -0,0 +1,251 @@
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <vector>
+#include "audiorw_executor.hpp"
+
+namespace audiorw {
+
+struct work_stealing_pool::impl {
+	struct prioritized_task {
+		int priority;
+		uint64_t seq;
+		task fn;
+	};
+	struct compare_priority {
+		// Higher priority first, then first come first served.
+		auto operator()(const prioritized_task& a, const prioritized_task& b) const -> bool {
+			if (a.priority != b.priority) { return a.priority < b.priority; }
+			return a.seq > b.seq;
+		}
+	};
+	struct worker_queue {
+		std::mutex mutex;
+		std::deque<task> tasks;
+	};
+	impl(size_t thread_count);
+	~impl();
+	auto submit(task fn, int priority) -> void;
+	auto get_thread_count() const -> size_t { return threads_.size(); }
+private:
+	auto run(size_t index) -> void;
+	auto take(size_t index) -> task;
+	auto try_take_local(size_t index) -> std::optional<task>;
+	auto try_take_shared(std::optional<int> min_priority) -> std::optional<task>;
+	auto try_steal(size_t index) -> std::optional<task>;
+	std::vector<std::unique_ptr<worker_queue>> queues_;
+	std::mutex shared_mutex_;
+	std::priority_queue<prioritized_task, std::vector<prioritized_task>, compare_priority> shared_;
+	uint64_t seq_ = 0;
+	std::mutex wake_mutex_;
+	std::condition_variable wake_;
+	// Number of submitted tasks which no worker has claimed yet.
+	size_t pending_ = 0;
+	bool stop_      = false;
+	std::vector<std::thread> threads_;
+};
+
+static thread_local const void* current_pool_   = nullptr;
+static thread_local size_t current_worker_index_ = 0;
+
+work_stealing_pool::impl::impl(size_t thread_count) {
+	thread_count = std::max(thread_count, size_t{1});
+	for (size_t i = 0; i < thread_count; i++) {
+		queues_.push_back(std::make_unique<worker_queue>());
+	}
+	for (size_t i = 0; i < thread_count; i++) {
+		threads_.emplace_back([this, i] { run(i); });
+	}
+}
+
+work_stealing_pool::impl::~impl() {
+	{
+		auto lock = std::unique_lock{wake_mutex_};
+		stop_ = true;
+	}
+	wake_.notify_all();
+	for (auto& thread : threads_) {
+		thread.join();
+	}
+}
+
+auto work_stealing_pool::impl::submit(task fn, int priority) -> void {
+	if (current_pool_ == this && priority == priority::normal) {
+		auto& queue = *queues_[current_worker_index_];
+		auto lock   = std::unique_lock{queue.mutex};
+		queue.tasks.push_back(std::move(fn));
+	}
+	else {
+		auto lock = std::unique_lock{shared_mutex_};
+		shared_.push({priority, seq_++, std::move(fn)});
+	}
+	{
+		auto lock = std::unique_lock{wake_mutex_};
+		pending_++;
+	}
+	wake_.notify_one();
+}
+
+auto work_stealing_pool::impl::run(size_t index) -> void {
+	current_pool_         = this;
+	current_worker_index_ = index;
+	for (;;) {
+		{
+			auto lock = std::unique_lock{wake_mutex_};
+			wake_.wait(lock, [this] { return stop_ || pending_ > 0; });
+			if (pending_ == 0) {
+				return;
+			}
+			pending_--;
+		}
+		// Tasks must not throw, see audiorw::task.
+		take(index)();
+	}
+}
+
+auto work_stealing_pool::impl::take(size_t index) -> task {
+	// A task has already been claimed from the pending count so one is
+	// guaranteed to be sitting in one of the queues.
+	for (;;) {
+		if (auto fn = try_take_shared(priority::normal + 1)) { return std::move(*fn); }
+		if (auto fn = try_take_local(index))                 { return std::move(*fn); }
+		if (auto fn = try_take_shared(std::nullopt))         { return std::move(*fn); }
+		if (auto fn = try_steal(index))                      { return std::move(*fn); }
+		std::this_thread::yield();
+	}
+}
+
+auto work_stealing_pool::impl::try_take_local(size_t index) -> std::optional<task> {
+	auto& queue = *queues_[index];
+	auto lock   = std::unique_lock{queue.mutex};
+	if (queue.tasks.empty()) {
+		return std::nullopt;
+	}
+	auto fn = std::move(queue.tasks.back());
+	queue.tasks.pop_back();
+	return fn;
+}
+
+auto work_stealing_pool::impl::try_take_shared(std::optional<int> min_priority) -> std::optional<task> {
+	auto lock = std::unique_lock{shared_mutex_};
+	if (shared_.empty()) {
+		return std::nullopt;
+	}
+	if (min_priority && shared_.top().priority < *min_priority) {
+		return std::nullopt;
+	}
+	// priority_queue::top() is const so the task has to be copied out.
+	auto fn = shared_.top().fn;
+	shared_.pop();
+	return fn;
+}
+
+auto work_stealing_pool::impl::try_steal(size_t index) -> std::optional<task> {
+	for (size_t i = 1; i < queues_.size(); i++) {
+		auto& queue = *queues_[(index + i) % queues_.size()];
+		auto lock   = std::unique_lock{queue.mutex};
+		if (!queue.tasks.empty()) {
+			auto fn = std::move(queue.tasks.front());
+			queue.tasks.pop_front();
+			return fn;
+		}
+	}
+	return std::nullopt;
+}
+
+work_stealing_pool::work_stealing_pool()
+	: work_stealing_pool{std::thread::hardware_concurrency()}
+{
+}
+
+work_stealing_pool::work_stealing_pool(size_t thread_count)
+	: impl_{std::make_unique<impl>(thread_count)}
+{
+}
+
+work_stealing_pool::~work_stealing_pool() = default;
+
+auto work_stealing_pool::submit(task fn) -> void {
+	impl_->submit(std::move(fn), priority::normal);
+}
+
+auto work_stealing_pool::submit(task fn, int priority) -> void {
+	impl_->submit(std::move(fn), priority);
+}
+
+auto work_stealing_pool::get_concurrency() const -> size_t {
+	return impl_->get_thread_count();
+}
+
+auto get_default_executor() -> executor_ref {
+	static auto pool = work_stealing_pool{};
+	return &pool;
+}
+
+} // audiorw
+
+namespace audiorw::detail {
+
+auto executor_or_inline(const std::optional<executor_ref>& executor) -> executor_ref {
+	static auto inline_ = inline_executor{};
+	return executor ? *executor : executor_ref{&inline_};
+}
+
+struct parallel_for_state {
+	std::function<void(size_t)> fn;
+	size_t count;
+	std::atomic<size_t> next = 0;
+	std::mutex mutex;
+	std::condition_variable done;
+	size_t completed = 0;
+	std::exception_ptr error;
+};
+
+static
+auto run_parallel_for_items(parallel_for_state* state) -> void {
+	for (;;) {
+		const auto index = state->next.fetch_add(1);
+		if (index >= state->count) {
+			return;
+		}
+		auto error = std::exception_ptr{};
+		try         { state->fn(index); }
+		catch (...) { error = std::current_exception(); }
+		auto lock = std::unique_lock{state->mutex};
+		if (error && !state->error) {
+			state->error = error;
+		}
+		if (++state->completed == state->count) {
+			state->done.notify_all();
+		}
+	}
+}
+
+auto parallel_for(executor_ref executor, size_t count, std::function<void(size_t)> fn, int priority) -> void {
+	if (count == 0) {
+		return;
+	}
+	auto state     = std::make_shared<parallel_for_state>();
+	state->fn      = std::move(fn);
+	state->count   = count;
+	const auto concurrency = std::max(executor.get_concurrency(), size_t{1});
+	const auto helpers     = std::min(count, concurrency) - 1;
+	for (size_t i = 0; i < helpers; i++) {
+		// Helpers which start after all the work has been claimed return
+		// immediately, so the state has to be kept alive by them.
+		executor.submit([state] { run_parallel_for_items(state.get()); }, priority);
+	}
+	run_parallel_for_items(state.get());
+	auto lock = std::unique_lock{state->mutex};
+	state->done.wait(lock, [&state] { return state->completed == state->count; });
+	if (state->error) {
+		std::rethrow_exception(state->error);
+	}
+}
+
+} // audiorw::detail
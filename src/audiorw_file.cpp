@@ -0,0 +1,495 @@
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <format>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include "audiorw_file.hpp"
+#if defined(_WIN32)
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+namespace audiorw::detail {
+
+static constexpr auto READ_THROUGH_BUFFER_SIZE = size_t{1 << 16};
+
+[[maybe_unused]] static
+auto read_through(const native_file& file, uint64_t offset, uint64_t length) -> void {
+	std::byte buffer[READ_THROUGH_BUFFER_SIZE];
+	for (auto pos = offset; pos < offset + length;) {
+		const auto n = file.read_at(pos, {buffer, size_t(std::min<uint64_t>(sizeof(buffer), offset + length - pos))});
+		if (n == 0) {
+			return;
+		}
+		pos += n;
+	}
+}
+
+#if defined(_WIN32)
+
+native_file::native_file(const std::filesystem::path& path, mode m) {
+	const auto access      = m == mode::write ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ;
+	const auto share       = FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE;
+	const auto disposition = m == mode::write ? CREATE_ALWAYS : OPEN_EXISTING;
+	const auto attributes  = m == mode::read_direct ? FILE_FLAG_NO_BUFFERING : FILE_ATTRIBUTE_NORMAL;
+	const auto handle      = CreateFileW(path.c_str(), access, share, nullptr, disposition, attributes, nullptr);
+	if (handle == INVALID_HANDLE_VALUE) {
+		throw std::runtime_error{std::format("Failed to open file: '{}'", path.string())};
+	}
+	handle_ = handle;
+}
+
+native_file::native_file(native_file&& rhs) noexcept
+	: handle_{std::exchange(rhs.handle_, nullptr)}
+{
+}
+
+native_file& native_file::operator=(native_file&& rhs) noexcept {
+	close();
+	handle_ = std::exchange(rhs.handle_, nullptr);
+	return *this;
+}
+
+auto native_file::is_open() const -> bool {
+	return handle_ != nullptr;
+}
+
+auto native_file::get_size() const -> uint64_t {
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(handle_, &size)) {
+		throw std::runtime_error{"Failed to get file size"};
+	}
+	return size.QuadPart;
+}
+
+auto native_file::read_at(uint64_t offset, std::span<std::byte> buffer) const -> size_t {
+	auto total = size_t{0};
+	while (total < buffer.size()) {
+		const auto piece = static_cast<DWORD>(std::min(buffer.size() - total, size_t{1} << 30));
+		auto overlapped       = OVERLAPPED{};
+		overlapped.Offset     = static_cast<DWORD>(offset + total);
+		overlapped.OffsetHigh = static_cast<DWORD>((offset + total) >> 32);
+		auto bytes_read = DWORD{0};
+		if (!ReadFile(handle_, buffer.data() + total, piece, &bytes_read, &overlapped)) {
+			if (GetLastError() == ERROR_HANDLE_EOF) {
+				break;
+			}
+			throw std::runtime_error{"Failed to read bytes"};
+		}
+		if (bytes_read == 0) {
+			break;
+		}
+		total += bytes_read;
+	}
+	return total;
+}
+
+auto native_file::read_some_at(uint64_t offset, std::span<std::byte> buffer) const -> size_t {
+	const auto piece = static_cast<DWORD>(std::min(buffer.size(), size_t{1} << 30));
+	auto overlapped       = OVERLAPPED{};
+	overlapped.Offset     = static_cast<DWORD>(offset);
+	overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+	auto bytes_read = DWORD{0};
+	if (!ReadFile(handle_, buffer.data(), piece, &bytes_read, &overlapped)) {
+		if (GetLastError() == ERROR_HANDLE_EOF) {
+			return 0;
+		}
+		throw std::runtime_error{"Failed to read bytes"};
+	}
+	return bytes_read;
+}
+
+auto native_file::write_at(uint64_t offset, std::span<const std::byte> buffer) -> void {
+	auto total = size_t{0};
+	while (total < buffer.size()) {
+		const auto piece = static_cast<DWORD>(std::min(buffer.size() - total, size_t{1} << 30));
+		auto overlapped       = OVERLAPPED{};
+		overlapped.Offset     = static_cast<DWORD>(offset + total);
+		overlapped.OffsetHigh = static_cast<DWORD>((offset + total) >> 32);
+		auto bytes_written = DWORD{0};
+		if (!WriteFile(handle_, buffer.data() + total, piece, &bytes_written, &overlapped)) {
+			throw std::runtime_error{"Failed to write bytes"};
+		}
+		total += bytes_written;
+	}
+}
+
+auto native_file::set_size(uint64_t size) -> void {
+	auto info = FILE_END_OF_FILE_INFO{};
+	info.EndOfFile.QuadPart = static_cast<LONGLONG>(size);
+	if (!SetFileInformationByHandle(handle_, FileEndOfFileInfo, &info, sizeof(info))) {
+		throw std::runtime_error{"Failed to set file size"};
+	}
+}
+
+auto native_file::will_need(uint64_t offset, uint64_t length) const -> void {
+	read_through(*this, offset, length);
+}
+
+auto native_file::dont_need(uint64_t offset, uint64_t length, bool write_back) const -> void {
+	// There's no way to ask for this on Windows.
+}
+
+auto native_file::close() -> void {
+	if (handle_) {
+		CloseHandle(handle_);
+		handle_ = nullptr;
+	}
+}
+
+#else
+
+native_file::native_file(const std::filesystem::path& path, mode m) {
+	auto flags = m == mode::write ? O_RDWR | O_CREAT | O_TRUNC : O_RDONLY;
+	if (m == mode::read_direct) {
+#if defined(O_DIRECT)
+		flags |= O_DIRECT;
+#elif !defined(__APPLE__)
+		throw std::runtime_error{"Direct I/O isn't supported on this platform"};
+#endif
+	}
+	fd_ = ::open(path.c_str(), flags | O_CLOEXEC, 0666);
+	if (fd_ < 0) {
+		throw std::runtime_error{std::format("Failed to open file: '{}'", path.string())};
+	}
+#if defined(__APPLE__)
+	if (m == mode::read_direct) {
+		::fcntl(fd_, F_NOCACHE, 1);
+	}
+#endif
+}
+
+native_file::native_file(native_file&& rhs) noexcept
+	: fd_{std::exchange(rhs.fd_, -1)}
+{
+}
+
+native_file& native_file::operator=(native_file&& rhs) noexcept {
+	close();
+	fd_ = std::exchange(rhs.fd_, -1);
+	return *this;
+}
+
+auto native_file::is_open() const -> bool {
+	return fd_ >= 0;
+}
+
+auto native_file::get_size() const -> uint64_t {
+	struct stat st;
+	if (::fstat(fd_, &st) != 0) {
+		throw std::runtime_error{"Failed to get file size"};
+	}
+	return st.st_size;
+}
+
+auto native_file::read_at(uint64_t offset, std::span<std::byte> buffer) const -> size_t {
+	auto total = size_t{0};
+	while (total < buffer.size()) {
+		const auto n = ::pread(fd_, buffer.data() + total, buffer.size() - total, offset + total);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			throw std::runtime_error{"Failed to read bytes"};
+		}
+		if (n == 0) {
+			break;
+		}
+		total += n;
+	}
+	return total;
+}
+
+auto native_file::read_some_at(uint64_t offset, std::span<std::byte> buffer) const -> size_t {
+	for (;;) {
+		const auto n = ::pread(fd_, buffer.data(), buffer.size(), offset);
+		if (n >= 0) {
+			return n;
+		}
+		if (errno != EINTR) {
+			throw std::runtime_error{"Failed to read bytes"};
+		}
+	}
+}
+
+auto native_file::write_at(uint64_t offset, std::span<const std::byte> buffer) -> void {
+	auto total = size_t{0};
+	while (total < buffer.size()) {
+		const auto n = ::pwrite(fd_, buffer.data() + total, buffer.size() - total, offset + total);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			throw std::runtime_error{"Failed to write bytes"};
+		}
+		total += n;
+	}
+}
+
+auto native_file::set_size(uint64_t size) -> void {
+	if (::ftruncate(fd_, size) != 0) {
+		throw std::runtime_error{"Failed to set file size"};
+	}
+}
+
+auto native_file::will_need(uint64_t offset, uint64_t length) const -> void {
+#if defined(__APPLE__)
+	auto advice = radvisory{};
+	advice.ra_offset = static_cast<off_t>(offset);
+	advice.ra_count  = static_cast<int>(std::min<uint64_t>(length, INT_MAX));
+	::fcntl(fd_, F_RDADVISE, &advice);
+#elif defined(POSIX_FADV_WILLNEED)
+	::posix_fadvise(fd_, static_cast<off_t>(offset), static_cast<off_t>(length), POSIX_FADV_WILLNEED);
+#else
+	read_through(*this, offset, length);
+#endif
+}
+
+auto native_file::dont_need(uint64_t offset, uint64_t length, bool write_back) const -> void {
+	if (write_back) {
+		// Dirty pages can't be dropped.
+#if defined(__linux__)
+		::sync_file_range(fd_, static_cast<off_t>(offset), static_cast<off_t>(length), SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+#else
+		::fsync(fd_);
+#endif
+	}
+#if defined(POSIX_FADV_DONTNEED)
+	::posix_fadvise(fd_, static_cast<off_t>(offset), static_cast<off_t>(length), POSIX_FADV_DONTNEED);
+#endif
+}
+
+auto native_file::close() -> void {
+	if (fd_ >= 0) {
+		::close(fd_);
+		fd_ = -1;
+	}
+}
+
+#endif
+
+native_file::~native_file() {
+	close();
+}
+
+//########################################################################################
+
+auto direct_file_reader::aligned_delete::operator()(std::byte* p) const -> void {
+	::operator delete[](p, std::align_val_t{DIRECT_IO_ALIGNMENT});
+}
+
+direct_file_reader::direct_file_reader(const std::filesystem::path& path)
+	: file_{path, native_file::mode::read_direct}
+	, buffer_{static_cast<std::byte*>(::operator new[](BUFFER_SIZE, std::align_val_t{DIRECT_IO_ALIGNMENT}))}
+	, size_{file_.get_size()}
+{
+}
+
+auto direct_file_reader::read_bytes(std::span<std::byte> buffer) -> size_t {
+	auto total = size_t{0};
+	while (total < buffer.size() && pos_ < size_) {
+		if (pos_ < buffer_offset_ || pos_ >= buffer_offset_ + buffer_size_) {
+			// Reads start on an aligned offset and cover the whole buffer.
+			// Only the read at the end of the file comes back short.
+			buffer_offset_ = pos_ - (pos_ % DIRECT_IO_ALIGNMENT);
+			buffer_size_   = file_.read_some_at(buffer_offset_, {buffer_.get(), BUFFER_SIZE});
+			if (pos_ >= buffer_offset_ + buffer_size_) {
+				break;
+			}
+		}
+		const auto available = size_t(buffer_offset_ + buffer_size_ - pos_);
+		const auto n         = std::min(buffer.size() - total, available);
+		std::copy_n(buffer_.get() + (pos_ - buffer_offset_), n, buffer.data() + total);
+		pos_  += n;
+		total += n;
+	}
+	return total;
+}
+
+//########################################################################################
+
+cache_dropper::cache_dropper(const std::filesystem::path& path, bool write_back)
+	: file_{path, native_file::mode::read}
+	, write_back_{write_back}
+{
+}
+
+cache_dropper::~cache_dropper() {
+	if (file_.is_open()) {
+		// Whatever is still dirty is left alone here. Writing it back
+		// would make abandoning a stream slow.
+		file_.dont_need(0, 0, false);
+	}
+}
+
+auto cache_dropper::count(uint64_t bytes) -> bool {
+	counted_ += bytes;
+	if (counted_ < INTERVAL) {
+		return false;
+	}
+	counted_ = 0;
+	return true;
+}
+
+auto cache_dropper::drop_behind(uint64_t pos) -> void {
+	if (pos < dropped_ + LAG) {
+		return;
+	}
+	const auto end = pos - LAG;
+	file_.dont_need(dropped_, end - dropped_, write_back_);
+	dropped_ = end;
+}
+
+auto cache_dropper::drop_all() -> void {
+	file_.dont_need(0, 0, write_back_);
+}
+
+//########################################################################################
+
+#if defined(__linux__)
+
+file_watch::file_watch(const std::filesystem::path& path)
+	: fd_{::inotify_init1(IN_NONBLOCK | IN_CLOEXEC)}
+{
+	if (fd_ >= 0 && ::inotify_add_watch(fd_, path.c_str(), IN_MODIFY | IN_CLOSE_WRITE) < 0) {
+		// Fall back to polling.
+		::close(fd_);
+		fd_ = -1;
+	}
+}
+
+file_watch::~file_watch() {
+	if (fd_ >= 0) {
+		::close(fd_);
+	}
+}
+
+auto file_watch::wait(std::chrono::milliseconds timeout) -> void {
+	if (fd_ < 0) {
+		std::this_thread::sleep_for(timeout);
+		return;
+	}
+	auto pfd   = pollfd{};
+	pfd.fd     = fd_;
+	pfd.events = POLLIN;
+	if (::poll(&pfd, 1, static_cast<int>(timeout.count())) > 0) {
+		// Drain the queued events. Which ones they were doesn't matter.
+		alignas(inotify_event) char buffer[4096];
+		while (::read(fd_, buffer, sizeof(buffer)) > 0) {}
+	}
+}
+
+#else
+
+file_watch::file_watch(const std::filesystem::path& path) {
+}
+
+file_watch::~file_watch() {
+}
+
+auto file_watch::wait(std::chrono::milliseconds timeout) -> void {
+	std::this_thread::sleep_for(timeout);
+}
+
+#endif
+
+file_watch::file_watch(file_watch&& rhs) noexcept
+	: fd_{std::exchange(rhs.fd_, -1)}
+{
+}
+
+file_watch& file_watch::operator=(file_watch&& rhs) noexcept {
+	std::swap(fd_, rhs.fd_);
+	return *this;
+}
+
+} // audiorw::detail
+
+namespace audiorw {
+
+#if defined(_WIN32)
+
+mapped_file::mapped_file(const std::filesystem::path& path) {
+	const auto file = detail::native_file{path, detail::native_file::mode::read};
+	const auto size = file.get_size();
+	if (size == 0) {
+		// Zero length files can't be mapped.
+		return;
+	}
+	const auto mapping = CreateFileMappingW(file.get_native_handle(), nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping) {
+		throw std::runtime_error{std::format("Failed to map file: '{}'", path.string())};
+	}
+	// The view keeps the mapping alive, and the mapping keeps the file open.
+	const auto view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+	if (!view) {
+		throw std::runtime_error{std::format("Failed to map file: '{}'", path.string())};
+	}
+	data_ = static_cast<const std::byte*>(view);
+	size_ = static_cast<size_t>(size);
+}
+
+auto mapped_file::unmap() -> void {
+	if (data_) {
+		UnmapViewOfFile(data_);
+	}
+}
+
+#else
+
+mapped_file::mapped_file(const std::filesystem::path& path) {
+	const auto file = detail::native_file{path, detail::native_file::mode::read};
+	const auto size = file.get_size();
+	if (size == 0) {
+		// Zero length files can't be mapped.
+		return;
+	}
+	// The mapping stays valid after the file is closed.
+	const auto addr = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, file.get_native_handle(), 0);
+	if (addr == MAP_FAILED) {
+		throw std::runtime_error{std::format("Failed to map file: '{}'", path.string())};
+	}
+	data_ = static_cast<const std::byte*>(addr);
+	size_ = static_cast<size_t>(size);
+}
+
+auto mapped_file::unmap() -> void {
+	if (data_) {
+		::munmap(const_cast<std::byte*>(data_), size_);
+	}
+}
+
+#endif
+
+mapped_file::mapped_file(mapped_file&& rhs) noexcept
+	: data_{std::exchange(rhs.data_, nullptr)}
+	, size_{std::exchange(rhs.size_, 0)}
+{
+}
+
+mapped_file& mapped_file::operator=(mapped_file&& rhs) noexcept {
+	unmap();
+	data_ = std::exchange(rhs.data_, nullptr);
+	size_ = std::exchange(rhs.size_, 0);
+	return *this;
+}
+
+mapped_file::~mapped_file() {
+	unmap();
+}
+
+} // audiorw
@@ -0,0 +1,1354 @@
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <numbers>
+#include <vector>
+#include "audiorw.hpp"
+#include "audiorw_md5.hpp"
+#include "audiorw_verify.hpp"
+
+namespace audiorw::detail::flac {
+
+// Settings for each compression level, modelled on the reference encoder's.
+struct level {
+	size_t block_size;
+	int max_lpc_order;
+	int max_partition_order;
+	bool stereo_decorrelation;
+	// Try every LPC order rather than the one the error estimate predicts.
+	bool exhaustive;
+};
+
+static constexpr level LEVELS[] = {
+	{1152,  0, 3, false, false},
+	{1152,  0, 3, true,  false},
+	{1152,  0, 3, true,  false},
+	{4096,  6, 4, false, false},
+	{4096,  8, 4, true,  false},
+	{4096,  8, 5, true,  false},
+	{4096,  8, 6, true,  false},
+	{4096, 12, 6, true,  true},
+	{4096, 12, 8, true,  true},
+};
+
+// Blocks are encoded in parallel this many at a time.
+static constexpr auto BLOCKS_PER_BATCH     = size_t{64};
+static constexpr auto SEEK_POINT_SECONDS   = uint64_t{10};
+static constexpr auto SEEK_POINT_SIZE      = size_t{18};
+static constexpr auto STREAMINFO_SIZE      = size_t{34};
+static constexpr auto MAX_FIXED_ORDER      = 4;
+static constexpr auto MIN_BIT_DEPTH        = 4;
+static constexpr auto MAX_BIT_DEPTH        = 24;
+static constexpr auto MAX_RICE_PARAM       = 14;
+static constexpr auto MAX_RICE2_PARAM      = 30;
+static constexpr auto MAX_RESIDUAL         = int64_t{1} << 30;
+static constexpr auto PLACEHOLDER_POINT    = ~uint64_t{0};
+
+enum class subframe_type { constant, verbatim, fixed, lpc };
+
+// Channel assignments from the frame header.
+static constexpr auto LEFT_SIDE  = uint32_t{8};
+static constexpr auto RIGHT_SIDE = uint32_t{9};
+static constexpr auto MID_SIDE   = uint32_t{10};
+
+[[nodiscard]] static constexpr
+auto make_crc8_table() -> std::array<uint8_t, 256> {
+	auto table = std::array<uint8_t, 256>{};
+	for (size_t i = 0; i < 256; i++) {
+		auto crc = uint8_t(i);
+		for (int bit = 0; bit < 8; bit++) {
+			crc = (crc & 0x80) ? uint8_t((crc << 1) ^ 0x07) : uint8_t(crc << 1);
+		}
+		table[i] = crc;
+	}
+	return table;
+}
+
+[[nodiscard]] static constexpr
+auto make_crc16_table() -> std::array<uint16_t, 256> {
+	auto table = std::array<uint16_t, 256>{};
+	for (size_t i = 0; i < 256; i++) {
+		auto crc = uint16_t(i << 8);
+		for (int bit = 0; bit < 8; bit++) {
+			crc = (crc & 0x8000) ? uint16_t((crc << 1) ^ 0x8005) : uint16_t(crc << 1);
+		}
+		table[i] = crc;
+	}
+	return table;
+}
+
+static constexpr auto CRC8_TABLE  = make_crc8_table();
+static constexpr auto CRC16_TABLE = make_crc16_table();
+
+[[nodiscard]] static
+auto crc8(std::span<const std::byte> bytes) -> uint8_t {
+	auto crc = uint8_t{0};
+	for (const auto b : bytes) {
+		crc = CRC8_TABLE[crc ^ std::to_integer<uint8_t>(b)];
+	}
+	return crc;
+}
+
+[[nodiscard]] static
+auto crc16(std::span<const std::byte> bytes) -> uint16_t {
+	auto crc = uint16_t{0};
+	for (const auto b : bytes) {
+		crc = uint16_t((crc << 8) ^ CRC16_TABLE[(crc >> 8) ^ std::to_integer<uint8_t>(b)]);
+	}
+	return crc;
+}
+
+struct bit_writer {
+	// At most 7 bits are left over from the last write, so this many can
+	// be written at once without overflowing.
+	static constexpr auto MAX_WRITE_BITS = 57;
+	std::vector<std::byte> bytes;
+	auto write(uint64_t value, int n) -> void {
+		if (n == 0) {
+			return;
+		}
+		acc_   = (acc_ << n) | (value & ((uint64_t{1} << n) - 1));
+		count_ += n;
+		while (count_ >= 8) {
+			count_ -= 8;
+			bytes.push_back(std::byte(uint8_t(acc_ >> count_)));
+		}
+	}
+	auto write_signed(int64_t value, int n) -> void {
+		write(uint64_t(value), n);
+	}
+	auto write_rice(uint32_t value, int k) -> void {
+		auto q = value >> k;
+		while (q >= 32) {
+			write(0, 32);
+			q -= 32;
+		}
+		const auto remainder = value & ((uint64_t{1} << k) - 1);
+		// With a large parameter the unary part and the remainder together
+		// can be more than write() takes at once.
+		if (int(q) + 1 + k <= MAX_WRITE_BITS) {
+			write((uint64_t{1} << k) | remainder, int(q) + 1 + k);
+		}
+		else {
+			write(1, int(q) + 1);
+			write(remainder, k);
+		}
+	}
+	auto align() -> void {
+		if (count_ > 0) {
+			write(0, 8 - count_);
+		}
+	}
+private:
+	uint64_t acc_ = 0;
+	int count_    = 0;
+};
+
+[[nodiscard]] static
+auto zigzag(int32_t r) -> uint32_t {
+	return (uint32_t(r) << 1) ^ uint32_t(r >> 31);
+}
+
+//########################################################################################
+// Residual coding
+
+struct rice_plan {
+	int partition_order = 0;
+	bool rice2          = false;
+	std::vector<uint8_t> params;
+	uint64_t bits       = 0;
+};
+
+[[nodiscard]] static
+auto get_rice_bits(uint64_t sum, uint64_t count, int k) -> uint64_t {
+	// sum >> k slightly overestimates the sum of the quotients, which is
+	// good enough for comparing parameters.
+	return (count * uint64_t(k + 1)) + (sum >> k);
+}
+
+[[nodiscard]] static
+auto choose_rice_param(uint64_t sum, uint64_t count) -> int {
+	if (count == 0 || sum == 0) {
+		return 0;
+	}
+	const auto mean = sum / count;
+	auto k = mean > 0 ? std::min(int(std::bit_width(mean)) - 1, MAX_RICE2_PARAM) : 0;
+	if (k < MAX_RICE2_PARAM && get_rice_bits(sum, count, k + 1) < get_rice_bits(sum, count, k)) {
+		k++;
+	}
+	return k;
+}
+
+// Picks the partition order and parameters that minimize the estimated
+// size. u holds the zigzagged residual, which starts at sample order.
+[[nodiscard]] static
+auto plan_rice(std::span<const uint32_t> u, size_t block_size, int order, int max_partition_order) -> rice_plan {
+	auto max_po = std::min(max_partition_order, int(std::countr_zero(block_size)));
+	while (max_po > 0 && (block_size >> max_po) <= size_t(order)) {
+		max_po--;
+	}
+	auto sums = std::vector<uint64_t>(size_t{1} << max_po);
+	const auto finest = block_size >> max_po;
+	for (size_t i = 0; i < u.size(); i++) {
+		sums[(i + order) / finest] += u[i];
+	}
+	auto best = rice_plan{};
+	best.bits = UINT64_MAX;
+	for (auto po = max_po; po >= 0; po--) {
+		const auto partitions = size_t{1} << po;
+		const auto size       = block_size >> po;
+		auto plan = rice_plan{po, false, std::vector<uint8_t>(partitions), 6};
+		for (size_t p = 0; p < partitions; p++) {
+			const auto count = size - (p == 0 ? size_t(order) : 0);
+			const auto k     = choose_rice_param(sums[p], count);
+			plan.params[p] = uint8_t(k);
+			plan.rice2     = plan.rice2 || k > MAX_RICE_PARAM;
+			plan.bits     += get_rice_bits(sums[p], count, k);
+		}
+		plan.bits += partitions * (plan.rice2 ? 5 : 4);
+		if (plan.bits < best.bits) {
+			best = std::move(plan);
+		}
+		// Merge pairs of partitions for the next coarser order.
+		for (size_t p = 0; p < partitions / 2; p++) {
+			sums[p] = sums[2 * p] + sums[(2 * p) + 1];
+		}
+	}
+	return best;
+}
+
+static
+auto write_residual(bit_writer* bw, std::span<const uint32_t> u, size_t block_size, int order, const rice_plan& plan) -> void {
+	bw->write(plan.rice2 ? 1 : 0, 2);
+	bw->write(uint64_t(plan.partition_order), 4);
+	const auto size = block_size >> plan.partition_order;
+	auto i = size_t{0};
+	for (size_t p = 0; p < plan.params.size(); p++) {
+		const auto k     = plan.params[p];
+		const auto count = size - (p == 0 ? size_t(order) : 0);
+		bw->write(k, plan.rice2 ? 5 : 4);
+		for (size_t j = 0; j < count; j++, i++) {
+			bw->write_rice(u[i], k);
+		}
+	}
+}
+
+//########################################################################################
+// Prediction
+
+struct subframe_plan {
+	subframe_type type = subframe_type::verbatim;
+	int order          = 0;
+	int precision      = 0;
+	int shift          = 0;
+	std::vector<int32_t> coefs;
+	std::vector<uint32_t> residual;
+	rice_plan rice;
+	uint64_t bits      = UINT64_MAX;
+};
+
+// Returns false if the residual gets too large to code.
+[[nodiscard]] static
+auto compute_fixed_residual(std::span<const int32_t> x, int order, std::vector<uint32_t>* u) -> bool {
+	u->resize(x.size() - order);
+	for (size_t i = order; i < x.size(); i++) {
+		auto r = int64_t{};
+		switch (order) {
+			case 0:  { r = x[i]; break; }
+			case 1:  { r = int64_t{x[i]} - x[i - 1]; break; }
+			case 2:  { r = int64_t{x[i]} - (2 * int64_t{x[i - 1]}) + x[i - 2]; break; }
+			case 3:  { r = int64_t{x[i]} - (3 * int64_t{x[i - 1]}) + (3 * int64_t{x[i - 2]}) - x[i - 3]; break; }
+			default: { r = int64_t{x[i]} - (4 * int64_t{x[i - 1]}) + (6 * int64_t{x[i - 2]}) - (4 * int64_t{x[i - 3]}) + x[i - 4]; break; }
+		}
+		if (r >= MAX_RESIDUAL || r <= -MAX_RESIDUAL) {
+			return false;
+		}
+		(*u)[i - order] = zigzag(int32_t(r));
+	}
+	return true;
+}
+
+[[nodiscard]] static
+auto compute_lpc_residual(std::span<const int32_t> x, std::span<const int32_t> coefs, int shift, std::vector<uint32_t>* u) -> bool {
+	const auto order = coefs.size();
+	u->resize(x.size() - order);
+	for (size_t i = order; i < x.size(); i++) {
+		auto sum = int64_t{0};
+		for (size_t j = 0; j < order; j++) {
+			sum += int64_t{coefs[j]} * x[i - j - 1];
+		}
+		const auto r = int64_t{x[i]} - (sum >> shift);
+		if (r >= MAX_RESIDUAL || r <= -MAX_RESIDUAL) {
+			return false;
+		}
+		(*u)[i - order] = zigzag(int32_t(r));
+	}
+	return true;
+}
+
+// A Tukey(0.5) window, as the reference encoder uses by default.
+[[nodiscard]] static
+auto make_window(size_t n) -> std::vector<double> {
+	auto w = std::vector<double>(n, 1.0);
+	const auto taper = size_t(0.25 * double(n));
+	for (size_t i = 0; i < taper; i++) {
+		const auto v = 0.5 - (0.5 * std::cos(std::numbers::pi * double(i) / double(taper)));
+		w[i]         = v;
+		w[n - 1 - i] = v;
+	}
+	return w;
+}
+
+// Levinson-Durbin recursion. Returns the coefficients and prediction error
+// for every order up to max_order, or nothing if the signal is silent.
+[[nodiscard]] static
+auto compute_lp_coefficients(std::span<const double> autoc, int max_order, std::vector<std::vector<double>>* coefs, std::vector<double>* errors) -> bool {
+	auto err = autoc[0];
+	if (err <= 0) {
+		return false;
+	}
+	auto lpc = std::vector<double>(max_order);
+	coefs->assign(max_order, {});
+	errors->assign(max_order, 0);
+	for (int i = 0; i < max_order; i++) {
+		auto r = -autoc[i + 1];
+		for (int j = 0; j < i; j++) {
+			r -= lpc[j] * autoc[i - j];
+		}
+		r /= err;
+		lpc[i] = r;
+		for (int j = 0; j < i / 2; j++) {
+			const auto tmp = lpc[j];
+			lpc[j]         += r * lpc[i - 1 - j];
+			lpc[i - 1 - j] += r * tmp;
+		}
+		if (i & 1) {
+			lpc[i / 2] += lpc[i / 2] * r;
+		}
+		err *= 1.0 - (r * r);
+		auto& out = (*coefs)[i];
+		out.resize(i + 1);
+		for (int j = 0; j <= i; j++) {
+			out[j] = -lpc[j];
+		}
+		(*errors)[i] = err;
+	}
+	return true;
+}
+
+// Returns false if the coefficients can't be represented.
+[[nodiscard]] static
+auto quantize_coefficients(std::span<const double> lp, int precision, std::vector<int32_t>* qlp, int* shift) -> bool {
+	const auto qmax = (1 << (precision - 1)) - 1;
+	const auto qmin = -(1 << (precision - 1));
+	auto cmax = 0.0;
+	for (const auto c : lp) {
+		cmax = std::max(cmax, std::abs(c));
+	}
+	if (cmax <= 0) {
+		return false;
+	}
+	int log2cmax;
+	std::frexp(cmax, &log2cmax);
+	*shift = std::min(15, (precision - 1) - log2cmax);
+	if (*shift < 0) {
+		return false;
+	}
+	qlp->resize(lp.size());
+	auto error = 0.0;
+	for (size_t i = 0; i < lp.size(); i++) {
+		error += lp[i] * double(1 << *shift);
+		const auto q = std::clamp(int32_t(std::lround(error)), qmin, qmax);
+		error -= q;
+		(*qlp)[i] = q;
+	}
+	return true;
+}
+
+[[nodiscard]] static
+auto estimate_bits_per_residual(double error, size_t samples) -> double {
+	if (error <= 0) {
+		return 0;
+	}
+	return std::max(0.0, 0.5 * std::log2(error * 0.5 / double(samples)));
+}
+
+[[nodiscard]] static
+auto get_precision(int bps, size_t block_size) -> int {
+	if (bps > 16) {
+		return 15;
+	}
+	return block_size <= 1152 ? 10 : block_size <= 2304 ? 11 : 12;
+}
+
+static
+auto consider(subframe_plan* best, subframe_plan* candidate) -> void {
+	if (candidate->bits < best->bits) {
+		std::swap(*best, *candidate);
+	}
+}
+
+[[nodiscard]] static
+auto plan_subframe(std::span<const int32_t> x, int bps, const level& settings) -> subframe_plan {
+	const auto n = x.size();
+	auto best = subframe_plan{};
+	best.type = subframe_type::verbatim;
+	best.bits = 8 + (uint64_t(n) * bps);
+	if (std::ranges::all_of(x, [v = x[0]](int32_t s) { return s == v; })) {
+		best.type = subframe_type::constant;
+		best.bits = 8 + bps;
+		return best;
+	}
+	auto candidate = subframe_plan{};
+	for (int order = 0; order <= MAX_FIXED_ORDER && size_t(order) < n; order++) {
+		candidate.type  = subframe_type::fixed;
+		candidate.order = order;
+		if (!compute_fixed_residual(x, order, &candidate.residual)) {
+			continue;
+		}
+		candidate.rice = plan_rice(candidate.residual, n, order, settings.max_partition_order);
+		candidate.bits = 8 + (uint64_t(order) * bps) + candidate.rice.bits;
+		consider(&best, &candidate);
+	}
+	const auto max_order = std::min(settings.max_lpc_order, int(n) - 1);
+	if (max_order <= 0) {
+		return best;
+	}
+	const auto window = make_window(n);
+	auto windowed = std::vector<double>(n);
+	for (size_t i = 0; i < n; i++) {
+		windowed[i] = double(x[i]) * window[i];
+	}
+	auto autoc = std::vector<double>(max_order + 1);
+	for (int lag = 0; lag <= max_order; lag++) {
+		auto sum = 0.0;
+		for (size_t i = lag; i < n; i++) {
+			sum += windowed[i] * windowed[i - lag];
+		}
+		autoc[lag] = sum;
+	}
+	auto lp     = std::vector<std::vector<double>>{};
+	auto errors = std::vector<double>{};
+	if (!compute_lp_coefficients(autoc, max_order, &lp, &errors)) {
+		return best;
+	}
+	const auto precision = get_precision(bps, n);
+	auto orders = std::vector<int>{};
+	if (settings.exhaustive) {
+		for (int order = 1; order <= max_order; order++) {
+			orders.push_back(order);
+		}
+	}
+	else {
+		auto best_order = 1;
+		auto best_bits  = std::numeric_limits<double>::max();
+		for (int order = 1; order <= max_order; order++) {
+			const auto bits = (estimate_bits_per_residual(errors[order - 1], n) * double(n - order)) + (double(order) * (bps + precision));
+			if (bits < best_bits) {
+				best_bits  = bits;
+				best_order = order;
+			}
+		}
+		orders.push_back(best_order);
+	}
+	for (const auto order : orders) {
+		candidate.type      = subframe_type::lpc;
+		candidate.order     = order;
+		candidate.precision = precision;
+		if (!quantize_coefficients(lp[order - 1], precision, &candidate.coefs, &candidate.shift)) {
+			continue;
+		}
+		if (!compute_lpc_residual(x, candidate.coefs, candidate.shift, &candidate.residual)) {
+			continue;
+		}
+		candidate.rice = plan_rice(candidate.residual, n, order, settings.max_partition_order);
+		candidate.bits = 8 + (uint64_t(order) * (bps + precision)) + 9 + candidate.rice.bits;
+		consider(&best, &candidate);
+	}
+	return best;
+}
+
+static
+auto write_subframe(bit_writer* bw, std::span<const int32_t> x, int bps, const subframe_plan& plan) -> void {
+	switch (plan.type) {
+		case subframe_type::constant: {
+			bw->write(0b00000000, 8);
+			bw->write_signed(x[0], bps);
+			return;
+		}
+		case subframe_type::verbatim: {
+			bw->write(0b00000010, 8);
+			for (const auto s : x) {
+				bw->write_signed(s, bps);
+			}
+			return;
+		}
+		case subframe_type::fixed: {
+			bw->write(uint64_t(0b00010000 | (plan.order << 1)), 8);
+			for (int i = 0; i < plan.order; i++) {
+				bw->write_signed(x[i], bps);
+			}
+			write_residual(bw, plan.residual, x.size(), plan.order, plan.rice);
+			return;
+		}
+		case subframe_type::lpc: {
+			bw->write(uint64_t(0b01000000 | ((plan.order - 1) << 1)), 8);
+			for (int i = 0; i < plan.order; i++) {
+				bw->write_signed(x[i], bps);
+			}
+			bw->write(uint64_t(plan.precision - 1), 4);
+			bw->write_signed(plan.shift, 5);
+			for (const auto c : plan.coefs) {
+				bw->write_signed(c, plan.precision);
+			}
+			write_residual(bw, plan.residual, x.size(), plan.order, plan.rice);
+			return;
+		}
+	}
+}
+
+//########################################################################################
+// Frames
+
+[[nodiscard]] static
+auto get_block_size_code(size_t block_size) -> uint32_t {
+	if (block_size == 192) {
+		return 1;
+	}
+	for (uint32_t k = 0; k < 4; k++) {
+		if (block_size == (size_t{576} << k)) {
+			return 2 + k;
+		}
+	}
+	for (uint32_t k = 0; k < 8; k++) {
+		if (block_size == (size_t{256} << k)) {
+			return 8 + k;
+		}
+	}
+	return block_size <= 256 ? 6 : 7;
+}
+
+[[nodiscard]] static
+auto get_sample_rate_code(int SR) -> uint32_t {
+	switch (SR) {
+		case 88200:  { return 1; }
+		case 176400: { return 2; }
+		case 192000: { return 3; }
+		case 8000:   { return 4; }
+		case 16000:  { return 5; }
+		case 22050:  { return 6; }
+		case 24000:  { return 7; }
+		case 32000:  { return 8; }
+		case 44100:  { return 9; }
+		case 48000:  { return 10; }
+		case 96000:  { return 11; }
+		// Taken from STREAMINFO.
+		default:     { return 0; }
+	}
+}
+
+[[nodiscard]] static
+auto get_sample_size_code(int bps) -> uint32_t {
+	switch (bps) {
+		case 8:  { return 1; }
+		case 12: { return 2; }
+		case 16: { return 4; }
+		case 20: { return 5; }
+		case 24: { return 6; }
+		default: { return 0; }
+	}
+}
+
+// Frame numbers are coded like UTF-8, extended to 31 bits.
+static
+auto write_frame_number(bit_writer* bw, uint64_t value) -> void {
+	if (value < 0x80) {
+		bw->write(value, 8);
+		return;
+	}
+	auto extra = 1;
+	while (extra < 5 && value >= (uint64_t{1} << (6 + (5 * extra)))) {
+		extra++;
+	}
+	// extra + 1 ones, then a zero.
+	bw->write(((uint64_t{1} << (extra + 1)) - 1) << 1, extra + 2);
+	bw->write(value >> (6 * extra), 6 - extra);
+	for (auto i = extra - 1; i >= 0; i--) {
+		bw->write(0x80 | ((value >> (6 * i)) & 0x3F), 8);
+	}
+}
+
+[[nodiscard]] static
+auto encode_frame(std::span<const std::vector<int32_t>> channels, int bps, int SR, uint64_t frame_number, const level& settings) -> std::vector<std::byte> {
+	const auto n   = channels[0].size();
+	const auto chs = channels.size();
+	auto plans      = std::vector<subframe_plan>(chs);
+	auto assignment = uint32_t(chs - 1);
+	auto side       = std::vector<int32_t>{};
+	auto mid        = std::vector<int32_t>{};
+	for (size_t c = 0; c < chs; c++) {
+		plans[c] = plan_subframe(channels[c], bps, settings);
+	}
+	if (chs == 2 && settings.stereo_decorrelation) {
+		side.resize(n);
+		mid.resize(n);
+		for (size_t i = 0; i < n; i++) {
+			side[i] = channels[0][i] - channels[1][i];
+			mid[i]  = int32_t((int64_t{channels[0][i]} + channels[1][i]) >> 1);
+		}
+		auto side_plan = plan_subframe(side, bps + 1, settings);
+		auto mid_plan  = plan_subframe(mid, bps, settings);
+		const auto independent = plans[0].bits + plans[1].bits;
+		const auto left_side   = plans[0].bits + side_plan.bits;
+		const auto right_side  = plans[1].bits + side_plan.bits;
+		const auto mid_side    = mid_plan.bits + side_plan.bits;
+		const auto smallest    = std::min({independent, left_side, right_side, mid_side});
+		if (smallest == mid_side) {
+			assignment = MID_SIDE;
+			plans[0]   = std::move(mid_plan);
+			plans[1]   = std::move(side_plan);
+		}
+		else if (smallest == left_side) {
+			assignment = LEFT_SIDE;
+			plans[1]   = std::move(side_plan);
+		}
+		else if (smallest == right_side) {
+			// The side channel comes first.
+			assignment = RIGHT_SIDE;
+			plans[0]   = std::move(side_plan);
+		}
+	}
+	auto bw = bit_writer{};
+	const auto block_size_code = get_block_size_code(n);
+	bw.write(0xFFF8, 16);
+	bw.write(block_size_code, 4);
+	bw.write(get_sample_rate_code(SR), 4);
+	bw.write(assignment, 4);
+	bw.write(get_sample_size_code(bps), 3);
+	bw.write(0, 1);
+	write_frame_number(&bw, frame_number);
+	if (block_size_code == 6) { bw.write(n - 1, 8); }
+	if (block_size_code == 7) { bw.write(n - 1, 16); }
+	bw.write(crc8(bw.bytes), 8);
+	const auto write_channel = [&](size_t c, std::span<const int32_t> x, int channel_bps) {
+		write_subframe(&bw, x, channel_bps, plans[c]);
+	};
+	switch (assignment) {
+		case LEFT_SIDE:  { write_channel(0, channels[0], bps); write_channel(1, side, bps + 1); break; }
+		case RIGHT_SIDE: { write_channel(0, side, bps + 1); write_channel(1, channels[1], bps); break; }
+		case MID_SIDE:   { write_channel(0, mid, bps); write_channel(1, side, bps + 1); break; }
+		default: {
+			for (size_t c = 0; c < chs; c++) {
+				write_channel(c, channels[c], bps);
+			}
+			break;
+		}
+	}
+	bw.align();
+	bw.write(crc16(bw.bytes), 16);
+	return std::move(bw.bytes);
+}
+
+//########################################################################################
+
+[[nodiscard]] static
+auto quantize(float x, int bps) -> int32_t {
+	const auto scale = float((int32_t{1} << (bps - 1)) - 1);
+	return int32_t(std::lrint(std::clamp(x, -1.0f, 1.0f) * scale));
+}
+
+template <typename T>
+static
+auto store_be(std::byte* p, T value, size_t bytes) -> void {
+	for (size_t i = 0; i < bytes; i++) {
+		p[i] = std::byte(uint8_t(uint64_t(value) >> (8 * (bytes - 1 - i))));
+	}
+}
+
+struct seek_point {
+	uint64_t sample = PLACEHOLDER_POINT;
+	uint64_t offset = 0;
+	uint16_t frames = 0;
+};
+
+} // audiorw::detail::flac
+
+namespace audiorw::detail {
+
+struct flac_encoder::impl {
+	audiorw::header header;
+	flac::level settings;
+	executor_ref executor;
+	int bps;
+	size_t chs;
+	md5 hash;
+	uint64_t frames_encoded = 0;
+	uint64_t frame_number   = 0;
+	// Offset of the next frame from the first.
+	uint64_t offset         = 0;
+	uint32_t min_frame_size = UINT32_MAX;
+	uint32_t max_frame_size = 0;
+	std::vector<flac::seek_point> seek_points;
+	size_t next_seek_point  = 0;
+	uint64_t seek_interval  = 0;
+	std::optional<md5_digest> digest;
+	std::vector<std::vector<std::byte>> encoded_blocks;
+	std::vector<std::byte> out;
+	std::vector<std::byte> metadata;
+	auto make_metadata() -> void {
+		const auto has_seektable = !seek_points.empty();
+		metadata.assign(4 + 4 + flac::STREAMINFO_SIZE + (has_seektable ? 4 + (seek_points.size() * flac::SEEK_POINT_SIZE) : 0), std::byte{0});
+		auto p = metadata.data();
+		std::memcpy(p, "fLaC", 4);
+		p += 4;
+		p[0] = std::byte(has_seektable ? 0x00 : 0x80);
+		flac::store_be(p + 1, flac::STREAMINFO_SIZE, 3);
+		p += 4;
+		// Bits: min/max block size (16 each), min/max frame size (24 each),
+		// then sample rate (20), channels - 1 (3), bits per sample - 1 (5)
+		// and total samples (36), then the MD5.
+		flac::store_be(p, settings.block_size, 2);
+		flac::store_be(p + 2, settings.block_size, 2);
+		if (max_frame_size > 0) {
+			flac::store_be(p + 4, min_frame_size, 3);
+			flac::store_be(p + 7, max_frame_size, 3);
+		}
+		const auto packed = (uint64_t(header.SR) << 44) | (uint64_t(chs - 1) << 41) | (uint64_t(bps - 1) << 36) | (header.frame_count.value & 0xFFFFFFFFF);
+		flac::store_be(p + 10, packed, 8);
+		if (digest) {
+			std::memcpy(p + 18, digest->data(), digest->size());
+		}
+		p += flac::STREAMINFO_SIZE;
+		if (!has_seektable) {
+			return;
+		}
+		p[0] = std::byte{0x80 | 3};
+		flac::store_be(p + 1, seek_points.size() * flac::SEEK_POINT_SIZE, 3);
+		p += 4;
+		for (const auto& point : seek_points) {
+			flac::store_be(p, point.sample, 8);
+			flac::store_be(p + 8, point.offset, 8);
+			flac::store_be(p + 16, point.frames, 2);
+			p += flac::SEEK_POINT_SIZE;
+		}
+	}
+	auto add_frame(uint64_t first_sample, size_t frames, size_t size) -> void {
+		while (next_seek_point < seek_points.size() && next_seek_point * seek_interval < first_sample + frames) {
+			seek_points[next_seek_point++] = {first_sample, offset, uint16_t(frames)};
+		}
+		min_frame_size = std::min(min_frame_size, uint32_t(size));
+		max_frame_size = std::max(max_frame_size, uint32_t(size));
+		offset += size;
+	}
+};
+
+flac_encoder::flac_encoder(const audiorw::header& header, const flac_options& options)
+	: impl_{std::make_unique<impl>(header, flac::LEVELS[std::clamp(options.compression_level, 0, 8)], executor_or_inline(options.executor), std::min(header.bit_depth, flac::MAX_BIT_DEPTH), size_t(header.channel_count.value))}
+{
+	if (impl_->bps < flac::MIN_BIT_DEPTH) {
+		throw std::runtime_error{std::format("FLAC can't be written with a bit depth of {}", impl_->bps)};
+	}
+	if (impl_->chs < 1 || impl_->chs > 8) {
+		throw std::runtime_error{std::format("FLAC can't be written with {} channels", impl_->chs)};
+	}
+	if (header.SR <= 0 || header.SR >= (1 << 20)) {
+		throw std::runtime_error{std::format("FLAC can't be written with a sample rate of {}", header.SR)};
+	}
+	const auto total = header.frame_count.value;
+	impl_->seek_interval = uint64_t(header.SR) * flac::SEEK_POINT_SECONDS;
+	impl_->seek_points.resize(total > 0 ? ((total - 1) / impl_->seek_interval) + 1 : 0);
+	impl_->make_metadata();
+}
+
+flac_encoder::flac_encoder(flac_encoder&& rhs) noexcept = default;
+flac_encoder::~flac_encoder() = default;
+
+auto flac_encoder::get_batch_frames() const -> size_t {
+	return impl_->settings.block_size * flac::BLOCKS_PER_BATCH;
+}
+
+auto flac_encoder::get_metadata() const -> std::span<const std::byte> {
+	return impl_->metadata;
+}
+
+auto flac_encoder::encode(std::span<const float> buffer) -> std::span<const std::byte> {
+	auto& x            = *impl_;
+	const auto frames  = buffer.size() / x.chs;
+	const auto block   = x.settings.block_size;
+	const auto blocks  = (frames + block - 1) / block;
+	const auto md5_job = blocks;
+	x.encoded_blocks.resize(blocks);
+	// The MD5 is of the samples as little endian integers. It can only be
+	// computed in order, so it is one more job alongside the blocks.
+	parallel_for(x.executor, blocks + 1, [&](size_t job) {
+		if (job == md5_job) {
+			const auto bytes_per_sample = size_t(x.bps + 7) / 8;
+			auto bytes = std::vector<std::byte>(buffer.size() * bytes_per_sample);
+			for (size_t i = 0; i < buffer.size(); i++) {
+				const auto value = uint32_t(flac::quantize(buffer[i], x.bps));
+				for (size_t b = 0; b < bytes_per_sample; b++) {
+					bytes[(i * bytes_per_sample) + b] = std::byte(uint8_t(value >> (8 * b)));
+				}
+			}
+			x.hash.update(bytes);
+			return;
+		}
+		const auto start = job * block;
+		const auto n     = std::min(block, frames - start);
+		auto channels = std::vector<std::vector<int32_t>>(x.chs, std::vector<int32_t>(n));
+		for (size_t i = 0; i < n; i++) {
+			for (size_t c = 0; c < x.chs; c++) {
+				channels[c][i] = flac::quantize(buffer[((start + i) * x.chs) + c], x.bps);
+			}
+		}
+		x.encoded_blocks[job] = flac::encode_frame(channels, x.bps, x.header.SR, x.frame_number + job, x.settings);
+	});
+	x.out.clear();
+	for (size_t b = 0; b < blocks; b++) {
+		const auto& bytes = x.encoded_blocks[b];
+		x.add_frame(x.frames_encoded + (b * block), std::min(block, frames - (b * block)), bytes.size());
+		x.out.insert(x.out.end(), bytes.begin(), bytes.end());
+	}
+	x.frame_number   += blocks;
+	x.frames_encoded += frames;
+	return x.out;
+}
+
+auto flac_encoder::finish() -> std::span<const std::byte> {
+	impl_->digest = impl_->hash.finish();
+	impl_->make_metadata();
+	return impl_->metadata;
+}
+
+} // audiorw::detail
+
+namespace audiorw::detail::flac {
+
+//########################################################################################
+// Decoding, for verify(). Frames are decoded to integers, checked against
+// their CRCs and the MD5, and thrown away.
+
+static constexpr auto VERIFY_READ_SIZE = size_t{1} << 20;
+static constexpr auto MAX_LPC_ORDER    = 32;
+// "fLaC"
+static constexpr auto STREAM_MARKER    = uint32_t{0x664C6143};
+
+struct stream_info {
+	size_t chs = 0;
+	int bps    = 0;
+	uint64_t total = 0;
+	md5_digest md5 = {};
+};
+
+// Reads bits MSB first. Bytes are only fetched as they are needed, so
+// the running CRCs cover exactly the bytes consumed so far. Past the end
+// of the stream it reads zeros and eof() is set.
+struct bit_reader {
+	// The stream is at offset start.
+	bit_reader(byte_stream_reader stream, void* user_data, uint64_t start)
+		: stream_{stream}
+		, user_data_{user_data}
+		, buffer_offset_{start}
+	{
+		buffer_.resize(VERIFY_READ_SIZE);
+	}
+	[[nodiscard]] auto at_end() -> bool { return count_ == 0 && !fill(); }
+	[[nodiscard]] auto eof() const -> bool { return eof_; }
+	[[nodiscard]] auto crc8() const -> uint8_t { return crc8_; }
+	[[nodiscard]] auto crc16() const -> uint16_t { return crc16_; }
+	// The CRCs start again from the given sync code, as if it had just
+	// been read.
+	auto restart_crc(uint32_t sync) -> void {
+		crc8_  = 0;
+		crc16_ = 0;
+		update_crc(uint8_t(sync >> 8));
+		update_crc(uint8_t(sync));
+	}
+	// Up to 32 bits.
+	[[nodiscard]] auto read(int n) -> uint32_t {
+		if (n == 0) {
+			return 0;
+		}
+		while (count_ < n) {
+			acc_    = (acc_ << 8) | next_byte();
+			count_ += 8;
+		}
+		count_ -= n;
+		return uint32_t((acc_ >> count_) & ((uint64_t{1} << n) - 1));
+	}
+	// Up to 33 bits, for the side channel of 32 bit audio.
+	[[nodiscard]] auto read_signed(int n) -> int64_t {
+		if (n == 0) {
+			return 0;
+		}
+		const auto value = n > 32 ? (uint64_t(read(n - 32)) << 32) | read(32) : uint64_t(read(n));
+		return int64_t(value << (64 - n)) >> (64 - n);
+	}
+	[[nodiscard]] auto read_unary() -> uint32_t {
+		auto zeros = uint32_t{0};
+		for (;;) {
+			const auto rest = acc_ & ((uint64_t{1} << count_) - 1);
+			if (rest != 0) {
+				const auto leading = count_ - std::bit_width(rest);
+				count_ -= leading + 1;
+				return zeros + uint32_t(leading);
+			}
+			zeros  += uint32_t(count_);
+			acc_    = next_byte();
+			count_  = 8;
+			if (eof_) {
+				return zeros;
+			}
+		}
+	}
+	[[nodiscard]] auto read_rice(int k) -> int64_t {
+		const auto q = uint64_t(read_unary());
+		const auto u = (q << k) | read(k);
+		return int64_t(u >> 1) ^ -int64_t(u & 1);
+	}
+	auto align() -> void {
+		count_ -= count_ % 8;
+	}
+	// Offset in the stream of the next byte, once aligned.
+	[[nodiscard]] auto get_byte_pos() const -> uint64_t {
+		return buffer_offset_ + pos_ - uint64_t(count_ / 8);
+	}
+	// Goes to a byte offset in the stream, from the buffer if it's there.
+	auto seek(uint64_t offset) -> void {
+		acc_   = 0;
+		count_ = 0;
+		eof_   = false;
+		if (offset >= buffer_offset_ && offset <= buffer_offset_ + end_) {
+			pos_ = size_t(offset - buffer_offset_);
+			return;
+		}
+		if (!stream_.seek(user_data_, offset)) {
+			throw std::runtime_error{"Failed to seek"};
+		}
+		buffer_offset_ = offset;
+		pos_           = 0;
+		end_           = 0;
+	}
+private:
+	auto fill() -> bool {
+		if (pos_ < end_) {
+			return true;
+		}
+		buffer_offset_ += end_;
+		pos_ = 0;
+		end_ = stream_.read_bytes(user_data_, {buffer_.data(), buffer_.size()});
+		return end_ > 0;
+	}
+	auto next_byte() -> uint8_t {
+		if (!fill()) {
+			eof_ = true;
+			return 0;
+		}
+		const auto b = std::to_integer<uint8_t>(buffer_[pos_++]);
+		update_crc(b);
+		return b;
+	}
+	auto update_crc(uint8_t b) -> void {
+		crc8_  = CRC8_TABLE[crc8_ ^ b];
+		crc16_ = uint16_t((crc16_ << 8) ^ CRC16_TABLE[(crc16_ >> 8) ^ b]);
+	}
+	byte_stream_reader stream_;
+	void* user_data_;
+	tracked_buffer<std::byte> buffer_{memory_category::io};
+	// Offset in the stream of buffer_[0].
+	uint64_t buffer_offset_ = 0;
+	size_t pos_             = 0;
+	size_t end_             = 0;
+	uint64_t acc_           = 0;
+	int count_              = 0;
+	uint8_t crc8_           = 0;
+	uint16_t crc16_         = 0;
+	bool eof_               = false;
+};
+
+struct frame_header {
+	size_t block_size   = 0;
+	uint32_t assignment = 0;
+	size_t chs          = 0;
+	int bps             = 0;
+};
+
+[[nodiscard]] static
+auto read_metadata(bit_reader* br) -> std::optional<stream_info> {
+	if (br->read(32) != STREAM_MARKER) {
+		return std::nullopt;
+	}
+	auto info = std::optional<stream_info>{};
+	for (;;) {
+		const auto last = br->read(1);
+		const auto type = br->read(7);
+		const auto size = br->read(24);
+		if (type == 0 && size == STREAMINFO_SIZE) {
+			// Block and frame sizes.
+			(void)br->read(16);
+			(void)br->read(16);
+			(void)br->read(24);
+			(void)br->read(24);
+			// Sample rate.
+			(void)br->read(20);
+			info        = stream_info{};
+			info->chs   = br->read(3) + 1;
+			info->bps   = int(br->read(5)) + 1;
+			info->total = (uint64_t(br->read(4)) << 32) | br->read(32);
+			for (auto& b : info->md5) {
+				b = uint8_t(br->read(8));
+			}
+		}
+		else {
+			for (uint32_t i = 0; i < size; i++) {
+				(void)br->read(8);
+			}
+		}
+		if (br->eof()) {
+			return std::nullopt;
+		}
+		if (last) {
+			return info;
+		}
+	}
+}
+
+// The inverse of write_frame_number().
+[[nodiscard]] static
+auto read_frame_number(bit_reader* br) -> std::optional<uint64_t> {
+	const auto first = br->read(8);
+	if (first < 0x80) {
+		return first;
+	}
+	const auto extra = std::countl_one(uint8_t(first)) - 1;
+	if (extra < 1 || extra > 6) {
+		return std::nullopt;
+	}
+	auto value = uint64_t(first & (0x3F >> extra));
+	for (int i = 0; i < extra; i++) {
+		const auto b = br->read(8);
+		if ((b & 0xC0) != 0x80) {
+			return std::nullopt;
+		}
+		value = (value << 6) | (b & 0x3F);
+	}
+	return value;
+}
+
+// Reads the rest of a frame header after its sync code.
+[[nodiscard]] static
+auto read_frame_header(bit_reader* br, const stream_info& info) -> std::optional<frame_header> {
+	static constexpr int SAMPLE_SIZES[] = {0, 8, 12, 0, 16, 20, 24, 32};
+	auto out = frame_header{};
+	const auto codes            = br->read(16);
+	const auto block_size_code  = codes >> 12;
+	const auto sample_rate_code = (codes >> 8) & 0xF;
+	const auto sample_size_code = (codes >> 1) & 0x7;
+	out.assignment              = (codes >> 4) & 0xF;
+	if ((codes & 1) || block_size_code == 0 || sample_rate_code == 0xF || out.assignment > MID_SIDE || sample_size_code == 3) {
+		return std::nullopt;
+	}
+	if (!read_frame_number(br)) {
+		return std::nullopt;
+	}
+	switch (block_size_code) {
+		case 1:  { out.block_size = 192; break; }
+		case 6:  { out.block_size = size_t(br->read(8)) + 1; break; }
+		case 7:  { out.block_size = size_t(br->read(16)) + 1; break; }
+		default: { out.block_size = block_size_code < 6 ? size_t{576} << (block_size_code - 2) : size_t{256} << (block_size_code - 8); break; }
+	}
+	switch (sample_rate_code) {
+		case 12: { (void)br->read(8); break; }
+		case 13: { (void)br->read(16); break; }
+		case 14: { (void)br->read(16); break; }
+		default: { break; }
+	}
+	out.bps = sample_size_code == 0 ? info.bps : SAMPLE_SIZES[sample_size_code];
+	out.chs = out.assignment < LEFT_SIDE ? size_t(out.assignment) + 1 : 2;
+	const auto crc = br->crc8();
+	if (br->read(8) != crc || br->eof()) {
+		return std::nullopt;
+	}
+	return out;
+}
+
+// Residuals are read into x after the order warm-up samples.
+[[nodiscard]] static
+auto read_residual(bit_reader* br, std::span<int64_t> x, int order) -> bool {
+	const auto method = br->read(2);
+	if (method > 1) {
+		return false;
+	}
+	const auto param_bits      = method == 0 ? 4 : 5;
+	const auto escape          = method == 0 ? uint32_t{15} : uint32_t{31};
+	const auto partition_order = br->read(4);
+	const auto partition_size  = x.size() >> partition_order;
+	if ((partition_size << partition_order) != x.size() || partition_size < size_t(order)) {
+		return false;
+	}
+	auto pos = size_t(order);
+	for (size_t end = partition_size; end <= x.size(); end += partition_size) {
+		const auto k = br->read(param_bits);
+		if (k == escape) {
+			const auto bits = int(br->read(5));
+			for (; pos < end; pos++) {
+				x[pos] = br->read_signed(bits);
+			}
+		}
+		else {
+			for (; pos < end; pos++) {
+				x[pos] = br->read_rice(int(k));
+			}
+		}
+		if (br->eof()) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static
+auto restore_fixed(std::span<int64_t> x, int order) -> void {
+	for (size_t i = order; i < x.size(); i++) {
+		switch (order) {
+			case 1:  { x[i] += x[i - 1]; break; }
+			case 2:  { x[i] += (2 * x[i - 1]) - x[i - 2]; break; }
+			case 3:  { x[i] += (3 * x[i - 1]) - (3 * x[i - 2]) + x[i - 3]; break; }
+			case 4:  { x[i] += (4 * x[i - 1]) - (6 * x[i - 2]) + (4 * x[i - 3]) - x[i - 4]; break; }
+			default: { return; }
+		}
+	}
+}
+
+[[nodiscard]] static
+auto read_warmup(bit_reader* br, std::span<int64_t> x, int order, int bps) -> bool {
+	if (x.size() < size_t(order)) {
+		return false;
+	}
+	for (int i = 0; i < order; i++) {
+		x[i] = br->read_signed(bps);
+	}
+	return true;
+}
+
+[[nodiscard]] static
+auto read_lpc_subframe(bit_reader* br, std::span<int64_t> x, int order, int bps) -> bool {
+	if (!read_warmup(br, x, order, bps)) {
+		return false;
+	}
+	const auto precision = int(br->read(4)) + 1;
+	const auto shift     = int(br->read_signed(5));
+	if (precision == 16 || shift < 0) {
+		return false;
+	}
+	auto coefs = std::array<int64_t, MAX_LPC_ORDER>{};
+	for (int j = 0; j < order; j++) {
+		coefs[j] = br->read_signed(precision);
+	}
+	if (!read_residual(br, x, order)) {
+		return false;
+	}
+	for (size_t i = order; i < x.size(); i++) {
+		auto sum = int64_t{0};
+		for (int j = 0; j < order; j++) {
+			sum += coefs[j] * x[i - 1 - j];
+		}
+		x[i] += sum >> shift;
+	}
+	return true;
+}
+
+[[nodiscard]] static
+auto read_subframe(bit_reader* br, std::span<int64_t> x, int bps) -> bool {
+	if (br->read(1) != 0) {
+		return false;
+	}
+	const auto type   = br->read(6);
+	const auto wasted = br->read(1) ? int(br->read_unary()) + 1 : 0;
+	bps -= wasted;
+	if (bps <= 0) {
+		return false;
+	}
+	if (type == 0) {
+		std::ranges::fill(x, br->read_signed(bps));
+	}
+	else if (type == 1) {
+		for (auto& s : x) {
+			s = br->read_signed(bps);
+		}
+	}
+	else if (type >= 8 && type <= 8 + MAX_FIXED_ORDER) {
+		const auto order = int(type - 8);
+		if (!read_warmup(br, x, order, bps) || !read_residual(br, x, order)) {
+			return false;
+		}
+		restore_fixed(x, order);
+	}
+	else if (type >= 32) {
+		if (!read_lpc_subframe(br, x, int(type - 31), bps)) {
+			return false;
+		}
+	}
+	else {
+		return false;
+	}
+	if (wasted > 0) {
+		for (auto& s : x) {
+			s <<= wasted;
+		}
+	}
+	return !br->eof();
+}
+
+// Reads the rest of a frame after its sync code. Returns nullopt if the
+// frame is damaged in any way, including failing either CRC.
+[[nodiscard]] static
+auto read_frame(bit_reader* br, const stream_info& info, std::vector<std::vector<int64_t>>* channels) -> std::optional<frame_header> {
+	const auto header = read_frame_header(br, info);
+	if (!header || header->chs != info.chs || header->bps != info.bps) {
+		return std::nullopt;
+	}
+	channels->resize(header->chs);
+	for (size_t c = 0; c < header->chs; c++) {
+		const auto side =
+			(header->assignment == LEFT_SIDE  && c == 1) ||
+			(header->assignment == RIGHT_SIDE && c == 0) ||
+			(header->assignment == MID_SIDE   && c == 1);
+		auto& x = (*channels)[c];
+		x.resize(header->block_size);
+		if (!read_subframe(br, x, header->bps + (side ? 1 : 0))) {
+			return std::nullopt;
+		}
+	}
+	if (header->assignment >= LEFT_SIDE) {
+		auto& a = (*channels)[0];
+		auto& b = (*channels)[1];
+		for (size_t i = 0; i < header->block_size; i++) {
+			switch (header->assignment) {
+				case LEFT_SIDE:  { b[i] = a[i] - b[i]; break; }
+				case RIGHT_SIDE: { a[i] = a[i] + b[i]; break; }
+				default: {
+					const auto mid  = (a[i] * 2) | (b[i] & 1);
+					const auto side = b[i];
+					a[i] = (mid + side) >> 1;
+					b[i] = (mid - side) >> 1;
+					break;
+				}
+			}
+		}
+	}
+	// A frame's CRC-16 over everything including the CRC itself is 0.
+	br->align();
+	(void)br->read(16);
+	if (br->eof() || br->crc16() != 0) {
+		return std::nullopt;
+	}
+	return header;
+}
+
+// Samples as little endian integers, the same as the encoder hashes.
+static
+auto hash_frame(md5* hash, const std::vector<std::vector<int64_t>>& channels, size_t frames, int bps, tracked_buffer<std::byte>* bytes) -> void {
+	const auto bytes_per_sample = size_t(bps + 7) / 8;
+	bytes->resize(frames * channels.size() * bytes_per_sample);
+	auto p = bytes->data();
+	for (size_t i = 0; i < frames; i++) {
+		for (const auto& x : channels) {
+			const auto value = uint64_t(x[i]);
+			for (size_t b = 0; b < bytes_per_sample; b++) {
+				*p++ = std::byte(uint8_t(value >> (8 * b)));
+			}
+		}
+	}
+	hash->update({bytes->data(), bytes->size()});
+}
+
+auto verify(byte_stream_reader stream, void* user_data, uint64_t start, const std::function<bool()>& should_abort) -> verify_result {
+	auto result = verify_result{};
+	result.format = format::flac;
+	auto br = bit_reader{stream, user_data, start};
+	const auto info = read_metadata(&br);
+	if (!info) {
+		result.status  = verify_status::malformed;
+		result.message = "The FLAC metadata couldn't be read";
+		return result;
+	}
+	auto hash     = md5{};
+	auto channels = std::vector<std::vector<int64_t>>{};
+	auto bytes    = tracked_buffer<std::byte>{};
+	// Set from a bad frame until the next good one, so that a damaged
+	// stretch of the file only counts as one error.
+	auto lost     = false;
+	// Whether a frame in that stretch ran into the end of the file. That
+	// makes it a truncation rather than damage, unless a good frame turns
+	// up after it.
+	auto cut_off  = false;
+	for (;;) {
+		if (should_abort && should_abort()) {
+			result.status = verify_status::aborted;
+			return result;
+		}
+		// Anything after the last frame, e.g. an ID3v1 tag, is ignored.
+		if ((info->total > 0 && result.frames_decoded >= info->total) || br.at_end()) {
+			break;
+		}
+		auto sync = br.read(16);
+		while ((sync & 0xFFFE) != 0xFFF8 && !br.eof()) {
+			lost = true;
+			sync = ((sync << 8) | br.read(8)) & 0xFFFF;
+		}
+		if (br.eof()) {
+			break;
+		}
+		const auto sync_pos = br.get_byte_pos() - 2;
+		br.restart_crc(sync);
+		const auto header = read_frame(&br, *info, &channels);
+		if (!header) {
+			lost    = true;
+			cut_off = cut_off || br.eof();
+			// The failed parse leaves the reader anywhere, not on a byte
+			// boundary, so the search goes on from just after the sync code.
+			br.seek(sync_pos + 1);
+			continue;
+		}
+		if (lost) {
+			result.crc_errors++;
+			lost    = false;
+			cut_off = false;
+		}
+		if (result.crc_errors == 0) {
+			hash_frame(&hash, channels, header->block_size, header->bps, &bytes);
+		}
+		result.frames_decoded += header->block_size;
+	}
+	if (lost && !cut_off) {
+		result.crc_errors++;
+	}
+	if (result.crc_errors > 0) {
+		result.status  = verify_status::corrupt;
+		result.message = std::format("{} damaged FLAC frame(s)", result.crc_errors);
+		return result;
+	}
+	if (info->total > 0 && result.frames_decoded < info->total && br.eof()) {
+		result.status  = verify_status::malformed;
+		result.message = std::format("The file is truncated. STREAMINFO has {} frames but only {} could be decoded", info->total, result.frames_decoded);
+		return result;
+	}
+	if (info->total > 0 && result.frames_decoded != info->total) {
+		result.status  = verify_status::malformed;
+		result.message = std::format("STREAMINFO has {} frames but {} were decoded", info->total, result.frames_decoded);
+		return result;
+	}
+	// An MD5 of all zeros means the encoder didn't compute one.
+	if (info->md5 != md5_digest{}) {
+		result.md5_checked = true;
+		if (hash.finish() != info->md5) {
+			result.status  = verify_status::corrupt;
+			result.message = "The audio doesn't match the MD5 in STREAMINFO";
+		}
+	}
+	return result;
+}
+
+} // audiorw::detail::flac
@@ -0,0 +1,152 @@
+#include <cstring>
+#include "audiorw_flat.hpp"
+
+namespace audiorw {
+
+sample_buffer::sample_buffer(std::pmr::memory_resource* resource)
+	: resource_{resource}
+{
+}
+
+sample_buffer::sample_buffer(sample_buffer&& rhs) noexcept
+	: resource_{rhs.resource_}
+	, data_{std::exchange(rhs.data_, nullptr)}
+	, size_{std::exchange(rhs.size_, 0)}
+{
+}
+
+sample_buffer& sample_buffer::operator=(sample_buffer&& rhs) noexcept {
+	release();
+	resource_ = rhs.resource_;
+	data_     = std::exchange(rhs.data_, nullptr);
+	size_     = std::exchange(rhs.size_, 0);
+	return *this;
+}
+
+sample_buffer::~sample_buffer() {
+	release();
+}
+
+auto sample_buffer::reset(size_t size) -> void {
+	if (size == size_) {
+		return;
+	}
+	release();
+	if (size > 0) {
+		data_ = static_cast<float*>(resource_->allocate(size * sizeof(float), ALIGNMENT));
+		size_ = size;
+	}
+}
+
+auto sample_buffer::release() -> void {
+	if (data_) {
+		resource_->deallocate(data_, size_ * sizeof(float), ALIGNMENT);
+		data_ = nullptr;
+		size_ = 0;
+	}
+}
+
+//########################################################################################
+
+auto flat_item::get_channel(size_t channel) const -> std::span<float> {
+	if (layout != frame_layout::planar) {
+		throw std::runtime_error{"Item is not planar"};
+	}
+	const auto frame_count = header.frame_count.value;
+	return {samples.data() + (channel * frame_count), frame_count};
+}
+
+//########################################################################################
+
+stream_frames_from_flat_item::stream_frames_from_flat_item(const flat_item& item)
+	: item_{item}
+{
+}
+
+auto stream_frames_from_flat_item::read_frames(std::span<float> buffer) -> ads::frame_count {
+	const auto chs              = item_.header.channel_count.value;
+	const auto frame_count      = item_.header.frame_count.value;
+	const auto frames_remaining = frame_count - std::min(pos_, frame_count);
+	const auto frames_to_read   = std::min(frames_remaining, buffer.size() / chs);
+	if (item_.layout == frame_layout::interleaved) {
+		std::memcpy(buffer.data(), item_.samples.data() + (pos_ * chs), frames_to_read * chs * sizeof(float));
+	}
+	else {
+		for (size_t c = 0; c < chs; c++) {
+			const auto src = item_.samples.data() + (c * frame_count) + pos_;
+			for (size_t i = 0; i < frames_to_read; i++) {
+				buffer[(i * chs) + c] = src[i];
+			}
+		}
+	}
+	pos_ += frames_to_read;
+	return {frames_to_read};
+}
+
+//########################################################################################
+
+stream_item_to_flat_item::stream_item_to_flat_item(flat_item* item)
+	: item_{item}
+{
+}
+
+auto stream_item_to_flat_item::seek(ads::frame_idx pos) -> bool {
+	pos_ = pos.value;
+	return true;
+}
+
+auto stream_item_to_flat_item::write_header(audiorw::header header) -> void {
+	item_->header = header;
+	const auto old_size = item_->samples.size();
+	item_->samples.reset(header.channel_count.value * header.frame_count.value);
+	// The header is written again each time a format probe is retried, and
+	// storage of the right size is kept, so only a new allocation is
+	// counted, in place of the last one.
+	if (item_->samples.size() == old_size) {
+		return;
+	}
+	const auto storage_bytes = item_->samples.size() * sizeof(float);
+	if (auto tracker = detail::get_memory_tracker()) {
+		tracker->on_free(memory_category::item_storage, std::exchange(storage_bytes_, storage_bytes));
+		tracker->on_alloc(memory_category::item_storage, storage_bytes);
+	}
+}
+
+auto stream_item_to_flat_item::write_frames(std::span<const float> buffer) -> ads::frame_count {
+	if (item_->header.channel_count == 0) {
+		throw std::runtime_error{"Header not written yet"};
+	}
+	const auto chs             = item_->header.channel_count.value;
+	const auto frame_count     = item_->header.frame_count.value;
+	const auto space_remaining = frame_count - std::min(pos_, frame_count);
+	const auto frames_to_write = std::min(space_remaining, buffer.size() / chs);
+	if (item_->layout == frame_layout::interleaved) {
+		std::memcpy(item_->samples.data() + (pos_ * chs), buffer.data(), frames_to_write * chs * sizeof(float));
+	}
+	else {
+		for (size_t c = 0; c < chs; c++) {
+			const auto dst = item_->samples.data() + (c * frame_count) + pos_;
+			for (size_t i = 0; i < frames_to_write; i++) {
+				dst[i] = buffer[(i * chs) + c];
+			}
+		}
+	}
+	pos_ += frames_to_write;
+	return {frames_to_write};
+}
+
+//########################################################################################
+
+auto read(const std::filesystem::path& path, audiorw::format_hint hint, frame_layout layout, std::pmr::memory_resource* resource) -> std::optional<flat_item> {
+	return audiorw::read(path, hint, layout, resource, detail::fn_always(false));
+}
+
+auto read(const std::filesystem::path& path, audiorw::format_hint hint, std::pmr::memory_resource* resource) -> std::optional<flat_item> {
+	return audiorw::read(path, hint, frame_layout::planar, resource, detail::fn_always(false));
+}
+
+auto write(const flat_item& item, const std::filesystem::path& path, storage_type type) -> operation_result {
+	return audiorw::write(item, path, type, detail::fn_always(false));
+}
+
+} // audiorw
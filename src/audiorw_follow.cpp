@@ -0,0 +1,269 @@
+#include <format>
+#include <thread>
+#include "audiorw_follow.hpp"
+
+namespace audiorw {
+
+stream_bytes_following_fs_path::stream_bytes_following_fs_path(const std::filesystem::path& path, follow_options options)
+	: file_{path, detail::native_file::mode::read}
+	, watch_{path}
+	, options_{std::move(options)}
+	, last_size_{file_.get_size()}
+	, last_growth_{std::chrono::steady_clock::now()}
+{
+	counters_.on_open();
+}
+
+auto stream_bytes_following_fs_path::close() -> bool {
+	file_.close();
+	return true;
+}
+
+auto stream_bytes_following_fs_path::push_back_byte(std::byte v) -> bool {
+	if (pos_ == 0) {
+		return false;
+	}
+	pos_--;
+	return true;
+}
+
+auto stream_bytes_following_fs_path::read_bytes(std::span<std::byte> buffer) -> size_t {
+	auto total = size_t{0};
+	while (total < buffer.size()) {
+		const auto n = file_.read_at(pos_, buffer.subspan(total));
+		pos_  += n;
+		total += n;
+		if (total < buffer.size() && !wait_for_size(pos_ + 1)) {
+			break;
+		}
+	}
+	counters_.on_read(total);
+	return total;
+}
+
+auto stream_bytes_following_fs_path::seek(int64_t offset, std::ios::seekdir mode) -> bool {
+	auto target = int64_t{0};
+	switch (mode) {
+		case std::ios::beg: { target = offset; break; }
+		case std::ios::cur: { target = int64_t(pos_) + offset; break; }
+		case std::ios::end: { target = int64_t(file_.get_size()) + offset; break; }
+		default:            { return false; }
+	}
+	if (target < 0) {
+		return false;
+	}
+	pos_ = uint64_t(target);
+	counters::add(counters::counter::seeks);
+	return true;
+}
+
+auto stream_bytes_following_fs_path::read_at(uint64_t offset, std::span<std::byte> buffer) const -> size_t {
+	return file_.read_at(offset, buffer);
+}
+
+auto stream_bytes_following_fs_path::get_file_size() const -> uint64_t {
+	return file_.get_size();
+}
+
+auto stream_bytes_following_fs_path::wait_for_size(uint64_t size) -> bool {
+	for (;;) {
+		const auto now          = std::chrono::steady_clock::now();
+		const auto current_size = file_.get_size();
+		if (current_size != last_size_) {
+			last_size_   = current_size;
+			last_growth_ = now;
+		}
+		if (current_size >= size) {
+			return true;
+		}
+		if (options_.should_stop && options_.should_stop()) {
+			return false;
+		}
+		if (options_.idle_timeout && now - last_growth_ >= *options_.idle_timeout) {
+			return false;
+		}
+		watch_.wait(options_.poll_interval);
+	}
+}
+
+} // audiorw
+
+namespace audiorw::detail {
+
+wav_follower::wav_follower(stream_bytes_following_fs_path in, const wav::layout& layout)
+	: in_{std::move(in)}
+	, layout_{layout}
+	, bytes_{memory_category::io}
+{
+	refresh();
+}
+
+auto wav_follower::get_header() const -> header {
+	return wav::to_header(layout_, frames_available_);
+}
+
+auto wav_follower::read_size_field(uint64_t offset) -> std::optional<uint64_t> {
+	std::byte field[8];
+	const auto size = layout_.size_field_bytes;
+	if (in_.read_at(offset, {field, size}) != size) {
+		return std::nullopt;
+	}
+	return size == 8 ? wav::load_le<uint64_t>(field) : uint64_t{wav::load_le<uint32_t>(field)};
+}
+
+auto wav_follower::refresh() -> ads::frame_count {
+	const auto file_size = in_.get_file_size();
+	std::byte riff_id[4];
+	if (layout_.size_field_bytes == 4 && in_.read_at(0, riff_id) == 4 && !wav::is_id(riff_id, "RIFF")) {
+		// The writer promoted the file to RF64 when it finished, so the
+		// sizes have moved to the ds64 chunk.
+		if (auto layout = wav::parse_layout([this](uint64_t offset, std::span<std::byte> buffer) { return in_.read_at(offset, buffer); })) {
+			layout_ = *layout;
+		}
+	}
+	auto data_bytes = file_size > layout_.data_offset ? file_size - layout_.data_offset : 0;
+	const auto riff_size = read_size_field(layout_.riff_size_field_offset);
+	const auto data_size = read_size_field(layout_.data_size_field_offset);
+	if (riff_size && data_size && *data_size != 0 && *data_size != wav::UNKNOWN_DATA_SIZE_32) {
+		// A writer may reserve the space up front, so the declared size
+		// is only an upper bound until the file is finalized.
+		data_bytes = std::min<uint64_t>(data_bytes, *data_size);
+		finished_  = data_bytes == *data_size && *riff_size + 8 == file_size;
+	}
+	last_file_size_   = file_size;
+	frames_available_ = data_bytes / layout_.block_align;
+	return {frames_available_};
+}
+
+auto wav_follower::read_frames(std::span<float> buffer) -> ads::frame_count {
+	const auto frames_wanted = buffer.size() / layout_.channel_count;
+	if (frames_wanted == 0) {
+		return {0};
+	}
+	while (pos_ >= frames_available_) {
+		if (refresh().value > pos_) {
+			break;
+		}
+		if (finished_ || !in_.wait_for_size(last_file_size_ + 1)) {
+			return {0};
+		}
+	}
+	const auto frames = std::min<uint64_t>(frames_wanted, frames_available_ - pos_);
+	bytes_.resize(frames * layout_.block_align);
+	const auto bytes_read  = in_.read_at(layout_.data_offset + (pos_ * layout_.block_align), {bytes_.data(), bytes_.size()});
+	const auto frames_read = bytes_read / layout_.block_align;
+	{
+		auto timer = scope_counter_timer{format::wav, counters::counter::convert_ns};
+		wav::convert_to_float(layout_.format, bytes_.data(), buffer.first(frames_read * layout_.channel_count));
+	}
+	counters::add(format::wav, counters::counter::frames_decoded, frames_read);
+	pos_ += frames_read;
+	return {frames_read};
+}
+
+auto wav_follower::seek(ads::frame_idx pos) -> bool {
+	if (pos.value > frames_available_ && pos.value > refresh().value) {
+		return false;
+	}
+	pos_ = pos.value;
+	counters::add(format::wav, counters::counter::seeks);
+	return true;
+}
+
+auto try_make_wav_follower(const std::filesystem::path& path, const follow_options& options) -> std::optional<wav_follower> {
+	auto in = stream_bytes_following_fs_path{path, options};
+	auto read_at = [&in](uint64_t offset, std::span<std::byte> buffer) { return in.read_at(offset, buffer); };
+	// The writer may not have got as far as the data chunk yet. Keep trying
+	// for as long as what is there looks like the start of a WAV file.
+	for (;;) {
+		if (auto layout = wav::parse_layout(read_at)) {
+			return wav_follower{std::move(in), *layout};
+		}
+		const auto size = in.get_file_size();
+		if (size >= 12) {
+			std::byte riff[12];
+			if (in.read_at(0, riff) != sizeof(riff) || !wav::is_riff_id(riff) || !wav::is_id(riff + 8, "WAVE")) {
+				return std::nullopt;
+			}
+		}
+		if (!in.wait_for_size(size + 1)) {
+			return std::nullopt;
+		}
+	}
+}
+
+// The WavPack decoder would wait on the following stream forever for more
+// of a file which was never WavPack, so the block ID at the start is checked
+// with an ordinary read first. As with WAV, a file too short to tell yet is
+// waited for.
+[[nodiscard]] static
+auto starts_like_wavpack(stream_bytes_following_fs_path* in) -> bool {
+	std::byte id[4];
+	if (!in->wait_for_size(sizeof(id))) {
+		return false;
+	}
+	return in->read_at(0, id) == sizeof(id) && wav::is_id(id, "wvpk");
+}
+
+} // audiorw::detail
+
+namespace audiorw {
+
+[[nodiscard]] static
+auto make_follower(const std::filesystem::path& path, format_hint hint, const follow_options& options) -> std::variant<detail::wav_follower, stream_item_from_byte_stream<stream_bytes_following_fs_path>> {
+	for (auto format : detail::get_formats_to_try(hint)) {
+		switch (format) {
+			case format::wav: {
+				if (auto follower = detail::try_make_wav_follower(path, options)) {
+					return std::move(follower).value();
+				}
+				break;
+			}
+			case format::wavpack: {
+				auto in = stream_bytes_following_fs_path{path, options};
+				if (!detail::starts_like_wavpack(&in)) {
+					break;
+				}
+				try {
+					return stream_item_from_byte_stream{std::move(in), format_hint::try_wavpack_only};
+				}
+				catch (const std::runtime_error&) {}
+				break;
+			}
+			default: {
+				// MP3, FLAC and Ogg Vorbis files can't be followed. Their
+				// decoders need to know where they end before they can
+				// decode them.
+				continue;
+			}
+		}
+		counters::add(format, counters::counter::probe_failures);
+	}
+	throw std::runtime_error{std::format("Failed to follow file: '{}'", path.string())};
+}
+
+stream_item_following_fs_path::stream_item_following_fs_path(const std::filesystem::path& path, format_hint hint, follow_options options)
+	: impl_{make_follower(path, hint, options)}
+{
+}
+
+auto stream_item_following_fs_path::get_header() const -> header {
+	return std::visit([](auto& impl) { return impl.get_header(); }, impl_);
+}
+
+auto stream_item_following_fs_path::refresh() -> ads::frame_count {
+	return std::visit([](auto& impl) -> ads::frame_count {
+		if constexpr (std::is_same_v<std::decay_t<decltype(impl)>, detail::wav_follower>) { return impl.refresh(); }
+		else                                                                                { return impl.get_header().frame_count; }
+	}, impl_);
+}
+
+auto stream_item_following_fs_path::read_frames(std::span<float> buffer) -> ads::frame_count {
+	return std::visit([buffer](auto& impl) { return impl.read_frames(buffer); }, impl_);
+}
+
+auto stream_item_following_fs_path::seek(ads::frame_idx pos) -> bool {
+	return std::visit([pos](auto& impl) { return impl.seek(pos); }, impl_);
+}
+
+} // audiorw
@@ -0,0 +1,95 @@
+#include <bit>
+#include <cstring>
+#include "audiorw_md5.hpp"
+
+namespace audiorw::detail {
+
+static constexpr uint32_t MD5_K[64] = {
+	0xD76AA478, 0xE8C7B756, 0x242070DB, 0xC1BDCEEE, 0xF57C0FAF, 0x4787C62A, 0xA8304613, 0xFD469501,
+	0x698098D8, 0x8B44F7AF, 0xFFFF5BB1, 0x895CD7BE, 0x6B901122, 0xFD987193, 0xA679438E, 0x49B40821,
+	0xF61E2562, 0xC040B340, 0x265E5A51, 0xE9B6C7AA, 0xD62F105D, 0x02441453, 0xD8A1E681, 0xE7D3FBC8,
+	0x21E1CDE6, 0xC33707D6, 0xF4D50D87, 0x455A14ED, 0xA9E3E905, 0xFCEFA3F8, 0x676F02D9, 0x8D2A4C8A,
+	0xFFFA3942, 0x8771F681, 0x6D9D6122, 0xFDE5380C, 0xA4BEEA44, 0x4BDECFA9, 0xF6BB4B60, 0xBEBFBC70,
+	0x289B7EC6, 0xEAA127FA, 0xD4EF3085, 0x04881D05, 0xD9D4D039, 0xE6DB99E5, 0x1FA27CF8, 0xC4AC5665,
+	0xF4292244, 0x432AFF97, 0xAB9423A7, 0xFC93A039, 0x655B59C3, 0x8F0CCC92, 0xFFEFF47D, 0x85845DD1,
+	0x6FA87E4F, 0xFE2CE6E0, 0xA3014314, 0x4E0811A1, 0xF7537E82, 0xBD3AF235, 0x2AD7D2BB, 0xEB86D391,
+};
+
+static constexpr int MD5_R[64] = {
+	7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+	5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+	4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+	6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21,
+};
+
+auto md5::process(const std::byte* block) -> void {
+	uint32_t m[16];
+	for (size_t i = 0; i < 16; i++) {
+		const auto p = block + (i * 4);
+		m[i] = uint32_t(std::to_integer<uint8_t>(p[0]))
+		     | uint32_t(std::to_integer<uint8_t>(p[1])) << 8
+		     | uint32_t(std::to_integer<uint8_t>(p[2])) << 16
+		     | uint32_t(std::to_integer<uint8_t>(p[3])) << 24;
+	}
+	auto [a, b, c, d] = state_;
+	for (size_t i = 0; i < 64; i++) {
+		auto f = uint32_t{};
+		auto g = size_t{};
+		switch (i / 16) {
+			case 0:  { f = (b & c) | (~b & d); g = i; break; }
+			case 1:  { f = (d & b) | (~d & c); g = (5 * i + 1) % 16; break; }
+			case 2:  { f = b ^ c ^ d;          g = (3 * i + 5) % 16; break; }
+			default: { f = c ^ (b | ~d);       g = (7 * i) % 16; break; }
+		}
+		const auto next = b + std::rotl(a + f + MD5_K[i] + m[g], MD5_R[i]);
+		a = d;
+		d = c;
+		c = b;
+		b = next;
+	}
+	state_[0] += a;
+	state_[1] += b;
+	state_[2] += c;
+	state_[3] += d;
+}
+
+auto md5::update(std::span<const std::byte> bytes) -> void {
+	auto used = size_t(length_ % 64);
+	length_ += bytes.size();
+	if (used > 0) {
+		const auto n = std::min(bytes.size(), 64 - used);
+		std::memcpy(buffer_.data() + used, bytes.data(), n);
+		bytes = bytes.subspan(n);
+		used += n;
+		if (used < 64) {
+			return;
+		}
+		process(buffer_.data());
+	}
+	while (bytes.size() >= 64) {
+		process(bytes.data());
+		bytes = bytes.subspan(64);
+	}
+	std::memcpy(buffer_.data(), bytes.data(), bytes.size());
+}
+
+auto md5::finish() -> md5_digest {
+	const auto bit_length = length_ * 8;
+	std::byte padding[72] = {std::byte{0x80}};
+	const auto used        = size_t(length_ % 64);
+	const auto pad_size    = (used < 56 ? 56 : 120) - used;
+	update({padding, pad_size});
+	std::byte length_bytes[8];
+	for (size_t i = 0; i < 8; i++) {
+		length_bytes[i] = std::byte(uint8_t(bit_length >> (i * 8)));
+	}
+	update(length_bytes);
+	auto out = md5_digest{};
+	for (size_t i = 0; i < 16; i++) {
+		out[i] = uint8_t(state_[i / 4] >> ((i % 4) * 8));
+	}
+	*this = md5{};
+	return out;
+}
+
+} // audiorw::detail
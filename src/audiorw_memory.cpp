@@ -0,0 +1,229 @@
+#include <bit>
+#include <map>
+#include <mutex>
+#include <new>
+#include <vector>
+#include "audiorw_memory.hpp"
+#if defined(_WIN32)
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace audiorw::detail {
+
+// Pages are prefaulted in pieces of this size so that the work spreads
+// evenly over the executor.
+static constexpr auto PREFAULT_PIECE_SIZE = size_t{1} << 24;
+
+[[nodiscard]] static
+auto round_up(size_t value, size_t multiple) -> size_t {
+	return (value + multiple - 1) / multiple * multiple;
+}
+
+[[nodiscard]] static
+auto get_page_size() -> size_t {
+#if defined(_WIN32)
+	auto info = SYSTEM_INFO{};
+	GetSystemInfo(&info);
+	return info.dwPageSize;
+#else
+	return static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+#endif
+}
+
+#if defined(_WIN32)
+
+[[nodiscard]] static
+auto map_huge_pages(size_t size, huge_pages mode) -> void* {
+	if (mode == huge_pages::explicit_ && GetLargePageMinimum() > 0) {
+		// Needs SeLockMemoryPrivilege. Without it this just fails.
+		if (const auto p = VirtualAlloc(nullptr, round_up(size, GetLargePageMinimum()), MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE)) {
+			return p;
+		}
+	}
+	return VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+}
+
+static
+auto unmap_huge_pages(void* p, size_t size) -> void {
+	VirtualFree(p, 0, MEM_RELEASE);
+}
+
+#else
+
+[[nodiscard]] static
+auto map_huge_pages(size_t size, huge_pages mode) -> void* {
+#if defined(MAP_HUGETLB)
+	if (mode == huge_pages::explicit_) {
+		const auto p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED) {
+			return p;
+		}
+	}
+#endif
+	// Over-allocate so that the start can be aligned to a huge page, which
+	// the kernel needs before it will back the range with them, then give
+	// back the excess at both ends.
+	const auto padded = size + HUGE_PAGE_SIZE;
+	const auto p      = ::mmap(nullptr, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) {
+		return nullptr;
+	}
+	const auto beg     = reinterpret_cast<uintptr_t>(p);
+	const auto aligned = round_up(beg, HUGE_PAGE_SIZE);
+	if (aligned > beg) {
+		::munmap(p, aligned - beg);
+	}
+	if (beg + padded > aligned + size) {
+		::munmap(reinterpret_cast<void*>(aligned + size), beg + padded - (aligned + size));
+	}
+#if defined(MADV_HUGEPAGE)
+	::madvise(reinterpret_cast<void*>(aligned), size, MADV_HUGEPAGE);
+#endif
+	return reinterpret_cast<void*>(aligned);
+}
+
+static
+auto unmap_huge_pages(void* p, size_t size) -> void {
+	::munmap(p, size);
+}
+
+#endif
+
+auto prefault(std::span<std::byte> bytes, executor_ref executor) -> void {
+	const auto page_size   = get_page_size();
+	const auto piece_count = (bytes.size() + PREFAULT_PIECE_SIZE - 1) / PREFAULT_PIECE_SIZE;
+	parallel_for(executor, piece_count, [=](size_t piece) {
+		const auto beg = piece * PREFAULT_PIECE_SIZE;
+		const auto end = std::min(bytes.size(), beg + PREFAULT_PIECE_SIZE);
+		for (auto i = beg; i < end; i += page_size) {
+			// Volatile so that the write isn't optimized away.
+			*static_cast<volatile std::byte*>(bytes.data() + i) = std::byte{0};
+		}
+	});
+}
+
+} // audiorw::detail
+
+namespace audiorw {
+
+huge_page_memory_resource::huge_page_memory_resource(huge_page_options options, std::pmr::memory_resource* upstream)
+	: options_{std::move(options)}
+	, upstream_{upstream}
+{
+}
+
+auto huge_page_memory_resource::do_allocate(size_t bytes, size_t alignment) -> void* {
+	if (bytes < options_.threshold || alignment > detail::HUGE_PAGE_SIZE) {
+		return upstream_->allocate(bytes, alignment);
+	}
+	const auto size = detail::round_up(bytes, detail::HUGE_PAGE_SIZE);
+	const auto p    = detail::map_huge_pages(size, options_.mode);
+	if (!p) {
+		throw std::bad_alloc{};
+	}
+	if (options_.prefault) {
+		detail::prefault({static_cast<std::byte*>(p), bytes}, detail::executor_or_inline(options_.executor));
+	}
+	return p;
+}
+
+auto huge_page_memory_resource::do_deallocate(void* p, size_t bytes, size_t alignment) -> void {
+	if (bytes < options_.threshold || alignment > detail::HUGE_PAGE_SIZE) {
+		upstream_->deallocate(p, bytes, alignment);
+		return;
+	}
+	detail::unmap_huge_pages(p, detail::round_up(bytes, detail::HUGE_PAGE_SIZE));
+}
+
+auto huge_page_memory_resource::do_is_equal(const std::pmr::memory_resource& other) const noexcept -> bool {
+	return this == &other;
+}
+
+//########################################################################################
+
+namespace detail {
+
+static constexpr auto MIN_SIZE_CLASS = size_t{64};
+
+[[nodiscard]] static
+auto get_size_class(size_t bytes) -> size_t {
+	// Eight classes per power of two, so no more than 12.5% is wasted.
+	const auto step = std::max(MIN_SIZE_CLASS, std::bit_floor(std::max(bytes, size_t{1})) / 8);
+	return round_up(bytes, step);
+}
+
+} // detail
+
+struct sample_buffer_pool::impl {
+	// Blocks are only reused for requests with the same size class and alignment.
+	using key = std::pair<size_t, size_t>;
+	sample_buffer_pool_options options;
+	std::pmr::memory_resource* upstream;
+	mutable std::mutex mutex;
+	std::map<key, std::vector<void*>> free_blocks;
+	size_t cached_bytes = 0;
+};
+
+sample_buffer_pool::sample_buffer_pool(sample_buffer_pool_options options, std::pmr::memory_resource* upstream)
+	: impl_{std::make_unique<impl>(std::move(options), upstream)}
+{
+}
+
+sample_buffer_pool::~sample_buffer_pool() {
+	release();
+}
+
+auto sample_buffer_pool::get_cached_bytes() const -> size_t {
+	const auto lock = std::lock_guard{impl_->mutex};
+	return impl_->cached_bytes;
+}
+
+auto sample_buffer_pool::release() -> void {
+	const auto lock = std::lock_guard{impl_->mutex};
+	for (auto& [key, blocks] : impl_->free_blocks) {
+		for (const auto p : blocks) {
+			impl_->upstream->deallocate(p, key.first, key.second);
+		}
+	}
+	impl_->free_blocks.clear();
+	impl_->cached_bytes = 0;
+}
+
+auto sample_buffer_pool::do_allocate(size_t bytes, size_t alignment) -> void* {
+	const auto size = detail::get_size_class(bytes);
+	{
+		const auto lock = std::lock_guard{impl_->mutex};
+		const auto pos  = impl_->free_blocks.find({size, alignment});
+		if (pos != impl_->free_blocks.end() && !pos->second.empty()) {
+			const auto p = pos->second.back();
+			pos->second.pop_back();
+			impl_->cached_bytes -= size;
+			return p;
+		}
+	}
+	return impl_->upstream->allocate(size, alignment);
+}
+
+auto sample_buffer_pool::do_deallocate(void* p, size_t bytes, size_t alignment) -> void {
+	const auto size = detail::get_size_class(bytes);
+	{
+		const auto lock = std::lock_guard{impl_->mutex};
+		if (impl_->cached_bytes + size <= impl_->options.max_cached_bytes) {
+			impl_->free_blocks[{size, alignment}].push_back(p);
+			impl_->cached_bytes += size;
+			return;
+		}
+	}
+	impl_->upstream->deallocate(p, size, alignment);
+}
+
+auto sample_buffer_pool::do_is_equal(const std::pmr::memory_resource& other) const noexcept -> bool {
+	return this == &other;
+}
+
+} // audiorw
@@ -0,0 +1,229 @@
+#include <cstring>
+#include "audiorw_file.hpp"
+#include "audiorw_prefetch.hpp"
+#include "audiorw_wav.hpp"
+
+namespace audiorw::detail::prefetch {
+
+// Prefetched ahead of the estimated position of a frame range for formats
+// where it can only be estimated, and along with it to cover the header.
+static constexpr auto ESTIMATE_MARGIN = uint64_t{1 << 18};
+static constexpr auto HEADER_SIZE     = uint64_t{1 << 16};
+
+struct byte_range {
+	uint64_t offset;
+	uint64_t length;
+};
+
+using byte_ranges = boost::container::small_vector<byte_range, 2>;
+
+struct frame_range {
+	uint64_t start;
+	std::optional<uint64_t> count;
+};
+
+[[nodiscard]] static
+auto load_be(const std::byte* bytes, size_t size) -> uint64_t {
+	auto value = uint64_t{0};
+	for (size_t i = 0; i < size; i++) {
+		value = (value << 8) | std::to_integer<uint8_t>(bytes[i]);
+	}
+	return value;
+}
+
+[[nodiscard]] static
+auto get_end(const frame_range& frames, uint64_t total_frames) -> uint64_t {
+	if (!frames.count) {
+		return total_frames;
+	}
+	return std::min(total_frames, frames.start + *frames.count);
+}
+
+// Assumes a roughly constant bitrate between first_byte and last_byte.
+[[nodiscard]] static
+auto estimate(uint64_t first_byte, uint64_t last_byte, uint64_t total_frames, const frame_range& frames) -> byte_ranges {
+	if (total_frames == 0) {
+		return {{0, last_byte}};
+	}
+	const auto bytes  = last_byte - first_byte;
+	const auto to_pos = [=](uint64_t frame) { return first_byte + uint64_t(double(bytes) * (double(frame) / double(total_frames))); };
+	const auto beg    = to_pos(std::min(frames.start, total_frames));
+	const auto end    = to_pos(get_end(frames, total_frames));
+	const auto lo     = beg > first_byte + ESTIMATE_MARGIN ? beg - ESTIMATE_MARGIN : first_byte;
+	const auto hi     = std::min(last_byte, end + ESTIMATE_MARGIN);
+	return {{0, std::min(HEADER_SIZE, last_byte)}, {lo, hi > lo ? hi - lo : 0}};
+}
+
+[[nodiscard]] static
+auto get_wav_ranges(const native_file& file, const frame_range& frames) -> std::optional<byte_ranges> {
+	const auto layout = wav::parse_layout([&file](uint64_t offset, std::span<std::byte> buffer) { return file.read_at(offset, buffer); });
+	if (!layout) {
+		return std::nullopt;
+	}
+	const auto file_size    = file.get_size();
+	const auto size_known   = layout->data_size != 0 && layout->data_size != wav::UNKNOWN_DATA_SIZE_32;
+	const auto data_end     = size_known ? std::min(file_size, layout->data_offset + layout->data_size) : file_size;
+	const auto total_frames = (data_end - std::min(data_end, layout->data_offset)) / layout->block_align;
+	const auto beg          = layout->data_offset + (std::min(frames.start, total_frames) * layout->block_align);
+	const auto end          = layout->data_offset + (get_end(frames, total_frames) * layout->block_align);
+	return byte_ranges{{0, layout->data_offset}, {beg, end > beg ? end - beg : 0}};
+}
+
+[[nodiscard]] static
+auto get_flac_ranges(const native_file& file, const frame_range& frames) -> std::optional<byte_ranges> {
+	static constexpr auto STREAMINFO       = 0;
+	static constexpr auto SEEKTABLE        = 3;
+	static constexpr auto SEEKPOINT_SIZE   = 18;
+	static constexpr auto PLACEHOLDER      = ~uint64_t{0};
+	std::byte magic[4];
+	if (file.read_at(0, magic) != sizeof(magic) || std::memcmp(magic, "fLaC", 4) != 0) {
+		return std::nullopt;
+	}
+	struct seekpoint { uint64_t frame; uint64_t offset; };
+	auto seekpoints   = std::vector<seekpoint>{};
+	auto total_frames = uint64_t{0};
+	auto pos          = uint64_t{4};
+	for (auto last = false; !last;) {
+		std::byte block_header[4];
+		if (file.read_at(pos, block_header) != sizeof(block_header)) {
+			return std::nullopt;
+		}
+		last = (std::to_integer<uint8_t>(block_header[0]) & 0x80) != 0;
+		const auto type = std::to_integer<uint8_t>(block_header[0]) & 0x7F;
+		const auto size = load_be(block_header + 1, 3);
+		if (type == STREAMINFO && size >= 18) {
+			std::byte info[18];
+			if (file.read_at(pos + 4, info) != sizeof(info)) {
+				return std::nullopt;
+			}
+			total_frames = load_be(info + 10, 8) & 0xFFFFFFFFF;
+		}
+		if (type == SEEKTABLE) {
+			auto table = std::vector<std::byte>(size);
+			if (file.read_at(pos + 4, table) != table.size()) {
+				return std::nullopt;
+			}
+			for (size_t i = 0; i + SEEKPOINT_SIZE <= table.size(); i += SEEKPOINT_SIZE) {
+				const auto frame = load_be(table.data() + i, 8);
+				if (frame != PLACEHOLDER) {
+					seekpoints.push_back({frame, load_be(table.data() + i + 8, 8)});
+				}
+			}
+		}
+		pos += 4 + size;
+	}
+	const auto first_frame_offset = pos;
+	const auto file_size          = file.get_size();
+	if (seekpoints.empty() || total_frames == 0) {
+		auto ranges = estimate(first_frame_offset, file_size, total_frames, frames);
+		ranges[0].length = std::max(ranges[0].length, first_frame_offset);
+		return ranges;
+	}
+	// Seek points are sorted by frame. Decoding starts at the last point at
+	// or before the start and can stop at the first point after the end.
+	const auto end = get_end(frames, total_frames);
+	auto lo = first_frame_offset;
+	auto hi = file_size;
+	for (const auto& point : seekpoints) {
+		if (point.frame <= frames.start) {
+			lo = first_frame_offset + point.offset;
+		}
+		else if (point.frame > end) {
+			hi = std::min(hi, first_frame_offset + point.offset);
+			break;
+		}
+	}
+	return byte_ranges{{0, first_frame_offset}, {lo, hi > lo ? hi - lo : 0}};
+}
+
+[[nodiscard]] static
+auto get_wavpack_ranges(const native_file& file, const frame_range& frames) -> std::optional<byte_ranges> {
+	static constexpr auto UNKNOWN_TOTAL_SAMPLES = uint32_t{0xFFFFFFFF};
+	std::byte block_header[32];
+	if (file.read_at(0, block_header) != sizeof(block_header) || std::memcmp(block_header, "wvpk", 4) != 0) {
+		return std::nullopt;
+	}
+	const auto file_size     = file.get_size();
+	const auto total_samples = wav::load_le<uint32_t>(block_header + 12);
+	if (total_samples == UNKNOWN_TOTAL_SAMPLES) {
+		return byte_ranges{{0, file_size}};
+	}
+	const auto total_frames = uint64_t{total_samples} | (uint64_t{std::to_integer<uint8_t>(block_header[11])} << 32);
+	return estimate(0, file_size, total_frames, frames);
+}
+
+[[nodiscard]] static
+auto get_byte_ranges(const native_file& file, format_hint hint, const frame_range& frames) -> byte_ranges {
+	for (auto format : get_formats_to_try(hint)) {
+		auto ranges = std::optional<byte_ranges>{};
+		switch (format) {
+			case format::flac:    { ranges = get_flac_ranges(file, frames); break; }
+			case format::wav:     { ranges = get_wav_ranges(file, frames); break; }
+			case format::wavpack: { ranges = get_wavpack_ranges(file, frames); break; }
+			// The frame count of an MP3 isn't known without decoding it.
+			case format::mp3:     { ranges = byte_ranges{{0, file.get_size()}}; break; }
+			// Seeks bisect the whole file for the page to start from.
+			case format::vorbis:  { ranges = byte_ranges{{0, file.get_size()}}; break; }
+		}
+		if (ranges) {
+			return *ranges;
+		}
+	}
+	return {{0, file.get_size()}};
+}
+
+static
+auto prefetch(const std::filesystem::path& path, uint64_t offset, std::optional<uint64_t> length) -> void {
+	const auto file = native_file{path, native_file::mode::read};
+	const auto size = file.get_size();
+	if (offset >= size) {
+		return;
+	}
+	file.will_need(offset, std::min(size - offset, length.value_or(size - offset)));
+}
+
+static
+auto prefetch(const prefetch_frame_range& range) -> void {
+	const auto file   = native_file{range.path, native_file::mode::read};
+	const auto frames = frame_range{range.start.value, range.count ? std::optional{range.count->value} : std::nullopt};
+	for (const auto& bytes : get_byte_ranges(file, range.hint, frames)) {
+		if (bytes.length > 0) {
+			file.will_need(bytes.offset, bytes.length);
+		}
+	}
+}
+
+static
+auto submit(const prefetch_options& options, std::function<void()> fn) -> void {
+	const auto executor = executor_or_inline(options.executor);
+	executor.submit([fn = std::move(fn)] {
+		try {
+			fn();
+		}
+		catch (...) {}
+	}, options.priority);
+}
+
+} // audiorw::detail::prefetch
+
+namespace audiorw {
+
+auto prefetch(std::span<const std::filesystem::path> paths, const prefetch_options& options) -> void {
+	for (const auto& path : paths) {
+		detail::prefetch::submit(options, [path] { detail::prefetch::prefetch(path, 0, std::nullopt); });
+	}
+}
+
+auto prefetch(std::span<const prefetch_byte_range> ranges, const prefetch_options& options) -> void {
+	for (const auto& range : ranges) {
+		detail::prefetch::submit(options, [range] { detail::prefetch::prefetch(range.path, range.offset, range.length); });
+	}
+}
+
+auto prefetch(std::span<const prefetch_frame_range> ranges, const prefetch_options& options) -> void {
+	for (const auto& range : ranges) {
+		detail::prefetch::submit(options, [range] { detail::prefetch::prefetch(range); });
+	}
+}
+
+} // audiorw
@@ -0,0 +1,88 @@
+#include <thread>
+#include "audiorw_throttle.hpp"
+
+namespace audiorw::detail {
+
+// How many seconds worth of tokens can build up while a bucket is idle.
+static constexpr auto BURST_SECONDS = 0.1;
+
+auto token_bucket::set_rate(double tokens_per_second) -> void {
+	rate_   = tokens_per_second;
+	tokens_ = std::min(tokens_, rate_ * BURST_SECONDS);
+}
+
+auto token_bucket::reserve(double tokens, std::chrono::steady_clock::time_point now) -> std::chrono::steady_clock::time_point {
+	if (rate_ <= 0) {
+		return now;
+	}
+	if (last_refill_ == std::chrono::steady_clock::time_point{}) {
+		last_refill_ = now;
+		tokens_      = rate_ * BURST_SECONDS;
+	}
+	const auto elapsed = std::chrono::duration<double>(now - last_refill_).count();
+	tokens_      = std::min(tokens_ + (elapsed * rate_), rate_ * BURST_SECONDS);
+	last_refill_ = now;
+	tokens_     -= tokens;
+	if (tokens_ >= 0) {
+		return now;
+	}
+	const auto debt = std::chrono::duration<double>(-tokens_ / rate_);
+	return now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(debt);
+}
+
+// Tokens go back up to the burst limit, so a refund can pay off debt but
+// can't save up more than an idle bucket would.
+auto token_bucket::refund(double tokens) -> void {
+	if (rate_ <= 0) {
+		return;
+	}
+	tokens_ = std::min(tokens_ + tokens, rate_ * BURST_SECONDS);
+}
+
+} // audiorw::detail
+
+namespace audiorw {
+
+io_throttle::io_throttle(io_limits shared_budget) {
+	set_shared_budget(shared_budget);
+}
+
+auto io_throttle::set_limits(io_class c, io_limits limits) -> void {
+	auto lock    = std::unique_lock{mutex_};
+	auto& bucket = classes_[size_t(c)];
+	bucket.bytes.set_rate(limits.bytes_per_second);
+	bucket.ops.set_rate(limits.ops_per_second);
+}
+
+auto io_throttle::set_shared_budget(io_limits limits) -> void {
+	auto lock = std::unique_lock{mutex_};
+	shared_.bytes.set_rate(limits.bytes_per_second);
+	shared_.ops.set_rate(limits.ops_per_second);
+}
+
+auto io_throttle::acquire(io_class c, size_t bytes) -> void {
+	auto wake_time = std::chrono::steady_clock::time_point{};
+	{
+		auto lock      = std::unique_lock{mutex_};
+		const auto now = std::chrono::steady_clock::now();
+		auto& bucket   = classes_[size_t(c)];
+		wake_time = std::max(bucket.bytes.reserve(double(bytes), now), bucket.ops.reserve(1, now));
+		if (c != io_class::foreground) {
+			wake_time = std::max({wake_time, shared_.bytes.reserve(double(bytes), now), shared_.ops.reserve(1, now)});
+		}
+	}
+	std::this_thread::sleep_until(wake_time);
+}
+
+auto io_throttle::refund(io_class c, size_t bytes) -> void {
+	if (bytes == 0) {
+		return;
+	}
+	auto lock = std::unique_lock{mutex_};
+	classes_[size_t(c)].bytes.refund(double(bytes));
+	if (c != io_class::foreground) {
+		shared_.bytes.refund(double(bytes));
+	}
+}
+
+} // audiorw
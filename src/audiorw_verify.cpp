@@ -0,0 +1,249 @@
+#include "audiorw_verify.hpp"
+#include "audiorw_wav.hpp"
+
+namespace audiorw::detail {
+
+// WAV data is read through in pieces of this size.
+static constexpr auto VERIFY_READ_SIZE = size_t{1} << 20;
+static constexpr auto ID3_HEADER_SIZE  = size_t{10};
+
+[[nodiscard]] static
+auto make_result(verify_status status, std::optional<audiorw::format> format, std::string message) -> verify_result {
+	auto result    = verify_result{};
+	result.status  = status;
+	result.format  = format;
+	result.message = std::move(message);
+	return result;
+}
+
+[[nodiscard]] static
+auto should_abort(const verify_options& options) -> bool {
+	return options.should_abort && options.should_abort();
+}
+
+[[nodiscard]] static
+auto read_at(stream_bytes_from_fs_path* in, uint64_t offset, std::span<std::byte> buffer) -> size_t {
+	if (!in->seek(int64_t(offset), std::ios::beg)) {
+		return 0;
+	}
+	return in->read_bytes(buffer);
+}
+
+// Where the audio starts, after an ID3v2 tag if there is one.
+[[nodiscard]] static
+auto skip_id3(stream_bytes_from_fs_path* in) -> uint64_t {
+	std::byte header[ID3_HEADER_SIZE];
+	if (read_at(in, 0, header) != sizeof(header) || std::memcmp(header, "ID3", 3) != 0) {
+		return 0;
+	}
+	// The size is 4 bytes of 7 bits each, not counting the header, or the
+	// footer which flag 0x10 says is there.
+	auto size = uint64_t{0};
+	for (size_t i = 6; i < 10; i++) {
+		size = (size << 7) | (std::to_integer<uint8_t>(header[i]) & 0x7F);
+	}
+	const auto has_footer = (std::to_integer<uint8_t>(header[5]) & 0x10) != 0;
+	return ID3_HEADER_SIZE + size + (has_footer ? ID3_HEADER_SIZE : 0);
+}
+
+[[nodiscard]] static
+auto verify_wav(stream_bytes_from_fs_path* in, const verify_options& options) -> verify_result {
+	const auto layout = wav::parse_layout(in);
+	if (!layout) {
+		return make_result(verify_status::malformed, format::wav, "The WAV chunks couldn't be parsed, or the sample format isn't PCM or IEEE float");
+	}
+	const auto length = uint64_t(in->get_length().value_or(0));
+	if (layout->size_field_bytes == 4 && layout->data_size == wav::UNKNOWN_DATA_SIZE_32) {
+		return make_result(verify_status::malformed, format::wav, "The data chunk size was never written");
+	}
+	if (layout->data_offset + layout->data_size > length) {
+		return make_result(verify_status::malformed, format::wav, std::format("The file is truncated. The data chunk ends at {} but the file is {} bytes", layout->data_offset + layout->data_size, length));
+	}
+	if (layout->data_size % layout->block_align != 0) {
+		return make_result(verify_status::malformed, format::wav, std::format("The data chunk size {} isn't a whole number of frames", layout->data_size));
+	}
+	std::byte riff_size_bytes[8] = {};
+	if (read_at(in, layout->riff_size_field_offset, {riff_size_bytes, layout->size_field_bytes}) != layout->size_field_bytes) {
+		return make_result(verify_status::malformed, format::wav, "The RIFF size couldn't be read");
+	}
+	const auto riff_end = 8 + (layout->size_field_bytes == 8 ? wav::load_le<uint64_t>(riff_size_bytes) : wav::load_le<uint32_t>(riff_size_bytes));
+	if (riff_end < layout->data_offset + layout->data_size || riff_end > length) {
+		return make_result(verify_status::malformed, format::wav, std::format("The RIFF size {} doesn't match the chunks or the file length {}", riff_end - 8, length));
+	}
+	// Nothing else in the file can be checked, but every byte of it should
+	// at least be readable.
+	auto buffer = tracked_buffer<std::byte>{memory_category::io};
+	buffer.resize(VERIFY_READ_SIZE);
+	if (!in->seek(int64_t(layout->data_offset), std::ios::beg)) {
+		return make_result(verify_status::unreadable, format::wav, "Couldn't seek to the sample data");
+	}
+	for (uint64_t pos = 0; pos < layout->data_size;) {
+		if (should_abort(options)) {
+			return make_result(verify_status::aborted, format::wav, {});
+		}
+		const auto bytes = size_t(std::min(uint64_t(VERIFY_READ_SIZE), layout->data_size - pos));
+		if (in->read_bytes({buffer.data(), bytes}) != bytes) {
+			return make_result(verify_status::unreadable, format::wav, std::format("The sample data couldn't be read at {}", layout->data_offset + pos));
+		}
+		pos += bytes;
+	}
+	auto result = verify_result{};
+	result.format         = format::wav;
+	result.frames_decoded = layout->data_size / layout->block_align;
+	return result;
+}
+
+#if AUDIORW_WITH_WAVPACK
+using wavpack_context_uptr = std::unique_ptr<WavpackContext, decltype(&WavpackCloseFile)>;
+
+[[nodiscard]] static
+auto verify_wavpack(stream_bytes_from_fs_path* in, const verify_options& options) -> verify_result {
+	auto stream = make_wavpack_stream_reader<stream_bytes_from_fs_path>();
+	char error[80];
+	// Every channel is decoded, and floats aren't normalized, so that the
+	// samples are exactly what the MD5 was computed on.
+	auto context = wavpack_context_uptr{WavpackOpenFileInputEx64(&stream, in, nullptr, error, 0, 0), &WavpackCloseFile};
+	if (!context) {
+		return make_result(verify_status::unreadable, format::wavpack, error);
+	}
+	const auto chs              = size_t(WavpackGetNumChannels(context.get()));
+	const auto bytes_per_sample = size_t(WavpackGetBytesPerSample(context.get()));
+	const auto total            = WavpackGetNumSamples64(context.get());
+	const auto qmode            = WavpackGetQualifyMode(context.get());
+	auto hash    = md5{};
+	auto samples = tracked_buffer<int32_t>{};
+	auto bytes   = tracked_buffer<std::byte>{};
+	auto result  = verify_result{};
+	result.format = format::wavpack;
+	samples.resize(chs * CHUNK_SIZE);
+	for (;;) {
+		if (should_abort(options)) {
+			return make_result(verify_status::aborted, format::wavpack, {});
+		}
+		const auto frames = WavpackUnpackSamples(context.get(), samples.data(), CHUNK_SIZE);
+		if (frames == 0) {
+			break;
+		}
+		format_wavpack_md5_bytes({samples.data(), frames * chs}, bytes_per_sample, qmode, &bytes);
+		hash.update({bytes.data(), bytes.size()});
+		result.frames_decoded += frames;
+	}
+	// Damaged blocks are decoded as silence and counted.
+	result.crc_errors = uint64_t(WavpackGetNumErrors(context.get()));
+	if (result.crc_errors > 0) {
+		result.status  = verify_status::corrupt;
+		result.message = std::format("{} WavPack block(s) failed their CRC", result.crc_errors);
+		return result;
+	}
+	if (total >= 0 && result.frames_decoded != uint64_t(total)) {
+		result.status  = verify_status::malformed;
+		result.message = std::format("The header has {} frames but {} were decoded", total, result.frames_decoded);
+		return result;
+	}
+	// The MD5 is read from the last block, so this can only be asked now.
+	// It is of the lossless audio, so can't be checked without the
+	// correction file if the file is hybrid.
+	unsigned char stored[16];
+	if (!WavpackLossyBlocks(context.get()) && WavpackGetMD5Sum(context.get(), stored)) {
+		result.md5_checked = true;
+		if (!std::ranges::equal(hash.finish(), stored)) {
+			result.status  = verify_status::corrupt;
+			result.message = "The audio doesn't match the stored MD5";
+		}
+	}
+	return result;
+}
+#endif
+
+// Formats without checksums are decoded with the normal reader, which is
+// all that can be done to check them.
+[[nodiscard]] static
+auto verify_by_reading(const std::filesystem::path& path, const verify_options& options) -> verify_result {
+	auto in = stream_item_from_fs_path{path, make_format_hint(path, true).value_or(format_hint::try_mp3_first)};
+	const auto header = in.get_header();
+	auto buffer = tracked_buffer<float>{};
+	auto result = verify_result{};
+	result.format = header.format;
+	buffer.resize(header.channel_count.value * CHUNK_SIZE);
+	while (result.frames_decoded < header.frame_count.value) {
+		if (should_abort(options)) {
+			return make_result(verify_status::aborted, header.format, {});
+		}
+		const auto frames = std::min(header.frame_count.value - result.frames_decoded, uint64_t(CHUNK_SIZE));
+		if (in.read_frames({buffer.data(), header.channel_count.value * frames}) != frames) {
+			result.status  = verify_status::malformed;
+			result.message = std::format("The header has {} frames but only {} could be decoded", header.frame_count.value, result.frames_decoded);
+			return result;
+		}
+		result.frames_decoded += frames;
+	}
+	return result;
+}
+
+[[nodiscard]] static
+auto verify_file(const std::filesystem::path& path, const verify_options& options) -> verify_result {
+	auto in    = stream_bytes_from_fs_path{path, options.cache};
+	const auto start = skip_id3(&in);
+	std::byte id[12] = {};
+	const auto id_bytes = read_at(&in, start, id);
+	if (id_bytes == sizeof(id) && wav::is_riff_id(id) && wav::is_id(id + 8, "WAVE")) {
+		return verify_wav(&in, options);
+	}
+	if (id_bytes >= 4 && wav::is_id(id, "fLaC")) {
+#if AUDIORW_WITH_FLAC
+		if (!in.seek(int64_t(start), std::ios::beg)) {
+			return make_result(verify_status::unreadable, format::flac, "Couldn't seek to the FLAC stream");
+		}
+		return flac::verify(make_byte_stream_reader<stream_bytes_from_fs_path>(), &in, start, options.should_abort);
+#else
+		return make_result(verify_status::unreadable, format::flac, "audiorw was built without FLAC support");
+#endif
+	}
+	if (id_bytes >= 4 && wav::is_id(id, "wvpk")) {
+#if AUDIORW_WITH_WAVPACK
+		if (!in.seek(0, std::ios::beg)) {
+			return make_result(verify_status::unreadable, format::wavpack, "Couldn't seek to the start of the file");
+		}
+		return verify_wavpack(&in, options);
+#else
+		return make_result(verify_status::unreadable, format::wavpack, "audiorw was built without WavPack support");
+#endif
+	}
+	in.close();
+	return verify_by_reading(path, options);
+}
+
+[[nodiscard]] static
+auto try_verify_file(const std::filesystem::path& path, const verify_options& options) -> verify_result {
+	try {
+		auto result = verify_file(path, options);
+		if (result.format) {
+			counters::add(*result.format, counters::counter::frames_decoded, result.frames_decoded);
+		}
+		return result;
+	}
+	catch (const std::exception& err) {
+		return make_result(verify_status::unreadable, std::nullopt, err.what());
+	}
+}
+
+} // audiorw::detail
+
+namespace audiorw {
+
+auto verify(std::span<const std::filesystem::path> paths, const verify_options& options) -> std::vector<verify_result> {
+	auto results = std::vector<verify_result>(paths.size());
+	detail::parallel_for(detail::executor_or_inline(options.executor), paths.size(), [&](size_t index) {
+		results[index] = detail::try_verify_file(paths[index], options);
+		if (options.on_complete) {
+			options.on_complete(index, results[index]);
+		}
+	});
+	return results;
+}
+
+auto verify(const std::filesystem::path& path, const verify_options& options) -> verify_result {
+	return detail::try_verify_file(path, options);
+}
+
+} // audiorw
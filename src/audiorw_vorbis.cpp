@@ -0,0 +1,455 @@
+#include <cstring>
+#include "audiorw.hpp"
+#define STB_VORBIS_HEADER_ONLY
+#include "extras/stb_vorbis.c"
+
+namespace audiorw::detail::ogg {
+
+static constexpr auto PAGE_HEADER_SIZE = size_t{27};
+static constexpr auto MAX_PAGE_SIZE    = PAGE_HEADER_SIZE + 255 + (255 * 255);
+// The granule position of a page on which no packet ends.
+static constexpr auto NO_GRANULE       = ~uint64_t{0};
+
+struct page {
+	uint64_t offset;
+	size_t size;
+	uint64_t granule;
+	uint32_t serial;
+};
+
+[[nodiscard]] static constexpr
+auto make_crc_table() -> std::array<uint32_t, 256> {
+	auto table = std::array<uint32_t, 256>{};
+	for (uint32_t i = 0; i < 256; i++) {
+		auto crc = i << 24;
+		for (int bit = 0; bit < 8; bit++) {
+			crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7 : crc << 1;
+		}
+		table[i] = crc;
+	}
+	return table;
+}
+
+static constexpr auto CRC_TABLE = make_crc_table();
+
+template <typename T> [[nodiscard]] static
+auto load_le(const std::byte* bytes) -> T {
+	auto value = T{0};
+	for (size_t i = 0; i < sizeof(T); i++) {
+		value |= T(std::to_integer<uint8_t>(bytes[i])) << (8 * i);
+	}
+	return value;
+}
+
+// Parses the page header at the start of bytes, which must hold at least
+// the header and segment table. The rest of the page may be cut off.
+[[nodiscard]] static
+auto parse_page(std::span<const std::byte> bytes, uint64_t offset) -> std::optional<page> {
+	if (bytes.size() < PAGE_HEADER_SIZE || std::memcmp(bytes.data(), "OggS", 4) != 0 || bytes[4] != std::byte{0}) {
+		return std::nullopt;
+	}
+	const auto segments = std::to_integer<size_t>(bytes[26]);
+	if (bytes.size() < PAGE_HEADER_SIZE + segments) {
+		return std::nullopt;
+	}
+	auto size = PAGE_HEADER_SIZE + segments;
+	for (size_t i = 0; i < segments; i++) {
+		size += std::to_integer<size_t>(bytes[PAGE_HEADER_SIZE + i]);
+	}
+	return page{offset, size, load_le<uint64_t>(bytes.data() + 6), load_le<uint32_t>(bytes.data() + 14)};
+}
+
+// For pages found by scanning, where "OggS" could just be part of a packet.
+[[nodiscard]] static
+auto is_valid(std::span<const std::byte> bytes, const page& p) -> bool {
+	if (bytes.size() < p.size) {
+		return false;
+	}
+	auto crc = uint32_t{0};
+	for (size_t i = 0; i < p.size; i++) {
+		// The checksum is calculated with its own field set to zero.
+		const auto b = (i >= 22 && i < 26) ? uint8_t{0} : std::to_integer<uint8_t>(bytes[i]);
+		crc = (crc << 8) ^ CRC_TABLE[(crc >> 24) ^ b];
+	}
+	return crc == load_le<uint32_t>(bytes.data() + 22);
+}
+
+} // audiorw::detail::ogg
+
+namespace audiorw::detail {
+
+// Bytes are read from the stream in blocks of this size.
+static constexpr auto VORBIS_READ_SIZE = size_t{1} << 16;
+// Decoding starts from a page at least this many frames before a seek
+// target. stb_vorbis drops the packet that the page starts part way
+// through, and the one after that only primes the decoder. Neither can
+// cover more than 4096 frames.
+static constexpr auto VORBIS_PREROLL   = uint64_t{1} << 14;
+// Seeks forward by less than this just decode up to the target.
+static constexpr auto VORBIS_SEEK_DECODE_LIMIT = uint64_t{1} << 16;
+// The header packets, including the comments, which can hold cover art.
+static constexpr auto MAX_VORBIS_HEADERS_SIZE  = size_t{1} << 26;
+
+struct scope_vorbis_reader::impl {
+	byte_stream_reader stream;
+	void* user_data;
+	stb_vorbis* vorbis = nullptr;
+	uint32_t serial    = 0;
+	size_t channels    = 0;
+	uint64_t length    = 0;
+	uint64_t frame_count = 0;
+	// Everything before the first audio page, to start again from.
+	std::vector<std::byte> headers;
+	std::optional<uint64_t> stream_pos;
+	// Input. in[0] is at in_offset in the stream. stb_vorbis has consumed
+	// up to in_pos and has been handed whole pages up to feed_end.
+	tracked_buffer<std::byte> in{memory_category::io};
+	uint64_t in_offset = 0;
+	size_t in_pos      = 0;
+	size_t in_end      = 0;
+	size_t feed_end    = 0;
+	// The granule position of the last page handed over which had one.
+	uint64_t fed_granule = ogg::NO_GRANULE;
+	// Decoded interleaved frames which haven't been returned yet.
+	tracked_buffer<float> pending{memory_category::decoder};
+	size_t pending_pos    = 0;
+	size_t pending_frames = 0;
+	// Where pending_pos is. Unknown after a seek until a page with a
+	// granule position has been decoded.
+	std::optional<uint64_t> pos;
+	tracked_buffer<std::byte> scan{memory_category::io};
+	~impl() {
+		if (vorbis) {
+			stb_vorbis_close(vorbis);
+		}
+	}
+	auto read_at(uint64_t offset, std::span<std::byte> buffer) -> size_t {
+		if (stream_pos != offset) {
+			stream_pos.reset();
+			if (!stream.seek(user_data, offset)) {
+				return 0;
+			}
+			stream_pos = offset;
+		}
+		auto total = size_t{0};
+		while (total < buffer.size()) {
+			const auto n = stream.read_bytes(user_data, buffer.subspan(total));
+			if (n == 0) {
+				break;
+			}
+			total += n;
+		}
+		*stream_pos += total;
+		return total;
+	}
+	auto open() -> void {
+		if (vorbis) {
+			stb_vorbis_close(vorbis);
+			vorbis = nullptr;
+		}
+		int used;
+		int error;
+		vorbis = stb_vorbis_open_pushdata(reinterpret_cast<const unsigned char*>(headers.data()), int(headers.size()), &used, &error, nullptr);
+		if (!vorbis) {
+			throw std::runtime_error{"Failed to open Ogg Vorbis stream"};
+		}
+	}
+	// Moves the input to a page boundary and forgets what was decoded.
+	auto reset_input(uint64_t offset) -> void {
+		in_offset      = offset;
+		in_pos         = 0;
+		in_end         = 0;
+		feed_end       = 0;
+		fed_granule    = ogg::NO_GRANULE;
+		pending_pos    = 0;
+		pending_frames = 0;
+	}
+	auto restart() -> void {
+		open();
+		reset_input(headers.size());
+		pos = 0;
+	}
+	auto seek_to_page(const ogg::page& p) -> void {
+		stb_vorbis_flush_pushdata(vorbis);
+		reset_input(p.offset);
+		pos.reset();
+	}
+	// Makes sure the input holds [in_pos, end), or as much of it as the
+	// stream has.
+	auto fill(size_t end) -> void {
+		if (end <= in_end) {
+			return;
+		}
+		if (in_pos > 0) {
+			std::memmove(in.data(), in.data() + in_pos, in_end - in_pos);
+			in_offset += in_pos;
+			in_end    -= in_pos;
+			feed_end  -= in_pos;
+			end       -= in_pos;
+			in_pos     = 0;
+		}
+		if (in.size() < std::max(end, VORBIS_READ_SIZE)) {
+			in.resize(std::max(end, VORBIS_READ_SIZE));
+		}
+		in_end += read_at(in_offset + in_end, {in.data() + in_end, in.size() - in_end});
+	}
+	// Hands the next page over to stb_vorbis. Returns false at the end of
+	// the logical stream.
+	auto feed_page() -> bool {
+		fill(feed_end + ogg::PAGE_HEADER_SIZE + 255);
+		const auto p = ogg::parse_page({in.data() + feed_end, in_end - feed_end}, in_offset + feed_end);
+		if (!p || p->serial != serial) {
+			return false;
+		}
+		fill(feed_end + p->size);
+		if (in_end - feed_end < p->size) {
+			return false;
+		}
+		feed_end += p->size;
+		if (p->granule != ogg::NO_GRANULE) {
+			fed_granule = p->granule;
+		}
+		return true;
+	}
+	auto add_pending(float** output, size_t frames) -> void {
+		if (pending_pos == pending_frames) {
+			pending_pos    = 0;
+			pending_frames = 0;
+		}
+		pending.resize((pending_frames + frames) * channels);
+		auto dst = pending.data() + (pending_frames * channels);
+		for (size_t i = 0; i < frames; i++) {
+			for (size_t c = 0; c < channels; c++) {
+				*dst++ = output[c][i];
+			}
+		}
+		pending_frames += frames;
+	}
+	// Every packet which ends on the pages handed over so far has been
+	// decoded, so the last frame decoded is the one before fed_granule.
+	auto sync_pos() -> void {
+		if (pos || fed_granule == ogg::NO_GRANULE || pending_frames == 0) {
+			return;
+		}
+		pos = fed_granule >= pending_frames ? fed_granule - pending_frames : 0;
+	}
+	// Decodes the next packet into pending. Returns false at the end.
+	auto decode_packet() -> bool {
+		for (;;) {
+			int chs;
+			float** output;
+			int samples = 0;
+			const auto used = stb_vorbis_decode_frame_pushdata(vorbis, reinterpret_cast<const unsigned char*>(in.data() + in_pos), int(feed_end - in_pos), &chs, &output, &samples);
+			if (used > 0) {
+				in_pos += used;
+				if (samples > 0) {
+					add_pending(output, samples);
+				}
+				return true;
+			}
+			if (stb_vorbis_get_error(vorbis) != VORBIS_need_more_data) {
+				throw std::runtime_error{"Failed to decode Ogg Vorbis packet"};
+			}
+			sync_pos();
+			if (!feed_page()) {
+				return false;
+			}
+		}
+	}
+	// Decodes until the next frame is at target, or the end. Returns false
+	// if decoding started too late to get there.
+	auto decode_to(uint64_t target) -> bool {
+		for (;;) {
+			if (pos) {
+				if (*pos > target) {
+					return false;
+				}
+				const auto skip = std::min<uint64_t>(target - *pos, pending_frames - pending_pos);
+				pending_pos += skip;
+				*pos        += skip;
+				if (*pos == target) {
+					return true;
+				}
+			}
+			if (!decode_packet()) {
+				return pos && *pos <= target;
+			}
+		}
+	}
+	// Finds the first valid page of the stream with a granule position
+	// which starts in [from, limit).
+	auto find_page(uint64_t from, uint64_t limit) -> std::optional<ogg::page> {
+		while (from < limit) {
+			scan.resize(VORBIS_READ_SIZE + ogg::MAX_PAGE_SIZE);
+			const auto n     = read_at(from, {scan.data(), scan.size()});
+			const auto bytes = std::span<const std::byte>{scan.data(), n};
+			const auto end   = std::min<uint64_t>(std::min(n, VORBIS_READ_SIZE), limit - from);
+			auto next = end;
+			for (size_t i = 0; i < end; i++) {
+				const auto p = ogg::parse_page(bytes.subspan(i), from + i);
+				if (!p || !ogg::is_valid(bytes.subspan(i), *p)) {
+					continue;
+				}
+				if (p->serial == serial && p->granule != ogg::NO_GRANULE) {
+					return p;
+				}
+				next = i + p->size;
+				break;
+			}
+			if (n == 0) {
+				break;
+			}
+			from += next;
+		}
+		return std::nullopt;
+	}
+	// Bisects the file for the last page whose granule position is at most
+	// target.
+	auto find_page_before(uint64_t target) -> std::optional<ogg::page> {
+		const auto data_offset = uint64_t{headers.size()};
+		auto lo   = data_offset;
+		auto hi   = length;
+		auto best = std::optional<ogg::page>{};
+		while (hi - lo > VORBIS_READ_SIZE) {
+			const auto mid = lo + ((hi - lo) / 2);
+			const auto p   = find_page(mid, hi);
+			if (p && p->granule <= target) {
+				best = p;
+				// The page can run past hi, and hi - lo mustn't wrap.
+				lo   = std::min(p->offset + p->size, hi);
+			}
+			else {
+				hi = mid;
+			}
+		}
+		for (auto p = find_page(lo, hi); p && p->granule <= target; p = find_page(p->offset + p->size, hi)) {
+			best = p;
+		}
+		return best;
+	}
+	// The granule position of the last page is the number of frames.
+	auto find_last_granule() -> uint64_t {
+		for (auto window = VORBIS_READ_SIZE;; window *= 4) {
+			const auto start = length > window ? length - window : 0;
+			scan.resize(length - start);
+			const auto n     = read_at(start, {scan.data(), scan.size()});
+			const auto bytes = std::span<const std::byte>{scan.data(), n};
+			for (auto i = n; i-- > 0;) {
+				const auto p = ogg::parse_page(bytes.subspan(i), start + i);
+				if (p && p->serial == serial && p->granule != ogg::NO_GRANULE && ogg::is_valid(bytes.subspan(i), *p)) {
+					return p->granule;
+				}
+			}
+			if (start == 0) {
+				throw std::runtime_error{"Ogg Vorbis stream has no audio"};
+			}
+		}
+	}
+};
+
+scope_vorbis_reader::scope_vorbis_reader(byte_stream_reader stream, void* user_data)
+	: impl_{std::make_unique<impl>(stream, user_data)}
+{
+	auto& x = *impl_;
+	const auto length = stream.get_length(user_data);
+	if (!length) {
+		throw std::runtime_error{"Ogg Vorbis needs a stream of known length"};
+	}
+	x.length = *length;
+	// stb_vorbis is given more and more of the start of the stream until it
+	// has all of the headers.
+	for (auto size = VORBIS_READ_SIZE;; size *= 2) {
+		x.headers.resize(size);
+		x.headers.resize(x.read_at(0, x.headers));
+		int used;
+		int error;
+		x.vorbis = stb_vorbis_open_pushdata(reinterpret_cast<const unsigned char*>(x.headers.data()), int(x.headers.size()), &used, &error, nullptr);
+		if (x.vorbis) {
+			x.headers.resize(used);
+			break;
+		}
+		if (error != VORBIS_need_more_data || x.headers.size() < size || size >= MAX_VORBIS_HEADERS_SIZE) {
+			throw std::runtime_error{"Not an Ogg Vorbis file"};
+		}
+	}
+	const auto first_page = ogg::parse_page(x.headers, 0);
+	if (!first_page) {
+		throw std::runtime_error{"Not an Ogg Vorbis file"};
+	}
+	const auto info = stb_vorbis_get_info(x.vorbis);
+	x.serial      = first_page->serial;
+	x.channels    = size_t(info.channels);
+	x.frame_count = x.find_last_granule();
+	x.reset_input(x.headers.size());
+	x.pos = 0;
+	header_.format        = format::vorbis;
+	header_.SR            = int(info.sample_rate);
+	header_.bit_depth     = 32;
+	header_.channel_count = {x.channels};
+	header_.frame_count   = {x.frame_count};
+}
+
+scope_vorbis_reader::scope_vorbis_reader(scope_vorbis_reader&& rhs) noexcept = default;
+scope_vorbis_reader& scope_vorbis_reader::operator=(scope_vorbis_reader&& rhs) noexcept = default;
+scope_vorbis_reader::~scope_vorbis_reader() = default;
+
+auto scope_vorbis_reader::read_frames(std::span<float> buffer) -> ads::frame_count {
+	auto& x = *impl_;
+	// A seek which failed part way can leave the position unknown, and
+	// then the only place to read from is the start.
+	if (!x.pos) {
+		x.restart();
+	}
+	// The last packet can decode past the end of the stream.
+	const auto frames = std::min<uint64_t>(buffer.size() / x.channels, x.frame_count - std::min(*x.pos, x.frame_count));
+	auto done = uint64_t{0};
+	while (done < frames) {
+		if (x.pending_pos == x.pending_frames) {
+			if (!x.decode_packet()) {
+				break;
+			}
+			continue;
+		}
+		const auto n = std::min<uint64_t>(frames - done, x.pending_frames - x.pending_pos);
+		std::memcpy(buffer.data() + (done * x.channels), x.pending.data() + (x.pending_pos * x.channels), n * x.channels * sizeof(float));
+		x.pending_pos += n;
+		*x.pos        += n;
+		done          += n;
+	}
+	return {done};
+}
+
+auto scope_vorbis_reader::seek(ads::frame_idx pos) -> bool {
+	auto& x = *impl_;
+	const auto target = pos.value;
+	if (target > x.frame_count) {
+		return false;
+	}
+	if (x.pos && *x.pos <= target && target - *x.pos < VORBIS_SEEK_DECODE_LIMIT) {
+		return x.decode_to(target);
+	}
+	const auto page = target >= VORBIS_PREROLL ? x.find_page_before(target - VORBIS_PREROLL) : std::nullopt;
+	if (page) {
+		// Starting from the page can go wrong, e.g. if it's damaged, but
+		// starting from the beginning still might not.
+		try {
+			x.seek_to_page(*page);
+			if (x.decode_to(target)) {
+				return true;
+			}
+		}
+		catch (const std::exception&) {}
+	}
+	x.restart();
+	return x.decode_to(target);
+}
+
+auto read_frames(scope_vorbis_reader* decoder, std::span<float> buffer) -> ads::frame_count {
+	return decoder->read_frames(buffer);
+}
+
+auto seek(scope_vorbis_reader* decoder, ads::frame_idx pos) -> bool {
+	return decoder->seek(pos);
+}
+
+} // audiorw::detail
@@ -0,0 +1,730 @@
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cmath>
+#include "audiorw_wav.hpp"
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define AUDIORW_WAV_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define AUDIORW_WAV_NEON
+#include <arm_neon.h>
+#endif
+
+namespace audiorw::detail::wav {
+
+auto get_bytes_per_sample(sample_format format) -> size_t {
+	switch (format) {
+		case sample_format::u8:  { return 1; }
+		case sample_format::s16: { return 2; }
+		case sample_format::s24: { return 3; }
+		case sample_format::s32: { return 4; }
+		case sample_format::f32: { return 4; }
+		case sample_format::f64: { return 8; }
+		default:                 { throw std::runtime_error{"Invalid sample format"}; }
+	}
+}
+
+auto get_sample_format(uint16_t format_tag, uint16_t bits_per_sample) -> std::optional<sample_format> {
+	if (format_tag == WAVE_FORMAT_PCM) {
+		switch (bits_per_sample) {
+			case 8:  { return sample_format::u8; }
+			case 16: { return sample_format::s16; }
+			case 24: { return sample_format::s24; }
+			case 32: { return sample_format::s32; }
+			default: { return std::nullopt; }
+		}
+	}
+	if (format_tag == WAVE_FORMAT_IEEE_FLOAT) {
+		switch (bits_per_sample) {
+			case 32: { return sample_format::f32; }
+			case 64: { return sample_format::f64; }
+			default: { return std::nullopt; }
+		}
+	}
+	return std::nullopt;
+}
+
+auto get_format_tag(sample_format format) -> uint16_t {
+	switch (format) {
+		case sample_format::f32:
+		case sample_format::f64: { return WAVE_FORMAT_IEEE_FLOAT; }
+		default:                 { return WAVE_FORMAT_PCM; }
+	}
+}
+
+auto get_sample_format(int bit_depth, storage_type type) -> sample_format {
+	switch (bit_depth) {
+		case 8:  { return sample_format::u8; }
+		case 16: { return sample_format::s16; }
+		case 24: { return sample_format::s24; }
+		case 32: { return type == storage_type::int_ ? sample_format::s32 : sample_format::f32; }
+		default: { throw std::runtime_error{"Invalid audio format"}; }
+	}
+}
+
+auto make_layout(const audiorw::header& header, storage_type type) -> layout {
+	auto out = layout{};
+	out.format                 = get_sample_format(header.bit_depth, type);
+	out.channel_count          = static_cast<uint16_t>(header.channel_count.value);
+	out.SR                     = static_cast<uint32_t>(header.SR);
+	out.bits_per_sample        = static_cast<uint16_t>(get_bytes_per_sample(out.format) * 8);
+	out.block_align            = static_cast<uint16_t>(out.channel_count * get_bytes_per_sample(out.format));
+	out.data_offset            = PCM_HEADER_SIZE;
+	out.data_size              = header.frame_count.value * out.block_align;
+	out.data_size_field_offset = PCM_HEADER_SIZE - 4;
+	return out;
+}
+
+auto fits_in_riff(size_t header_size, uint64_t data_size) -> bool {
+	// The data chunk is padded to an even size.
+	return header_size - 8 + data_size + (data_size & 1) <= UINT32_MAX;
+}
+
+static
+auto write_fmt_and_data_chunks(std::byte* p, const layout& layout, uint32_t data_size) -> void {
+	std::memcpy(p, "fmt ", 4);
+	store_le<uint32_t>(p + 4, 16);
+	store_le<uint16_t>(p + 8, get_format_tag(layout.format));
+	store_le<uint16_t>(p + 10, layout.channel_count);
+	store_le<uint32_t>(p + 12, layout.SR);
+	store_le<uint32_t>(p + 16, layout.SR * layout.block_align);
+	store_le<uint16_t>(p + 20, layout.block_align);
+	store_le<uint16_t>(p + 22, layout.bits_per_sample);
+	std::memcpy(p + 24, "data", 4);
+	store_le<uint32_t>(p + 28, data_size);
+}
+
+auto make_pcm_header(const layout& layout) -> std::array<std::byte, PCM_HEADER_SIZE> {
+	if (!fits_in_riff(PCM_HEADER_SIZE, layout.data_size)) {
+		throw std::runtime_error{"Too much data for a RIFF header"};
+	}
+	auto out = std::array<std::byte, PCM_HEADER_SIZE>{};
+	const auto p = out.data();
+	std::memcpy(p, "RIFF", 4);
+	store_le<uint32_t>(p + 4, static_cast<uint32_t>(PCM_HEADER_SIZE - 8 + layout.data_size + (layout.data_size & 1)));
+	std::memcpy(p + 8, "WAVE", 4);
+	write_fmt_and_data_chunks(p + 12, layout, static_cast<uint32_t>(layout.data_size));
+	return out;
+}
+
+auto make_rf64_header(const layout& layout, uint64_t frame_count) -> std::array<std::byte, RF64_HEADER_SIZE> {
+	auto out = std::array<std::byte, RF64_HEADER_SIZE>{};
+	const auto p         = out.data();
+	const auto riff_size = RF64_HEADER_SIZE - 8 + layout.data_size + (layout.data_size & 1);
+	if (fits_in_riff(RF64_HEADER_SIZE, layout.data_size)) {
+		std::memcpy(p, "RIFF", 4);
+		store_le<uint32_t>(p + 4, static_cast<uint32_t>(riff_size));
+		std::memcpy(p + 8, "WAVEJUNK", 8);
+		store_le<uint32_t>(p + 16, DS64_SIZE);
+		write_fmt_and_data_chunks(p + 20 + DS64_SIZE, layout, static_cast<uint32_t>(layout.data_size));
+		return out;
+	}
+	std::memcpy(p, "RF64", 4);
+	store_le<uint32_t>(p + 4, UINT32_MAX);
+	std::memcpy(p + 8, "WAVEds64", 8);
+	store_le<uint32_t>(p + 16, DS64_SIZE);
+	store_le<uint64_t>(p + 20, riff_size);
+	store_le<uint64_t>(p + 28, layout.data_size);
+	store_le<uint64_t>(p + 36, frame_count);
+	store_le<uint32_t>(p + 44, 0);
+	write_fmt_and_data_chunks(p + 20 + DS64_SIZE, layout, UNKNOWN_DATA_SIZE_32);
+	return out;
+}
+
+auto to_header(const layout& layout, uint64_t frame_count) -> audiorw::header {
+	auto out = audiorw::header{};
+	out.format        = format::wav;
+	out.channel_count = {layout.channel_count};
+	out.frame_count   = {frame_count};
+	out.SR            = static_cast<int>(layout.SR);
+	out.bit_depth     = layout.bits_per_sample;
+	return out;
+}
+
+// The same as dr_wav, which decoded WAV files before, so 8-bit files
+// decode to exactly what they did.
+static constexpr auto U8_SCALE  = 1.0f / 127.5f;
+static constexpr auto S16_SCALE = 1.0f / 32768.0f;
+static constexpr auto S24_SCALE = 1.0f / 8388608.0f;
+static constexpr auto S32_SCALE = 1.0f / 2147483648.0f;
+
+template <typename T> [[nodiscard]] static
+auto load_native(const std::byte* src) -> T {
+	// WAV is little endian, as is every platform this is built for. The
+	// vector loops load samples straight from memory too.
+	static_assert(std::endian::native == std::endian::little, "WAV samples are loaded in host byte order");
+	auto value = T{};
+	std::memcpy(&value, src, sizeof(T));
+	return value;
+}
+
+[[nodiscard]] static
+auto load_s24(const std::byte* p) -> int32_t {
+	// Assembled in the top of a 32 bit integer to sign extend.
+	return int32_t(
+		uint32_t(std::to_integer<uint8_t>(p[0])) << 8 |
+		uint32_t(std::to_integer<uint8_t>(p[1])) << 16 |
+		uint32_t(std::to_integer<uint8_t>(p[2])) << 24) >> 8;
+}
+
+// Converts a single sample. Used for whatever the vector loops leave over.
+[[nodiscard]] static
+auto to_float(sample_format format, const std::byte* src) -> float {
+	switch (format) {
+		case sample_format::u8:  { return (float(std::to_integer<uint8_t>(*src)) * U8_SCALE) - 1.0f; }
+		case sample_format::s16: { return float(load_native<int16_t>(src)) * S16_SCALE; }
+		case sample_format::s24: { return float(load_s24(src)) * S24_SCALE; }
+		case sample_format::s32: { return float(load_native<int32_t>(src)) * S32_SCALE; }
+		case sample_format::f32: { return load_native<float>(src); }
+		case sample_format::f64: { return float(load_native<double>(src)); }
+		default:                 { throw std::runtime_error{"Invalid sample format"}; }
+	}
+}
+
+// The vector loops convert as many samples as they can and return how many
+// that was. They produce exactly what to_float() would.
+#if defined(AUDIORW_WAV_SSE2)
+
+[[nodiscard]] static
+auto convert_s16_simd(const std::byte* src, float* dst, size_t count) -> size_t {
+	const auto scale = _mm_set1_ps(S16_SCALE);
+	auto i = size_t{0};
+	for (; i + 8 <= count; i += 8) {
+		const auto x  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + (i * 2)));
+		const auto lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+		const auto hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+		_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+		_mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+	}
+	return i;
+}
+
+[[nodiscard]] static
+auto convert_s32_simd(const std::byte* src, float* dst, size_t count) -> size_t {
+	const auto scale = _mm_set1_ps(S32_SCALE);
+	auto i = size_t{0};
+	for (; i + 4 <= count; i += 4) {
+		const auto x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + (i * 4)));
+		_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(x), scale));
+	}
+	return i;
+}
+
+// A std::pair would drop the vectors' alignment attributes.
+struct stereo_frames_simd {
+	__m128 a;
+	__m128 b;
+};
+
+// Loads 4 stereo frames as floats, a = L0 R0 L1 R1, b = L2 R2 L3 R3.
+[[nodiscard]] static
+auto load_stereo_simd(sample_format format, const std::byte* src) -> stereo_frames_simd {
+	switch (format) {
+		case sample_format::s16: {
+			const auto x     = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src));
+			const auto y     = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + 8));
+			const auto scale = _mm_set1_ps(S16_SCALE);
+			return {
+				_mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16)), scale),
+				_mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(y, y), 16)), scale)};
+		}
+		case sample_format::s32: {
+			const auto scale = _mm_set1_ps(S32_SCALE);
+			return {
+				_mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src))), scale),
+				_mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 16))), scale)};
+		}
+		default: {
+			return {
+				_mm_loadu_ps(reinterpret_cast<const float*>(src)),
+				_mm_loadu_ps(reinterpret_cast<const float*>(src + 16))};
+		}
+	}
+}
+
+[[nodiscard]] static
+auto deinterleave_stereo_simd(sample_format format, const std::byte* src, size_t frame_count, float* left, float* right) -> size_t {
+	if (format != sample_format::s16 && format != sample_format::s32 && format != sample_format::f32) {
+		return 0;
+	}
+	const auto frame_bytes = get_bytes_per_sample(format) * 2;
+	auto f = size_t{0};
+	for (; f + 4 <= frame_count; f += 4) {
+		const auto [a, b] = load_stereo_simd(format, src + (f * frame_bytes));
+		if (left)  { _mm_storeu_ps(left + f, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0))); }
+		if (right) { _mm_storeu_ps(right + f, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1))); }
+	}
+	return f;
+}
+
+#elif defined(AUDIORW_WAV_NEON)
+
+[[nodiscard]] static
+auto convert_s16_simd(const std::byte* src, float* dst, size_t count) -> size_t {
+	auto i = size_t{0};
+	for (; i + 8 <= count; i += 8) {
+		const auto x = vld1q_s16(reinterpret_cast<const int16_t*>(src + (i * 2)));
+		vst1q_f32(dst + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(x))), S16_SCALE));
+		vst1q_f32(dst + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(x))), S16_SCALE));
+	}
+	return i;
+}
+
+[[nodiscard]] static
+auto convert_s32_simd(const std::byte* src, float* dst, size_t count) -> size_t {
+	auto i = size_t{0};
+	for (; i + 4 <= count; i += 4) {
+		const auto x = vld1q_s32(reinterpret_cast<const int32_t*>(src + (i * 4)));
+		vst1q_f32(dst + i, vmulq_n_f32(vcvtq_f32_s32(x), S32_SCALE));
+	}
+	return i;
+}
+
+[[nodiscard]] static
+auto deinterleave_stereo_simd(sample_format format, const std::byte* src, size_t frame_count, float* left, float* right) -> size_t {
+	auto f = size_t{0};
+	const auto store = [&](float32x4x2_t x) {
+		if (left)  { vst1q_f32(left + f, x.val[0]); }
+		if (right) { vst1q_f32(right + f, x.val[1]); }
+	};
+	switch (format) {
+		case sample_format::s16: {
+			for (; f + 4 <= frame_count; f += 4) {
+				// vld2 splits the channels as it loads.
+				const auto x = vld2_s16(reinterpret_cast<const int16_t*>(src + (f * 4)));
+				store({vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(x.val[0])), S16_SCALE), vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(x.val[1])), S16_SCALE)});
+			}
+			return f;
+		}
+		case sample_format::s32: {
+			for (; f + 4 <= frame_count; f += 4) {
+				const auto x = vld2q_s32(reinterpret_cast<const int32_t*>(src + (f * 8)));
+				store({vmulq_n_f32(vcvtq_f32_s32(x.val[0]), S32_SCALE), vmulq_n_f32(vcvtq_f32_s32(x.val[1]), S32_SCALE)});
+			}
+			return f;
+		}
+		case sample_format::f32: {
+			for (; f + 4 <= frame_count; f += 4) {
+				store(vld2q_f32(reinterpret_cast<const float*>(src + (f * 8))));
+			}
+			return f;
+		}
+		default: {
+			return 0;
+		}
+	}
+}
+
+#else
+
+[[nodiscard]] static auto convert_s16_simd(const std::byte*, float*, size_t) -> size_t { return 0; }
+[[nodiscard]] static auto convert_s32_simd(const std::byte*, float*, size_t) -> size_t { return 0; }
+[[nodiscard]] static auto deinterleave_stereo_simd(sample_format, const std::byte*, size_t, float*, float*) -> size_t { return 0; }
+
+#endif
+
+auto convert_to_float(sample_format format, const std::byte* src, std::span<float> dst) -> void {
+	const auto bytes_per_sample = get_bytes_per_sample(format);
+	auto i = size_t{0};
+	switch (format) {
+		case sample_format::s16: { i = convert_s16_simd(src, dst.data(), dst.size()); break; }
+		case sample_format::s32: { i = convert_s32_simd(src, dst.data(), dst.size()); break; }
+		case sample_format::f32: { std::memcpy(dst.data(), src, dst.size() * sizeof(float)); return; }
+		default:                 { break; }
+	}
+	for (; i < dst.size(); i++) {
+		dst[i] = to_float(format, src + (i * bytes_per_sample));
+	}
+}
+
+auto convert_to_float(sample_format format, const std::byte* src, size_t frame_count, size_t channel_count, std::span<float* const> dst) -> void {
+	const auto chs = std::min(channel_count, dst.size());
+	if (channel_count == 1) {
+		if (chs == 1) {
+			convert_to_float(format, src, {dst[0], frame_count});
+		}
+		return;
+	}
+	const auto bytes_per_sample = get_bytes_per_sample(format);
+	const auto frame_bytes      = bytes_per_sample * channel_count;
+	auto f = size_t{0};
+	if (channel_count == 2) {
+		f = deinterleave_stereo_simd(format, src, frame_count, dst[0], chs > 1 ? dst[1] : nullptr);
+	}
+	for (; f < frame_count; f++) {
+		const auto frame = src + (f * frame_bytes);
+		for (size_t c = 0; c < chs; c++) {
+			dst[c][f] = to_float(format, frame + (c * bytes_per_sample));
+		}
+	}
+}
+
+auto convert_from_float(sample_format format, std::span<const float> src, std::byte* dst) -> void {
+	const auto clip = [](float x) { return std::clamp(x, -1.0f, 1.0f); };
+	switch (format) {
+		case sample_format::u8: {
+			for (size_t i = 0; i < src.size(); i++) {
+				dst[i] = std::byte(uint8_t(std::lrint(clip(src[i]) * 127.0f) + 128));
+			}
+			return;
+		}
+		case sample_format::s16: {
+			for (size_t i = 0; i < src.size(); i++) {
+				store_le<uint16_t>(dst + (i * 2), uint16_t(int16_t(std::lrint(clip(src[i]) * 32767.0f))));
+			}
+			return;
+		}
+		case sample_format::s24: {
+			for (size_t i = 0; i < src.size(); i++) {
+				const auto value = uint32_t(int32_t(std::lrint(clip(src[i]) * 8388607.0f)));
+				const auto p     = dst + (i * 3);
+				p[0] = std::byte(uint8_t(value));
+				p[1] = std::byte(uint8_t(value >> 8));
+				p[2] = std::byte(uint8_t(value >> 16));
+			}
+			return;
+		}
+		case sample_format::s32: {
+			for (size_t i = 0; i < src.size(); i++) {
+				store_le<uint32_t>(dst + (i * 4), uint32_t(int32_t(std::llrint(double(clip(src[i])) * 2147483647.0))));
+			}
+			return;
+		}
+		case sample_format::f32: {
+			std::memcpy(dst, src.data(), src.size() * sizeof(float));
+			return;
+		}
+		case sample_format::f64: {
+			for (size_t i = 0; i < src.size(); i++) {
+				const auto value = double(src[i]);
+				std::memcpy(dst + (i * 8), &value, sizeof(value));
+			}
+			return;
+		}
+		default: {
+			throw std::runtime_error{"Invalid sample format"};
+		}
+	}
+}
+
+auto write_parallel(const audiorw::header& header, storage_type type, read_frames_at_function read_frames_at, const std::filesystem::path& path, std::function<bool()> should_abort, const parallel_write_options& options) -> operation_result {
+	auto layout = make_layout(header, type);
+	if (!fits_in_riff(PCM_HEADER_SIZE, layout.data_size)) {
+		layout.data_offset = RF64_HEADER_SIZE;
+	}
+	const auto chs             = size_t{layout.channel_count};
+	const auto frame_count     = header.frame_count.value;
+	const auto frames_per_task = std::max(options.frames_per_task, size_t{1});
+	const auto task_count      = (frame_count + frames_per_task - 1) / frames_per_task;
+	const auto tmp_path        = make_tmp_file_path(path);
+	auto file    = native_file{tmp_path, native_file::mode::write};
+	auto aborted = std::atomic<bool>{false};
+	const auto discard = [&] {
+		file.close();
+		std::filesystem::remove(tmp_path);
+	};
+	try {
+		file.set_size(layout.data_offset + layout.data_size + (layout.data_size & 1));
+		counters::add(format::wav, counters::counter::files_opened);
+		parallel_for(executor_or_inline(options.executor), task_count, [&](size_t task) {
+			if (aborted.load(std::memory_order_relaxed) || should_abort()) {
+				aborted = true;
+				return;
+			}
+			const auto start  = task * frames_per_task;
+			const auto frames = std::min(frames_per_task, frame_count - start);
+			auto samples = std::vector<float>(frames * chs);
+			auto bytes   = std::vector<std::byte>(frames * layout.block_align);
+			read_frames_at({start}, samples);
+			{
+				auto timer = scope_counter_timer{format::wav, counters::counter::encode_ns};
+				convert_from_float(layout.format, samples, bytes.data());
+			}
+			file.write_at(layout.data_offset + (start * layout.block_align), bytes);
+			counters::add(format::wav, counters::counter::frames_encoded, frames);
+			counters::add(counters::counter::bytes_written, bytes.size());
+		});
+		if (aborted) {
+			discard();
+			return operation_result::abort;
+		}
+		if (layout.data_offset == PCM_HEADER_SIZE) {
+			file.write_at(0, make_pcm_header(layout));
+		}
+		else {
+			file.write_at(0, make_rf64_header(layout, frame_count));
+		}
+		file.close();
+		std::filesystem::rename(tmp_path, path);
+		return operation_result::success;
+	}
+	catch (...) {
+		counters::add(format::wav, counters::counter::exceptions);
+		try { discard(); } catch (...) {}
+		throw;
+	}
+}
+
+} // audiorw::detail::wav
+
+namespace audiorw::detail {
+
+wav_encoder::wav_encoder(const audiorw::header& header, storage_type type, std::optional<uint64_t> frame_count)
+	: header_info_{header}
+	, type_{type}
+	, header_{}
+{
+	header_info_.frame_count = {frame_count.value_or(0)};
+	auto layout = wav::make_layout(header_info_, type);
+	block_align_ = layout.block_align;
+	if (frame_count && wav::fits_in_riff(wav::PCM_HEADER_SIZE, layout.data_size)) {
+		header_size_ = wav::PCM_HEADER_SIZE;
+		std::ranges::copy(wav::make_pcm_header(layout), header_.begin());
+		return;
+	}
+	header_size_ = wav::RF64_HEADER_SIZE;
+	std::ranges::copy(wav::make_rf64_header(layout, header_info_.frame_count.value), header_.begin());
+}
+
+auto wav_encoder::encode(std::span<const float> buffer, std::byte* out) const -> void {
+	wav::convert_from_float(wav::get_sample_format(header_info_.bit_depth, type_), buffer, out);
+}
+
+auto wav_encoder::finish(uint64_t frames_written) -> std::span<const std::byte> {
+	header_info_.frame_count = {frames_written};
+	const auto layout = wav::make_layout(header_info_, type_);
+	if (header_size_ == wav::PCM_HEADER_SIZE) {
+		std::ranges::copy(wav::make_pcm_header(layout), header_.begin());
+	}
+	else {
+		std::ranges::copy(wav::make_rf64_header(layout, frames_written), header_.begin());
+	}
+	return get_header();
+}
+
+// Samples are read in blocks of about this many bytes. Big enough that
+// the per-read overhead doesn't matter, small enough to stay in cache
+// until it has been converted.
+static constexpr auto WAV_READ_SIZE = size_t{1} << 18;
+
+struct scope_wav_reader::impl {
+	byte_stream_reader stream;
+	void* user_data;
+	wav::layout layout;
+	uint64_t frame_count = 0;
+	uint64_t pos         = 0;
+	// Where the input is, so that reads which carry on from the last one
+	// don't seek.
+	std::optional<uint64_t> stream_pos;
+	tracked_buffer<std::byte> bytes{memory_category::io};
+	auto read_at(uint64_t offset, std::span<std::byte> buffer) -> size_t {
+		if (stream_pos != offset) {
+			stream_pos.reset();
+			if (!stream.seek(user_data, offset)) {
+				return 0;
+			}
+			stream_pos = offset;
+		}
+		auto total = size_t{0};
+		while (total < buffer.size()) {
+			const auto n = stream.read_bytes(user_data, buffer.subspan(total));
+			if (n == 0) {
+				break;
+			}
+			total += n;
+		}
+		*stream_pos += total;
+		return total;
+	}
+	// Reads up to frame_count frames from pos in blocks, handing each one
+	// to convert(bytes, frame offset, frames).
+	auto read_blocks(uint64_t frame_count, auto convert) -> uint64_t {
+		const auto block_align  = size_t{layout.block_align};
+		const auto block_frames = std::max(size_t{1}, WAV_READ_SIZE / block_align);
+		auto done = uint64_t{0};
+		while (done < frame_count) {
+			const auto frames = std::min<uint64_t>(block_frames, frame_count - done);
+			bytes.resize(frames * block_align);
+			const auto bytes_read  = read_at(layout.data_offset + ((pos + done) * block_align), {bytes.data(), bytes.size()});
+			const auto frames_read = bytes_read / block_align;
+			convert(bytes.data(), done, frames_read);
+			done += frames_read;
+			if (frames_read < frames) {
+				break;
+			}
+		}
+		pos += done;
+		return done;
+	}
+};
+
+scope_wav_reader::scope_wav_reader(byte_stream_reader stream, void* user_data)
+	: impl_{std::make_unique<impl>(stream, user_data)}
+{
+	const auto layout = wav::parse_layout([this](uint64_t offset, std::span<std::byte> buffer) { return impl_->read_at(offset, buffer); });
+	if (!layout) {
+		throw std::runtime_error{"Not a PCM or float WAV file"};
+	}
+	const auto length     = stream.get_length(user_data);
+	const auto available  = length && *length >= layout->data_offset ? std::optional{*length - layout->data_offset} : std::nullopt;
+	const auto size_known = layout->data_size != 0 && !(layout->size_field_bytes == 4 && layout->data_size == wav::UNKNOWN_DATA_SIZE_32);
+	auto data_size = uint64_t{0};
+	if (size_known) {
+		// Truncated files are read as far as they go.
+		data_size = available ? std::min(layout->data_size, *available) : layout->data_size;
+	}
+	else if (available) {
+		// Left unset by a writer that didn't finish.
+		data_size = *available;
+	}
+	else {
+		throw std::runtime_error{"WAV data size is unknown"};
+	}
+	impl_->layout      = *layout;
+	impl_->frame_count = data_size / layout->block_align;
+	header_            = wav::to_header(*layout, impl_->frame_count);
+}
+
+scope_wav_reader::scope_wav_reader(scope_wav_reader&& rhs) noexcept = default;
+scope_wav_reader& scope_wav_reader::operator=(scope_wav_reader&& rhs) noexcept = default;
+scope_wav_reader::~scope_wav_reader() = default;
+
+auto scope_wav_reader::read_frames(std::span<float> buffer) -> ads::frame_count {
+	auto& in          = *impl_;
+	const auto chs    = size_t{in.layout.channel_count};
+	const auto frames = std::min<uint64_t>(buffer.size() / chs, in.frame_count - in.pos);
+	if (in.layout.format == wav::sample_format::f32) {
+		// Already the samples, so they are read straight into place.
+		const auto samples     = buffer.first(frames * chs);
+		const auto bytes_read  = in.read_at(in.layout.data_offset + (in.pos * in.layout.block_align), std::as_writable_bytes(samples));
+		const auto frames_read = bytes_read / in.layout.block_align;
+		in.pos += frames_read;
+		return {frames_read};
+	}
+	return {in.read_blocks(frames, [&](const std::byte* bytes, uint64_t offset, size_t n) {
+		wav::convert_to_float(in.layout.format, bytes, buffer.subspan(offset * chs, n * chs));
+	})};
+}
+
+auto scope_wav_reader::read_frames(std::span<const std::span<float>> channels, size_t offset, size_t frame_count) -> ads::frame_count {
+	auto& in   = *impl_;
+	auto chs   = std::min(channels.size(), size_t{in.layout.channel_count});
+	auto dst   = boost::container::small_vector<float*, 8>(chs);
+	auto limit = std::min<uint64_t>(frame_count, in.frame_count - in.pos);
+	for (size_t c = 0; c < chs; c++) {
+		limit = std::min<uint64_t>(limit, channels[c].size() > offset ? channels[c].size() - offset : 0);
+	}
+	return {in.read_blocks(limit, [&](const std::byte* bytes, uint64_t done, size_t n) {
+		for (size_t c = 0; c < chs; c++) {
+			dst[c] = channels[c].data() + offset + done;
+		}
+		wav::convert_to_float(in.layout.format, bytes, n, in.layout.channel_count, {dst.data(), dst.size()});
+	})};
+}
+
+auto scope_wav_reader::seek(ads::frame_idx pos) -> bool {
+	if (pos.value > impl_->frame_count) {
+		return false;
+	}
+	impl_->pos = pos.value;
+	return true;
+}
+
+auto read_frames(scope_wav_reader* decoder, std::span<float> buffer) -> ads::frame_count {
+	return decoder->read_frames(buffer);
+}
+
+auto seek(scope_wav_reader* decoder, ads::frame_idx pos) -> bool {
+	return decoder->seek(pos);
+}
+
+} // audiorw::detail
+
+namespace audiorw {
+
+auto write_wav_parallel(const audiorw::item& item, const std::filesystem::path& path, storage_type type, const parallel_write_options& options) -> operation_result {
+	const auto read_frames_at = [&item](ads::frame_idx pos, std::span<float> buffer) {
+		const auto beg = item.frames.begin() + pos.value;
+		const auto end = beg + (buffer.size() / item.header.channel_count.value);
+		ads::interleave(std::ranges::subrange(beg, end), buffer.begin());
+	};
+	return write_wav_parallel(item.header, read_frames_at, path, type, detail::fn_always(false), options);
+}
+
+auto write_wav_parallel(const flat_item& item, const std::filesystem::path& path, storage_type type, const parallel_write_options& options) -> operation_result {
+	const auto read_frames_at = [&item](ads::frame_idx pos, std::span<float> buffer) {
+		const auto chs    = item.header.channel_count.value;
+		const auto frames = buffer.size() / chs;
+		if (item.layout == frame_layout::interleaved) {
+			std::copy_n(item.samples.data() + (pos.value * chs), buffer.size(), buffer.data());
+			return;
+		}
+		for (size_t c = 0; c < chs; c++) {
+			const auto channel = item.get_channel(c);
+			for (size_t f = 0; f < frames; f++) {
+				buffer[(f * chs) + c] = channel[pos.value + f];
+			}
+		}
+	};
+	return write_wav_parallel(item.header, read_frames_at, path, type, detail::fn_always(false), options);
+}
+
+//########################################################################################
+
+mapped_wav::mapped_wav(const std::filesystem::path& path)
+	: file_{path}
+{
+	const auto bytes  = file_.get_bytes();
+	const auto layout = detail::wav::parse_layout([bytes](uint64_t offset, std::span<std::byte> buffer) -> size_t {
+		if (offset >= bytes.size()) {
+			return 0;
+		}
+		const auto n = std::min<uint64_t>(buffer.size(), bytes.size() - offset);
+		std::memcpy(buffer.data(), bytes.data() + offset, n);
+		return n;
+	});
+	if (!layout || layout->format != detail::wav::sample_format::f32) {
+		throw std::runtime_error{"Not a 32 bit float WAV file"};
+	}
+	if constexpr (std::endian::native != std::endian::little) {
+		throw std::runtime_error{"Float WAV data can only be viewed in place on little endian platforms"};
+	}
+	// The mapping is page aligned, so this only fails for files with oddly
+	// sized chunks before the data.
+	if (layout->data_offset % alignof(float) != 0) {
+		throw std::runtime_error{"WAV data isn't aligned for viewing in place"};
+	}
+	const auto available  = bytes.size() > layout->data_offset ? bytes.size() - layout->data_offset : 0;
+	const auto size_known = layout->data_size != 0 && !(layout->size_field_bytes == 4 && layout->data_size == detail::wav::UNKNOWN_DATA_SIZE_32);
+	const auto data_size  = size_known ? std::min<uint64_t>(layout->data_size, available) : available;
+	const auto frames     = data_size / layout->block_align;
+	header_  = detail::wav::to_header(*layout, frames);
+	samples_ = {reinterpret_cast<const float*>(bytes.data() + layout->data_offset), size_t(frames * layout->channel_count)};
+}
+
+auto mapped_wav::get_channel(size_t channel) const -> strided_channel_view {
+	const auto chs = header_.channel_count.value;
+	if (channel >= chs) {
+		throw std::runtime_error{"Channel index out of range"};
+	}
+	return {samples_.data() + channel, size_t(chs), size_t(header_.frame_count.value)};
+}
+
+auto mapped_wav::get_planar() const -> std::span<const float> {
+	if (header_.channel_count.value != 1) {
+		throw std::runtime_error{"Only mono files can be viewed as planar"};
+	}
+	return samples_;
+}
+
+auto try_map_wav(const std::filesystem::path& path) -> std::optional<mapped_wav> {
+	try {
+		return mapped_wav{path};
+	}
+	catch (const std::runtime_error&) {
+		return std::nullopt;
+	}
+}
+
+} // audiorw
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+
+// Tests are plain executables which return non-zero on failure, so they
+// don't need a test framework.
+#define AUDIORW_CHECK(expr) \
+	do { \
+		if (!(expr)) { \
+			std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #expr); \
+			std::exit(EXIT_FAILURE); \
+		} \
+	} while (false)
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "check.hpp"
+#include <audiorw.hpp>
+#include <audiorw_verify.hpp>
+#include <fstream>
+
+// Writing files into memory and verifying them, for the tests which
+// need audio to work on.
+
+[[nodiscard]] inline
+auto make_header(audiorw::format format, uint64_t channel_count, uint64_t frame_count, int bit_depth) -> audiorw::header {
+	auto header = audiorw::header{};
+	header.format        = format;
+	header.channel_count = {channel_count};
+	header.frame_count   = {frame_count};
+	header.bit_depth     = bit_depth;
+	return header;
+}
+
+// Reads the interleaved samples, which have to outlive the stream.
+[[nodiscard]] inline
+auto make_input(std::span<const float> samples, uint64_t channel_count) {
+	return audiorw::generic_frame_input_stream{[samples, channel_count, pos = size_t{0}](std::span<float> buffer) mutable {
+		const auto n = std::min(buffer.size(), samples.size() - pos);
+		std::copy_n(samples.begin() + pos, n, buffer.begin());
+		pos += n;
+		return ads::frame_count{n / channel_count};
+	}};
+}
+
+[[nodiscard]] inline
+auto write_to_bytes(const audiorw::header& header, std::span<const float> samples, audiorw::storage_type type = audiorw::storage_type::int_) -> std::vector<std::byte> {
+	auto in    = make_input(samples, header.channel_count.value);
+	auto bytes = std::vector<std::byte>{};
+	auto out   = audiorw::stream::bytes::to(&bytes);
+	AUDIORW_CHECK(audiorw::write(header, &in, &out, type) == audiorw::operation_result::success);
+	return bytes;
+}
+
+#if AUDIORW_WITH_FLAC
+[[nodiscard]] inline
+auto write_flac_to_bytes(const audiorw::header& header, std::span<const float> samples, const audiorw::flac_options& options = {}) -> std::vector<std::byte> {
+	auto in    = make_input(samples, header.channel_count.value);
+	auto bytes = std::vector<std::byte>{};
+	auto out   = audiorw::stream::bytes::to(&bytes);
+	AUDIORW_CHECK(audiorw::write_flac(header, &in, &out, options) == audiorw::operation_result::success);
+	return bytes;
+}
+#endif
+
+#if AUDIORW_WITH_WAVPACK
+[[nodiscard]] inline
+auto write_wavpack_to_bytes(const audiorw::header& header, std::span<const float> samples, audiorw::storage_type type, const audiorw::wavpack_options& options) -> std::vector<std::byte> {
+	auto in    = make_input(samples, header.channel_count.value);
+	auto bytes = std::vector<std::byte>{};
+	auto out   = audiorw::stream::bytes::to(&bytes);
+	AUDIORW_CHECK(audiorw::write_wavpack(header, &in, &out, type, options) == audiorw::operation_result::success);
+	return bytes;
+}
+#endif
+
+// For the functions which take paths. Formats which are hinted by the
+// extension need the right one, e.g. ".mp3".
+[[nodiscard]] inline
+auto write_temp_file(std::span<const std::byte> bytes, const char* extension) -> std::filesystem::path {
+	const auto path = std::filesystem::temp_directory_path() / (std::string{"audiorw_test"} + extension);
+	auto file = std::ofstream{path, std::ios::binary};
+	file.write(reinterpret_cast<const char*>(bytes.data()), std::streamsize(bytes.size()));
+	return path;
+}
+
+[[nodiscard]] inline
+auto verify_bytes(std::span<const std::byte> bytes, const char* extension) -> audiorw::verify_result {
+	const auto path = write_temp_file(bytes, extension);
+	auto executor = audiorw::inline_executor{};
+	auto options  = audiorw::verify_options{};
+	options.executor = &executor;
+	const auto result = audiorw::verify(path, options);
+	std::filesystem::remove(path);
+	return result;
+}
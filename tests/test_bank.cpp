@@ -0,0 +1,58 @@
+#include "helpers.hpp"
+#include <audiorw_bank.hpp>
+
+// Sounds are stored in a sample bank and read back.
+
+static constexpr auto FRAME_COUNT = uint64_t{70'001};
+
+[[nodiscard]] static
+auto make_item(uint64_t channel_count) -> audiorw::item {
+	auto samples = std::vector<float>(FRAME_COUNT * channel_count);
+	for (size_t i = 0; i < samples.size(); i++) {
+		samples[i] = float(i % 1000) / 1000.0f;
+	}
+	auto header = make_header(audiorw::format::wav, channel_count, FRAME_COUNT, 32);
+	header.SR = 44100;
+	auto item = audiorw::item{};
+	auto out  = audiorw::stream::item::to(&item);
+	out.write_header(header);
+	AUDIORW_CHECK(out.write_frames(samples) == FRAME_COUNT);
+	return item;
+}
+
+[[nodiscard]] static
+auto get_samples(const audiorw::item& item) -> std::vector<float> {
+	auto samples = std::vector<float>(item.header.frame_count.value * item.header.channel_count.value);
+	auto in      = audiorw::stream::frames::from(item);
+	AUDIORW_CHECK(in.read_frames(samples) == item.header.frame_count.value);
+	return samples;
+}
+
+// Three channels don't divide the chunks the raw samples are copied in,
+// so every chunk ends partway through a frame unless it's rounded down.
+static
+auto test_raw_float_round_trip() -> void {
+	const auto path = std::filesystem::temp_directory_path() / "audiorw_test.bank";
+	const auto item = make_item(3);
+	{
+		auto writer = audiorw::sample_bank_writer{path};
+		writer.add("three", item, audiorw::bank_blob::raw_float);
+		writer.commit();
+	}
+	{
+		const auto bank  = audiorw::sample_bank{path};
+		const auto entry = bank.find("three");
+		AUDIORW_CHECK(entry != nullptr);
+		const auto read = bank.read(*entry);
+		AUDIORW_CHECK(read.has_value());
+		AUDIORW_CHECK(read->header.channel_count == 3);
+		AUDIORW_CHECK(read->header.frame_count == FRAME_COUNT);
+		AUDIORW_CHECK(get_samples(*read) == get_samples(item));
+	}
+	std::filesystem::remove(path);
+}
+
+auto main() -> int {
+	test_raw_float_round_trip();
+	return EXIT_SUCCESS;
+}
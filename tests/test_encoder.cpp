@@ -0,0 +1,67 @@
+#include "helpers.hpp"
+#include <cmath>
+
+// Frames are pushed through an encoder_handle in uneven chunks, and the
+// bytes are compared with what write() produces from the same samples.
+
+static constexpr auto CHANNELS    = uint64_t{2};
+static constexpr auto FRAME_COUNT = uint64_t{50'021};
+
+[[nodiscard]] static
+auto make_samples() -> std::vector<float> {
+	auto samples = std::vector<float>(FRAME_COUNT * CHANNELS);
+	for (uint64_t f = 0; f < FRAME_COUNT; f++) {
+		samples[(f * CHANNELS) + 0] = 0.5f * float(std::sin(double(f) * 0.01));
+		samples[(f * CHANNELS) + 1] = 0.25f * float(std::sin(double(f) * 0.037));
+	}
+	return samples;
+}
+
+[[nodiscard]] static
+auto encode(const audiorw::header& header, std::span<const float> samples, audiorw::storage_type type) -> std::vector<std::byte> {
+	auto bytes   = std::vector<std::byte>{};
+	auto encoder = audiorw::encoder_handle{header, &bytes, type};
+	auto chunk   = uint64_t{1};
+	while (!samples.empty()) {
+		const auto n = std::min(chunk * CHANNELS, samples.size());
+		AUDIORW_CHECK(encoder.write_frames(samples.first(n)) == n / CHANNELS);
+		samples = samples.subspan(n);
+		chunk   = (chunk * 7) % 10'007;
+	}
+	encoder.finish();
+	return bytes;
+}
+
+static
+auto check_format(audiorw::format format, int bit_depth, audiorw::storage_type type) -> void {
+	const auto samples = make_samples();
+	const auto header  = make_header(format, CHANNELS, FRAME_COUNT, bit_depth);
+	AUDIORW_CHECK(encode(header, samples, type) == write_to_bytes(header, samples, type));
+}
+
+static
+auto test_frame_count_mismatch() -> void {
+	const auto samples = make_samples();
+	auto bytes   = std::vector<std::byte>{};
+	auto encoder = audiorw::encoder_handle{make_header(audiorw::format::wav, CHANNELS, FRAME_COUNT - 1, 16), &bytes, audiorw::storage_type::int_};
+	auto threw   = false;
+	try { encoder.write_frames(samples); } catch (const std::runtime_error&) { threw = true; }
+	AUDIORW_CHECK(threw);
+	threw = false;
+	try { encoder.finish(); } catch (const std::runtime_error&) { threw = true; }
+	AUDIORW_CHECK(threw);
+}
+
+auto main() -> int {
+	check_format(audiorw::format::wav, 16, audiorw::storage_type::int_);
+	check_format(audiorw::format::wav, 32, audiorw::storage_type::float_);
+#if AUDIORW_WITH_FLAC
+	check_format(audiorw::format::flac, 16, audiorw::storage_type::int_);
+#endif
+#if AUDIORW_WITH_WAVPACK
+	check_format(audiorw::format::wavpack, 16, audiorw::storage_type::int_);
+	check_format(audiorw::format::wavpack, 32, audiorw::storage_type::float_);
+#endif
+	test_frame_count_mismatch();
+	return EXIT_SUCCESS;
+}
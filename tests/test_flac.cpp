@@ -0,0 +1,98 @@
+#include "helpers.hpp"
+#include <cmath>
+
+// FLAC files written by audiorw's encoder are decoded again, both by the
+// normal reader and by verify(), and compared with what went in.
+
+static constexpr auto FRAME_COUNT = uint64_t{100'003};
+
+enum class signal { silence, tone, noise, tone_with_bursts };
+
+// The same quantization the encoder does, so that the expected samples are
+// exactly what it should have stored.
+[[nodiscard]] static
+auto quantize(float x, int bit_depth) -> int32_t {
+	const auto scale = float((int32_t{1} << (bit_depth - 1)) - 1);
+	return int32_t(std::lrint(std::clamp(x, -1.0f, 1.0f) * scale));
+}
+
+[[nodiscard]] static
+auto make_samples(signal s, uint64_t channel_count) -> std::vector<float> {
+	auto samples = std::vector<float>(FRAME_COUNT * channel_count);
+	auto noise   = uint32_t{1};
+	const auto next_noise = [&noise] {
+		noise = (noise * 1664525u) + 1013904223u;
+		return (float(noise >> 8) / float(1 << 23)) - 1.0f;
+	};
+	for (uint64_t f = 0; f < FRAME_COUNT; f++) {
+		for (uint64_t c = 0; c < channel_count; c++) {
+			auto& x = samples[(f * channel_count) + c];
+			switch (s) {
+				case signal::silence: { x = 0.0f; break; }
+				case signal::tone:    { x = 0.8f * float(std::sin(double(f) * 0.01 * double(c + 1))); break; }
+				case signal::noise:   { x = next_noise(); break; }
+				case signal::tone_with_bursts: {
+					// Short stretches of full scale noise give some partitions
+					// much bigger residuals than the rest.
+					const auto burst = (f / 1000) % 7 == 3;
+					x = burst ? next_noise() : 0.01f * float(std::sin(double(f) * 0.003));
+					break;
+				}
+			}
+		}
+	}
+	return samples;
+}
+
+[[nodiscard]] static
+auto encode(std::span<const float> samples, uint64_t channel_count, int bit_depth, int compression_level) -> std::vector<std::byte> {
+	auto options = audiorw::flac_options{};
+	options.compression_level = compression_level;
+	return write_flac_to_bytes(make_header(audiorw::format::flac, channel_count, FRAME_COUNT, bit_depth), samples, options);
+}
+
+static
+auto check_decoded(std::span<const std::byte> bytes, std::span<const float> samples, uint64_t channel_count, int bit_depth) -> void {
+	const auto item = audiorw::read(bytes, audiorw::format_hint::try_flac_only);
+	AUDIORW_CHECK(item.has_value());
+	AUDIORW_CHECK(item->header.channel_count == channel_count);
+	AUDIORW_CHECK(item->header.frame_count == FRAME_COUNT);
+	auto decoded = std::vector<float>(samples.size());
+	auto in      = audiorw::stream::frames::from(*item);
+	AUDIORW_CHECK(in.read_frames(decoded) == FRAME_COUNT);
+	// Decoders scale by a power of two, so every sample comes back exactly.
+	const auto scale = float(int32_t{1} << (bit_depth - 1));
+	for (size_t i = 0; i < samples.size(); i++) {
+		AUDIORW_CHECK(int32_t(decoded[i] * scale) == quantize(samples[i], bit_depth));
+	}
+}
+
+static
+auto check_verified(std::span<const std::byte> bytes) -> void {
+	const auto result = verify_bytes(bytes, ".flac");
+	AUDIORW_CHECK(result.status == audiorw::verify_status::ok);
+	AUDIORW_CHECK(result.md5_checked);
+	AUDIORW_CHECK(result.crc_errors == 0);
+	AUDIORW_CHECK(result.frames_decoded == FRAME_COUNT);
+}
+
+static
+auto test_round_trip() -> void {
+	for (const auto s : {signal::silence, signal::tone, signal::noise, signal::tone_with_bursts}) {
+		for (const auto channel_count : {uint64_t{1}, uint64_t{2}, uint64_t{3}}) {
+			const auto samples = make_samples(s, channel_count);
+			for (const auto bit_depth : {8, 16, 24}) {
+				for (const auto level : {0, 5, 8}) {
+					const auto bytes = encode(samples, channel_count, bit_depth, level);
+					check_verified(bytes);
+					check_decoded(bytes, samples, channel_count, bit_depth);
+				}
+			}
+		}
+	}
+}
+
+auto main() -> int {
+	test_round_trip();
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,109 @@
+#include "check.hpp"
+#include <atomic>
+#include <audiorw.hpp>
+#include <new>
+#include <tuple>
+
+// Every allocation in the process is counted, not just the ones the memory
+// tracker knows about, so anything the chunk loops allocate shows up here.
+static auto allocation_count = std::atomic<size_t>{0};
+
+auto operator new(size_t size) -> void* {
+	allocation_count++;
+	if (auto p = std::malloc(size ? size : 1)) {
+		return p;
+	}
+	throw std::bad_alloc{};
+}
+
+auto operator delete(void* p) noexcept -> void          { std::free(p); }
+auto operator delete(void* p, size_t) noexcept -> void  { std::free(p); }
+
+static constexpr auto CHANNELS = uint64_t{2};
+
+// One chunk, and many chunks with a partial one at the end.
+static constexpr auto SHORT_FRAME_COUNT = uint64_t{1000};
+static constexpr auto LONG_FRAME_COUNT  = uint64_t{(1 << 14) * 20 + 123};
+
+struct allocations {
+	size_t count;
+	audiorw::memory_report report;
+};
+
+[[nodiscard]] static
+auto make_header(uint64_t frame_count) -> audiorw::header {
+	auto header = audiorw::header{};
+	header.format        = audiorw::format::wav;
+	header.channel_count = {CHANNELS};
+	header.frame_count   = {frame_count};
+	header.bit_depth     = 16;
+	return header;
+}
+
+// The output is reserved up front so that only the library's own
+// allocations are counted.
+[[nodiscard]] static
+auto write_wav(uint64_t frame_count, std::vector<std::byte>* bytes) -> allocations {
+	auto pos = uint64_t{0};
+	auto in  = audiorw::generic_frame_input_stream{[&pos](std::span<float> buffer) {
+		for (auto& x : buffer) { x = float(pos++ % 200) / 100.0f - 1.0f; }
+		return ads::frame_count{buffer.size() / CHANNELS};
+	}};
+	bytes->clear();
+	bytes->reserve(frame_count * CHANNELS * sizeof(float) + 1024);
+	auto out          = audiorw::stream::bytes::to(bytes);
+	auto report       = audiorw::memory_report{};
+	const auto before = allocation_count.load();
+	const auto result = audiorw::write(make_header(frame_count), &in, &out, audiorw::storage_type::int_, [] { return false; }, &report);
+	const auto count  = allocation_count.load() - before;
+	AUDIORW_CHECK(result == audiorw::operation_result::success);
+	return {count, report};
+}
+
+[[nodiscard]] static
+auto read_wav(std::span<const std::byte> bytes, uint64_t frame_count) -> allocations {
+	auto item         = audiorw::item{};
+	auto in           = audiorw::byte_input_stream{bytes};
+	auto out          = audiorw::stream::item::to(&item);
+	auto report       = audiorw::memory_report{};
+	const auto before = allocation_count.load();
+	const auto result = audiorw::read(&in, &out, audiorw::format_hint::try_wav_only, [] { return false; }, &report);
+	const auto count  = allocation_count.load() - before;
+	AUDIORW_CHECK(result == audiorw::operation_result::success);
+	AUDIORW_CHECK(item.header.frame_count == frame_count);
+	AUDIORW_CHECK(report.get_peak_bytes(audiorw::memory_category::item_storage) == frame_count * CHANNELS * sizeof(float));
+	return {count, report};
+}
+
+// Buffers are sized by the first chunk and reused for the rest, so a file
+// which takes twenty chunks costs exactly as many allocations as one which
+// takes one. Each is done once beforehand so that one-time setup isn't
+// counted against whichever runs first.
+static
+auto test_write_chunk_loop_does_not_allocate() -> void {
+	auto bytes = std::vector<std::byte>{};
+	std::ignore = write_wav(SHORT_FRAME_COUNT, &bytes);
+	const auto one_chunk   = write_wav(SHORT_FRAME_COUNT, &bytes);
+	const auto many_chunks = write_wav(LONG_FRAME_COUNT, &bytes);
+	AUDIORW_CHECK(one_chunk.count == many_chunks.count);
+	AUDIORW_CHECK(one_chunk.report.allocation_count == many_chunks.report.allocation_count);
+}
+
+static
+auto test_read_chunk_loop_does_not_allocate() -> void {
+	auto short_bytes = std::vector<std::byte>{};
+	auto long_bytes  = std::vector<std::byte>{};
+	std::ignore = write_wav(SHORT_FRAME_COUNT, &short_bytes);
+	std::ignore = write_wav(LONG_FRAME_COUNT, &long_bytes);
+	std::ignore = read_wav(short_bytes, SHORT_FRAME_COUNT);
+	const auto one_chunk   = read_wav(short_bytes, SHORT_FRAME_COUNT);
+	const auto many_chunks = read_wav(long_bytes, LONG_FRAME_COUNT);
+	AUDIORW_CHECK(one_chunk.count == many_chunks.count);
+	AUDIORW_CHECK(one_chunk.report.allocation_count == many_chunks.report.allocation_count);
+}
+
+auto main() -> int {
+	test_write_chunk_loop_does_not_allocate();
+	test_read_chunk_loop_does_not_allocate();
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,110 @@
+#include "helpers.hpp"
+#include <cmath>
+
+// Stereo files in each format are read with both read_into() overloads and
+// compared with what read() decodes. The buffers are followed by guard
+// samples which must not be touched.
+
+static constexpr auto CHANNELS    = uint64_t{2};
+static constexpr auto FRAME_COUNT = uint64_t{20'011};
+static constexpr auto GUARD       = 1000.0f;
+static constexpr auto GUARD_COUNT = size_t{64};
+
+// The channels are different, so that mixing them up would be noticed.
+[[nodiscard]] static
+auto make_samples() -> std::vector<float> {
+	auto samples = std::vector<float>(FRAME_COUNT * CHANNELS);
+	for (uint64_t f = 0; f < FRAME_COUNT; f++) {
+		samples[(f * CHANNELS) + 0] = 0.5f * float(std::sin(double(f) * 0.01));
+		samples[(f * CHANNELS) + 1] = 0.25f * float(std::sin(double(f) * 0.037));
+	}
+	return samples;
+}
+
+[[nodiscard]] static
+auto read_expected(const std::filesystem::path& path, audiorw::format_hint hint) -> std::vector<float> {
+	const auto item = audiorw::read(path, hint);
+	AUDIORW_CHECK(item.has_value());
+	AUDIORW_CHECK(item->header.channel_count == CHANNELS);
+	auto samples = std::vector<float>(item->header.frame_count.value * CHANNELS);
+	auto in      = audiorw::stream::frames::from(*item);
+	AUDIORW_CHECK(in.read_frames(samples) == item->header.frame_count.value);
+	return samples;
+}
+
+[[nodiscard]] static
+auto guard_intact(std::span<const float> buffer) -> bool {
+	return std::ranges::all_of(buffer, [](float x) { return x == GUARD; });
+}
+
+static
+auto check_interleaved(const std::filesystem::path& path, audiorw::format_hint hint, std::span<const float> expected, uint64_t start, uint64_t frames) -> void {
+	auto buffer = std::vector<float>((frames * CHANNELS) + GUARD_COUNT, GUARD);
+	const auto result = audiorw::read_into(path, hint, std::span{buffer}.first(frames * CHANNELS), {start});
+	const auto wanted = std::min(frames, (expected.size() / CHANNELS) - start);
+	AUDIORW_CHECK(result.header.channel_count == CHANNELS);
+	AUDIORW_CHECK(result.frames_written == wanted);
+	AUDIORW_CHECK(std::ranges::equal(std::span{buffer}.first(wanted * CHANNELS), expected.subspan(start * CHANNELS, wanted * CHANNELS)));
+	AUDIORW_CHECK(guard_intact(std::span{buffer}.subspan(wanted * CHANNELS)));
+}
+
+static
+auto check_channels(const std::filesystem::path& path, audiorw::format_hint hint, std::span<const float> expected, uint64_t start, uint64_t frames) -> void {
+	auto left   = std::vector<float>(frames + GUARD_COUNT, GUARD);
+	auto right  = std::vector<float>(frames + GUARD_COUNT, GUARD);
+	const auto channels = std::array{std::span{left}.first(frames), std::span{right}.first(frames)};
+	const auto result   = audiorw::read_into(path, hint, std::span<const std::span<float>>{channels}, {start});
+	const auto wanted   = std::min(frames, (expected.size() / CHANNELS) - start);
+	AUDIORW_CHECK(result.frames_written == wanted);
+	for (uint64_t f = 0; f < wanted; f++) {
+		AUDIORW_CHECK(left[f] == expected[((start + f) * CHANNELS) + 0]);
+		AUDIORW_CHECK(right[f] == expected[((start + f) * CHANNELS) + 1]);
+	}
+	AUDIORW_CHECK(guard_intact(std::span{left}.subspan(wanted)));
+	AUDIORW_CHECK(guard_intact(std::span{right}.subspan(wanted)));
+}
+
+// The whole file, part of it from the start, part of it from the middle,
+// and a buffer which runs past the end. Lossy decoders can settle
+// differently after a seek than when decoding straight through, so for
+// those only the reads from the start are compared.
+static
+auto check_file(const std::filesystem::path& path, audiorw::format_hint hint, bool lossy) -> void {
+	const auto expected    = read_expected(path, hint);
+	const auto frame_count = expected.size() / CHANNELS;
+	for (const auto& [start, frames] : {std::pair{uint64_t{0}, frame_count},
+	                                   std::pair{uint64_t{0}, uint64_t{1000}},
+	                                   std::pair{frame_count / 3, uint64_t{1000}},
+	                                   std::pair{frame_count - 100, uint64_t{1000}}}) {
+		if (lossy && start > 0) {
+			continue;
+		}
+		check_interleaved(path, hint, expected, start, frames);
+		check_channels(path, hint, expected, start, frames);
+	}
+}
+
+static
+auto check_written(audiorw::format format, audiorw::format_hint hint, const char* extension, int bit_depth) -> void {
+	const auto samples = make_samples();
+	const auto path    = write_temp_file(write_to_bytes(make_header(format, CHANNELS, FRAME_COUNT, bit_depth), samples), extension);
+	check_file(path, hint, false);
+	std::filesystem::remove(path);
+}
+
+auto main() -> int {
+	check_written(audiorw::format::wav, audiorw::format_hint::try_wav_only, ".wav", 16);
+#if AUDIORW_WITH_FLAC
+	check_written(audiorw::format::flac, audiorw::format_hint::try_flac_only, ".flac", 16);
+#endif
+#if AUDIORW_WITH_WAVPACK
+	check_written(audiorw::format::wavpack, audiorw::format_hint::try_wavpack_only, ".wv", 16);
+#endif
+#if AUDIORW_WITH_MP3
+	check_file(std::filesystem::path{AUDIORW_TEST_DATA_DIR} / "stereo.mp3", audiorw::format_hint::try_mp3_only, true);
+#endif
+#if AUDIORW_WITH_VORBIS
+	check_file(std::filesystem::path{AUDIORW_TEST_DATA_DIR} / "stereo.ogg", audiorw::format_hint::try_vorbis_only, true);
+#endif
+	return EXIT_SUCCESS;
+}
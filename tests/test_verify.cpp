@@ -0,0 +1,108 @@
+#include "helpers.hpp"
+#include <cmath>
+#include <thread>
+
+// FLAC files written by audiorw are damaged in known ways and verified.
+// Formats without checksums are verified by decoding them.
+
+#if AUDIORW_WITH_FLAC
+static constexpr auto CHANNELS    = uint64_t{2};
+static constexpr auto FRAME_COUNT = uint64_t{100'003};
+
+[[nodiscard]] static
+auto make_tone() -> std::vector<float> {
+	auto samples = std::vector<float>(FRAME_COUNT * CHANNELS);
+	for (size_t i = 0; i < samples.size(); i++) {
+		samples[i] = 0.5f * float(std::sin(double(i / CHANNELS) * 0.01));
+	}
+	return samples;
+}
+
+[[nodiscard]] static
+auto make_flac() -> std::vector<std::byte> {
+	return write_flac_to_bytes(make_header(audiorw::format::flac, CHANNELS, FRAME_COUNT, 16), make_tone());
+}
+
+static
+auto test_intact() -> void {
+	const auto result = verify_bytes(make_flac(), ".flac");
+	AUDIORW_CHECK(result.status == audiorw::verify_status::ok);
+	AUDIORW_CHECK(result.md5_checked);
+	AUDIORW_CHECK(result.frames_decoded == FRAME_COUNT);
+}
+
+// Wherever the damage is, sync is found again at the next frame, so the
+// rest of the file decodes and only one frame is counted as damaged.
+static
+auto test_flipped_byte() -> void {
+	const auto intact = make_flac();
+	for (const auto fraction : {0.2, 0.5, 0.8}) {
+		auto bytes = intact;
+		bytes[size_t(double(bytes.size()) * fraction)] ^= std::byte{0xFF};
+		const auto result = verify_bytes(bytes, ".flac");
+		AUDIORW_CHECK(result.status == audiorw::verify_status::corrupt);
+		AUDIORW_CHECK(result.crc_errors == 1);
+		AUDIORW_CHECK(result.frames_decoded < FRAME_COUNT);
+	}
+}
+
+static
+auto test_truncated() -> void {
+	auto bytes = make_flac();
+	bytes.resize(bytes.size() / 2);
+	const auto result = verify_bytes(bytes, ".flac");
+	AUDIORW_CHECK(result.status == audiorw::verify_status::malformed);
+	AUDIORW_CHECK(result.crc_errors == 0);
+}
+#endif
+
+#if AUDIORW_WITH_MP3
+// A stereo file, so that the decoder is asked for frames and not samples.
+static
+auto test_mp3() -> void {
+	const auto path = std::filesystem::path{AUDIORW_TEST_DATA_DIR} / "stereo.mp3";
+	const auto item = audiorw::read(path, audiorw::format_hint::try_mp3_only);
+	AUDIORW_CHECK(item.has_value());
+	auto executor = audiorw::inline_executor{};
+	auto options  = audiorw::verify_options{};
+	options.executor = &executor;
+	const auto result = audiorw::verify(path, options);
+	AUDIORW_CHECK(result.status == audiorw::verify_status::ok);
+	AUDIORW_CHECK(result.format == audiorw::format::mp3);
+	AUDIORW_CHECK(!result.md5_checked);
+	AUDIORW_CHECK(result.frames_decoded == item->header.frame_count.value);
+}
+#endif
+
+// Without an executor, nothing should run on another thread.
+static
+auto test_no_executor() -> void {
+	const auto samples = std::vector<float>(1000 * 2);
+	const auto path    = write_temp_file(write_to_bytes(make_header(audiorw::format::wav, 2, 1000, 16), samples), ".wav");
+	const auto paths   = std::vector<std::filesystem::path>(8, path);
+	auto threads = std::vector<std::thread::id>(paths.size());
+	auto options = audiorw::verify_options{};
+	// Slow enough that a pool would have taken some of the files.
+	options.on_complete = [&threads](size_t index, const audiorw::verify_result&) {
+		threads[index] = std::this_thread::get_id();
+		std::this_thread::sleep_for(std::chrono::milliseconds{10});
+	};
+	for (const auto& result : audiorw::verify(paths, options)) {
+		AUDIORW_CHECK(result.status == audiorw::verify_status::ok);
+	}
+	AUDIORW_CHECK(std::ranges::all_of(threads, [](std::thread::id id) { return id == std::this_thread::get_id(); }));
+	std::filesystem::remove(path);
+}
+
+auto main() -> int {
+	test_no_executor();
+#if AUDIORW_WITH_FLAC
+	test_intact();
+	test_flipped_byte();
+	test_truncated();
+#endif
+#if AUDIORW_WITH_MP3
+	test_mp3();
+#endif
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,49 @@
+#include "helpers.hpp"
+#include <cmath>
+
+// Seeking in an Ogg Vorbis file, forwards and back, near and far, has to
+// land on the same frames as decoding it straight through.
+
+static constexpr auto CHANNELS    = uint64_t{2};
+static constexpr auto READ_FRAMES = uint64_t{1000};
+// Decoding from a page after a seek primes the decoder differently from
+// decoding from the start, which can move the last bits of a sample.
+static constexpr auto TOLERANCE   = 1e-5f;
+
+[[nodiscard]] static
+auto read_linear(const std::filesystem::path& path) -> std::vector<float> {
+	const auto item = audiorw::read(path, audiorw::format_hint::try_vorbis_only);
+	AUDIORW_CHECK(item.has_value());
+	AUDIORW_CHECK(item->header.channel_count == CHANNELS);
+	auto samples = std::vector<float>(item->header.frame_count.value * CHANNELS);
+	auto in      = audiorw::stream::frames::from(*item);
+	AUDIORW_CHECK(in.read_frames(samples) == item->header.frame_count.value);
+	return samples;
+}
+
+static
+auto test_seek() -> void {
+	const auto path        = std::filesystem::path{AUDIORW_TEST_DATA_DIR} / "stereo_long.ogg";
+	const auto linear      = read_linear(path);
+	const auto frame_count = uint64_t{linear.size() / CHANNELS};
+	auto decoder = audiorw::decoder_handle{path, audiorw::format_hint::try_vorbis_only};
+	AUDIORW_CHECK(decoder.get_header().frame_count == frame_count);
+	// Far forwards, back, a little way forwards, into the preroll, to the
+	// end and back to the start.
+	const auto targets = {frame_count / 2, frame_count / 20, (frame_count / 20) + 3000, frame_count - 10'000, uint64_t{5000}, frame_count - 300, uint64_t{0}};
+	auto buffer = std::vector<float>(READ_FRAMES * CHANNELS);
+	for (const auto target : targets) {
+		AUDIORW_CHECK(decoder.seek({target}));
+		const auto wanted = std::min(READ_FRAMES, frame_count - target);
+		AUDIORW_CHECK(decoder.read_frames(buffer) == wanted);
+		for (size_t i = 0; i < wanted * CHANNELS; i++) {
+			AUDIORW_CHECK(std::abs(buffer[i] - linear[(target * CHANNELS) + i]) <= TOLERANCE);
+		}
+	}
+	AUDIORW_CHECK(!decoder.seek({frame_count + 1}));
+}
+
+auto main() -> int {
+	test_seek();
+	return EXIT_SUCCESS;
+}
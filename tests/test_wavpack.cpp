@@ -0,0 +1,57 @@
+#include "helpers.hpp"
+#include <cmath>
+
+// WavPack files are written with an MD5 of the audio, which verify() then
+// checks, at each bit depth, with and without an executor to hash on.
+
+static constexpr auto CHANNELS    = uint64_t{2};
+static constexpr auto FRAME_COUNT = uint64_t{300'007};
+
+[[nodiscard]] static
+auto make_tone() -> std::vector<float> {
+	auto samples = std::vector<float>(FRAME_COUNT * CHANNELS);
+	for (size_t i = 0; i < samples.size(); i++) {
+		samples[i] = 0.5f * float(std::sin(double(i / CHANNELS) * 0.01 * double((i % CHANNELS) + 1)));
+	}
+	return samples;
+}
+
+static
+auto check_md5(std::span<const float> samples, int bit_depth, audiorw::storage_type type, std::optional<audiorw::executor_ref> executor) -> void {
+	auto options = audiorw::wavpack_options{};
+	options.store_md5 = true;
+	options.executor  = executor;
+	const auto bytes  = write_wavpack_to_bytes(make_header(audiorw::format::wavpack, CHANNELS, FRAME_COUNT, bit_depth), samples, type, options);
+	const auto result = verify_bytes(bytes, ".wv");
+	AUDIORW_CHECK(result.status == audiorw::verify_status::ok);
+	AUDIORW_CHECK(result.md5_checked);
+	AUDIORW_CHECK(result.frames_decoded == FRAME_COUNT);
+}
+
+static
+auto test_md5() -> void {
+	const auto samples = make_tone();
+	auto pool = audiorw::work_stealing_pool{2};
+	for (const auto executor : {std::optional<audiorw::executor_ref>{}, std::optional<audiorw::executor_ref>{&pool}}) {
+		check_md5(samples, 8, audiorw::storage_type::int_, executor);
+		check_md5(samples, 16, audiorw::storage_type::int_, executor);
+		check_md5(samples, 24, audiorw::storage_type::int_, executor);
+		check_md5(samples, 32, audiorw::storage_type::float_, executor);
+	}
+}
+
+// Without store_md5 there is nothing for verify() to check.
+static
+auto test_no_md5() -> void {
+	const auto samples = make_tone();
+	const auto bytes   = write_to_bytes(make_header(audiorw::format::wavpack, CHANNELS, FRAME_COUNT, 16), samples);
+	const auto result  = verify_bytes(bytes, ".wv");
+	AUDIORW_CHECK(result.status == audiorw::verify_status::ok);
+	AUDIORW_CHECK(!result.md5_checked);
+}
+
+auto main() -> int {
+	test_md5();
+	test_no_md5();
+	return EXIT_SUCCESS;
+}